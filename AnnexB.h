@@ -0,0 +1,34 @@
+#ifndef CAPTUREENCODER_ANNEXB_H
+#define CAPTUREENCODER_ANNEXB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Calls onNal(nal, size) for every NAL unit of an Annex-B buffer, start
+// codes stripped. The NAL units point into data.
+template <typename F>
+void forEachNal(const uint8_t* data, size_t length, F onNal) {
+    size_t i = 0;
+    size_t start = length;
+    while (i + 3 <= length) {
+        if (data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1) {
+            if (start < length) {
+                size_t end = i;
+                // the leading zero of a 4 byte start code
+                while (end > start && data[end - 1] == 0) {
+                    end--;
+                }
+                onNal(data + start, end - start);
+            }
+            i += 3;
+            start = i;
+        } else {
+            i++;
+        }
+    }
+    if (start < length) {
+        onNal(data + start, length - start);
+    }
+}
+
+#endif  // CAPTUREENCODER_ANNEXB_H
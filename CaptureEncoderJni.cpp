@@ -9,6 +9,11 @@
 #include <string>
 
 #include "CaptureModel.h"
+#include "EncoderResourceManager.h"
+#include "FrameTracer.h"
+#include "RgaCropScale.h"
+
+#define TRACE_SIGNAL_DUMP_PATH "/data/local/tmp/capture_trace.json"
 
 std::map<jint, sp<CaptureModel>> mCaptureModels;
 std::mutex mModelLock;
@@ -22,6 +27,7 @@ extern "C" JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void* reserved) {
         ALOGE("%s   JNI_OnLoad 1.6 error", __func__);
         return JNI_ERR;
     }
+    FrameTracer::getInstance().installSignalHandler(TRACE_SIGNAL_DUMP_PATH);
     ALOGI("%s   success", __func__);
     return JNI_VERSION_1_6;
 }
@@ -128,7 +134,12 @@ Java_com_vhd_captureencoder_CaptureModel_removeEncoder(JNIEnv* env,
     auto iter = mCaptureModels.find(camera_id);
     if (iter != mCaptureModels.end()) {
         sp<CaptureModel> captureModel = iter->second;
-        jobject javaObj = captureModel->removeEncoderUnit(encoder_id);
+        std::vector<jobject> packetBufferRefs;
+        jobject javaObj =
+            captureModel->removeEncoderUnit(encoder_id, &packetBufferRefs);
+        for (jobject ref : packetBufferRefs) {
+            env->DeleteGlobalRef(ref);
+        }
         if (javaObj) {
             env->DeleteGlobalRef(javaObj);
         } else {
@@ -140,4 +151,536 @@ Java_com_vhd_captureencoder_CaptureModel_removeEncoder(JNIEnv* env,
         ALOGI("%s   camera_id: %d not init", __func__, camera_id);
         return -1;
     }
+}
+extern "C" JNIEXPORT jint JNICALL
+Java_com_vhd_captureencoder_CaptureModel_registerPacketBuffers(
+    JNIEnv* env, jobject thiz, jint camera_id, jint encoder_id,
+    jobjectArray buffers) {
+    ALOGI("%s   camera_id: %d encoder_id: %d", __func__, camera_id, encoder_id);
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter == mCaptureModels.end()) {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        return -1;
+    }
+    std::shared_ptr<PacketBufferPool> pool =
+        std::make_shared<PacketBufferPool>();
+    std::vector<jobject> refs;
+    jsize count = buffers ? env->GetArrayLength(buffers) : 0;
+    for (jsize i = 0; i < count; i++) {
+        jobject buffer = env->GetObjectArrayElement(buffers, i);
+        void* data = buffer ? env->GetDirectBufferAddress(buffer) : nullptr;
+        jlong capacity = buffer ? env->GetDirectBufferCapacity(buffer) : -1;
+        if (data == nullptr || capacity <= 0) {
+            ALOGE("%s   buffer %d is not a direct ByteBuffer", __func__, i);
+            if (buffer) {
+                env->DeleteLocalRef(buffer);
+            }
+            for (jobject ref : refs) {
+                env->DeleteGlobalRef(ref);
+            }
+            return -EINVAL;
+        }
+        // the index Java gets back in onGetVideoBuffer is the array index
+        pool->addBuffer(data, capacity);
+        refs.push_back(env->NewGlobalRef(buffer));
+        env->DeleteLocalRef(buffer);
+    }
+    if (count == 0) {
+        pool = nullptr;
+    }
+    std::vector<jobject> oldRefs;
+    int ret = iter->second->setPacketBufferPool(encoder_id, pool, refs,
+                                                &oldRefs);
+    if (ret) {
+        oldRefs = refs;
+    }
+    for (jobject ref : oldRefs) {
+        env->DeleteGlobalRef(ref);
+    }
+    return ret;
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_vhd_captureencoder_CaptureModel_setRecording(
+    JNIEnv* env, jobject thiz, jint camera_id, jint encoder_id,
+    jstring path_prefix, jint segment_duration_ms, jlong segment_bytes) {
+    std::string pathPrefix;
+    if (path_prefix) {
+        const char* prefix = env->GetStringUTFChars(path_prefix, nullptr);
+        if (prefix) {
+            pathPrefix = prefix;
+            env->ReleaseStringUTFChars(path_prefix, prefix);
+        }
+    }
+    ALOGI("%s   camera_id: %d encoder_id: %d prefix: %s", __func__, camera_id,
+          encoder_id, pathPrefix.c_str());
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter != mCaptureModels.end()) {
+        sp<CaptureModel> captureModel = iter->second;
+        return captureModel->setRecording(encoder_id, pathPrefix,
+                                          (int64_t)segment_duration_ms * 1000,
+                                          segment_bytes);
+    } else {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        return -1;
+    }
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_vhd_captureencoder_CaptureModel_setRtpStream(
+    JNIEnv* env, jobject thiz, jint camera_id, jint encoder_id, jstring host,
+    jint port, jint payload_type) {
+    std::string destination;
+    if (host) {
+        const char* address = env->GetStringUTFChars(host, nullptr);
+        if (address) {
+            destination = address;
+            env->ReleaseStringUTFChars(host, address);
+        }
+    }
+    ALOGI("%s   camera_id: %d encoder_id: %d host: %s port: %d", __func__,
+          camera_id, encoder_id, destination.c_str(), port);
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter != mCaptureModels.end()) {
+        sp<CaptureModel> captureModel = iter->second;
+        return captureModel->setRtpStream(encoder_id, destination, port,
+                                          payload_type);
+    } else {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        return -1;
+    }
+}
+
+// -1 sends every temporal layer again
+extern "C" JNIEXPORT jint JNICALL
+Java_com_vhd_captureencoder_CaptureModel_setRtpTemporalLayer(
+    JNIEnv* env, jobject thiz, jint camera_id, jint encoder_id,
+    jint max_temporal_id) {
+    ALOGI("%s   camera_id: %d encoder_id: %d max_temporal_id: %d", __func__,
+          camera_id, encoder_id, max_temporal_id);
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter != mCaptureModels.end()) {
+        sp<CaptureModel> captureModel = iter->second;
+        return captureModel->setRtpTemporalLayer(encoder_id, max_temporal_id);
+    } else {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        return -1;
+    }
+}
+
+// 1 to 4 temporal layers of an MPP encoder from the next start, the layer
+// of each packet is in bits 24 to 26 of its flags
+extern "C" JNIEXPORT jint JNICALL
+Java_com_vhd_captureencoder_CaptureModel_setTemporalLayers(
+    JNIEnv* env, jobject thiz, jint camera_id, jint encoder_id, jint layers) {
+    ALOGI("%s   camera_id: %d encoder_id: %d layers: %d", __func__, camera_id,
+          encoder_id, layers);
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter != mCaptureModels.end()) {
+        sp<CaptureModel> captureModel = iter->second;
+        return captureModel->setTemporalLayers(encoder_id, layers);
+    } else {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        return -1;
+    }
+}
+
+// slices per frame of an MPP encoder from the next start, every slice but
+// the last of a frame is delivered with MediaCodec.BUFFER_FLAG_PARTIAL_FRAME
+extern "C" JNIEXPORT jint JNICALL
+Java_com_vhd_captureencoder_CaptureModel_setLowDelaySlices(
+    JNIEnv* env, jobject thiz, jint camera_id, jint encoder_id, jint slices) {
+    ALOGI("%s   camera_id: %d encoder_id: %d slices: %d", __func__, camera_id,
+          encoder_id, slices);
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter != mCaptureModels.end()) {
+        sp<CaptureModel> captureModel = iter->second;
+        return captureModel->setLowDelaySlices(encoder_id, slices);
+    } else {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        return -1;
+    }
+}
+
+// rate control of a running MPP encoder, -1 keeps a setting. rc_mode is
+// MppEncRcMode: 0 VBR, 1 CBR, 2 FIXQP, 3 AVBR. qp_min_i and qp_max_i bound
+// the I frames, qp_min and qp_max the others.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_vhd_captureencoder_CaptureModel_setRateControl(
+    JNIEnv* env, jobject thiz, jint camera_id, jint encoder_id, jint rc_mode,
+    jint bps_target, jint bps_min, jint bps_max, jint qp_init, jint qp_min,
+    jint qp_max, jint qp_min_i, jint qp_max_i, jint fps, jint gop) {
+    ALOGI("%s   camera_id: %d encoder_id: %d", __func__, camera_id, encoder_id);
+    VENC_RC_ATTR_t rc;
+    venc_rc_attr_init(&rc);
+    rc.rc_mode = rc_mode;
+    rc.bps_target = bps_target;
+    rc.bps_min = bps_min;
+    rc.bps_max = bps_max;
+    rc.qp_init = qp_init;
+    rc.qp_min = qp_min;
+    rc.qp_max = qp_max;
+    rc.qp_min_i = qp_min_i;
+    rc.qp_max_i = qp_max_i;
+    if (fps > 0) {
+        rc.fps_num = fps;
+        rc.fps_den = 1;
+    }
+    rc.gop_len = gop;
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter != mCaptureModels.end()) {
+        sp<CaptureModel> captureModel = iter->second;
+        return captureModel->setRateControl(encoder_id, rc);
+    } else {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        return -1;
+    }
+}
+
+// six ints per region: x, y, width, height, qp and flags. qp is a delta
+// unless flags bit 0 makes it absolute, bit 1 forces intra. Null or empty
+// clears the regions.
+extern "C" JNIEXPORT jint JNICALL
+Java_com_vhd_captureencoder_CaptureModel_setRoiRegions(
+    JNIEnv* env, jobject thiz, jint camera_id, jint encoder_id,
+    jintArray regions) {
+    std::vector<RoiRegionCfg> roi;
+    jsize length = regions ? env->GetArrayLength(regions) : 0;
+    if (length % 6) {
+        ALOGE("%s   %d ints are no whole regions", __func__, length);
+        return -EINVAL;
+    }
+    if (length > 0) {
+        std::vector<jint> values(length);
+        env->GetIntArrayRegion(regions, 0, length, values.data());
+        for (jsize i = 0; i < length; i += 6) {
+            if (values[i] < 0 || values[i + 1] < 0 || values[i + 2] <= 0 ||
+                values[i + 3] <= 0 || values[i] > 0xffff ||
+                values[i + 1] > 0xffff || values[i + 2] > 0xffff ||
+                values[i + 3] > 0xffff) {
+                return -EINVAL;
+            }
+            RoiRegionCfg region;
+            memset(&region, 0, sizeof(region));
+            region.x = values[i];
+            region.y = values[i + 1];
+            region.w = values[i + 2];
+            region.h = values[i + 3];
+            region.qp_val = values[i + 4];
+            region.qp_mode = values[i + 5] & 1;
+            region.force_intra = (values[i + 5] >> 1) & 1;
+            roi.push_back(region);
+        }
+    }
+    ALOGI("%s   camera_id: %d encoder_id: %d regions: %zu", __func__, camera_id,
+          encoder_id, roi.size());
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter != mCaptureModels.end()) {
+        sp<CaptureModel> captureModel = iter->second;
+        return captureModel->setRoiRegions(encoder_id, roi);
+    } else {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        return -1;
+    }
+}
+
+static std::string getUtfString(JNIEnv* env, jstring string) {
+    std::string result;
+    if (string) {
+        const char* chars = env->GetStringUTFChars(string, nullptr);
+        if (chars) {
+            result = chars;
+            env->ReleaseStringUTFChars(string, chars);
+        }
+    }
+    return result;
+}
+
+// cell_width x cell_height palette indices per glyph, glyph i is drawn for
+// byte i of charset in a text
+extern "C" JNIEXPORT jint JNICALL
+Java_com_vhd_captureencoder_CaptureModel_setOsdGlyphs(
+    JNIEnv* env, jobject thiz, jint camera_id, jint encoder_id,
+    jint cell_width, jint cell_height, jbyteArray bitmaps, jstring charset) {
+    std::vector<uint8_t> glyphs;
+    jsize length = bitmaps ? env->GetArrayLength(bitmaps) : 0;
+    if (length > 0) {
+        glyphs.resize(length);
+        env->GetByteArrayRegion(bitmaps, 0, length, (jbyte*)glyphs.data());
+    }
+    std::string chars = getUtfString(env, charset);
+    ALOGI("%s   camera_id: %d encoder_id: %d cell: %dx%d glyphs: %zu", __func__,
+          camera_id, encoder_id, cell_width, cell_height, chars.size());
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter != mCaptureModels.end()) {
+        sp<CaptureModel> captureModel = iter->second;
+        return captureModel->setOsdGlyphs(encoder_id, cell_width, cell_height,
+                                          glyphs, chars);
+    } else {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        return -1;
+    }
+}
+
+// region 0 to 7, null or empty text hides it
+extern "C" JNIEXPORT jint JNICALL
+Java_com_vhd_captureencoder_CaptureModel_setOsdText(
+    JNIEnv* env, jobject thiz, jint camera_id, jint encoder_id, jint region,
+    jint x, jint y, jstring text) {
+    std::string chars = getUtfString(env, text);
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter != mCaptureModels.end()) {
+        sp<CaptureModel> captureModel = iter->second;
+        return captureModel->setOsdText(encoder_id, region, x, y, chars);
+    } else {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        return -1;
+    }
+}
+
+// alpha << 24 | y << 16 | u << 8 | v per palette index
+extern "C" JNIEXPORT jint JNICALL
+Java_com_vhd_captureencoder_CaptureModel_setOsdPalette(
+    JNIEnv* env, jobject thiz, jint camera_id, jint encoder_id,
+    jintArray palette) {
+    std::vector<uint32_t> yuva;
+    jsize length = palette ? env->GetArrayLength(palette) : 0;
+    if (length > 0) {
+        yuva.resize(length);
+        env->GetIntArrayRegion(palette, 0, length, (jint*)yuva.data());
+    }
+    ALOGI("%s   camera_id: %d encoder_id: %d entries: %zu", __func__, camera_id,
+          encoder_id, yuva.size());
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter != mCaptureModels.end()) {
+        sp<CaptureModel> captureModel = iter->second;
+        return captureModel->setOsdPalette(encoder_id, yuva);
+    } else {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        return -1;
+    }
+}
+
+// the requests the coming IDR serves, this one included
+extern "C" JNIEXPORT jint JNICALL
+Java_com_vhd_captureencoder_CaptureModel_requestKeyFrame(
+    JNIEnv* env, jobject thiz, jint camera_id, jint encoder_id) {
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter != mCaptureModels.end()) {
+        sp<CaptureModel> captureModel = iter->second;
+        return captureModel->requestKeyFrame(encoder_id);
+    } else {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        return -1;
+    }
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_vhd_captureencoder_CaptureModel_setKeyFrameWindow(
+    JNIEnv* env, jobject thiz, jint camera_id, jint window_ms) {
+    ALOGI("%s   camera_id: %d window_ms: %d", __func__, camera_id, window_ms);
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter != mCaptureModels.end()) {
+        sp<CaptureModel> captureModel = iter->second;
+        captureModel->setKeyFrameWindow(window_ms);
+    } else {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+    }
+}
+
+// {requests, idrs}, requests - idrs were merged
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_vhd_captureencoder_CaptureModel_getKeyFrameStats(
+    JNIEnv* env, jobject thiz, jint camera_id, jint encoder_id) {
+    int64_t requests = 0, keyFrames = 0;
+    {
+        std::lock_guard<std::mutex> lk(mModelLock);
+        auto iter = mCaptureModels.find(camera_id);
+        if (iter != mCaptureModels.end()) {
+            sp<CaptureModel> captureModel = iter->second;
+            captureModel->getKeyFrameStats(encoder_id, &requests, &keyFrames);
+        } else {
+            ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        }
+    }
+    jlong stats[2] = {(jlong)requests, (jlong)keyFrames};
+    jlongArray array = env->NewLongArray(2);
+    env->SetLongArrayRegion(array, 0, 2, stats);
+    return array;
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_vhd_captureencoder_CaptureModel_releasePacketBuffer(
+    JNIEnv* env, jobject thiz, jint camera_id, jint encoder_id, jint index) {
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter != mCaptureModels.end()) {
+        sp<CaptureModel> captureModel = iter->second;
+        return captureModel->releasePacketBuffer(encoder_id, index);
+    } else {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        return -1;
+    }
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_vhd_captureencoder_CaptureModel_setBufferConfig(
+    JNIEnv* env, jobject thiz, jint camera_id, jint count, jboolean adaptive,
+    jint max_count, jint starvation_ms) {
+    ALOGI("%s   camera_id: %d", __func__, camera_id);
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter != mCaptureModels.end()) {
+        sp<CaptureModel> captureModel = iter->second;
+        return captureModel->setBufferConfig(count, adaptive, max_count,
+                                             starvation_ms);
+    } else {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        return -1;
+    }
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_vhd_captureencoder_CaptureModel_getStarvationEvents(JNIEnv* env,
+                                                             jobject thiz,
+                                                             jint camera_id) {
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter != mCaptureModels.end()) {
+        sp<CaptureModel> captureModel = iter->second;
+        return captureModel->getStarvationEvents();
+    } else {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        return -1;
+    }
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_vhd_captureencoder_CaptureModel_getDroppedFrames(JNIEnv* env,
+                                                          jobject thiz,
+                                                          jint camera_id) {
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter != mCaptureModels.end()) {
+        sp<CaptureModel> captureModel = iter->second;
+        return captureModel->getDroppedFrames();
+    } else {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        return -1;
+    }
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_vhd_captureencoder_CaptureModel_setBackpressure(
+    JNIEnv* env, jobject thiz, jint camera_id, jint consumer_id, jint policy,
+    jint max_pending) {
+    ALOGI("%s   camera_id: %d", __func__, camera_id);
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter != mCaptureModels.end()) {
+        sp<CaptureModel> captureModel = iter->second;
+        return captureModel->setBackpressure(consumer_id, policy, max_pending);
+    } else {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        return -1;
+    }
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_vhd_captureencoder_CaptureModel_getConsumerDroppedFrames(
+    JNIEnv* env, jobject thiz, jint camera_id, jint consumer_id) {
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter != mCaptureModels.end()) {
+        sp<CaptureModel> captureModel = iter->second;
+        return captureModel->getConsumerDroppedFrames(consumer_id);
+    } else {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        return -1;
+    }
+}
+
+extern "C" JNIEXPORT jlong JNICALL
+Java_com_vhd_captureencoder_CaptureModel_getSavedConversions(JNIEnv* env,
+                                                             jobject thiz,
+                                                             jint camera_id) {
+    std::lock_guard<std::mutex> lk(mModelLock);
+    auto iter = mCaptureModels.find(camera_id);
+    if (iter != mCaptureModels.end()) {
+        sp<CaptureModel> captureModel = iter->second;
+        return captureModel->getSavedConversions();
+    } else {
+        ALOGI("%s   camera_id: %d not init", __func__, camera_id);
+        return -1;
+    }
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_vhd_captureencoder_CaptureModel_dumpTrace(JNIEnv* env, jobject thiz,
+                                                   jstring path) {
+    const char* tracePath = env->GetStringUTFChars(path, nullptr);
+    if (tracePath == nullptr) {
+        return -1;
+    }
+    ALOGI("%s   path: %s", __func__, tracePath);
+    int ret = FrameTracer::getInstance().dumpChromeTrace(tracePath);
+    env->ReleaseStringUTFChars(path, tracePath);
+    return ret;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_vhd_captureencoder_CaptureModel_setTraceEnabled(JNIEnv* env,
+                                                         jobject thiz,
+                                                         jboolean enabled) {
+    FrameTracer::getInstance().setEnabled(enabled);
+}
+
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_vhd_captureencoder_CaptureModel_getRgaCacheStats(JNIEnv* env,
+                                                          jobject thiz) {
+    uint64_t hits = 0, misses = 0;
+    RgaCropScale::getCacheStats(&hits, &misses);
+    jlong stats[2] = {(jlong)hits, (jlong)misses};
+    jlongArray array = env->NewLongArray(2);
+    env->SetLongArrayRegion(array, 0, 2, stats);
+    return array;
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_vhd_captureencoder_CaptureModel_setEncoderBudget(JNIEnv* env,
+                                                          jobject thiz,
+                                                          jlong pixels_per_second) {
+    EncoderResourceManager::getInstance().setBudget(pixels_per_second);
+}
+
+// {budget, reserved, measured} in pixels per second
+extern "C" JNIEXPORT jlongArray JNICALL
+Java_com_vhd_captureencoder_CaptureModel_getEncoderLoad(JNIEnv* env,
+                                                        jobject thiz) {
+    EncoderResourceManager& manager = EncoderResourceManager::getInstance();
+    jlong load[3] = {(jlong)manager.getBudget(),
+                     (jlong)manager.getReservedLoad(),
+                     (jlong)manager.getMeasuredLoad()};
+    jlongArray array = env->NewLongArray(3);
+    env->SetLongArrayRegion(array, 0, 3, load);
+    return array;
+}
+
+extern "C" JNIEXPORT jint JNICALL
+Java_com_vhd_captureencoder_CaptureModel_getEncoderUtilization(JNIEnv* env,
+                                                               jobject thiz) {
+    return EncoderResourceManager::getInstance().getUtilization();
 }
\ No newline at end of file
@@ -1,173 +1,313 @@
-//
-// Created by Charlie on 2024/7/22.
-//
-
-#ifndef CAPTUREENCODER_CAPTUREMODEL_H
-#define CAPTUREENCODER_CAPTUREMODEL_H
-
-#include <errno.h>
-#include <jni.h>
-#include <linux/v4l2-subdev.h>
-#include <linux/videodev2.h>
-#include <string.h>
-#include <sys/mman.h>
-#include <system/window.h>
-#include <utils/RefBase.h>
-#include <utils/Thread.h>
-
-#include <map>
-#include <mutex>
-#include <vector>
-
-#include "IProcessDoneListener.h"
-#include "EncoderUnit.h"
-#include "MppEncoderUnit.h"
-#include "PreviewUnit.h"
-#include "JNIEnvUtil.h"
-
-#define V4L2_BUFFER_COUNT 4
-
-using namespace android;
-
-class CaptureModel : public RefBase, public IProcessDoneListener {
-public:
-    CaptureModel(int cameraId, JavaVM* Jvm);
-
-    ~CaptureModel();
-
-    int startCapture(ANativeWindow* nativeWindow, int width, int height,
-                     int fps);
-
-    int stopCapture();
-
-    int loadFd();
-
-    int addEncoderUnit(jobject& javaEncoder);
-
-    jobject removeEncoderUnit(int encoderId);
-
-    void notifyProcessDone(std::shared_ptr<IProcessUnit::ProcessBuf>& processBuf) override;
-
-    struct v4l2_capability mCapability;
-
-    struct v4l2Buffer gV4l2Buf[V4L2_BUFFER_COUNT];
-
-    enum v4l2_buf_type mBufType;
-
-    std::vector<struct v4l2_plane> mPlanes;
-
-private:
-
-    std::mutex mEncoderLock;
-
-    std::map<int, jobject> mJavaEncoders;
-
-    int mEncoderId = 0;
-
-    struct v4l2Param {
-        bool getFormat;
-
-        uint32_t mMinDistance;
-
-        uint32_t mV4l2Format;
-
-        uint32_t mV4l2Width;
-
-        uint32_t mV4l2Height;
-    };
-
-    class PollThread : public Thread {
-    public:
-        explicit PollThread(sp<CaptureModel> captureModel,
-                            std::list<sp<IProcessUnit>> processList,
-                            uint32_t width, uint32_t height, uint32_t format);
-
-        virtual ~PollThread();
-
-        void returnCameraBuffer(std::shared_ptr<IProcessUnit::ProcessBuf>& processBuf);
-
-    private:
-        virtual bool threadLoop();
-
-        virtual status_t readyToRun();
-
-        void showDebugFPS();
-
-        sp<CaptureModel> mCaptureModel = nullptr;
-
-        std::list<sp<IProcessUnit>> mProcessList;
-
-        uint32_t mWidth;
-
-        uint32_t mHeight;
-
-        uint32_t mFormat;
-
-        void postProcess(void* start, int index);
-
-        std::mutex mProcessBufLock;
-
-        int mFrameCount;
-
-        int mLastFrameCount;
-
-        nsecs_t mLastFpsTime;
-    };
-
-    sp<PollThread> mPollThread = nullptr;
-
-    int mCameraId;
-
-    int mWidth;
-
-    int mHeight;
-
-    int mFps;
-
-    JavaVM* globalJvm = nullptr;
-
-    v4l2Param mSelectParams;
-
-    std::atomic<int> mFd = -1;
-
-    volatile bool mV4l2Streaming = false;
-
-    std::mutex mCaptureLock;
-
-    std::condition_variable mStopCon;
-
-    int enumDeviceFmt();
-
-    int getDeviceFmt();
-
-    int queryCapability();
-
-    int v4l2StreamOff();
-
-    int v4l2SetFmt();
-
-    int v4l2SetFps();
-
-    int v4l2ReqBuf();
-
-    int v4l2StreamOn();
-
-    void selectCameraBuf();
-
-    std::list<sp<IProcessUnit>> mProcessList;
-
-    int querySensorTimings();
-
-    struct v4l2_subdev_format mSubFormat;
-
-    int getSensorFormat();
-
-    int setSensorFormat();
-
-    int setSensorInterval();
-
-    struct v4l2_format mFormat;
-
-};
-
-#endif  // CAPTUREENCODER_CAPTUREMODEL_H
+//
+// Created by Charlie on 2024/7/22.
+//
+
+#ifndef CAPTUREENCODER_CAPTUREMODEL_H
+#define CAPTUREENCODER_CAPTUREMODEL_H
+
+#include <errno.h>
+#include <jni.h>
+#include <string.h>
+#include <system/window.h>
+#include <utils/RefBase.h>
+#include <utils/Thread.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "IProcessDoneListener.h"
+#include "CaptureReactor.h"
+#include "EncoderResourceManager.h"
+#include "EncoderUnit.h"
+#include "FragmentedMp4Recorder.h"
+#include "FrameSource.h"
+#include "MppEncoderUnit.h"
+#include "OsdOverlay.h"
+#include "PacketBufferPool.h"
+#include "PreviewUnit.h"
+#include "RtpPacketizer.h"
+#include "ScalerStage.h"
+#include "StreamHandler.h"
+#include "JNIEnvUtil.h"
+
+using namespace android;
+
+class CaptureModel : public RefBase, public IProcessDoneListener {
+public:
+    CaptureModel(int cameraId, JavaVM* Jvm);
+
+    ~CaptureModel();
+
+    int startCapture(ANativeWindow* nativeWindow, int width, int height,
+                     int fps);
+
+    int stopCapture();
+
+    // replace the default V4L2 device, must be called while stopped
+    void setFrameSource(const sp<FrameSource>& source);
+
+    // buffer pool for the next capture session. In adaptive mode the pool
+    // grows up to maxCount whenever every buffer stays held by the consumers
+    // for longer than starvationMs.
+    int setBufferConfig(int count, bool adaptive, int maxCount,
+                        int starvationMs);
+
+    int getStarvationEvents();
+
+    // frames the driver produced but never handed to us, from sequence gaps
+    int64_t getDroppedFrames();
+
+    // scaler conversions skipped because consumers with the same output
+    // geometry shared one result
+    int64_t getSavedConversions();
+
+    // consumer id of the preview for the per-consumer calls below, encoders
+    // use the id returned by addEncoderUnit()
+    static const int kPreviewConsumerId = -1;
+
+    // backpressure for one consumer, applied from the next capture session.
+    // policy is an IProcessUnit::BackpressurePolicy.
+    int setBackpressure(int consumerId, int policy, int maxPending);
+
+    // frames the consumer skipped under its backpressure policy
+    int64_t getConsumerDroppedFrames(int consumerId);
+
+    // An encoder of the capture width runs on MPP, any other on MediaCodec.
+    // When the encoder budget is short a session is started at down to half
+    // its fps, a MediaCodec one also at down to half its size. An MPP
+    // session keeps its size, so its MPP-only settings below always apply.
+    int addEncoderUnit(jobject& javaEncoder);
+
+    // the global refs of the encoder's packet buffers are handed back in
+    // packetBufferRefs for the caller to delete
+    jobject removeEncoderUnit(int encoderId,
+                              std::vector<jobject>* packetBufferRefs);
+
+    // direct buffers the encoder's packets are delivered in from the next
+    // capture session, refs keep them alive. A null pool goes back to
+    // byte[] delivery. The refs of a pool this replaces are handed back in
+    // oldRefs.
+    int setPacketBufferPool(int encoderId,
+                            const std::shared_ptr<PacketBufferPool>& pool,
+                            const std::vector<jobject>& refs,
+                            std::vector<jobject>* oldRefs);
+
+    // Java is done with the packet buffer at index
+    int releasePacketBuffer(int encoderId, int index);
+
+    // records the encoder natively into fragmented MP4 from the next
+    // capture session, segments go to <pathPrefix>_<session>_<index>.mp4.
+    // An empty prefix stops recording, a limit of 0 is no limit.
+    int setRecording(int encoderId, const std::string& pathPrefix,
+                     int64_t segmentDurationUs, int64_t segmentBytes);
+
+    // streams the encoder as RTP to a numeric host from the next capture
+    // session, an empty host stops streaming
+    int setRtpStream(int encoderId, const std::string& host, int port,
+                     int payloadType);
+
+    // the RTP stream of the encoder only carries temporal layers up to
+    // maxTemporalId, negative sends all of them
+    int setRtpTemporalLayer(int encoderId, int maxTemporalId);
+
+    // Temporal layers of an MPP encoder from the next capture session, 1 to
+    // 4. Each layer doubles the frame rate of the ones below, so consumers
+    // of lower rates take the lower layers of one encode.
+    int setTemporalLayers(int encoderId, int layers);
+
+    // Low delay output of an MPP encoder from the next capture session: the
+    // frame is cut into this many slices and each is delivered as soon as
+    // it is encoded, 1 delivers whole frames.
+    int setLowDelaySlices(int encoderId, int slices);
+
+    // Rate control of an MPP encoder, a negative field keeps the current
+    // setting. A running encoder picks it up on its next frame, fps is
+    // capped at the rate its session was granted. It is kept for the next
+    // capture sessions too. -EOPNOTSUPP when the encoder runs on
+    // MediaCodec.
+    int setRateControl(int encoderId, const VENC_RC_ATTR_t& rc);
+
+    // ROI rectangles of an MPP encoder with a QP delta each, or an absolute
+    // QP, in encoder pixels. Replaces the previous ones from the next frame
+    // on and is kept for the next capture sessions, empty clears them.
+    // -EOPNOTSUPP when the encoder runs on MediaCodec.
+    int setRoiRegions(int encoderId, const std::vector<RoiRegionCfg>& regions);
+
+    // Text the MPP encoder blends over its frames, see OsdOverlay. Changes
+    // show from the next frame on and are kept for the next capture
+    // sessions. -EOPNOTSUPP when the encoder runs on MediaCodec.
+    int setOsdGlyphs(int encoderId, int cellWidth, int cellHeight,
+                     const std::vector<uint8_t>& bitmaps,
+                     const std::string& charset);
+
+    int setOsdText(int encoderId, int region, int x, int y,
+                   const std::string& text);
+
+    int setOsdPalette(int encoderId, const std::vector<uint32_t>& yuva);
+
+    // Asks the running encoder for an IDR, requests within the key frame
+    // window are merged into one. Returns the requests the coming IDR
+    // serves, 0 when the encoder is not running and starts with one anyway.
+    int requestKeyFrame(int encoderId);
+
+    // requests closer together than this share one IDR
+    void setKeyFrameWindow(int windowMs);
+
+    // requests and the IDRs issued for them over all sessions of the
+    // encoder, the running one included. -ENOENT before its first session.
+    int getKeyFrameStats(int encoderId, int64_t* requests, int64_t* keyFrames);
+
+    void notifyProcessDone(std::shared_ptr<IProcessUnit::ProcessBuf>& processBuf) override;
+
+private:
+    std::list<sp<IProcessUnit>> setupScalerStage();
+
+    // stops the units and the source of a started session, with mCaptureLock
+    // held
+    void teardownCapture();
+
+    struct BackpressureConfig {
+        IProcessUnit::BackpressurePolicy policy;
+
+        uint32_t maxPending;
+    };
+
+    void applyBackpressure(int consumerId, const sp<IProcessUnit>& unit);
+
+    // regions cut to a width x height picture, empty ones dropped
+    static std::vector<RoiRegionCfg> clippedRoiRegions(
+        const std::vector<RoiRegionCfg>& regions, int width, int height);
+
+    // the overlay of an existing encoder, created on first use; null and
+    // ret set when it cannot take one
+    std::shared_ptr<OsdOverlay> getOsdOverlay(int encoderId, int* ret);
+
+    // fps above the granted rate would overrun the encoder budget
+    static VENC_RC_ATTR_t cappedRateControl(const VENC_RC_ATTR_t& rc,
+                                            int maxFps);
+
+    typedef StreamHandler::BufferConfig BufferConfig;
+
+    std::mutex mEncoderLock;
+
+    std::map<int, jobject> mJavaEncoders;
+
+    struct PacketPool {
+        std::shared_ptr<PacketBufferPool> pool;
+
+        std::vector<jobject> refs;
+    };
+
+    std::map<int, PacketPool> mPacketPools;
+
+    struct RecordingConfig {
+        std::string pathPrefix;
+
+        int64_t segmentDurationUs;
+
+        int64_t segmentBytes;
+    };
+
+    std::map<int, RecordingConfig> mRecordings;
+
+    // recorders of the running session, closed once the units are stopped
+    std::vector<std::shared_ptr<FragmentedMp4Recorder>> mRecorders;
+
+    struct RtpConfig {
+        std::string host;
+
+        int port;
+
+        int payloadType;
+
+        int maxTemporalId;
+    };
+
+    std::map<int, RtpConfig> mRtpStreams;
+
+    std::vector<std::shared_ptr<RtpPacketizer>> mPacketizers;
+
+    std::map<int, VENC_RC_ATTR_t> mRateControls;
+
+    std::map<int, int> mTemporalLayers;
+
+    std::map<int, int> mLowDelaySlices;
+
+    std::map<int, std::vector<RoiRegionCfg>> mRoiRegions;
+
+    std::map<int, std::shared_ptr<OsdOverlay>> mOsdOverlays;
+
+    struct MppSession {
+        sp<MppEncoderUnit> unit;
+
+        // granted by EncoderResourceManager
+        int maxFps;
+
+        int width;
+
+        int height;
+    };
+
+    // MPP encoders of the running session by encoder id
+    std::map<int, MppSession> mMppEncoders;
+
+    int64_t mKeyFrameWindowUs;
+
+    int mEncoderId = 0;
+
+    sp<StreamHandler> mStreamHandler = nullptr;
+
+    int mCameraId;
+
+    int mWidth;
+
+    int mHeight;
+
+    int mFps;
+
+    JavaVM* globalJvm = nullptr;
+
+    sp<FrameSource> mSource = nullptr;
+
+    BufferConfig mBufferConfig = {4, false, 8, 100};
+
+    int mStarvationEvents = 0;
+
+    int64_t mDroppedFrames = 0;
+
+    int64_t mSavedConversions = 0;
+
+    std::map<int, BackpressureConfig> mBackpressure;
+
+    // units of the running session by consumer id
+    std::map<int, sp<IProcessUnit>> mConsumers;
+
+    std::map<int, int64_t> mConsumerDrops;
+
+    struct KeyFrameStats {
+        int64_t requests = 0;
+
+        int64_t keyFrames = 0;
+    };
+
+    // of the sessions that ended, by encoder id
+    std::map<int, KeyFrameStats> mKeyFrameStats;
+
+    volatile bool mStreaming = false;
+
+    std::mutex mCaptureLock;
+
+    std::condition_variable mStopCon;
+
+    std::list<sp<IProcessUnit>> mProcessList;
+
+    sp<ScalerStage> mScalerStage = nullptr;
+
+    // EncoderResourceManager channels held by the running session
+    std::vector<int> mEncoderChannels;
+};
+
+#endif  // CAPTUREENCODER_CAPTUREMODEL_H
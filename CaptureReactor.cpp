@@ -0,0 +1,210 @@
+#define LOG_TAG "NativeCaptureReactor"
+
+#include "CaptureReactor.h"
+
+#include <errno.h>
+#include <log/log.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <utils/Trace.h>
+
+CaptureReactor CaptureReactor::sInstance;
+
+CaptureReactor& CaptureReactor::getInstance() {
+    return sInstance;
+}
+
+CaptureReactor::CaptureReactor() {
+    ALOGI("%s   CaptureReactor: %p", __func__, this);
+}
+
+CaptureReactor::~CaptureReactor() {
+    ALOGI("%s   CaptureReactor: %p", __func__, this);
+    if (mLoopThread) {
+        mLoopThread->requestExit();
+        wakeup();
+        mLoopThread->join();
+        mLoopThread.clear();
+    }
+    if (mEventFd >= 0) {
+        close(mEventFd);
+        mEventFd = -1;
+    }
+    if (mEpollFd >= 0) {
+        close(mEpollFd);
+        mEpollFd = -1;
+    }
+}
+
+int CaptureReactor::ensureStarted() {
+    if (mLoopThread) {
+        return 0;
+    }
+    mEpollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (mEpollFd < 0) {
+        ALOGE("%s   epoll_create1 failed: %s", __func__, strerror(errno));
+        return -errno;
+    }
+    mEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (mEventFd < 0) {
+        ALOGE("%s   eventfd failed: %s", __func__, strerror(errno));
+        int ret = -errno;
+        close(mEpollFd);
+        mEpollFd = -1;
+        return ret;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = mEventFd;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, mEventFd, &ev)) {
+        ALOGE("%s   add eventfd failed: %s", __func__, strerror(errno));
+        return -errno;
+    }
+    mLoopThread = new LoopThread(this);
+    mLoopThread->run("CaptureReactor");
+    return 0;
+}
+
+void CaptureReactor::wakeup() {
+    uint64_t one = 1;
+    if (write(mEventFd, &one, sizeof(one)) != sizeof(one)) {
+        ALOGE("%s   write eventfd failed: %s", __func__, strerror(errno));
+    }
+}
+
+int CaptureReactor::addFd(int fd, const sp<Handler>& handler) {
+    std::lock_guard<std::mutex> lk(mLock);
+    int ret = ensureStarted();
+    if (ret < 0) {
+        return ret;
+    }
+    if (mHandlers.find(fd) != mHandlers.end()) {
+        ALOGE("%s   fd: %d already registered", __func__, fd);
+        return -EEXIST;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(mEpollFd, EPOLL_CTL_ADD, fd, &ev)) {
+        ALOGE("%s   EPOLL_CTL_ADD fd: %d failed: %s", __func__, fd,
+              strerror(errno));
+        return -errno;
+    }
+    mHandlers[fd] = {handler, true};
+    ALOGI("%s   fd: %d handler: %p", __func__, fd, handler.get());
+    return 0;
+}
+
+int CaptureReactor::removeFd(int fd) {
+    std::unique_lock<std::mutex> lk(mLock);
+    auto iter = mHandlers.find(fd);
+    if (iter == mHandlers.end()) {
+        return -ENOENT;
+    }
+    if (iter->second.enabled) {
+        epoll_ctl(mEpollFd, EPOLL_CTL_DEL, fd, NULL);
+    }
+    sp<Handler> handler = iter->second.handler;
+    mHandlers.erase(iter);
+    // events already fetched for fd are dropped in dispatch() since the
+    // handler is gone from the map, only a running callback has to finish
+    if (gettid() != mLoopTid) {
+        while (mDispatchingFd == fd) {
+            mDispatchCond.wait(lk);
+        }
+    }
+    lk.unlock();
+    ALOGI("%s   fd: %d handler: %p", __func__, fd, handler.get());
+    return 0;
+}
+
+int CaptureReactor::setFdEnabled(int fd, const Handler* handler,
+                                 bool enabled) {
+    std::lock_guard<std::mutex> lk(mLock);
+    auto iter = mHandlers.find(fd);
+    // the fd number may already belong to another session after a stop
+    if (iter == mHandlers.end() || iter->second.handler.get() != handler) {
+        return -ENOENT;
+    }
+    if (iter->second.enabled == enabled) {
+        return 0;
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(mEpollFd, enabled ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, fd, &ev)) {
+        ALOGE("%s   %s fd: %d failed: %s", __func__,
+              enabled ? "EPOLL_CTL_ADD" : "EPOLL_CTL_DEL", fd, strerror(errno));
+        return -errno;
+    }
+    iter->second.enabled = enabled;
+    return 0;
+}
+
+void CaptureReactor::dispatch(int fd, uint32_t events) {
+    sp<Handler> handler;
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        auto iter = mHandlers.find(fd);
+        if (iter == mHandlers.end()) {
+            return;
+        }
+        handler = iter->second.handler;
+        mDispatchingFd = fd;
+    }
+    handler->onEvent(fd, events);
+    {
+        std::lock_guard<std::mutex> lk(mLock);
+        mDispatchingFd = -1;
+    }
+    mDispatchCond.notify_all();
+}
+
+bool CaptureReactor::loopOnce() {
+    ATRACE_CALL();
+    struct epoll_event events[kMaxEvents];
+    int n = epoll_wait(mEpollFd, events, kMaxEvents, -1);
+    if (n < 0) {
+        if (errno != EINTR) {
+            ALOGE("%s   epoll_wait failed: %s", __func__, strerror(errno));
+        }
+        return true;
+    }
+    for (int i = 0; i < n; i++) {
+        if (events[i].data.fd == mEventFd) {
+            // only the destructor wakes the loop, threadLoop sees the exit
+            uint64_t count = 0;
+            read(mEventFd, &count, sizeof(count));
+        } else {
+            dispatch(events[i].data.fd, events[i].events);
+        }
+    }
+    return true;
+}
+
+CaptureReactor::LoopThread::LoopThread(CaptureReactor* reactor)
+    : mReactor(reactor) {
+    ALOGI("%s   LoopThread: %p", __func__, this);
+}
+
+CaptureReactor::LoopThread::~LoopThread() {
+    ALOGI("%s   LoopThread: %p", __func__, this);
+}
+
+status_t CaptureReactor::LoopThread::readyToRun() {
+    std::lock_guard<std::mutex> lk(mReactor->mLock);
+    mReactor->mLoopTid = gettid();
+    return NO_ERROR;
+}
+
+bool CaptureReactor::LoopThread::threadLoop() {
+    if (exitPending()) {
+        return false;
+    }
+    return mReactor->loopOnce();
+}
@@ -0,0 +1,98 @@
+#ifndef CAPTUREENCODER_CAPTUREREACTOR_H
+#define CAPTUREENCODER_CAPTUREREACTOR_H
+
+#include <stdint.h>
+#include <utils/RefBase.h>
+#include <utils/Thread.h>
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+
+using namespace android;
+
+// One epoll thread shared by every capture session. Each session registers
+// its device fd (and any helper fds such as timers) with a Handler, the
+// reactor calls the handler on its own thread when the fd becomes ready.
+// Stopping a session removes its fds right away, it never waits for a poll
+// timeout.
+class CaptureReactor {
+public:
+    class Handler : public virtual RefBase {
+    public:
+        virtual ~Handler() {}
+
+        // called on the reactor thread, must not block
+        virtual void onEvent(int fd, uint32_t events) = 0;
+    };
+
+    static CaptureReactor& getInstance();
+
+    CaptureReactor();
+
+    ~CaptureReactor();
+
+    int addFd(int fd, const sp<Handler>& handler);
+
+    // once this returns the handler is not running and will not be called
+    // again for fd, also when called from the reactor thread itself
+    int removeFd(int fd);
+
+    // stop or resume watching fd without dropping the registration, used
+    // while the device has no buffer queued. A disabled fd is taken out of
+    // the epoll set, epoll reports EPOLLERR and EPOLLHUP whatever events
+    // are asked for.
+    int setFdEnabled(int fd, const Handler* handler, bool enabled);
+
+private:
+    class LoopThread : public Thread {
+    public:
+        explicit LoopThread(CaptureReactor* reactor);
+
+        virtual ~LoopThread();
+
+    private:
+        virtual bool threadLoop();
+
+        virtual status_t readyToRun();
+
+        CaptureReactor* mReactor;
+    };
+
+    static const int kMaxEvents = 16;
+
+    static CaptureReactor sInstance;
+
+    int ensureStarted();
+
+    void wakeup();
+
+    void dispatch(int fd, uint32_t events);
+
+    bool loopOnce();
+
+    std::mutex mLock;
+
+    std::condition_variable mDispatchCond;
+
+    int mEpollFd = -1;
+
+    int mEventFd = -1;
+
+    struct Registration {
+        sp<Handler> handler;
+
+        // in the epoll set
+        bool enabled;
+    };
+
+    std::map<int, Registration> mHandlers;
+
+    int mDispatchingFd = -1;
+
+    pid_t mLoopTid = -1;
+
+    sp<LoopThread> mLoopThread = nullptr;
+};
+
+#endif  // CAPTUREENCODER_CAPTUREREACTOR_H
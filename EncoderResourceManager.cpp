@@ -0,0 +1,190 @@
+#define LOG_TAG "NativeEncoderResourceManager"
+
+#include "EncoderResourceManager.h"
+
+#include <cutils/properties.h>
+#include <errno.h>
+#include <log/log.h>
+#include <utils/Timers.h>
+
+#include <algorithm>
+
+namespace {
+
+class MonotonicClock : public EncoderResourceManager::Clock {
+public:
+    int64_t nowUs() override { return systemTime(SYSTEM_TIME_MONOTONIC) / 1000; }
+};
+
+}  // namespace
+
+EncoderResourceManager EncoderResourceManager::sInstance(property_get_int64(
+    "debug.capture.encoder_budget", EncoderResourceManager::kDefaultBudget));
+
+EncoderResourceManager& EncoderResourceManager::getInstance() {
+    return sInstance;
+}
+
+EncoderResourceManager::EncoderResourceManager(int64_t budget,
+                                               std::shared_ptr<Clock> clock)
+    : mClock(clock), mBudget(budget) {
+    if (mClock == nullptr) {
+        mClock = std::make_shared<MonotonicClock>();
+    }
+    mChannels.resize(kMaxChannels);
+    for (auto& channel : mChannels) {
+        channel = {false, 0, 0, 0, 0, 0, 0};
+    }
+    ALOGI("%s   EncoderResourceManager: %p budget: %lld", __func__, this,
+          (long long)mBudget);
+}
+
+EncoderResourceManager::~EncoderResourceManager() {
+    ALOGI("%s   EncoderResourceManager: %p", __func__, this);
+}
+
+void EncoderResourceManager::setBudget(int64_t budget) {
+    std::lock_guard<std::mutex> lk(mLock);
+    ALOGI("%s   budget: %lld", __func__, (long long)budget);
+    mBudget = budget;
+}
+
+int64_t EncoderResourceManager::getBudget() {
+    std::lock_guard<std::mutex> lk(mLock);
+    return mBudget;
+}
+
+// Lower fps first at the requested size, then halve the size and try again
+// from the requested fps. Sizes stay 16 aligned for the encoder, the
+// smallest size the session allows is taken as is: 2160 halves to 1072 and
+// would otherwise skip 1080.
+bool EncoderResourceManager::fit(const Request& request, int64_t available,
+                                 Grant* grant) {
+    int width = request.width;
+    int height = request.height;
+    while (width >= request.minWidth && height >= request.minHeight &&
+           width > 0 && height > 0) {
+        int fps = request.fps;
+        if (loadOf(width, height, fps) > available) {
+            fps = available / loadOf(width, height, 1);
+        }
+        if (fps >= request.minFps && fps > 0) {
+            grant->width = width;
+            grant->height = height;
+            grant->fps = fps;
+            return true;
+        }
+        if (width == request.minWidth || height == request.minHeight) {
+            break;
+        }
+        width = std::max((width / 2) & ~15, request.minWidth);
+        height = std::max((height / 2) & ~15, request.minHeight);
+    }
+    return false;
+}
+
+int EncoderResourceManager::acquire(const Request& request, Grant* grant) {
+    if (grant == nullptr || request.width <= 0 || request.height <= 0 ||
+        request.fps <= 0) {
+        return -EINVAL;
+    }
+    std::lock_guard<std::mutex> lk(mLock);
+    int64_t available = mBudget;
+    Channel* free = nullptr;
+    int channelId = -1;
+    for (int i = 0; i < (int)mChannels.size(); i++) {
+        Channel& channel = mChannels[i];
+        if (channel.inUse) {
+            available -= loadOf(channel.width, channel.height, channel.fps);
+        } else if (free == nullptr) {
+            free = &channel;
+            channelId = i;
+        }
+    }
+    if (free == nullptr) {
+        ALOGE("%s   no free channel", __func__);
+        return -EBUSY;
+    }
+    if (!fit(request, available, grant)) {
+        ALOGE("%s   %dx%d@%d does not fit, available: %lld", __func__,
+              request.width, request.height, request.fps,
+              (long long)available);
+        return -EBUSY;
+    }
+    grant->channelId = channelId;
+    *free = {true, grant->width, grant->height, grant->fps,
+             mClock->nowUs(), 0, 0};
+    ALOGI("%s   channelId: %d %dx%d@%d granted %dx%d@%d", __func__, channelId,
+          request.width, request.height, request.fps, grant->width,
+          grant->height, grant->fps);
+    return 0;
+}
+
+int EncoderResourceManager::release(int channelId) {
+    std::lock_guard<std::mutex> lk(mLock);
+    if (channelId < 0 || channelId >= (int)mChannels.size() ||
+        !mChannels[channelId].inUse) {
+        ALOGE("%s   channelId: %d not in use", __func__, channelId);
+        return -EINVAL;
+    }
+    mChannels[channelId].inUse = false;
+    ALOGI("%s   channelId: %d okay", __func__, channelId);
+    return 0;
+}
+
+void EncoderResourceManager::updateWindow(Channel* channel, int64_t nowUs) {
+    int64_t elapsedUs = nowUs - channel->windowStartUs;
+    if (elapsedUs < kWindowUs) {
+        return;
+    }
+    channel->measuredLoad =
+        channel->windowFrames * loadOf(channel->width, channel->height, 1) *
+        1000000 / elapsedUs;
+    channel->windowStartUs = nowUs;
+    channel->windowFrames = 0;
+}
+
+void EncoderResourceManager::onFrameEncoded(int channelId) {
+    std::lock_guard<std::mutex> lk(mLock);
+    if (channelId < 0 || channelId >= (int)mChannels.size() ||
+        !mChannels[channelId].inUse) {
+        return;
+    }
+    Channel& channel = mChannels[channelId];
+    updateWindow(&channel, mClock->nowUs());
+    channel.windowFrames++;
+}
+
+int64_t EncoderResourceManager::getReservedLoad() {
+    std::lock_guard<std::mutex> lk(mLock);
+    int64_t load = 0;
+    for (const auto& channel : mChannels) {
+        if (channel.inUse) {
+            load += loadOf(channel.width, channel.height, channel.fps);
+        }
+    }
+    return load;
+}
+
+int64_t EncoderResourceManager::getMeasuredLoad() {
+    std::lock_guard<std::mutex> lk(mLock);
+    int64_t nowUs = mClock->nowUs();
+    int64_t load = 0;
+    for (auto& channel : mChannels) {
+        if (channel.inUse) {
+            // a stalled session decays on its own
+            updateWindow(&channel, nowUs);
+            load += channel.measuredLoad;
+        }
+    }
+    return load;
+}
+
+int EncoderResourceManager::getUtilization() {
+    int64_t load = getMeasuredLoad();
+    std::lock_guard<std::mutex> lk(mLock);
+    if (mBudget <= 0) {
+        return 0;
+    }
+    return load * 100 / mBudget;
+}
@@ -0,0 +1,109 @@
+#ifndef CAPTUREENCODER_ENCODERRESOURCEMANAGER_H
+#define CAPTUREENCODER_ENCODERRESOURCEMANAGER_H
+
+#include <stdint.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Hands out encoder channels against the pixel rate the VEPU sustains in
+// real time. Every session reserves width x height x fps of the budget; a
+// session that does not fit is downgraded to a lower fps, then to a lower
+// resolution, within the limits it allows, or rejected. Encoded frames are
+// reported back so the measured load can be compared with the reservation.
+class EncoderResourceManager {
+public:
+    // time source, replaceable so the rate windows can be driven by hand
+    class Clock {
+    public:
+        virtual ~Clock() {}
+
+        virtual int64_t nowUs() = 0;
+    };
+
+    struct Request {
+        int width;
+        int height;
+        int fps;
+        // lowest fps and size the session still accepts, the requested
+        // values when it takes no downgrade
+        int minFps;
+        int minWidth;
+        int minHeight;
+    };
+
+    struct Grant {
+        int channelId;
+        int width;
+        int height;
+        int fps;
+    };
+
+    static const int kMaxChannels = 6;
+
+    // 4K60, what one VEPU core encodes in real time
+    static const int64_t kDefaultBudget = 3840LL * 2160 * 60;
+
+    static EncoderResourceManager& getInstance();
+
+    explicit EncoderResourceManager(int64_t budget = kDefaultBudget,
+                                    std::shared_ptr<Clock> clock = nullptr);
+
+    ~EncoderResourceManager();
+
+    // pixels per second shared by all sessions, applies to later admissions
+    void setBudget(int64_t budget);
+
+    int64_t getBudget();
+
+    // -EBUSY when the session does not fit even downgraded or no channel is
+    // free, -EINVAL on a bad request
+    int acquire(const Request& request, Grant* grant);
+
+    int release(int channelId);
+
+    void onFrameEncoded(int channelId);
+
+    // pixels per second reserved by the admitted sessions
+    int64_t getReservedLoad();
+
+    // pixels per second actually encoded over the last window
+    int64_t getMeasuredLoad();
+
+    // measured load against the budget, in percent
+    int getUtilization();
+
+private:
+    struct Channel {
+        bool inUse;
+        int width;
+        int height;
+        int fps;
+        int64_t windowStartUs;
+        int64_t windowFrames;
+        int64_t measuredLoad;
+    };
+
+    static const int64_t kWindowUs = 1000000;
+
+    static int64_t loadOf(int width, int height, int fps) {
+        return (int64_t)width * height * fps;
+    }
+
+    bool fit(const Request& request, int64_t available, Grant* grant);
+
+    void updateWindow(Channel* channel, int64_t nowUs);
+
+    static EncoderResourceManager sInstance;
+
+    std::shared_ptr<Clock> mClock;
+
+    int64_t mBudget;
+
+    std::vector<Channel> mChannels;
+
+    std::mutex mLock;
+};
+
+#endif  // CAPTUREENCODER_ENCODERRESOURCEMANAGER_H
@@ -1,84 +1,115 @@
-//
-// Created by Charlie on 2024/7/24.
-//
-
-#ifndef CAPTUREENCODER_ENCODERUNIT_H
-#define CAPTUREENCODER_ENCODERUNIT_H
-
-#include <jni.h>
-#include <utils/Thread.h>
-
-#include "IProcessDoneListener.h"
-#include "IProcessUnit.h"
-#include "media/NdkMediaCodec.h"
-
-class EncoderUnit : public IProcessUnit {
-public:
-    EncoderUnit(IProcessDoneListener* processDoneListener, JavaVM* Jvm, jobject javaEncoder, int preViewFps);
-
-    ~EncoderUnit();
-
-    bool shouldProcessImg() override;
-
-    int32_t processBuffer(
-        std::shared_ptr<ProcessBuf>& processBuf) override;
-
-    void waitForNextRequest(std::shared_ptr<ProcessBuf>* out) override;
-
-    AMediaCodec* mCodec;
-private:
-
-    class SendResultThread : public Thread {
-    public:
-        explicit SendResultThread(AMediaCodec* codec, JavaVM* Jvm, jobject javaEncoder);
-
-        virtual ~SendResultThread();
-
-    private:
-        virtual bool threadLoop();
-
-        virtual status_t readyToRun();
-
-        AMediaCodec* mCodec;
-
-        JavaVM* globalJvm = nullptr;
-
-        JNIEnv* mJniEnv;
-
-        jobject mJavaEncoder;
-
-        jmethodID mGetVideoMethodId;
-    };
-
-    sp<SendResultThread> mSendResultThread = nullptr;
-
-    IProcessDoneListener* mIProcessDoneListener;
-
-    int setupCodec();
-
-    virtual bool threadLoop();
-
-    virtual status_t readyToRun();
-
-    JavaVM* globalJvm = nullptr;
-
-    JNIEnv* mJniEnv;
-
-    jobject mJavaEncoder;
-
-    int mWidth;
-
-    int mHeight;
-
-    int mFps;
-
-    AMediaFormat* mFormat;
-
-    int mSkipCodecNum = 0;
-
-    int mCount = 0;
-
-    int mPts = 0;
-};
-
-#endif  // CAPTUREENCODER_ENCODERUNIT_H
+//
+// Created by Charlie on 2024/7/24.
+//
+
+#ifndef CAPTUREENCODER_ENCODERUNIT_H
+#define CAPTUREENCODER_ENCODERUNIT_H
+
+#include <jni.h>
+#include <utils/Thread.h>
+
+#include <memory>
+#include <vector>
+
+#include "IProcessDoneListener.h"
+#include "IPacketSink.h"
+#include "IProcessUnit.h"
+#include "PacketBufferPool.h"
+#include "media/NdkMediaCodec.h"
+
+class EncoderUnit : public IProcessUnit {
+public:
+    EncoderUnit(IProcessDoneListener* processDoneListener, JavaVM* Jvm, jobject javaEncoder,
+                const std::shared_ptr<PacketBufferPool>& packetPool, int channelId);
+
+    // encode at other than the Java encoder's format, set before run()
+    void setEncodeFormat(int width, int height, int fps);
+
+    // native consumer of the encoded packets next to Java, add before run()
+    void addPacketSink(const std::shared_ptr<IPacketSink>& sink);
+
+    ~EncoderUnit();
+
+    bool shouldProcessImg() override;
+
+    bool getOutputSpec(OutputSpec* spec) override;
+
+    KeyFrameRequester* getKeyFrameRequester() override;
+
+    AMediaCodec* mCodec;
+private:
+
+    class SendResultThread : public Thread {
+    public:
+        explicit SendResultThread(AMediaCodec* codec, JavaVM* Jvm, jobject javaEncoder,
+                                  int traceConsumer,
+                                  const std::shared_ptr<PacketBufferPool>& packetPool,
+                                  int channelId,
+                                  const std::vector<std::shared_ptr<IPacketSink>>& packetSinks);
+
+        virtual ~SendResultThread();
+
+    private:
+        virtual bool threadLoop();
+
+        virtual status_t readyToRun();
+
+        AMediaCodec* mCodec;
+
+        JavaVM* globalJvm = nullptr;
+
+        JNIEnv* mJniEnv;
+
+        jobject mJavaEncoder;
+
+        jmethodID mGetVideoMethodId;
+
+        bool mVideoMethodWithPts = false;
+
+        jmethodID mGetVideoBufferMethodId = nullptr;
+
+        std::shared_ptr<PacketBufferPool> mPacketPool;
+
+        int mTraceConsumer;
+
+        int mChannelId;
+
+        std::vector<std::shared_ptr<IPacketSink>> mPacketSinks;
+    };
+
+    sp<SendResultThread> mSendResultThread = nullptr;
+
+    IProcessDoneListener* mIProcessDoneListener;
+
+    int setupCodec();
+
+    virtual bool threadLoop();
+
+    virtual status_t readyToRun();
+
+    JavaVM* globalJvm = nullptr;
+
+    JNIEnv* mJniEnv;
+
+    jobject mJavaEncoder;
+
+    int mWidth;
+
+    int mHeight;
+
+    int mFps;
+
+    AMediaFormat* mFormat;
+
+    int mTraceConsumer = -1;
+
+    std::shared_ptr<PacketBufferPool> mPacketPool;
+
+    int mChannelId;
+
+    std::vector<std::shared_ptr<IPacketSink>> mPacketSinks;
+
+    KeyFrameRequester mKeyFrames;
+};
+
+#endif  // CAPTUREENCODER_ENCODERUNIT_H
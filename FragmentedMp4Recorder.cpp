@@ -0,0 +1,606 @@
+#define LOG_TAG "NativeFragmentedMp4Recorder"
+
+#include "FragmentedMp4Recorder.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <log/log.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "AnnexB.h"
+#include "PacketBufferPool.h"
+
+namespace {
+
+void put8(std::vector<uint8_t>* out, uint32_t value) {
+    out->push_back(value & 0xff);
+}
+
+void put16(std::vector<uint8_t>* out, uint32_t value) {
+    put8(out, value >> 8);
+    put8(out, value);
+}
+
+void put32(std::vector<uint8_t>* out, uint32_t value) {
+    put16(out, value >> 16);
+    put16(out, value);
+}
+
+void put64(std::vector<uint8_t>* out, uint64_t value) {
+    put32(out, value >> 32);
+    put32(out, value);
+}
+
+void putBytes(std::vector<uint8_t>* out, const uint8_t* data, size_t length) {
+    out->insert(out->end(), data, data + length);
+}
+
+void patch32(std::vector<uint8_t>* out, size_t offset, uint32_t value) {
+    (*out)[offset] = value >> 24;
+    (*out)[offset + 1] = value >> 16;
+    (*out)[offset + 2] = value >> 8;
+    (*out)[offset + 3] = value;
+}
+
+// returns the offset to hand to endBox()
+size_t beginBox(std::vector<uint8_t>* out, const char* type) {
+    size_t offset = out->size();
+    put32(out, 0);
+    putBytes(out, (const uint8_t*)type, 4);
+    return offset;
+}
+
+size_t beginFullBox(std::vector<uint8_t>* out, const char* type,
+                    uint8_t version, uint32_t flags) {
+    size_t offset = beginBox(out, type);
+    put32(out, (uint32_t)version << 24 | (flags & 0xffffff));
+    return offset;
+}
+
+void endBox(std::vector<uint8_t>* out, size_t offset) {
+    patch32(out, offset, out->size() - offset);
+}
+
+void putMatrix(std::vector<uint8_t>* out) {
+    static const uint32_t kUnity[9] = {0x00010000, 0, 0, 0, 0x00010000, 0,
+                                       0,          0, 0x40000000};
+    for (uint32_t value : kUnity) {
+        put32(out, value);
+    }
+}
+
+// the NAL payload without emulation prevention bytes
+std::vector<uint8_t> toRbsp(const std::vector<uint8_t>& nal) {
+    std::vector<uint8_t> rbsp;
+    rbsp.reserve(nal.size());
+    int zeros = 0;
+    for (uint8_t byte : nal) {
+        if (zeros >= 2 && byte == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = byte == 0 ? zeros + 1 : 0;
+        rbsp.push_back(byte);
+    }
+    return rbsp;
+}
+
+const int kHevcVps = 32;
+const int kHevcSps = 33;
+const int kHevcPps = 34;
+const int kHevcAud = 35;
+const int kH264Sps = 7;
+const int kH264Pps = 8;
+const int kH264Aud = 9;
+const int kH264Idr = 5;
+
+}  // namespace
+
+FragmentedMp4Recorder::FragmentedMp4Recorder(Codec codec, int width,
+                                             int height,
+                                             const std::string& pathPrefix,
+                                             int64_t segmentDurationUs,
+                                             int64_t segmentBytes)
+    : mCodec(codec),
+      mWidth(width),
+      mHeight(height),
+      mPathPrefix(pathPrefix),
+      mSegmentDurationUs(segmentDurationUs),
+      mSegmentBytes(segmentBytes) {
+    if (posix_memalign((void**)&mWriteBuffer, kWriteAlign, kWriteBufferSize)) {
+        mWriteBuffer = nullptr;
+    }
+    ALOGI("%s   %s %dx%d prefix: %s segment: %lldus %lld bytes", __func__,
+          mCodec == CODEC_HEVC ? "hevc" : "h264", mWidth, mHeight,
+          mPathPrefix.c_str(), (long long)mSegmentDurationUs,
+          (long long)mSegmentBytes);
+}
+
+FragmentedMp4Recorder::~FragmentedMp4Recorder() {
+    close();
+    free(mWriteBuffer);
+}
+
+int FragmentedMp4Recorder::getSegmentCount() {
+    std::lock_guard<std::mutex> lk(mLock);
+    return mSegmentCount;
+}
+
+int64_t FragmentedMp4Recorder::getDroppedPackets() {
+    std::lock_guard<std::mutex> lk(mLock);
+    return mDroppedPackets;
+}
+
+void FragmentedMp4Recorder::parseParameterSets(const uint8_t* data,
+                                               size_t length) {
+    forEachNal(data, length, [this](const uint8_t* nal, size_t size) {
+        if (size < 2) {
+            return;
+        }
+        if (mCodec == CODEC_HEVC) {
+            int type = (nal[0] >> 1) & 0x3f;
+            if (type == kHevcVps) {
+                mVps.assign(nal, nal + size);
+            } else if (type == kHevcSps) {
+                mSps.assign(nal, nal + size);
+            } else if (type == kHevcPps) {
+                mPps.assign(nal, nal + size);
+            }
+        } else {
+            int type = nal[0] & 0x1f;
+            if (type == kH264Sps) {
+                mSps.assign(nal, nal + size);
+            } else if (type == kH264Pps) {
+                mPps.assign(nal, nal + size);
+            }
+        }
+    });
+}
+
+bool FragmentedMp4Recorder::isKeyFrame(const uint8_t* data, size_t length,
+                                       uint32_t flags) {
+    if (flags & PacketBufferPool::kFlagKeyFrame) {
+        return true;
+    }
+    bool keyFrame = false;
+    forEachNal(data, length, [this, &keyFrame](const uint8_t* nal,
+                                               size_t size) {
+        if (size < 1) {
+            return;
+        }
+        if (mCodec == CODEC_HEVC) {
+            // BLA, IDR and CRA
+            int type = (nal[0] >> 1) & 0x3f;
+            keyFrame |= type >= 16 && type <= 23;
+        } else {
+            keyFrame |= (nal[0] & 0x1f) == kH264Idr;
+        }
+    });
+    return keyFrame;
+}
+
+size_t FragmentedMp4Recorder::appendSample(const uint8_t* data,
+                                           size_t length) {
+    size_t before = mSampleData.size();
+    forEachNal(data, length, [this](const uint8_t* nal, size_t size) {
+        if (size < 1) {
+            return;
+        }
+        // parameter sets live in the sample entry
+        if (mCodec == CODEC_HEVC) {
+            int type = (nal[0] >> 1) & 0x3f;
+            if (type == kHevcVps || type == kHevcSps || type == kHevcPps ||
+                type == kHevcAud) {
+                return;
+            }
+        } else {
+            int type = nal[0] & 0x1f;
+            if (type == kH264Sps || type == kH264Pps || type == kH264Aud) {
+                return;
+            }
+        }
+        put32(&mSampleData, size);
+        putBytes(&mSampleData, nal, size);
+    });
+    return mSampleData.size() - before;
+}
+
+void FragmentedMp4Recorder::onPacket(const uint8_t* data, size_t length,
+                                     uint32_t flags, int64_t ptsUs) {
+    std::lock_guard<std::mutex> lk(mLock);
+    if (mClosed || data == nullptr || length == 0) {
+        return;
+    }
+    // the slices of a low delay encode are gathered into one sample
+    if (mPartialDone) {
+        mPartialData.clear();
+        mPartialFlags = 0;
+        mPartialDone = false;
+    }
+    if (flags & PacketBufferPool::kFlagPartialFrame) {
+        mPartialData.insert(mPartialData.end(), data, data + length);
+        mPartialFlags |= flags;
+        return;
+    }
+    if (!mPartialData.empty()) {
+        mPartialData.insert(mPartialData.end(), data, data + length);
+        data = mPartialData.data();
+        length = mPartialData.size();
+        flags |= mPartialFlags & PacketBufferPool::kFlagKeyFrame;
+        mPartialDone = true;
+    }
+    parseParameterSets(data, length);
+    bool keyFrame = isKeyFrame(data, length, flags);
+    if ((flags & PacketBufferPool::kFlagCodecConfig) && !keyFrame) {
+        return;
+    }
+
+    if (mFd < 0) {
+        bool haveParameterSets = !mSps.empty() && !mPps.empty() &&
+                                 (mCodec != CODEC_HEVC || !mVps.empty());
+        if (!keyFrame || !haveParameterSets || openSegment(ptsUs)) {
+            mDroppedPackets++;
+            return;
+        }
+    } else if (keyFrame && !mSamples.empty()) {
+        bool rotate =
+            (mSegmentDurationUs > 0 &&
+             ptsUs - mSegmentStartUs >= mSegmentDurationUs) ||
+            (mSegmentBytes > 0 && mSegmentFileBytes + (int64_t)mSampleData.size() >=
+                                      mSegmentBytes);
+        if (rotate) {
+            closeSegment(ptsUs);
+            if (openSegment(ptsUs)) {
+                mDroppedPackets++;
+                return;
+            }
+        } else {
+            writeFragment(ptsUs);
+        }
+    }
+
+    size_t offset = mSampleData.size();
+    size_t size = appendSample(data, length);
+    if (size == 0) {
+        return;
+    }
+    mSamples.push_back({offset, (uint32_t)size, ptsUs, keyFrame});
+}
+
+int FragmentedMp4Recorder::close() {
+    std::lock_guard<std::mutex> lk(mLock);
+    if (mClosed) {
+        return 0;
+    }
+    mClosed = true;
+    return closeSegment(-1);
+}
+
+int FragmentedMp4Recorder::openSegment(int64_t startUs) {
+    if (mWriteBuffer == nullptr) {
+        return -ENOMEM;
+    }
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s_%d.mp4", mPathPrefix.c_str(),
+             mSegmentCount);
+    mFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (mFd < 0) {
+        ALOGE("%s   open %s failed errno: %s", __func__, path, strerror(errno));
+        return -errno;
+    }
+    ALOGI("%s   %s", __func__, path);
+    mSegmentCount++;
+    mSegmentStartUs = startUs;
+    mSegmentFileBytes = 0;
+    mFragmentSequence = 0;
+    mWriteLength = 0;
+    writeInitSegment();
+    return 0;
+}
+
+int FragmentedMp4Recorder::closeSegment(int64_t endPtsUs) {
+    if (mFd < 0) {
+        return 0;
+    }
+    if (!mSamples.empty()) {
+        writeFragment(endPtsUs);
+    }
+    int ret = flushFile();
+    fdatasync(mFd);
+    ::close(mFd);
+    mFd = -1;
+    ALOGI("%s   segment: %d bytes: %lld", __func__, mSegmentCount - 1,
+          (long long)mSegmentFileBytes);
+    return ret;
+}
+
+int64_t FragmentedMp4Recorder::toTicks(int64_t ptsUs) const {
+    return (ptsUs - mSegmentStartUs) * kTimescale / 1000000;
+}
+
+void FragmentedMp4Recorder::writeSampleEntry(std::vector<uint8_t>* out) {
+    size_t entry = beginBox(out, mCodec == CODEC_HEVC ? "hvc1" : "avc1");
+    for (int i = 0; i < 6; i++) {
+        put8(out, 0);
+    }
+    put16(out, 1);  // data_reference_index
+    put16(out, 0);
+    put16(out, 0);
+    put32(out, 0);
+    put32(out, 0);
+    put32(out, 0);
+    put16(out, mWidth);
+    put16(out, mHeight);
+    put32(out, 0x00480000);  // 72 dpi
+    put32(out, 0x00480000);
+    put32(out, 0);
+    put16(out, 1);  // frame_count
+    for (int i = 0; i < 32; i++) {
+        put8(out, 0);  // compressorname
+    }
+    put16(out, 0x0018);
+    put16(out, 0xffff);
+
+    if (mCodec == CODEC_HEVC) {
+        std::vector<uint8_t> sps = toRbsp(mSps);
+        // NAL header, then vps id, max_sub_layers_minus1 and the nesting
+        // flag, then the 12 bytes of general profile_tier_level
+        uint8_t ptl[12] = {0};
+        uint8_t subLayers = 0;
+        if (sps.size() >= 15) {
+            subLayers = sps[2];
+            memcpy(ptl, &sps[3], sizeof(ptl));
+        }
+        size_t config = beginBox(out, "hvcC");
+        put8(out, 1);
+        putBytes(out, ptl, 1 + 4 + 6);  // profile, compatibility, constraints
+        put8(out, ptl[11]);             // level_idc
+        put16(out, 0xf000);             // min_spatial_segmentation_idc
+        put8(out, 0xfc);                // parallelismType
+        // the encoders are fed NV12, 4:2:0 at 8 bits
+        put8(out, 0xfc | 1);
+        put8(out, 0xf8);
+        put8(out, 0xf8);
+        put16(out, 0);  // avgFrameRate
+        put8(out, (((subLayers >> 1) & 0x7) + 1) << 3 | (subLayers & 1) << 2 | 3);
+        put8(out, 3);
+        const std::vector<uint8_t>* sets[3] = {&mVps, &mSps, &mPps};
+        const int types[3] = {kHevcVps, kHevcSps, kHevcPps};
+        for (int i = 0; i < 3; i++) {
+            put8(out, 0x80 | types[i]);  // array_completeness
+            put16(out, 1);
+            put16(out, sets[i]->size());
+            putBytes(out, sets[i]->data(), sets[i]->size());
+        }
+        endBox(out, config);
+    } else {
+        size_t config = beginBox(out, "avcC");
+        put8(out, 1);
+        put8(out, mSps.size() > 1 ? mSps[1] : 0);  // profile
+        put8(out, mSps.size() > 2 ? mSps[2] : 0);  // compatibility
+        put8(out, mSps.size() > 3 ? mSps[3] : 0);  // level
+        put8(out, 0xfc | 3);
+        put8(out, 0xe0 | 1);
+        put16(out, mSps.size());
+        putBytes(out, mSps.data(), mSps.size());
+        put8(out, 1);
+        put16(out, mPps.size());
+        putBytes(out, mPps.data(), mPps.size());
+        endBox(out, config);
+    }
+    endBox(out, entry);
+}
+
+void FragmentedMp4Recorder::writeInitSegment() {
+    std::vector<uint8_t> out;
+    size_t box = beginBox(&out, "ftyp");
+    putBytes(&out, (const uint8_t*)"iso5", 4);
+    put32(&out, 512);
+    putBytes(&out, (const uint8_t*)"iso5iso6mp41", 12);
+    endBox(&out, box);
+
+    size_t moov = beginBox(&out, "moov");
+    box = beginFullBox(&out, "mvhd", 0, 0);
+    put32(&out, 0);
+    put32(&out, 0);
+    put32(&out, 1000);
+    put32(&out, 0);
+    put32(&out, 0x00010000);  // rate
+    put16(&out, 0x0100);      // volume
+    put16(&out, 0);
+    put32(&out, 0);
+    put32(&out, 0);
+    putMatrix(&out);
+    for (int i = 0; i < 6; i++) {
+        put32(&out, 0);
+    }
+    put32(&out, 2);  // next_track_ID
+    endBox(&out, box);
+
+    size_t trak = beginBox(&out, "trak");
+    box = beginFullBox(&out, "tkhd", 0, 3);  // enabled, in movie
+    put32(&out, 0);
+    put32(&out, 0);
+    put32(&out, 1);  // track_ID
+    put32(&out, 0);
+    put32(&out, 0);
+    put32(&out, 0);
+    put32(&out, 0);
+    put16(&out, 0);
+    put16(&out, 0);
+    put16(&out, 0);
+    put16(&out, 0);
+    putMatrix(&out);
+    put32(&out, (uint32_t)mWidth << 16);
+    put32(&out, (uint32_t)mHeight << 16);
+    endBox(&out, box);
+
+    size_t mdia = beginBox(&out, "mdia");
+    box = beginFullBox(&out, "mdhd", 0, 0);
+    put32(&out, 0);
+    put32(&out, 0);
+    put32(&out, kTimescale);
+    put32(&out, 0);
+    put16(&out, 0x55c4);  // und
+    put16(&out, 0);
+    endBox(&out, box);
+
+    box = beginFullBox(&out, "hdlr", 0, 0);
+    put32(&out, 0);
+    putBytes(&out, (const uint8_t*)"vide", 4);
+    put32(&out, 0);
+    put32(&out, 0);
+    put32(&out, 0);
+    putBytes(&out, (const uint8_t*)"VideoHandler", 13);
+    endBox(&out, box);
+
+    size_t minf = beginBox(&out, "minf");
+    box = beginFullBox(&out, "vmhd", 0, 1);
+    put16(&out, 0);
+    put16(&out, 0);
+    put16(&out, 0);
+    put16(&out, 0);
+    endBox(&out, box);
+
+    size_t dinf = beginBox(&out, "dinf");
+    size_t dref = beginFullBox(&out, "dref", 0, 0);
+    put32(&out, 1);
+    box = beginFullBox(&out, "url ", 0, 1);  // media in this file
+    endBox(&out, box);
+    endBox(&out, dref);
+    endBox(&out, dinf);
+
+    // the samples are all in the fragments
+    size_t stbl = beginBox(&out, "stbl");
+    box = beginFullBox(&out, "stsd", 0, 0);
+    put32(&out, 1);
+    writeSampleEntry(&out);
+    endBox(&out, box);
+    box = beginFullBox(&out, "stts", 0, 0);
+    put32(&out, 0);
+    endBox(&out, box);
+    box = beginFullBox(&out, "stsc", 0, 0);
+    put32(&out, 0);
+    endBox(&out, box);
+    box = beginFullBox(&out, "stsz", 0, 0);
+    put32(&out, 0);
+    put32(&out, 0);
+    endBox(&out, box);
+    box = beginFullBox(&out, "stco", 0, 0);
+    put32(&out, 0);
+    endBox(&out, box);
+    endBox(&out, stbl);
+    endBox(&out, minf);
+    endBox(&out, mdia);
+    endBox(&out, trak);
+
+    size_t mvex = beginBox(&out, "mvex");
+    box = beginFullBox(&out, "trex", 0, 0);
+    put32(&out, 1);  // track_ID
+    put32(&out, 1);  // default_sample_description_index
+    put32(&out, 0);
+    put32(&out, 0);
+    put32(&out, 0);
+    endBox(&out, box);
+    endBox(&out, mvex);
+    endBox(&out, moov);
+
+    writeFile(out.data(), out.size());
+}
+
+void FragmentedMp4Recorder::writeFragment(int64_t endPtsUs) {
+    static const uint32_t kSyncSample = 0x02000000;      // depends on none
+    static const uint32_t kNonSyncSample = 0x01010000;   // depends, non sync
+
+    std::vector<uint8_t> out;
+    size_t moof = beginBox(&out, "moof");
+    size_t box = beginFullBox(&out, "mfhd", 0, 0);
+    put32(&out, ++mFragmentSequence);
+    endBox(&out, box);
+
+    size_t traf = beginBox(&out, "traf");
+    box = beginFullBox(&out, "tfhd", 0, 0x020000);  // default-base-is-moof
+    put32(&out, 1);
+    endBox(&out, box);
+    box = beginFullBox(&out, "tfdt", 1, 0);
+    put64(&out, toTicks(mSamples[0].ptsUs));
+    endBox(&out, box);
+
+    // data offset, duration, size and flags per sample
+    box = beginFullBox(&out, "trun", 0, 0x000001 | 0x000100 | 0x000200 | 0x000400);
+    put32(&out, mSamples.size());
+    size_t dataOffset = out.size();
+    put32(&out, 0);
+    for (size_t i = 0; i < mSamples.size(); i++) {
+        const Sample& sample = mSamples[i];
+        int64_t duration = -1;
+        if (i + 1 < mSamples.size()) {
+            duration = toTicks(mSamples[i + 1].ptsUs) - toTicks(sample.ptsUs);
+        } else if (endPtsUs >= 0) {
+            duration = toTicks(endPtsUs) - toTicks(sample.ptsUs);
+        }
+        if (duration <= 0) {
+            duration = mLastDurationTicks > 0 ? mLastDurationTicks : kTimescale / 30;
+        }
+        mLastDurationTicks = duration;
+        put32(&out, duration);
+        put32(&out, sample.size);
+        put32(&out, sample.keyFrame ? kSyncSample : kNonSyncSample);
+    }
+    endBox(&out, box);
+    endBox(&out, traf);
+    endBox(&out, moof);
+    patch32(&out, dataOffset, out.size() + 8);
+
+    put32(&out, 8 + mSampleData.size());
+    putBytes(&out, (const uint8_t*)"mdat", 4);
+    if (writeFile(out.data(), out.size()) ||
+        writeFile(mSampleData.data(), mSampleData.size())) {
+        mDroppedPackets += mSamples.size();
+    }
+    mSamples.clear();
+    mSampleData.clear();
+}
+
+int FragmentedMp4Recorder::writeFile(const uint8_t* data, size_t length) {
+    mSegmentFileBytes += length;
+    while (length > 0) {
+        size_t chunk = kWriteBufferSize - mWriteLength;
+        if (chunk > length) {
+            chunk = length;
+        }
+        memcpy(mWriteBuffer + mWriteLength, data, chunk);
+        mWriteLength += chunk;
+        data += chunk;
+        length -= chunk;
+        if (mWriteLength == kWriteBufferSize) {
+            int ret = flushFile();
+            if (ret) {
+                return ret;
+            }
+        }
+    }
+    return 0;
+}
+
+int FragmentedMp4Recorder::flushFile() {
+    size_t written = 0;
+    while (written < mWriteLength) {
+        ssize_t ret = write(mFd, mWriteBuffer + written, mWriteLength - written);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ALOGE("%s   write failed errno: %s", __func__, strerror(errno));
+            mWriteLength = 0;
+            return -errno;
+        }
+        written += ret;
+    }
+    mWriteLength = 0;
+    return 0;
+}
@@ -0,0 +1,142 @@
+#ifndef CAPTUREENCODER_FRAGMENTEDMP4RECORDER_H
+#define CAPTUREENCODER_FRAGMENTEDMP4RECORDER_H
+
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "IPacketSink.h"
+
+// Records an HEVC or H.264 packet stream natively into fragmented MP4, so
+// recording no longer takes every packet through JNI. hvcC/avcC are built
+// from the in-band parameter sets, sample times are the packet pts on a
+// 90 kHz timescale. Every key frame starts a fragment (moof + mdat), and
+// once a segment is past its duration or size the next key frame starts a
+// new file with its own init segment. Files are written through a large
+// aligned buffer, whole buffers at a time.
+//
+// No JNI or codec in here, it can be fed from a recorded bitstream on a
+// host just as well.
+class FragmentedMp4Recorder : public IPacketSink {
+public:
+    enum Codec {
+        CODEC_HEVC = 0,
+        CODEC_H264,
+    };
+
+    // segments go to <pathPrefix>_<index>.mp4, a limit of 0 is no limit
+    FragmentedMp4Recorder(Codec codec, int width, int height,
+                          const std::string& pathPrefix,
+                          int64_t segmentDurationUs, int64_t segmentBytes);
+
+    ~FragmentedMp4Recorder();
+
+    void onPacket(const uint8_t* data, size_t length, uint32_t flags,
+                  int64_t ptsUs) override;
+
+    // writes out what is pending and closes the segment, later packets are
+    // dropped
+    int close();
+
+    int getSegmentCount();
+
+    // packets dropped before the first key frame with parameter sets, or on
+    // write errors
+    int64_t getDroppedPackets();
+
+private:
+    struct Sample {
+        size_t offset;
+        uint32_t size;
+        int64_t ptsUs;
+        bool keyFrame;
+    };
+
+    void parseParameterSets(const uint8_t* data, size_t length);
+
+    bool isKeyFrame(const uint8_t* data, size_t length, uint32_t flags);
+
+    // appends the packet as 4 byte length prefixed NAL units without
+    // parameter sets and delimiters, returns the bytes appended
+    size_t appendSample(const uint8_t* data, size_t length);
+
+    int openSegment(int64_t startUs);
+
+    int closeSegment(int64_t endPtsUs);
+
+    void writeInitSegment();
+
+    void writeSampleEntry(std::vector<uint8_t>* out);
+
+    // moof + mdat of the pending samples, the last one lasting until
+    // endPtsUs, or as long as the one before when endPtsUs is negative
+    void writeFragment(int64_t endPtsUs);
+
+    int writeFile(const uint8_t* data, size_t length);
+
+    // writes out what the buffer holds, a short write only at segment end
+    int flushFile();
+
+    int64_t toTicks(int64_t ptsUs) const;
+
+    static const int kTimescale = 90000;
+
+    static const size_t kWriteBufferSize = 1024 * 1024;
+
+    static const size_t kWriteAlign = 4096;
+
+    Codec mCodec;
+
+    int mWidth;
+
+    int mHeight;
+
+    std::string mPathPrefix;
+
+    int64_t mSegmentDurationUs;
+
+    int64_t mSegmentBytes;
+
+    std::mutex mLock;
+
+    bool mClosed = false;
+
+    std::vector<uint8_t> mVps;
+
+    std::vector<uint8_t> mSps;
+
+    std::vector<uint8_t> mPps;
+
+    int mFd = -1;
+
+    int mSegmentCount = 0;
+
+    int64_t mSegmentStartUs = 0;
+
+    int64_t mSegmentFileBytes = 0;
+
+    uint32_t mFragmentSequence = 0;
+
+    int64_t mLastDurationTicks = 0;
+
+    int64_t mDroppedPackets = 0;
+
+    // slices of the frame being received, the last one completes it
+    std::vector<uint8_t> mPartialData;
+
+    uint32_t mPartialFlags = 0;
+
+    bool mPartialDone = false;
+
+    std::vector<Sample> mSamples;
+
+    std::vector<uint8_t> mSampleData;
+
+    uint8_t* mWriteBuffer = nullptr;
+
+    size_t mWriteLength = 0;
+};
+
+#endif  // CAPTUREENCODER_FRAGMENTEDMP4RECORDER_H
@@ -0,0 +1,121 @@
+#ifndef CAPTUREENCODER_FRAMECADENCE_H
+#define CAPTUREENCODER_FRAMECADENCE_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+// Picks which capture frames a consumer running at a lower rate takes, for
+// any rational ratio (60 -> 25, 59.94 -> 30). This is the Bresenham
+// accumulator in closed form: frame n is taken when the accumulated
+// out/in rate crosses an integer between n and n + 1. Being a function of
+// the sequence number alone it can be asked from any thread, and driver
+// drops simply advance it.
+class FrameCadence {
+public:
+    // rates as num/den frames per second, an output at or above the input
+    // rate takes every frame
+    void setRates(uint32_t inNum, uint32_t inDen, uint32_t outNum,
+                  uint32_t outDen) {
+        mInNum = inNum;
+        mInDen = inDen;
+        setOutputRate(outNum, outDen);
+        mHasAnchor = false;
+    }
+
+    // Changes the output rate of a running consumer. The rate is one atomic
+    // word, so wants() never sees half of an update, and the consuming unit
+    // re-anchors its timestamp grid on the next evenPtsUs().
+    void setOutputRate(uint32_t outNum, uint32_t outDen) {
+        mOutRate.store((uint64_t)outNum << 32 | outDen,
+                       std::memory_order_release);
+    }
+
+    bool takesEveryFrame() const {
+        return takesEveryFrame(mOutRate.load(std::memory_order_acquire));
+    }
+
+    bool wants(uint32_t sequence) const {
+        uint64_t rate = mOutRate.load(std::memory_order_acquire);
+        if (takesEveryFrame(rate)) {
+            return true;
+        }
+        uint64_t step = (rate >> 32) * mInDen;
+        uint64_t threshold = (uint64_t)mInNum * (uint32_t)rate;
+        return ((uint64_t)sequence + 1) * step / threshold !=
+               (uint64_t)sequence * step / threshold;
+    }
+
+    // Timestamp for a taken frame on an even grid at the output rate. The
+    // taken frames themselves are 2 or 3 capture periods apart for 60 -> 25,
+    // the grid smooths that out. Each frame gets the grid point nearest to
+    // its capture time, so capture jitter does not move it and a frame
+    // dropped before the unit leaves its gap right away. The grid never
+    // repeats a point and is re-anchored on the capture clock when the
+    // capture time falls more than one output period behind it. Only
+    // called by the consuming unit.
+    int64_t evenPtsUs(int64_t captureUs) {
+        uint64_t rate = mOutRate.load(std::memory_order_acquire);
+        if (takesEveryFrame(rate)) {
+            return captureUs;
+        }
+        if (rate != mGridRate) {
+            mGridRate = rate;
+            mOutNum = rate >> 32;
+            mOutDen = (uint32_t)rate;
+            mHasAnchor = false;
+        }
+        int64_t periodUs = 1000000LL * mOutDen / mOutNum;
+        int64_t index = 0;
+        if (mHasAnchor && captureUs >= mAnchorUs) {
+            // round((captureUs - mAnchorUs) / period) on the exact period
+            index = (2 * (captureUs - mAnchorUs) * mOutNum + 1000000LL * mOutDen) /
+                    (2000000LL * mOutDen);
+            if (index < mGridIndex) {
+                index = mGridIndex;
+            }
+        }
+        if (!mHasAnchor || captureUs < mAnchorUs ||
+            gridPtsUs(index) - captureUs > periodUs) {
+            mAnchorUs = captureUs;
+            mHasAnchor = true;
+            index = 0;
+        }
+        mGridIndex = index + 1;
+        return gridPtsUs(index);
+    }
+
+private:
+    bool takesEveryFrame(uint64_t rate) const {
+        uint64_t step = (rate >> 32) * mInDen;
+        uint64_t threshold = (uint64_t)mInNum * (uint32_t)rate;
+        return step == 0 || threshold == 0 || step >= threshold;
+    }
+
+    int64_t gridPtsUs(int64_t index) const {
+        return mAnchorUs + index * 1000000LL * mOutDen / mOutNum;
+    }
+
+    uint32_t mInNum = 0;
+
+    uint32_t mInDen = 1;
+
+    // outNum << 32 | outDen
+    std::atomic<uint64_t> mOutRate{0};
+
+    // the rate the timestamp grid was laid out for
+    uint64_t mGridRate = 0;
+
+    uint32_t mOutNum = 0;
+
+    uint32_t mOutDen = 1;
+
+    bool mHasAnchor = false;
+
+    int64_t mAnchorUs = 0;
+
+    // grid point after the last one handed out
+    int64_t mGridIndex = 0;
+};
+
+#endif  // CAPTUREENCODER_FRAMECADENCE_H
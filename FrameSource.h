@@ -0,0 +1,68 @@
+#ifndef CAPTUREENCODER_FRAMESOURCE_H
+#define CAPTUREENCODER_FRAMESOURCE_H
+
+#include <stdint.h>
+#include <utils/RefBase.h>
+
+#include "V4l2Buffer.h"
+
+using namespace android;
+
+// Producer of raw capture frames. CaptureModel only talks to a FrameSource,
+// so the fan-out can run on a V4L2 device or on a synthetic in-memory source.
+class FrameSource : public RefBase {
+public:
+    struct Frame {
+        int index;
+        void* start;
+        uint32_t bytesUsed;
+        // capture time on CLOCK_MONOTONIC
+        int64_t timestampUs;
+        // increments once per frame the source produced, gaps are drops
+        uint32_t sequence;
+    };
+
+    FrameSource() {}
+
+    virtual ~FrameSource() {}
+
+    virtual int open() = 0;
+
+    // select the capture format and geometry closest to the request
+    virtual int negotiate(int width, int height, int fps) = 0;
+
+    // allocate, map and export the buffers, queue them and start streaming
+    virtual int start() = 0;
+
+    virtual int stop() = 0;
+
+    virtual void close() = 0;
+
+    // fd that becomes readable when a frame can be dequeued
+    virtual int getPollFd() = 0;
+
+    virtual int dequeue(Frame* frame) = 0;
+
+    virtual int requeue(int index) = 0;
+
+    virtual int exportFd(int index) = 0;
+
+    // number of buffers to allocate on the next start()
+    virtual int setBufferCount(int count) = 0;
+
+    virtual int getBufferCount() = 0;
+
+    // add buffers to a running stream, returns how many were added
+    virtual int growBuffers(int count) = 0;
+
+    virtual uint32_t getWidth() = 0;
+
+    virtual uint32_t getHeight() = 0;
+
+    virtual uint32_t getFormat() = 0;
+
+    // capture rate as num/den frames per second, valid once started
+    virtual void getFrameRate(uint32_t* num, uint32_t* den) = 0;
+};
+
+#endif  // CAPTUREENCODER_FRAMESOURCE_H
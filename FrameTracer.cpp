@@ -0,0 +1,336 @@
+#define LOG_TAG "NativeFrameTracer"
+
+#include "FrameTracer.h"
+
+#include <errno.h>
+#include <log/log.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+#include <utils/Thread.h>
+
+using namespace android;
+
+static const char* sStageNames[FrameTracer::STAGE_COUNT] = {
+    "DQBUF",   "DISPATCH", "RGA_BLIT",    "PREVIEW_POST",
+    "CODEC_QUEUE", "MPP_PUT",  "MPP_GET", "JNI_DELIVER",
+};
+
+static int sSignalFd = -1;
+
+static void onDumpSignal(int) {
+    uint64_t one = 1;
+    write(sSignalFd, &one, sizeof(one));
+}
+
+// writing the dump takes a while, the capture threads must not wait on it
+class SignalDumpThread : public Thread {
+public:
+    explicit SignalDumpThread(const std::string& path)
+        : Thread(false), mPath(path) {}
+
+private:
+    bool threadLoop() override {
+        uint64_t count = 0;
+        if (read(sSignalFd, &count, sizeof(count)) != sizeof(count)) {
+            if (errno == EINTR) {
+                return true;
+            }
+            ALOGE("%s   read failed: %s", __func__, strerror(errno));
+            return false;
+        }
+        FrameTracer::getInstance().dumpChromeTrace(mPath.c_str());
+        return true;
+    }
+
+    std::string mPath;
+};
+
+static sp<SignalDumpThread> sSignalDumpThread;
+
+class ThreadRingOwner {
+public:
+    ~ThreadRingOwner() {
+        if (mRing) {
+            FrameTracer::getInstance().releaseThreadRing(mRing);
+        }
+    }
+
+    FrameTracer::Ring* mRing = nullptr;
+};
+
+static thread_local ThreadRingOwner sRingOwner;
+
+FrameTracer& FrameTracer::getInstance() {
+    static FrameTracer sInstance;
+    return sInstance;
+}
+
+FrameTracer::FrameTracer() {
+    for (int i = 0; i < kMaxConsumers; i++) {
+        for (int b = 0; b < kBuckets; b++) {
+            mHistograms[i].buckets[b].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+FrameTracer::~FrameTracer() {
+    // rings may still be referenced by exiting threads, leave them to the
+    // process teardown
+}
+
+void FrameTracer::setEnabled(bool enabled) {
+    ALOGI("%s   enabled: %d", __func__, enabled);
+    mEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+int FrameTracer::registerConsumer(const char* name) {
+    std::lock_guard<std::mutex> lk(mRingLock);
+    int count = mConsumerCount.load(std::memory_order_relaxed);
+    // units are recreated for every capture session, a fresh slot first so
+    // the last sessions stay in the dumps as long as possible
+    int consumer = count < kMaxConsumers ? count : -1;
+    for (int i = 0; consumer < 0 && i < count; i++) {
+        if (!mHistograms[i].inUse) {
+            consumer = i;
+        }
+    }
+    if (consumer < 0) {
+        ALOGE("%s   too many consumers, %s not traced", __func__, name);
+        return -1;
+    }
+    Histogram& h = mHistograms[consumer];
+    for (int b = 0; b < kBuckets; b++) {
+        h.buckets[b].store(0, std::memory_order_relaxed);
+    }
+    char label[64];
+    snprintf(label, sizeof(label), "%s #%d", name, ++mRegistrations);
+    h.name = label;
+    h.inUse = true;
+    if (consumer == count) {
+        mConsumerCount.store(count + 1, std::memory_order_release);
+    }
+    ALOGI("%s   consumer: %d name: %s", __func__, consumer, label);
+    return consumer;
+}
+
+void FrameTracer::unregisterConsumer(int consumer) {
+    std::lock_guard<std::mutex> lk(mRingLock);
+    if (consumer >= 0 && consumer < mConsumerCount.load(std::memory_order_relaxed)) {
+        mHistograms[consumer].inUse = false;
+    }
+}
+
+FrameTracer::Ring* FrameTracer::getThreadRing() {
+    if (sRingOwner.mRing) {
+        return sRingOwner.mRing;
+    }
+    std::lock_guard<std::mutex> lk(mRingLock);
+    Ring* ring = nullptr;
+    for (Ring* r : mRings) {
+        if (!r->inUse.load(std::memory_order_relaxed)) {
+            ring = r;
+            break;
+        }
+    }
+    if (ring == nullptr) {
+        ring = new Ring();
+        mRings.push_back(ring);
+    }
+    ring->inUse.store(true, std::memory_order_relaxed);
+    char name[17] = {0};
+    prctl(PR_GET_NAME, name);
+    mThreadNames[gettid()] = name;
+    sRingOwner.mRing = ring;
+    return ring;
+}
+
+void FrameTracer::releaseThreadRing(Ring* ring) {
+    ring->inUse.store(false, std::memory_order_release);
+}
+
+void FrameTracer::record(Stage stage, uint32_t sequence, int consumer,
+                         nsecs_t startNs, nsecs_t endNs, int64_t ptsUs) {
+    if (!isEnabled()) {
+        return;
+    }
+    static thread_local int32_t sTid = gettid();
+    Ring* ring = getThreadRing();
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    Event& e = ring->events[head & (kRingSize - 1)];
+    e.startNs = startNs;
+    e.endNs = endNs;
+    e.ptsUs = ptsUs;
+    e.sequence = sequence;
+    e.tid = sTid;
+    e.stage = stage;
+    e.consumer = consumer;
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+int FrameTracer::bucketOf(uint64_t us) {
+    if (us < kSubBuckets) {
+        return us;
+    }
+    int msb = 63 - __builtin_clzll(us);
+    int shift = msb - 3;
+    int bucket = (msb - 2) * kSubBuckets + ((us >> shift) & (kSubBuckets - 1));
+    return bucket < kBuckets ? bucket : kBuckets - 1;
+}
+
+uint64_t FrameTracer::bucketUpperUs(int bucket) {
+    if (bucket < kSubBuckets) {
+        return bucket;
+    }
+    int shift = bucket / kSubBuckets - 1;
+    uint64_t lower = (uint64_t)(kSubBuckets + bucket % kSubBuckets) << shift;
+    return lower + (1ull << shift) - 1;
+}
+
+uint64_t FrameTracer::percentile(const uint64_t* buckets, uint64_t count,
+                                 double p) {
+    uint64_t rank = (uint64_t)(p * count);
+    if (rank >= count) {
+        rank = count - 1;
+    }
+    uint64_t seen = 0;
+    for (int b = 0; b < kBuckets; b++) {
+        seen += buckets[b];
+        if (seen > rank) {
+            return bucketUpperUs(b);
+        }
+    }
+    return bucketUpperUs(kBuckets - 1);
+}
+
+void FrameTracer::recordLatency(int consumer, int64_t captureUs) {
+    if (!isEnabled() || consumer < 0 ||
+        consumer >= mConsumerCount.load(std::memory_order_acquire)) {
+        return;
+    }
+    int64_t latencyUs = systemTime(SYSTEM_TIME_MONOTONIC) / 1000 - captureUs;
+    Histogram& h = mHistograms[consumer];
+    h.buckets[bucketOf(latencyUs > 0 ? latencyUs : 0)].fetch_add(
+        1, std::memory_order_relaxed);
+}
+
+int FrameTracer::dumpChromeTrace(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == nullptr) {
+        ALOGE("%s   open %s failed: %s", __func__, path, strerror(errno));
+        return -errno;
+    }
+
+    std::vector<Ring*> rings;
+    std::map<int, std::string> threadNames;
+    std::vector<std::string> consumerNames;
+    {
+        std::lock_guard<std::mutex> lk(mRingLock);
+        rings = mRings;
+        threadNames = mThreadNames;
+        int consumers = mConsumerCount.load(std::memory_order_relaxed);
+        for (int i = 0; i < consumers; i++) {
+            consumerNames.push_back(mHistograms[i].name);
+        }
+    }
+
+    int pid = getpid();
+    int written = 0;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (const auto& pair : threadNames) {
+        fprintf(file,
+                "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,"
+                "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                written++ ? ",\n" : "", pid, pair.first, pair.second.c_str());
+    }
+
+    std::vector<Event> events(kRingSize);
+    for (Ring* ring : rings) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t first = head > kRingSize ? head - kRingSize : 0;
+        for (uint64_t i = first; i < head; i++) {
+            events[i - first] = ring->events[i & (kRingSize - 1)];
+        }
+        // anything the writer lapped while we copied is torn, skip it
+        uint64_t after = ring->head.load(std::memory_order_acquire);
+        uint64_t valid = after >= kRingSize ? after - kRingSize + 1 : 0;
+        for (uint64_t i = first > valid ? first : valid; i < head; i++) {
+            const Event& e = events[i - first];
+            const char* consumer =
+                e.consumer >= 0 && e.consumer < (int)consumerNames.size()
+                    ? consumerNames[e.consumer].c_str()
+                    : "";
+            fprintf(file,
+                    "%s{\"name\":\"%s\",\"cat\":\"frame\",\"ph\":\"X\","
+                    "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+                    "\"args\":{\"seq\":%lld,\"ptsUs\":%lld,\"consumer\":\"%s\"}}",
+                    written++ ? ",\n" : "", sStageNames[e.stage],
+                    e.startNs / 1000.0, (e.endNs - e.startNs) / 1000.0, pid,
+                    e.tid,
+                    e.sequence == kNoSequence ? -1LL : (long long)e.sequence,
+                    (long long)e.ptsUs, consumer);
+        }
+    }
+
+    fprintf(file, "\n],\"otherData\":{");
+    for (size_t i = 0; i < consumerNames.size(); i++) {
+        uint64_t buckets[kBuckets];
+        uint64_t count = 0;
+        for (int b = 0; b < kBuckets; b++) {
+            buckets[b] = mHistograms[i].buckets[b].load(std::memory_order_relaxed);
+            count += buckets[b];
+        }
+        uint64_t p50 = count ? percentile(buckets, count, 0.50) : 0;
+        uint64_t p99 = count ? percentile(buckets, count, 0.99) : 0;
+        uint64_t p999 = count ? percentile(buckets, count, 0.999) : 0;
+        fprintf(file,
+                "%s\"%s\":\"count=%llu p50=%lluus p99=%lluus p999=%lluus\"",
+                i ? "," : "", consumerNames[i].c_str(),
+                (unsigned long long)count, (unsigned long long)p50,
+                (unsigned long long)p99, (unsigned long long)p999);
+        ALOGI("%s   %s latency count: %llu p50: %lluus p99: %lluus p999: %lluus",
+              __func__, consumerNames[i].c_str(), (unsigned long long)count,
+              (unsigned long long)p50, (unsigned long long)p99,
+              (unsigned long long)p999);
+    }
+    fprintf(file, "}}\n");
+    fclose(file);
+    ALOGI("%s   %d events written to %s", __func__, written, path);
+    return written;
+}
+
+int FrameTracer::installSignalHandler(const char* path) {
+    std::lock_guard<std::mutex> lk(mRingLock);
+    if (sSignalFd >= 0) {
+        return 0;
+    }
+    sSignalFd = eventfd(0, EFD_CLOEXEC);
+    if (sSignalFd < 0) {
+        ALOGE("%s   eventfd failed: %s", __func__, strerror(errno));
+        return -errno;
+    }
+    sSignalDumpThread = new SignalDumpThread(path);
+    status_t ret = sSignalDumpThread->run("FrameTraceDump");
+    if (ret != NO_ERROR) {
+        ALOGE("%s   dump thread failed: %d", __func__, ret);
+        sSignalDumpThread.clear();
+        close(sSignalFd);
+        sSignalFd = -1;
+        return ret < 0 ? ret : -EAGAIN;
+    }
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = onDumpSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGUSR2, &action, NULL)) {
+        ALOGE("%s   sigaction failed: %s", __func__, strerror(errno));
+        return -errno;
+    }
+    ALOGI("%s   kill -USR2 %d dumps to %s", __func__, getpid(), path);
+    return 0;
+}
@@ -0,0 +1,166 @@
+#ifndef CAPTUREENCODER_FRAMETRACER_H
+#define CAPTUREENCODER_FRAMETRACER_H
+
+#include <stdint.h>
+#include <utils/Timers.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Always-on per-frame stage tracing. Every thread writes complete events
+// (stage, frame sequence, start, duration) into its own ring without locks,
+// a dump walks all rings and writes Chrome trace JSON that Perfetto opens.
+// Capture-to-delivery latency is kept per consumer in log-linear histograms.
+class FrameTracer {
+public:
+    enum Stage {
+        STAGE_DQBUF = 0,
+        STAGE_DISPATCH,
+        STAGE_RGA_BLIT,
+        STAGE_PREVIEW_POST,
+        STAGE_CODEC_QUEUE,
+        STAGE_MPP_PUT,
+        STAGE_MPP_GET,
+        STAGE_JNI_DELIVER,
+        STAGE_COUNT
+    };
+
+    static const uint32_t kNoSequence = 0xffffffffu;
+
+    static const int kMaxConsumers = 16;
+
+    static FrameTracer& getInstance();
+
+    FrameTracer();
+
+    ~FrameTracer();
+
+    void setEnabled(bool enabled);
+
+    bool isEnabled() const { return mEnabled.load(std::memory_order_relaxed); }
+
+    // Returns an id for recordLatency(), every call gets its own histogram
+    // so units of the same name keep apart. The name shows up in the dump
+    // with the registration number.
+    int registerConsumer(const char* name);
+
+    // the consumer is gone, its histogram stays in the dumps until a new
+    // consumer takes the slot over
+    void unregisterConsumer(int consumer);
+
+    void record(Stage stage, uint32_t sequence, int consumer, nsecs_t startNs,
+                nsecs_t endNs, int64_t ptsUs = 0);
+
+    // latency from the capture timestamp to the moment the consumer handed
+    // the frame on, both on CLOCK_MONOTONIC
+    void recordLatency(int consumer, int64_t captureUs);
+
+    int dumpChromeTrace(const char* path);
+
+    // SIGUSR2 dumps to path, the handler only pokes an eventfd and the file
+    // is written on a thread of its own
+    int installSignalHandler(const char* path);
+
+private:
+    struct Event {
+        nsecs_t startNs;
+        nsecs_t endNs;
+        int64_t ptsUs;
+        uint32_t sequence;
+        int32_t tid;
+        uint16_t stage;
+        int16_t consumer;
+    };
+
+    static const int kRingSize = 4096;  // events per thread, power of two
+
+    // owned by one thread at a time, handed to a new thread once the owner
+    // exits so short-lived unit threads do not leak rings
+    struct Ring {
+        std::atomic<uint64_t> head{0};
+        std::atomic<bool> inUse{false};
+        Event events[kRingSize];
+    };
+
+    // 8 linear sub-buckets per power of two of microseconds, ~12% precision
+    static const int kSubBuckets = 8;
+
+    static const int kBuckets = 32 * kSubBuckets;
+
+    struct Histogram {
+        std::atomic<uint64_t> buckets[kBuckets];
+        // both under mRingLock
+        std::string name;
+        bool inUse = false;
+    };
+
+    static int bucketOf(uint64_t us);
+
+    static uint64_t bucketUpperUs(int bucket);
+
+    static uint64_t percentile(const uint64_t* buckets, uint64_t count,
+                               double p);
+
+    Ring* getThreadRing();
+
+    void releaseThreadRing(Ring* ring);
+
+    std::atomic<bool> mEnabled{true};
+
+    std::mutex mRingLock;
+
+    std::vector<Ring*> mRings;
+
+    std::map<int, std::string> mThreadNames;
+
+    // slots ever used, the ones below it may be free again
+    std::atomic<int> mConsumerCount{0};
+
+    int mRegistrations = 0;
+
+    Histogram mHistograms[kMaxConsumers];
+
+    friend class ThreadRingOwner;
+};
+
+// Records one stage for the enclosing scope.
+class ScopedFrameTrace {
+public:
+    ScopedFrameTrace(FrameTracer::Stage stage, uint32_t sequence,
+                     int consumer = -1)
+        : mStage(stage), mSequence(sequence), mConsumer(consumer) {
+        if (FrameTracer::getInstance().isEnabled()) {
+            mStartNs = systemTime(SYSTEM_TIME_MONOTONIC);
+        }
+    }
+
+    ~ScopedFrameTrace() {
+        if (mStartNs) {
+            FrameTracer::getInstance().record(
+                mStage, mSequence, mConsumer, mStartNs,
+                systemTime(SYSTEM_TIME_MONOTONIC), mPtsUs);
+        }
+    }
+
+    // for stages that only learn the frame once they are done, e.g. DQBUF
+    void setFrame(uint32_t sequence, int64_t ptsUs = 0) {
+        mSequence = sequence;
+        mPtsUs = ptsUs;
+    }
+
+private:
+    FrameTracer::Stage mStage;
+
+    uint32_t mSequence;
+
+    int mConsumer;
+
+    int64_t mPtsUs = 0;
+
+    nsecs_t mStartNs = 0;
+};
+
+#endif  // CAPTUREENCODER_FRAMETRACER_H
@@ -0,0 +1,75 @@
+#include "GopController.h"
+
+GopController::GopController() {}
+
+GopController::GopController(const Config& config) : mConfig(config) {}
+
+GopController::MotionStats GopController::summarize(const uint32_t* blocks,
+                                                    size_t stride, size_t cols,
+                                                    size_t rows,
+                                                    uint32_t movingSad) {
+    MotionStats stats = {0, 0};
+    size_t count = cols * rows;
+    if (blocks == nullptr || count == 0 || cols > stride) {
+        return stats;
+    }
+    uint64_t sadSum = 0;
+    size_t moving = 0;
+    for (size_t y = 0; y < rows; y++) {
+        const uint32_t* row = blocks + y * stride;
+        for (size_t x = 0; x < cols; x++) {
+            uint32_t sad = row[x] & 0x7fff;
+            sadSum += sad;
+            if (sad > movingSad) {
+                moving++;
+            }
+        }
+    }
+    stats.meanSad = (uint32_t)(sadSum / count);
+    stats.movingPermille = (uint32_t)(moving * 1000 / count);
+    return stats;
+}
+
+GopController::Decision GopController::onFrame(const MotionStats& stats) {
+    Decision decision = {false, false, 0, 0};
+    mFramesSinceKeyFrame++;
+
+    bool cut = mHasLevel && stats.meanSad >= mConfig.cutMinSad &&
+               stats.meanSad > mSadLevel * mConfig.cutRatio &&
+               mFramesSinceKeyFrame >= mConfig.minIdrDistance;
+    if (cut) {
+        decision.keyFrame = true;
+        mFramesSinceKeyFrame = 0;
+        // the new scene sets the level from here
+        mSadLevel = stats.meanSad;
+    } else if (mHasLevel) {
+        mSadLevel += (stats.meanSad - mSadLevel) / 8;
+    } else {
+        mSadLevel = stats.meanSad;
+        mHasLevel = true;
+    }
+
+    if (stats.movingPermille <= mConfig.staticPermille) {
+        mStaticRun++;
+    } else {
+        mStaticRun = 0;
+    }
+    if (!mStatic && mStaticRun >= mConfig.staticFrames) {
+        mStatic = true;
+        decision.gopChanged = true;
+        decision.gopLen = mConfig.staticGop;
+        decision.viLen = mConfig.baseGop;
+    } else if (mStatic &&
+               (cut || stats.movingPermille > mConfig.leaveStaticPermille)) {
+        mStatic = false;
+        mStaticRun = 0;
+        decision.gopChanged = true;
+        decision.gopLen = mConfig.baseGop;
+        decision.viLen = 0;
+    }
+    return decision;
+}
+
+void GopController::onKeyFrame() {
+    mFramesSinceKeyFrame = 0;
+}
@@ -0,0 +1,92 @@
+#ifndef CAPTUREENCODER_GOPCONTROLLER_H
+#define CAPTUREENCODER_GOPCONTROLLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Adapts the GOP of an encoder to what the motion statistics of its frames
+// show. A frame whose SAD jumps well above the running level is a scene cut
+// and asks for an IDR; a run of frames where next to nothing moves switches
+// to a long GOP of smart P frames that refer back to a long-term reference,
+// until motion comes back. Plain C++ without Android or MPP dependencies so
+// recorded statistics can be replayed through it on a host.
+class GopController {
+public:
+    struct Config {
+        // GOP while there is motion, also the virtual I interval of the
+        // static GOP
+        int baseGop = 60;
+        // IDR interval while the picture is static
+        int staticGop = 600;
+        // a block with a SAD above this moved
+        uint32_t movingSad = 512;
+        // mean SAD over the running level that makes a scene cut, and the
+        // mean SAD a cut needs at least
+        float cutRatio = 3.0f;
+        uint32_t cutMinSad = 1024;
+        // frames between two scene cut IDRs at least
+        int minIdrDistance = 15;
+        // moved blocks in permille at or below which a frame is static, and
+        // above which a static picture is left
+        uint32_t staticPermille = 5;
+        uint32_t leaveStaticPermille = 20;
+        // static frames in a row before the long GOP is used
+        int staticFrames = 60;
+    };
+
+    struct MotionStats {
+        uint32_t meanSad;
+        // blocks that moved, per thousand blocks
+        uint32_t movingPermille;
+    };
+
+    struct Decision {
+        bool keyFrame;
+        bool gopChanged;
+        // the GOP to use when it changed, viLen 0 is a plain P chain
+        int gopLen;
+        int viLen;
+    };
+
+    GopController();
+
+    explicit GopController(const Config& config);
+
+    // Motion statistics of one frame from the MPP motion detection output,
+    // one 32 bit MppEncMDBlkInfo per 16x16 block: SAD in bits 0-14, the
+    // horizontal and vertical motion vector above it. Rows are stride
+    // blocks apart, only the first cols x rows blocks are the picture.
+    static MotionStats summarize(const uint32_t* blocks, size_t stride,
+                                 size_t cols, size_t rows, uint32_t movingSad);
+
+    // feeds the statistics of the frame just encoded, the decision applies
+    // to the next frames submitted
+    Decision onFrame(const MotionStats& stats);
+
+    // an IDR that did not come from here, requested or periodic
+    void onKeyFrame();
+
+    // GOP while there is motion, a change shows in the next decision that
+    // changes the GOP
+    void setBaseGop(int baseGop) { mConfig.baseGop = baseGop; }
+
+    bool isStatic() const { return mStatic; }
+
+    const Config& getConfig() const { return mConfig; }
+
+private:
+    Config mConfig;
+
+    bool mHasLevel = false;
+
+    // running mean SAD, the level a scene cut stands out from
+    float mSadLevel = 0;
+
+    int mFramesSinceKeyFrame = 0;
+
+    int mStaticRun = 0;
+
+    bool mStatic = false;
+};
+
+#endif  // CAPTUREENCODER_GOPCONTROLLER_H
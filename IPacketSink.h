@@ -0,0 +1,27 @@
+#ifndef CAPTUREENCODER_IPACKETSINK_H
+#define CAPTUREENCODER_IPACKETSINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Native consumer of encoded packets, fed by the encoder units next to the
+// Java delivery. Packets are Annex-B, flags are MediaCodec.BUFFER_FLAG_*
+// plus the temporal layer in PacketBufferPool::kFlagTemporalIdMask. A low
+// delay encoder delivers a frame slice by slice, all but the last flagged
+// kFlagPartialFrame and with the pts of the frame.
+// Called from the encoder's result thread, the packet is only valid during
+// the call.
+class IPacketSink {
+public:
+
+    IPacketSink() {}
+
+    virtual ~IPacketSink() {}
+
+    virtual void onPacket(const uint8_t* data, size_t length, uint32_t flags,
+                          int64_t ptsUs) = 0;
+
+};
+
+
+#endif //CAPTUREENCODER_IPACKETSINK_H
@@ -1,54 +1,188 @@
-//
-// Created by Charlie on 2024/7/24.
-//
-
-#ifndef CAPTUREENCODER_IPROCESSUNIT_H
-#define CAPTUREENCODER_IPROCESSUNIT_H
-
-#include <stdint.h>
-#include <utils/RefBase.h>
-
-#include <list>
-#include <mutex>
-
-using namespace android;
-
-class IProcessUnit : public Thread {
-public:
-    static const int kReqWaitTimeoutMs = 33;  // 33ms
-    static const int kReqWaitTimesMax = 90;   // 33ms * 90 ~= 3 sec
-
-    struct ProcessBuf {
-        int index;
-        void* start;
-        uint32_t width;
-        uint32_t height;
-        uint32_t format;
-        uint32_t processNum;
-    };
-
-    IProcessUnit() {}
-
-    virtual ~IProcessUnit() {}
-
-    virtual bool threadLoop() = 0;
-
-    virtual status_t readyToRun() = 0;
-
-    std::mutex mProcessLock;
-
-    std::condition_variable mProcessCond;
-
-    std::list<std::shared_ptr<ProcessBuf>> mProcessList;
-
-    virtual void waitForNextRequest(std::shared_ptr<ProcessBuf>* out) = 0;
-
-    virtual bool shouldProcessImg() {
-        return true;
-    }
-
-    virtual int32_t processBuffer(
-        std::shared_ptr<ProcessBuf>& processBuf) = 0;
-};
-
-#endif  // CAPTUREENCODER_IPROCESSUNIT_H
+//
+// Created by Charlie on 2024/7/24.
+//
+
+#ifndef CAPTUREENCODER_IPROCESSUNIT_H
+#define CAPTUREENCODER_IPROCESSUNIT_H
+
+#include <errno.h>
+#include <stdint.h>
+#include <utils/RefBase.h>
+#include <utils/Thread.h>
+
+#include <atomic>
+#include <memory>
+
+#include "FrameCadence.h"
+#include "KeyFrameRequester.h"
+#include "ProcessRing.h"
+
+using namespace android;
+
+class IProcessDoneListener;
+
+class IProcessUnit : public Thread {
+public:
+    static const int kReqWaitTimeoutMs = 33;  // 33ms
+    static const int kReqWaitTimesMax = 90;   // 33ms * 90 ~= 3 sec
+    // frames queued per unit, more than any capture or scaler pool holds
+    static const uint32_t kRingSize = 32;
+
+    struct ProcessBuf {
+        int index;
+        // dmabuf of the capture buffer, -1 when only start can be used
+        int fd;
+        void* start;
+        uint32_t width;
+        uint32_t height;
+        uint32_t format;
+        uint32_t processNum;
+        int64_t timestampUs;
+        uint32_t sequence;
+        // stage that owns the buffer when it is not a capture buffer
+        IProcessDoneListener* releaser;
+    };
+
+    // frame geometry a unit consumes, format is a V4L2 fourcc. The crop is
+    // the part of the capture frame that is scaled, width 0 for all of it.
+    struct OutputSpec {
+        uint32_t width;
+        uint32_t height;
+        uint32_t format;
+        uint32_t cropX = 0;
+        uint32_t cropY = 0;
+        uint32_t cropWidth = 0;
+        uint32_t cropHeight = 0;
+
+        bool operator==(const OutputSpec& o) const {
+            return width == o.width && height == o.height &&
+                   format == o.format && cropX == o.cropX &&
+                   cropY == o.cropY && cropWidth == o.cropWidth &&
+                   cropHeight == o.cropHeight;
+        }
+    };
+
+    IProcessUnit() {}
+
+    virtual ~IProcessUnit() {}
+
+    virtual bool threadLoop() = 0;
+
+    virtual status_t readyToRun() = 0;
+
+    // wakes the unit thread so it sees exitPending() right away
+    void requestExit() override {
+        Thread::requestExit();
+        mProcessRing.wake();
+    }
+
+    // Waits for the next frame and leaves it queued, call commitRequest()
+    // once it is handled. out stays null on timeout or exit.
+    void waitForNextRequest(std::shared_ptr<ProcessBuf>* out) {
+        if (out == nullptr) {
+            return;
+        }
+        if (exitPending() ||
+            !mProcessRing.wait(kReqWaitTimeoutMs * kReqWaitTimesMax)) {
+            return;
+        }
+        *out = *mProcessRing.peek();
+    }
+
+    void commitRequest() {
+        mProcessRing.commit();
+    }
+
+    virtual bool shouldProcessImg() {
+        return true;
+    }
+
+    // units that scale the capture frame to a fixed output report it here so
+    // the scaler stage can produce it for them, false means raw frames
+    virtual bool getOutputSpec(OutputSpec* spec) {
+        return false;
+    }
+
+    // What the feeding stage does with a frame while maxPending frames are
+    // already queued that the unit has not started on. No policy blocks
+    // the feeding thread, it feeds every other unit too.
+    // QUEUE_ALL queues it anyway up to the ring size, a full ring refuses
+    // it. The unit keeps every frame it can and holds up the capture once
+    // it has all the capture buffers, frames that come in meanwhile are
+    // lost in the driver.
+    // DROP_OLDEST hands back the oldest queued frame to make room.
+    // maxPending only counts the frames waiting: those the unit already
+    // took off the ring come on top, one for preview and MediaCodec
+    // encoders, up to two for MPP encoders.
+    // LATEST_WINS keeps only the newest, as DROP_OLDEST with maxPending 1.
+    enum BackpressurePolicy {
+        BACKPRESSURE_QUEUE_ALL = 0,
+        BACKPRESSURE_DROP_OLDEST,
+        BACKPRESSURE_LATEST_WINS,
+    };
+
+    // must be called before the unit is fed
+    void setBackpressure(BackpressurePolicy policy, uint32_t maxPending) {
+        mPolicy = policy;
+        mMaxPending = policy == BACKPRESSURE_LATEST_WINS ? 1 : maxPending;
+        if (mMaxPending == 0 || mMaxPending > kRingSize) {
+            mMaxPending = kRingSize;
+        }
+    }
+
+    BackpressurePolicy getBackpressurePolicy() const { return mPolicy; }
+
+    // rate this unit runs at relative to the capture rate, must be called
+    // before the unit is fed
+    void setFrameRate(uint32_t captureNum, uint32_t captureDen,
+                      uint32_t num, uint32_t den) {
+        mCadence.setRates(captureNum, captureDen, num, den);
+    }
+
+    // asked by the feeding stage before the frame is scaled or handed over,
+    // a frame the unit does not want never reaches it
+    virtual bool wantsFrame(uint32_t sequence) {
+        return mCadence.wants(sequence);
+    }
+
+    // encoders take key frame requests through it, null for other units
+    virtual KeyFrameRequester* getKeyFrameRequester() {
+        return nullptr;
+    }
+
+    // frames this unit skipped, evicted or refused by a full ring
+    int64_t getDroppedFrames() const {
+        return mDroppedFrames.load(std::memory_order_relaxed);
+    }
+
+    // Called by the one stage feeding this unit. A frame the policy pushes
+    // out is moved to evicted and must be released by the caller, it never
+    // reaches the unit. -EAGAIN when the frame itself was not queued, the
+    // caller still owns it then.
+    virtual int32_t processBuffer(std::shared_ptr<ProcessBuf>& processBuf,
+                                  std::shared_ptr<ProcessBuf>* evicted) {
+        if (mPolicy != BACKPRESSURE_QUEUE_ALL &&
+            mProcessRing.pending() >= mMaxPending &&
+            mProcessRing.evictOldest(evicted)) {
+            mDroppedFrames.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (!mProcessRing.push(processBuf)) {
+            mDroppedFrames.fetch_add(1, std::memory_order_relaxed);
+            return -EAGAIN;
+        }
+        return 0;
+    }
+
+protected:
+    ProcessRing<std::shared_ptr<ProcessBuf>, kRingSize> mProcessRing;
+
+    BackpressurePolicy mPolicy = BACKPRESSURE_QUEUE_ALL;
+
+    uint32_t mMaxPending = kRingSize;
+
+    std::atomic<int64_t> mDroppedFrames{0};
+
+    FrameCadence mCadence;
+};
+
+#endif  // CAPTUREENCODER_IPROCESSUNIT_H
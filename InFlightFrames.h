@@ -0,0 +1,104 @@
+#ifndef CAPTUREENCODER_INFLIGHTFRAMES_H
+#define CAPTUREENCODER_INFLIGHTFRAMES_H
+
+#include <stddef.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// Frames handed to an encoder whose output is not out yet, in submission
+// order. The submit thread waits for room before it takes the next frame
+// off its ring, the harvest thread works on the oldest one and pops it once
+// the encoder is done with it. A harvest that lost track of the encoder's
+// output marks the list failed, which lets the submit thread through to
+// replace the encoder.
+template <typename T>
+class InFlightFrames {
+public:
+    explicit InFlightFrames(size_t maxInFlight) : mMaxInFlight(maxInFlight) {}
+
+    // submit side, false on timeout. failed tells whether the harvest gave
+    // up, the list may be full then.
+    bool waitForRoom(int timeoutMs, bool* failed) {
+        std::unique_lock<std::mutex> lk(mLock);
+        if (!mCond.wait_for(lk, std::chrono::milliseconds(timeoutMs), [this] {
+                return mFrames.size() < mMaxInFlight || mFailed;
+            })) {
+            return false;
+        }
+        *failed = mFailed;
+        return true;
+    }
+
+    void push(const T& frame) {
+        std::lock_guard<std::mutex> lk(mLock);
+        mFrames.push_back(frame);
+        mCond.notify_all();
+    }
+
+    // Harvest side, waits up to timeoutMs for a frame or for stop() to turn
+    // true. out is the oldest frame, still in flight until popOldest(), and
+    // is left alone when there is none. stop() is called under the lock,
+    // whoever makes it true calls wake() afterwards.
+    template <typename Stop>
+    bool waitForOldest(int timeoutMs, Stop stop, T* out) {
+        std::unique_lock<std::mutex> lk(mLock);
+        mCond.wait_for(lk, std::chrono::milliseconds(timeoutMs),
+                       [this, &stop] { return !mFrames.empty() || stop(); });
+        if (mFrames.empty()) {
+            return false;
+        }
+        *out = mFrames.front();
+        return true;
+    }
+
+    // the encoder no longer reads the oldest frame
+    void popOldest() {
+        std::lock_guard<std::mutex> lk(mLock);
+        if (!mFrames.empty()) {
+            mFrames.pop_front();
+        }
+        mCond.notify_all();
+    }
+
+    void setFailed(bool failed) {
+        std::lock_guard<std::mutex> lk(mLock);
+        mFailed = failed;
+        mCond.notify_all();
+    }
+
+    void wake() {
+        std::lock_guard<std::mutex> lk(mLock);
+        mCond.notify_all();
+    }
+
+    // empties the list once the encoder is gone, the caller releases what
+    // comes back
+    std::deque<T> takeAll() {
+        std::deque<T> frames;
+        std::lock_guard<std::mutex> lk(mLock);
+        frames.swap(mFrames);
+        mCond.notify_all();
+        return frames;
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lk(mLock);
+        return mFrames.size();
+    }
+
+private:
+    const size_t mMaxInFlight;
+
+    std::mutex mLock;
+
+    std::condition_variable mCond;
+
+    std::deque<T> mFrames;
+
+    bool mFailed = false;
+};
+
+#endif  // CAPTUREENCODER_INFLIGHTFRAMES_H
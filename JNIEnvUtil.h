@@ -1,39 +1,128 @@
-//
-// Created by Charlie on 2024/7/31.
-//
-
-#ifndef CAPTUREENCODER_JNIENVUTIL_H
-#define CAPTUREENCODER_JNIENVUTIL_H
-
-#include <log/log.h>
-
-static JNIEnv* getJniEnv(JavaVM* globalJvm) {
-    if (globalJvm == nullptr) {
-        ALOGE("%s   globalJvm is nullptr", __func__);
-        return nullptr;
-    }
-
-    JNIEnv *jniEnv = nullptr;
-    int status = globalJvm->GetEnv((void **)&jniEnv, JNI_VERSION_1_6);
-
-    if (status == JNI_EDETACHED || jniEnv == nullptr) {
-        status = globalJvm->AttachCurrentThread(&jniEnv, nullptr);
-        if (status < 0) {
-            jniEnv = nullptr;
-        }
-    }
-    if (jniEnv == nullptr) {
-        ALOGE("%s   jniEnv is nullptr", __func__);
-    }
-    return jniEnv;
-}
-
-struct v4l2Buffer {
-    int index = 0;
-    void* start = nullptr;
-    unsigned int offset;
-    unsigned int length;
-    int exportFd = 0;
-};
-
-#endif //CAPTUREENCODER_JNIENVUTIL_H
+//
+// Created by Charlie on 2024/7/31.
+//
+
+#ifndef CAPTUREENCODER_JNIENVUTIL_H
+#define CAPTUREENCODER_JNIENVUTIL_H
+
+#include <log/log.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "PacketBufferPool.h"
+
+static JNIEnv* getJniEnv(JavaVM* globalJvm) {
+    if (globalJvm == nullptr) {
+        ALOGE("%s   globalJvm is nullptr", __func__);
+        return nullptr;
+    }
+
+    JNIEnv *jniEnv = nullptr;
+    int status = globalJvm->GetEnv((void **)&jniEnv, JNI_VERSION_1_6);
+
+    if (status == JNI_EDETACHED || jniEnv == nullptr) {
+        status = globalJvm->AttachCurrentThread(&jniEnv, nullptr);
+        if (status < 0) {
+            jniEnv = nullptr;
+        }
+    }
+    if (jniEnv == nullptr) {
+        ALOGE("%s   jniEnv is nullptr", __func__);
+    }
+    return jniEnv;
+}
+
+// Java encoders may implement onGetVideoFrame(byte[], int, long ptsUs) to get
+// the capture time, older ones only have onGetVideoFrame(byte[], int)
+static jmethodID getVideoFrameMethod(JNIEnv* jniEnv, jclass clazz,
+                                     bool* withPts) {
+    jmethodID methodId =
+        jniEnv->GetMethodID(clazz, "onGetVideoFrame", "([BIJ)V");
+    if (methodId) {
+        *withPts = true;
+        return methodId;
+    }
+    jniEnv->ExceptionClear();
+    *withPts = false;
+    return jniEnv->GetMethodID(clazz, "onGetVideoFrame", "([BI)V");
+}
+
+// a Java callback that threw leaves the exception pending, and the next JNI
+// call on the thread would abort on it. Logs and clears it, true when there
+// was one.
+static bool clearCallbackException(JNIEnv* jniEnv, const char* method) {
+    if (!jniEnv->ExceptionCheck()) {
+        return false;
+    }
+    ALOGE("%s   %s threw", __func__, method);
+    jniEnv->ExceptionDescribe();
+    jniEnv->ExceptionClear();
+    return true;
+}
+
+// false when the array could not be made or the callback threw
+static bool sendVideoFrame(JNIEnv* jniEnv, jobject javaEncoder,
+                           jmethodID methodId, bool withPts,
+                           const uint8_t* data, int length, int64_t ptsUs) {
+    jbyteArray array = jniEnv->NewByteArray(length);
+    if (array == nullptr) {
+        clearCallbackException(jniEnv, "NewByteArray");
+        return false;
+    }
+    jniEnv->SetByteArrayRegion(array, 0, length,
+                               reinterpret_cast<const jbyte*>(data));
+    if (withPts) {
+        jniEnv->CallVoidMethod(javaEncoder, methodId, array, length,
+                               (jlong)ptsUs);
+    } else {
+        jniEnv->CallVoidMethod(javaEncoder, methodId, array, length);
+    }
+    jniEnv->DeleteLocalRef(array);
+    return !clearCallbackException(jniEnv, "onGetVideoFrame");
+}
+
+// Java encoders that registered packet buffers implement
+// onGetVideoBuffer(int index, int length, int flags, long ptsUs) and hand the
+// index back through releasePacketBuffer() once the packet is consumed
+static jmethodID getVideoBufferMethod(JNIEnv* jniEnv, jclass clazz) {
+    jmethodID methodId =
+        jniEnv->GetMethodID(clazz, "onGetVideoBuffer", "(IIIJ)V");
+    if (methodId == nullptr) {
+        jniEnv->ExceptionClear();
+    }
+    return methodId;
+}
+
+// Delivers through the packet pool when there is one, otherwise or while
+// Java holds every pooled buffer as a byte[] so the stream never loses a
+// packet. Returns false when the packet could not be delivered at all, or
+// the callback threw; a pooled buffer it threw on goes back to the pool.
+static bool deliverVideoPacket(JNIEnv* jniEnv, jobject javaEncoder,
+                               PacketBufferPool* pool, jmethodID bufferMethod,
+                               jmethodID frameMethod, bool withPts,
+                               const uint8_t* data, int length, int flags,
+                               int64_t ptsUs) {
+    if (pool && bufferMethod) {
+        int index = pool->acquire(length);
+        if (index >= 0) {
+            memcpy(pool->getData(index), data, length);
+            jniEnv->CallVoidMethod(javaEncoder, bufferMethod, index, length,
+                                   flags, (jlong)ptsUs);
+            if (clearCallbackException(jniEnv, "onGetVideoBuffer")) {
+                // Java never got to hand it back, -EINVAL if it did
+                pool->release(index);
+                return false;
+            }
+            return true;
+        }
+        ALOGW("%s   packet pool: %d, %d bytes go as byte[]", __func__, index,
+              length);
+    }
+    if (frameMethod == nullptr) {
+        return false;
+    }
+    return sendVideoFrame(jniEnv, javaEncoder, frameMethod, withPts, data,
+                          length, ptsUs);
+}
+
+#endif //CAPTUREENCODER_JNIENVUTIL_H
@@ -0,0 +1,45 @@
+#define LOG_TAG "NativeKeyFrameRequester"
+
+#include "KeyFrameRequester.h"
+
+#include <log/log.h>
+
+KeyFrameRequester::KeyFrameRequester(int64_t windowUs) : mWindowUs(windowUs) {}
+
+void KeyFrameRequester::setWindowUs(int64_t windowUs) {
+    std::lock_guard<std::mutex> lk(mLock);
+    mWindowUs = windowUs > 0 ? windowUs : 0;
+}
+
+int KeyFrameRequester::request() {
+    std::lock_guard<std::mutex> lk(mLock);
+    mRequests++;
+    return mPending.fetch_add(1, std::memory_order_release) + 1;
+}
+
+bool KeyFrameRequester::takeDue(int64_t nowUs) {
+    if (mPending.load(std::memory_order_acquire) == 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lk(mLock);
+    if (mHasKeyFrame && nowUs - mLastKeyFrameUs < mWindowUs) {
+        return false;
+    }
+    int merged = mPending.exchange(0, std::memory_order_relaxed);
+    mHasKeyFrame = true;
+    mLastKeyFrameUs = nowUs;
+    mKeyFrames++;
+    ALOGI("%s   idr for %d requests, %lld requests %lld idrs so far", __func__,
+          merged, (long long)mRequests, (long long)mKeyFrames);
+    return true;
+}
+
+int64_t KeyFrameRequester::getRequests() {
+    std::lock_guard<std::mutex> lk(mLock);
+    return mRequests;
+}
+
+int64_t KeyFrameRequester::getKeyFrames() {
+    std::lock_guard<std::mutex> lk(mLock);
+    return mKeyFrames;
+}
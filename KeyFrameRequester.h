@@ -0,0 +1,54 @@
+#ifndef CAPTUREENCODER_KEYFRAMEREQUESTER_H
+#define CAPTUREENCODER_KEYFRAMEREQUESTER_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+
+// Collects key frame requests for one encoder and turns bursts of them into
+// one IDR. The first request is served at the next frame submitted; what
+// comes in within the window after an IDR waits for the window to end and
+// shares one IDR then, so twenty viewers joining at once cost at most two.
+class KeyFrameRequester {
+public:
+    // window of the debug.capture.idr_window_ms property
+    static const int64_t kDefaultWindowUs = 500000;
+
+    explicit KeyFrameRequester(int64_t windowUs = kDefaultWindowUs);
+
+    void setWindowUs(int64_t windowUs);
+
+    // any thread, returns the requests waiting for the next IDR, this one
+    // included
+    int request();
+
+    // Asked by the encoder thread before each frame it submits, nowUs on
+    // the frame clock. True when the frame is to be encoded as IDR, the
+    // requests it serves are then cleared.
+    bool takeDue(int64_t nowUs);
+
+    // requests received and IDRs they resulted in, the difference is what
+    // was merged
+    int64_t getRequests();
+
+    int64_t getKeyFrames();
+
+private:
+    std::mutex mLock;
+
+    int64_t mWindowUs;
+
+    // keeps takeDue() lock free while nothing is asked for
+    std::atomic<int> mPending{0};
+
+    bool mHasKeyFrame = false;
+
+    int64_t mLastKeyFrameUs = 0;
+
+    int64_t mRequests = 0;
+
+    int64_t mKeyFrames = 0;
+};
+
+#endif  // CAPTUREENCODER_KEYFRAMEREQUESTER_H
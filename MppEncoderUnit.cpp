@@ -1,227 +1,566 @@
-//
-// Created by Charlie on 2024/7/31.
-//
-#define LOG_TAG "NativeMppEncoderUnit"
-
-#include "MppEncoderUnit.h"
-
-#include <errno.h>
-#include <linux/videodev2.h>
-#include <log/log.h>
-#include <utils/Trace.h>
-
-#include "RgaCropScale.h"
-#include "JNIEnvUtil.h"
-
-constexpr int COLOR_FormatYUV420Flexible = 0x7F420888;
-#define HAL_PIXEL_FORMAT_YCrCb_NV12 0x15
-
-static const int64_t TIMEOUT_USEC = 12000;
-
-MppEncoderUnit::MppEncoderUnit(IProcessDoneListener* processDoneListener, v4l2Buffer* buffer, JavaVM *Jvm, jobject javaEncoder, int preViewFps)
-    : mIProcessDoneListener(processDoneListener), mv4l2Buffer(buffer), globalJvm(Jvm),
-      mJavaEncoder(javaEncoder), mPreviewFps(preViewFps) {
-    mEncodeData = (unsigned char*)malloc(2 * 1024 * 1024);
-    ALOGI("%s   mEncodeData: %p", __func__, mEncodeData);
-}
-
-MppEncoderUnit::~MppEncoderUnit() {
-    ALOGI("%s   MppEncoderUnit: %p", __func__, this);
-    if (mEncodeData) {
-        free(mEncodeData);
-        mEncodeData = nullptr;
-    }
-    /*
-    if (mSendResultThread) {
-        mSendResultThread->requestExit();
-        mSendResultThread->join();
-        mSendResultThread.clear();
-        mSendResultThread = nullptr;
-    }
-    */
-}
-
-bool MppEncoderUnit::shouldProcessImg() {
-    return true;
-}
-
-int32_t MppEncoderUnit::processBuffer(
-    std::shared_ptr<ProcessBuf> &processBuf) {
-    ATRACE_CALL();
-    std::unique_lock<std::mutex> lk(mProcessLock);
-    mProcessList.push_back(processBuf);
-    lk.unlock();
-    mProcessCond.notify_one();
-    return 0;
-}
-
-status_t MppEncoderUnit::readyToRun() {
-    ALOGI("%s   MppEncoderUnit: %p", __func__, this);
-    mJniEnv = getJniEnv(globalJvm);
-    if (mJniEnv) {
-        jclass clazz = mJniEnv->GetObjectClass(mJavaEncoder);
-
-        jfieldID widthField = mJniEnv->GetFieldID(clazz, "mWidth", "I");
-        if (widthField == nullptr) {
-            ALOGE("%s   cannot get widthField errno: %s", __func__, strerror(errno));
-        } else {
-            mWidth = mJniEnv->GetIntField(mJavaEncoder, widthField);
-        }
-
-        jfieldID heightField = mJniEnv->GetFieldID(clazz, "mHeight", "I");
-        if (heightField == nullptr) {
-            ALOGE("%s   cannot get heightField errno: %s", __func__, strerror(errno));
-        } else {
-            mHeight = mJniEnv->GetIntField(mJavaEncoder, heightField);
-        }
-
-        jfieldID fpsField = mJniEnv->GetFieldID(clazz, "mFps", "I");
-        if (fpsField == nullptr) {
-            ALOGE("%s   cannot get fpsField errno: %s", __func__, strerror(errno));
-        } else {
-            mFps = mJniEnv->GetIntField(mJavaEncoder, fpsField);
-            mSkipCodecNum = mPreviewFps / mFps;
-        }
-
-        mGetVideoMethodId =
-            mJniEnv->GetMethodID(clazz, "onGetVideoFrame", "([BI)V");
-        ALOGI("%s   mGetVideoMethodId: %p", __func__, mGetVideoMethodId);
-
-
-    } else {
-        ALOGE("%s   cannot get jni env errno: %s", __func__, strerror(errno));
-        return -1;
-    }
-
-    ALOGI("%s   MppEncoderUnit: %p width: %d height: %d fps: %d mSkipCodecNum: %d", __func__, this,
-          mWidth, mHeight, mFps, mSkipCodecNum);
-    int status = setupCodec();
-    if (status) {
-        return -errno;
-    }
-    /*
-    mSendResultThread = new SendResultThread(&mppEncoder, globalJvm, mJavaEncoder);
-    mSendResultThread->run("SendResultThread");
-    */
-    return NO_ERROR;
-}
-
-int MppEncoderUnit::setupCodec() {
-    ALOGI("%s   success", __func__);
-    int channelId = MppChannel::getInstance().getChannel();
-    {
-        memset(&mCodecParam, 0, sizeof(mCodecParam));
-        mCodecParam.format = MPP_FMT_YUV420SP;
-        mCodecParam.width = mWidth;
-        mCodecParam.height = mHeight;
-        mCodecParam.type = MPP_VIDEO_CodingHEVC;
-        mCodecParam.rc_mode = MPP_ENC_RC_MODE_FIXQP;
-        mCodecParam.rc_mode = MPP_ENC_RC_MODE_FIXQP;
-        mCodecParam.bps_target = 1920 * 1000;
-        mCodecParam.gop_len = 60;
-    }
-
-    int ret = mppEncoder.venc_init(channelId, &mCodecParam, mv4l2Buffer, mWidth * mHeight * 1.5);
-    if (ret) {
-        ALOGE("%s   failed errno: %s", __func__, strerror(errno));
-    }
-    return 0;
-}
-
-void MppEncoderUnit::waitForNextRequest(std::shared_ptr<ProcessBuf> *out) {
-    ATRACE_CALL();
-    if (out == nullptr) {
-        ALOGE("%s   out is null", __func__);
-        return;
-    }
-
-    std::unique_lock<std::mutex> lk(mProcessLock);
-    int waitTimes = 0;
-    while (mProcessList.empty()) {
-        if (exitPending()) {
-            return;
-        }
-        std::chrono::milliseconds timeout =
-            std::chrono::milliseconds(kReqWaitTimeoutMs);
-        auto st = mProcessCond.wait_for(lk, timeout);
-        if (st == std::cv_status::timeout) {
-            waitTimes++;
-            if (waitTimes == kReqWaitTimesMax) {
-                // no new request, return
-                return;
-            }
-        }
-    }
-    *out = mProcessList.front();
-}
-
-bool MppEncoderUnit::threadLoop() {
-
-    std::shared_ptr<ProcessBuf> processBuf;
-    waitForNextRequest(&processBuf);
-    if (processBuf == nullptr) {
-        return true;
-    }
-    mppEncoder.venc_put_src_imge(processBuf->index);
-
-    unsigned long frameLength = 2 * 1024 * 1024;
-    unsigned char* encodeData = mEncodeData;
-    ALOGI("%s   mEncodeData: %p", __func__, mEncodeData);
-    int ret = mppEncoder.venc_get_frame(encodeData, &frameLength);
-    if (ret) {
-        ALOGE("%s   venc_get_frame errno: %s", __func__, strerror(errno));
-        usleep(100000);
-        return true;
-    }
-    ALOGI("%s   venc_get_frame success frameLength: %lu", __func__, frameLength);
-    {
-        std::unique_lock<std::mutex> lk(mProcessLock);
-        mProcessList.pop_front();
-    }
-    if (mIProcessDoneListener) {
-        mIProcessDoneListener->notifyProcessDone(processBuf);
-    }
-
-    if (mJniEnv && mJavaEncoder && mGetVideoMethodId) {
-        jbyteArray array = mJniEnv->NewByteArray(frameLength);
-        mJniEnv->SetByteArrayRegion(array, 0, frameLength,
-                                    reinterpret_cast<const jbyte *>(encodeData));
-        mJniEnv->CallVoidMethod(mJavaEncoder, mGetVideoMethodId, array,
-                                frameLength);
-        mJniEnv->DeleteLocalRef(array);
-    }
-
-    return true;
-}
-
-MppEncoderUnit::SendResultThread::SendResultThread(MppEncoder* codec, JavaVM* Jvm, jobject javaEncoder)
-    : mCodec(codec),
-      globalJvm(Jvm),
-      mJavaEncoder(javaEncoder) {
-    ALOGI("%s   SendResultThread: %p", __func__, this);
-}
-
-MppEncoderUnit::SendResultThread::~SendResultThread() {
-    ALOGI("%s   SendResultThread: %p", __func__, this);
-}
-
-status_t MppEncoderUnit::SendResultThread::readyToRun() {
-    ALOGI("%s   SendResultThread: %p", __func__, this);
-    mJniEnv = getJniEnv(globalJvm);
-    if (mJniEnv) {
-        jclass clazz = mJniEnv->GetObjectClass(mJavaEncoder);
-        mGetVideoMethodId =
-            mJniEnv->GetMethodID(clazz, "onGetVideoFrame", "([BI)V");
-        ALOGI("%s   mGetVideoMethodId: %p", __func__, mGetVideoMethodId);
-    } else {
-        ALOGE("%s   cannot get jni env errno: %s", __func__, strerror(errno));
-        return -errno;
-    }
-    return NO_ERROR;
-}
-
-bool MppEncoderUnit::SendResultThread::threadLoop() {
-
-    return true;
-}
-
+//
+// Created by Charlie on 2024/7/31.
+//
+#define LOG_TAG "NativeMppEncoderUnit"
+
+#include "MppEncoderUnit.h"
+
+#include <cutils/properties.h>
+#include <errno.h>
+#include <linux/videodev2.h>
+#include <log/log.h>
+#include <utils/Trace.h>
+
+#include "EncoderResourceManager.h"
+#include "FrameTracer.h"
+#include "RgaCropScale.h"
+#include "JNIEnvUtil.h"
+
+constexpr int COLOR_FormatYUV420Flexible = 0x7F420888;
+#define HAL_PIXEL_FORMAT_YCrCb_NV12 0x15
+
+static const int64_t TIMEOUT_USEC = 12000;
+
+MppEncoderUnit::MppEncoderUnit(IProcessDoneListener* processDoneListener, const sp<FrameSource>& source, JavaVM *Jvm, jobject javaEncoder,
+                               const std::shared_ptr<PacketBufferPool>& packetPool, int channelId)
+    : mIProcessDoneListener(processDoneListener), mSource(source), globalJvm(Jvm),
+      mJavaEncoder(javaEncoder), mPacketPool(packetPool), mChannelId(channelId) {
+    venc_rc_attr_init(&mPendingRc);
+    mAdaptiveGop = property_get_bool("debug.capture.adaptive_gop", true);
+    mMotionLog = property_get_bool("debug.capture.motion_log", false);
+    ALOGI("%s   MppEncoderUnit: %p", __func__, this);
+}
+
+MppEncoderUnit::~MppEncoderUnit() {
+    ALOGI("%s   MppEncoderUnit: %p", __func__, this);
+    stopHarvest();
+    FrameTracer::getInstance().unregisterConsumer(mTraceConsumer);
+    FrameTracer::getInstance().unregisterConsumer(mFirstSliceTraceConsumer);
+}
+
+bool MppEncoderUnit::shouldProcessImg() {
+    return true;
+}
+
+void MppEncoderUnit::setEncodeFps(int fps) {
+    mGrantedFps = fps;
+}
+
+void MppEncoderUnit::addPacketSink(const std::shared_ptr<IPacketSink>& sink,
+                                   int maxTemporalId) {
+    mPacketSinks.push_back({sink, maxTemporalId});
+}
+
+void MppEncoderUnit::setTemporalLayers(int layers) {
+    mTemporalLayers = layers;
+}
+
+void MppEncoderUnit::setLowDelaySlices(int slices) {
+    mLowDelaySlices = slices;
+}
+
+void MppEncoderUnit::setRateControl(const VENC_RC_ATTR_t& rc) {
+    std::lock_guard<std::mutex> lk(mRcLock);
+    venc_rc_attr_merge(&mPendingRc, &rc);
+    if (rc.gop_len > 0 && rc.vi_len < 0) {
+        mPendingBaseGop = rc.gop_len;
+    }
+    mRcPending.store(true, std::memory_order_release);
+}
+
+void MppEncoderUnit::setRoiRegions(const std::vector<RoiRegionCfg>& regions) {
+    std::lock_guard<std::mutex> lk(mRoiLock);
+    mPendingRoi = regions;
+    mRoiPending.store(true, std::memory_order_release);
+}
+
+void MppEncoderUnit::setOsdOverlay(const std::shared_ptr<OsdOverlay>& overlay) {
+    mOsd = overlay;
+}
+
+void MppEncoderUnit::onFrameMotion(const GopController::MotionStats& stats,
+                                   bool keyFrame) {
+    std::lock_guard<std::mutex> lk(mRcLock);
+    if (mPendingMotion.size() < kMaxPendingMotion) {
+        mPendingMotion.push_back({stats, keyFrame});
+    }
+}
+
+void MppEncoderUnit::updateGop() {
+    std::vector<FrameMotion> motion;
+    int baseGop;
+    {
+        std::lock_guard<std::mutex> lk(mRcLock);
+        if (mPendingMotion.empty() && mPendingBaseGop < 0) {
+            return;
+        }
+        motion.swap(mPendingMotion);
+        baseGop = mPendingBaseGop;
+        mPendingBaseGop = -1;
+        // a GOP set while static is where the controller returns to, the
+        // static GOP stays until motion comes back
+        if (baseGop > 0 && mGop.isStatic()) {
+            mPendingRc.gop_len = mGop.getConfig().staticGop;
+            mPendingRc.vi_len = baseGop;
+        }
+    }
+    if (baseGop > 0) {
+        mGop.setBaseGop(baseGop);
+    }
+    for (const FrameMotion& frame : motion) {
+        if (mMotionLog) {
+            ALOGI("%s   motion sad: %u moving: %u key: %d", __func__,
+                  frame.stats.meanSad, frame.stats.movingPermille,
+                  frame.keyFrame);
+        }
+        // an intra frame has no motion to measure
+        if (frame.keyFrame) {
+            mGop.onKeyFrame();
+            continue;
+        }
+        GopController::Decision decision = mGop.onFrame(frame.stats);
+        if (decision.keyFrame) {
+            ALOGI("%s   scene cut sad: %u", __func__, frame.stats.meanSad);
+            mSceneCutIdr = true;
+        }
+        if (decision.gopChanged) {
+            ALOGI("%s   %s gop: %d vi: %d", __func__,
+                  decision.viLen ? "static" : "moving", decision.gopLen,
+                  decision.viLen);
+            VENC_RC_ATTR_t rc;
+            venc_rc_attr_init(&rc);
+            rc.gop_len = decision.gopLen;
+            rc.vi_len = decision.viLen;
+            std::lock_guard<std::mutex> lk(mRcLock);
+            venc_rc_attr_merge(&mPendingRc, &rc);
+            mRcPending.store(true, std::memory_order_release);
+        }
+    }
+}
+
+KeyFrameRequester* MppEncoderUnit::getKeyFrameRequester() {
+    return &mKeyFrames;
+}
+
+void MppEncoderUnit::applyRateControl() {
+    VENC_RC_ATTR_t rc;
+    {
+        std::lock_guard<std::mutex> lk(mRcLock);
+        rc = mPendingRc;
+        venc_rc_attr_init(&mPendingRc);
+        mRcPending.store(false, std::memory_order_relaxed);
+    }
+    int ret = mppEncoder.venc_set_rc(&rc);
+    if (ret) {
+        ALOGE("%s   MppEncoderUnit: %p venc_set_rc ret: %d", __func__, this, ret);
+        return;
+    }
+    mergeRateControl(rc);
+    if (rc.fps_num > 0 && rc.fps_den > 0) {
+        // the producer decimates to the new rate from its next frame
+        mCadence.setOutputRate(rc.fps_num, rc.fps_den);
+    }
+}
+
+status_t MppEncoderUnit::readyToRun() {
+    ALOGI("%s   MppEncoderUnit: %p", __func__, this);
+    mJniEnv = getJniEnv(globalJvm);
+    if (mJniEnv) {
+        jclass clazz = mJniEnv->GetObjectClass(mJavaEncoder);
+
+        jfieldID widthField = mJniEnv->GetFieldID(clazz, "mWidth", "I");
+        if (widthField == nullptr) {
+            ALOGE("%s   cannot get widthField errno: %s", __func__, strerror(errno));
+        } else {
+            mWidth = mJniEnv->GetIntField(mJavaEncoder, widthField);
+        }
+
+        jfieldID heightField = mJniEnv->GetFieldID(clazz, "mHeight", "I");
+        if (heightField == nullptr) {
+            ALOGE("%s   cannot get heightField errno: %s", __func__, strerror(errno));
+        } else {
+            mHeight = mJniEnv->GetIntField(mJavaEncoder, heightField);
+        }
+
+        jfieldID fpsField = mJniEnv->GetFieldID(clazz, "mFps", "I");
+        if (fpsField == nullptr) {
+            ALOGE("%s   cannot get fpsField errno: %s", __func__, strerror(errno));
+        } else {
+            mFps = mJniEnv->GetIntField(mJavaEncoder, fpsField);
+        }
+
+    } else {
+        ALOGE("%s   cannot get jni env errno: %s", __func__, strerror(errno));
+        return -1;
+    }
+    if (mGrantedFps > 0) {
+        mFps = mGrantedFps;
+    }
+
+    ALOGI("%s   MppEncoderUnit: %p width: %d height: %d fps: %d", __func__, this,
+          mWidth, mHeight, mFps);
+    char traceName[32];
+    snprintf(traceName, sizeof(traceName), "MppEncoderUnit %dx%d", mWidth, mHeight);
+    mTraceConsumer = FrameTracer::getInstance().registerConsumer(traceName);
+    if (mLowDelaySlices > 1) {
+        snprintf(traceName, sizeof(traceName), "MppEncoderUnit %dx%d slice",
+                 mWidth, mHeight);
+        mFirstSliceTraceConsumer =
+            FrameTracer::getInstance().registerConsumer(traceName);
+    }
+    int status = setupCodec();
+    if (status) {
+        return -EIO;
+    }
+    mSendResultThread = new SendResultThread(this, globalJvm, mJavaEncoder);
+    mSendResultThread->run("SendResultThread");
+    return NO_ERROR;
+}
+
+int MppEncoderUnit::setupCodec() {
+    ALOGI("%s   success", __func__);
+    {
+        memset(&mCodecParam, 0, sizeof(mCodecParam));
+        mCodecParam.format = MPP_FMT_YUV420SP;
+        mCodecParam.width = mWidth;
+        mCodecParam.height = mHeight;
+        mCodecParam.type = MPP_VIDEO_CodingHEVC;
+        mCodecParam.rc_mode = MPP_ENC_RC_MODE_FIXQP;
+        mCodecParam.bps_target = 1920 * 1000;
+        mCodecParam.gop_len = 60;
+        if (mFps > 0) {
+            mCodecParam.fps_in_num = mFps;
+            mCodecParam.fps_in_den = 1;
+            mCodecParam.fps_out_num = mFps;
+            mCodecParam.fps_out_den = 1;
+        }
+    }
+    // rate control set before the encoder ran is its initial config
+    {
+        std::lock_guard<std::mutex> lk(mRcLock);
+        if (mRcPending.load(std::memory_order_relaxed)) {
+            const VENC_RC_ATTR_t& rc = mPendingRc;
+            mergeRateControl(rc);
+            if (rc.fps_num > 0 && rc.fps_den > 0) {
+                mCadence.setOutputRate(rc.fps_num, rc.fps_den);
+            }
+            venc_rc_attr_init(&mPendingRc);
+            mRcPending.store(false, std::memory_order_relaxed);
+            mPendingBaseGop = -1;
+        }
+    }
+    if (mTemporalLayers > 1) {
+        // tsvc2 to tsvc4 of mpi_enc_gen_ref_cfg
+        mCodecParam.gop_mode = mTemporalLayers - 1;
+        mCodecParam.vi_len = 0;
+    }
+    if (mLowDelaySlices > 1) {
+        // whole CTU rows per slice, 32x32 CTUs as the HEVC md info layout
+        int ctuCols = (mWidth + 31) / 32;
+        int ctuRows = (mHeight + 31) / 32;
+        int sliceRows = (ctuRows + mLowDelaySlices - 1) / mLowDelaySlices;
+        mCodecParam.split_mode = MPP_ENC_SPLIT_BY_CTU;
+        mCodecParam.split_arg = sliceRows * ctuCols;
+        mCodecParam.split_out = MPP_ENC_SPLIT_OUT_LOWDELAY;
+        ALOGI("%s   low delay %d slices of %d ctu rows", __func__,
+              mLowDelaySlices, sliceRows);
+    }
+    GopController::Config gopConfig;
+    gopConfig.baseGop = mCodecParam.gop_len;
+    gopConfig.staticGop = mCodecParam.gop_len * 10;
+    if (mFps > 0) {
+        gopConfig.minIdrDistance = (mFps + 1) / 2;
+        gopConfig.staticFrames = mFps * 2;
+    }
+    mGop = GopController(gopConfig);
+    {
+        std::lock_guard<std::mutex> lk(mRcLock);
+        mMovingSad = gopConfig.movingSad;
+    }
+    if (mOsd) {
+        mOsd->setFrameSize(mWidth, mHeight);
+    }
+
+    int ret = mppEncoder.venc_init(mChannelId, &mCodecParam, mSource->getBufferCount(), mWidth * mHeight * 1.5);
+    if (ret) {
+        ALOGE("%s   venc_init ret: %d", __func__, ret);
+    }
+    return ret;
+}
+
+void MppEncoderUnit::mergeRateControl(const VENC_RC_ATTR_t& rc) {
+    if (rc.rc_mode >= 0) mCodecParam.rc_mode = rc.rc_mode;
+    if (rc.bps_target >= 0) mCodecParam.bps_target = rc.bps_target;
+    if (rc.bps_max >= 0) mCodecParam.bps_max = rc.bps_max;
+    if (rc.bps_min >= 0) mCodecParam.bps_min = rc.bps_min;
+    if (rc.qp_init >= 0) mCodecParam.qp_init = rc.qp_init;
+    if (rc.qp_min >= 0) mCodecParam.qp_min = rc.qp_min;
+    if (rc.qp_max >= 0) mCodecParam.qp_max = rc.qp_max;
+    if (rc.qp_min_i >= 0) mCodecParam.qp_min_i = rc.qp_min_i;
+    if (rc.qp_max_i >= 0) mCodecParam.qp_max_i = rc.qp_max_i;
+    if (rc.gop_len >= 0) mCodecParam.gop_len = rc.gop_len;
+    // the temporal layers own the ref cfg, as in venc_set_rc()
+    if (rc.vi_len >= 0 && mTemporalLayers <= 1) {
+        mCodecParam.gop_mode = rc.vi_len > 0 ? 4 : 0;
+        mCodecParam.vi_len = rc.vi_len;
+    }
+    if (rc.fps_num > 0 && rc.fps_den > 0) {
+        mCodecParam.fps_in_num = rc.fps_num;
+        mCodecParam.fps_in_den = rc.fps_den;
+        mCodecParam.fps_out_num = rc.fps_num;
+        mCodecParam.fps_out_den = rc.fps_den;
+    }
+}
+
+int MppEncoderUnit::restartCodec(int64_t nowUs) {
+    if (nowUs < mCodecRetryUs) {
+        return -EAGAIN;
+    }
+    ALOGE("%s   MppEncoderUnit: %p restarting the encoder", __func__, this);
+    stopHarvest();
+    mppEncoder.venc_deinit();
+    releaseInFlight();
+    // the new encoder starts with an IDR and without a palette
+    mOsdPaletteGeneration = 0;
+    int ret = mppEncoder.venc_init(mChannelId, &mCodecParam,
+                                   mSource->getBufferCount(),
+                                   mWidth * mHeight * 1.5);
+    if (ret) {
+        ALOGE("%s   venc_init ret: %d", __func__, ret);
+        mCodecRetryUs = nowUs + 1000000;
+        return -EIO;
+    }
+    mInFlight.setFailed(false);
+    mSendResultThread = new SendResultThread(this, globalJvm, mJavaEncoder);
+    mSendResultThread->run("SendResultThread");
+    return 0;
+}
+
+bool MppEncoderUnit::threadLoop() {
+    if (exitPending()) {
+        // the packets of every frame in flight are out, nothing MPP holds
+        // is still referenced
+        stopHarvest();
+        mppEncoder.venc_deinit();
+        releaseInFlight();
+        return false;
+    }
+
+    // leave frames in the ring while MPP is full so the backpressure
+    // policy decides which ones are skipped
+    bool codecFailed;
+    if (!mInFlight.waitForRoom(kReqWaitTimeoutMs, &codecFailed)) {
+        return true;
+    }
+
+    std::shared_ptr<ProcessBuf> processBuf;
+    waitForNextRequest(&processBuf);
+    if (processBuf == nullptr) {
+        return true;
+    }
+    commitRequest();
+
+    if (codecFailed && restartCodec(processBuf->timestampUs)) {
+        // no encoder to take it
+        if (mIProcessDoneListener) {
+            mIProcessDoneListener->notifyProcessDone(processBuf);
+        }
+        return true;
+    }
+
+    if (mAdaptiveGop) {
+        updateGop();
+    }
+    // frame boundary, whatever rate control changed since the last frame
+    // goes in as one config
+    if (mRcPending.load(std::memory_order_acquire)) {
+        applyRateControl();
+    }
+    // takeDue() first, a requested key frame is due either way
+    if (mKeyFrames.takeDue(processBuf->timestampUs) || mSceneCutIdr) {
+        mppEncoder.venc_request_idr();
+        mSceneCutIdr = false;
+    }
+    if (mRoiPending.load(std::memory_order_acquire)) {
+        // a writer holding the lock gets its regions in on a later frame
+        std::unique_lock<std::mutex> lk(mRoiLock, std::try_to_lock);
+        if (lk.owns_lock()) {
+            mRoi.swap(mPendingRoi);
+            mRoiPending.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    const MppEncOSDData2* osd = nullptr;
+    if (mOsd) {
+        uint32_t paletteGeneration = mOsd->getPaletteGeneration();
+        if (paletteGeneration != mOsdPaletteGeneration) {
+            MppEncOSDPlt palette;
+            mOsd->getPalette(&palette);
+            mppEncoder.venc_set_osd_palette(&palette);
+            mOsdPaletteGeneration = paletteGeneration;
+        }
+        osd = mOsd->prepare();
+    }
+
+    int ret;
+    {
+        ScopedFrameTrace trace(FrameTracer::STAGE_MPP_PUT, processBuf->sequence,
+                               mTraceConsumer);
+        ret = mppEncoder.venc_put_src_imge(processBuf->index,
+                                           mSource->exportFd(processBuf->index),
+                                           mCadence.evenPtsUs(processBuf->timestampUs),
+                                           mRoi.data(), (int)mRoi.size(), osd);
+    }
+    if (ret) {
+        ALOGE("%s   venc_put_src_imge sequence: %u ret: %d", __func__,
+              processBuf->sequence, ret);
+        if (mIProcessDoneListener) {
+            mIProcessDoneListener->notifyProcessDone(processBuf);
+        }
+        return true;
+    }
+
+    mInFlight.push(processBuf);
+    return true;
+}
+
+void MppEncoderUnit::stopHarvest() {
+    if (mSendResultThread) {
+        mSendResultThread->requestExit();
+        mInFlight.wake();
+        mSendResultThread->join();
+        mSendResultThread.clear();
+        mSendResultThread = nullptr;
+    }
+}
+
+void MppEncoderUnit::releaseInFlight() {
+    std::deque<std::shared_ptr<ProcessBuf>> inFlight = mInFlight.takeAll();
+    for (std::shared_ptr<ProcessBuf>& processBuf : inFlight) {
+        if (mIProcessDoneListener) {
+            mIProcessDoneListener->notifyProcessDone(processBuf);
+        }
+    }
+}
+
+MppEncoderUnit::SendResultThread::SendResultThread(MppEncoderUnit* unit, JavaVM* Jvm, jobject javaEncoder)
+    : mUnit(unit),
+      globalJvm(Jvm),
+      mJavaEncoder(javaEncoder) {
+    ALOGI("%s   SendResultThread: %p", __func__, this);
+}
+
+MppEncoderUnit::SendResultThread::~SendResultThread() {
+    ALOGI("%s   SendResultThread: %p", __func__, this);
+}
+
+status_t MppEncoderUnit::SendResultThread::readyToRun() {
+    ALOGI("%s   SendResultThread: %p", __func__, this);
+    mJniEnv = getJniEnv(globalJvm);
+    if (mJniEnv) {
+        jclass clazz = mJniEnv->GetObjectClass(mJavaEncoder);
+        mGetVideoMethodId =
+            getVideoFrameMethod(mJniEnv, clazz, &mVideoMethodWithPts);
+        mGetVideoBufferMethodId = getVideoBufferMethod(mJniEnv, clazz);
+        ALOGI("%s   mGetVideoMethodId: %p withPts: %d mGetVideoBufferMethodId: %p "
+              "packetPool: %p", __func__, mGetVideoMethodId, mVideoMethodWithPts,
+              mGetVideoBufferMethodId, mUnit->mPacketPool.get());
+    } else {
+        ALOGE("%s   cannot get jni env errno: %s", __func__, strerror(errno));
+        return -errno;
+    }
+    return NO_ERROR;
+}
+
+void MppEncoderUnit::SendResultThread::deliver(const ProcessBuf& processBuf,
+                                               const EncodedPacket& packet) {
+    // key frames are always on the base layer and keep their plain flag
+    uint32_t flags = packet.flags |
+                     packet.temporal_id << PacketBufferPool::kFlagTemporalIdShift;
+    if (mJniEnv && mJavaEncoder) {
+        ScopedFrameTrace trace(FrameTracer::STAGE_JNI_DELIVER,
+                               processBuf.sequence, mUnit->mTraceConsumer);
+        if (!deliverVideoPacket(mJniEnv, mJavaEncoder, mUnit->mPacketPool.get(),
+                                mGetVideoBufferMethodId, mGetVideoMethodId,
+                                mVideoMethodWithPts, packet.data,
+                                packet.length, flags, packet.pts_us)) {
+            ALOGE("%s   %zu bytes not delivered", __func__, packet.length);
+        }
+    }
+    for (const PacketSink& sink : mUnit->mPacketSinks) {
+        if (sink.maxTemporalId >= 0 && packet.temporal_id > sink.maxTemporalId) {
+            continue;
+        }
+        sink.sink->onPacket(packet.data, packet.length, flags, packet.pts_us);
+    }
+}
+
+bool MppEncoderUnit::SendResultThread::threadLoop() {
+    std::shared_ptr<ProcessBuf> processBuf;
+    // frames still in flight on exit are drained first
+    if (!mUnit->mInFlight.waitForOldest(kReqWaitTimeoutMs,
+                                        [this] { return exitPending(); },
+                                        &processBuf)) {
+        return !exitPending();
+    }
+
+    // MPP encodes in submission order, these are the packets of processBuf:
+    // one, or one per slice in low delay mode with all but the last partial.
+    // A packet is read in place, it goes back to MPP once delivered.
+    std::shared_ptr<EncodedPacket> packet;
+    int ret;
+    bool first = true;
+    bool last = false;
+    while (!last) {
+        {
+            ScopedFrameTrace trace(FrameTracer::STAGE_MPP_GET, processBuf->sequence,
+                                   mUnit->mTraceConsumer);
+            ret = mUnit->mppEncoder.venc_get_packet(&packet);
+        }
+        if (ret) {
+            // MPP may still read the capture buffer and whatever it puts
+            // out next is not known to be this frame's, the submit thread
+            // replaces the encoder before anything is released
+            ALOGE("%s   venc_get_packet sequence: %u ret: %d", __func__,
+                  processBuf->sequence, ret);
+            mUnit->mInFlight.setFailed(true);
+            return false;
+        }
+        last = !(packet->flags & PacketBufferPool::kFlagPartialFrame);
+
+        // MPP is done reading the capture buffer once the frame is out
+        if (last) {
+            mUnit->mInFlight.popOldest();
+            if (mUnit->mIProcessDoneListener) {
+                mUnit->mIProcessDoneListener->notifyProcessDone(processBuf);
+            }
+        }
+        ALOGI("%s   venc_get_packet success length: %zu flags: %u", __func__,
+              packet->length, packet->flags);
+
+        deliver(*processBuf, *packet);
+        if (first && mUnit->mFirstSliceTraceConsumer >= 0) {
+            FrameTracer::getInstance().recordLatency(
+                mUnit->mFirstSliceTraceConsumer, processBuf->timestampUs);
+        }
+        first = false;
+    }
+    FrameTracer::getInstance().recordLatency(mUnit->mTraceConsumer,
+                                             processBuf->timestampUs);
+    EncoderResourceManager::getInstance().onFrameEncoded(mUnit->mChannelId);
+    if (mUnit->mAdaptiveGop && packet->md_blocks) {
+        // mGop belongs to the submit thread
+        uint32_t movingSad;
+        {
+            std::lock_guard<std::mutex> lk(mUnit->mRcLock);
+            movingSad = mUnit->mMovingSad;
+        }
+        mUnit->onFrameMotion(
+            GopController::summarize(packet->md_blocks, packet->md_stride,
+                                     packet->md_cols, packet->md_rows,
+                                     movingSad),
+            packet->flags & PacketBufferPool::kFlagKeyFrame);
+    }
+
+    return true;
+}
@@ -1,95 +1,250 @@
-//
-// Created by Charlie on 2024/7/31.
-//
-
-#ifndef CAPTUREENCODER_MPPENCODERUNIT_H
-#define CAPTUREENCODER_MPPENCODERUNIT_H
-
-#include <jni.h>
-#include <utils/Thread.h>
-
-#include "IProcessDoneListener.h"
-#include "IProcessUnit.h"
-#include "media/NdkMediaCodec.h"
-#include "JNIEnvUtil.h"
-#include "venc/mpi_enc.h"
-#include "MppChannel.h"
-
-class MppEncoderUnit : public IProcessUnit {
-public:
-    MppEncoderUnit(IProcessDoneListener* processDoneListener, v4l2Buffer* buffer, JavaVM* Jvm, jobject javaEncoder, int preViewFps);
-
-    ~MppEncoderUnit();
-
-    bool shouldProcessImg() override;
-
-    int32_t processBuffer(
-        std::shared_ptr<ProcessBuf>& processBuf) override;
-
-    void waitForNextRequest(std::shared_ptr<ProcessBuf>* out) override;
-
-private:
-
-    class SendResultThread : public Thread {
-    public:
-        explicit SendResultThread(MppEncoder* codec, JavaVM* Jvm, jobject javaEncoder);
-
-        virtual ~SendResultThread();
-
-    private:
-        virtual bool threadLoop();
-
-        virtual status_t readyToRun();
-
-        MppEncoder* mCodec;
-
-        JavaVM* globalJvm = nullptr;
-
-        JNIEnv* mJniEnv;
-
-        jobject mJavaEncoder;
-
-        jmethodID mGetVideoMethodId;
-    };
-
-    sp<SendResultThread> mSendResultThread = nullptr;
-
-    IProcessDoneListener* mIProcessDoneListener;
-
-    v4l2Buffer* mv4l2Buffer;
-
-    int setupCodec();
-
-    virtual bool threadLoop();
-
-    virtual status_t readyToRun();
-
-    JavaVM* globalJvm = nullptr;
-
-    JNIEnv* mJniEnv;
-
-    jobject mJavaEncoder;
-
-    int mPreviewFps;
-
-    VENC_ATTR_t mCodecParam;
-
-    MppEncoder mppEncoder;
-
-    unsigned char* mEncodeData = nullptr;
-
-    int mWidth;
-
-    int mHeight;
-
-    int mFps;
-
-    jmethodID mGetVideoMethodId;
-
-    int mSkipCodecNum = 0;
-
-};
-
-
-
-#endif //CAPTUREENCODER_MPPENCODERUNIT_H
+//
+// Created by Charlie on 2024/7/31.
+//
+
+#ifndef CAPTUREENCODER_MPPENCODERUNIT_H
+#define CAPTUREENCODER_MPPENCODERUNIT_H
+
+#include <jni.h>
+#include <utils/Thread.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "IProcessDoneListener.h"
+#include "IPacketSink.h"
+#include "IProcessUnit.h"
+#include "media/NdkMediaCodec.h"
+#include "JNIEnvUtil.h"
+#include "venc/mpi_enc.h"
+#include "FrameSource.h"
+#include "GopController.h"
+#include "InFlightFrames.h"
+#include "OsdOverlay.h"
+#include "PacketBufferPool.h"
+
+class MppEncoderUnit : public IProcessUnit {
+public:
+    MppEncoderUnit(IProcessDoneListener* processDoneListener, const sp<FrameSource>& source, JavaVM* Jvm, jobject javaEncoder,
+                   const std::shared_ptr<PacketBufferPool>& packetPool, int channelId);
+
+    ~MppEncoderUnit();
+
+    bool shouldProcessImg() override;
+
+    // rate granted to the session in place of the fps of the Java encoder,
+    // set before run()
+    void setEncodeFps(int fps);
+
+    // native consumer of the encoded packets next to Java, add before run().
+    // A sink with a maxTemporalId only gets the layers up to it, negative
+    // is all of them.
+    void addPacketSink(const std::shared_ptr<IPacketSink>& sink,
+                       int maxTemporalId = -1);
+
+    // Hierarchical P with 2 to 4 temporal layers, each one doubling the rate
+    // of the ones below, 1 is a plain P chain. Set before run(), takes
+    // precedence over a smart P GOP.
+    void setTemporalLayers(int layers);
+
+    // Low delay output: every frame is encoded as this many slices and each
+    // one is delivered as soon as the encoder finishes it, flagged
+    // PacketBufferPool::kFlagPartialFrame up to the last one of the frame.
+    // 1 delivers whole frames. Set before run().
+    void setLowDelaySlices(int slices);
+
+    // Changes rate control without restarting the encoder. Calls made
+    // between two frames are merged and applied together before the next
+    // frame is submitted, a negative field keeps the current setting.
+    void setRateControl(const VENC_RC_ATTR_t& rc);
+
+    KeyFrameRequester* getKeyFrameRequester() override;
+
+    // ROI of the frames submitted from now on, in encoder pixels, replacing
+    // the previous ones. Empty clears them. The submit thread picks the new
+    // set up between two frames without ever waiting on this call.
+    void setRoiRegions(const std::vector<RoiRegionCfg>& regions);
+
+    // text the encoder blends over the frames, set before run()
+    void setOsdOverlay(const std::shared_ptr<OsdOverlay>& overlay);
+
+private:
+
+    // frames submitted to MPP whose packets are not out yet
+    static const size_t kMaxInFlight = 2;
+
+    // Harvests the packets of the submitted frames in submission order,
+    // hands each capture buffer back once its packet is out and delivers
+    // the packet to Java, so encoding overlaps the next submission.
+    class SendResultThread : public Thread {
+    public:
+        explicit SendResultThread(MppEncoderUnit* unit, JavaVM* Jvm, jobject javaEncoder);
+
+        virtual ~SendResultThread();
+
+    private:
+        virtual bool threadLoop();
+
+        virtual status_t readyToRun();
+
+        // hands one packet of processBuf to Java and the sinks
+        void deliver(const ProcessBuf& processBuf, const EncodedPacket& packet);
+
+        MppEncoderUnit* mUnit;
+
+        JavaVM* globalJvm = nullptr;
+
+        JNIEnv* mJniEnv;
+
+        jobject mJavaEncoder;
+
+        jmethodID mGetVideoMethodId;
+
+        bool mVideoMethodWithPts = false;
+
+        jmethodID mGetVideoBufferMethodId = nullptr;
+    };
+
+    sp<SendResultThread> mSendResultThread = nullptr;
+
+    // blocks until every frame in flight is harvested, or the harvest
+    // thread gave up on a failed encoder
+    void stopHarvest();
+
+    // hands the capture buffers of the frames in flight back, only once
+    // MPP is gone and no longer reads them
+    void releaseInFlight();
+
+    // Replaces an encoder whose output stopped with a new one on the same
+    // config, the frames in flight are lost. Submit thread only, -EAGAIN
+    // until a second after the last failed attempt.
+    int restartCodec(int64_t nowUs);
+
+    // failed once the harvest thread missed a packet, the packets still to
+    // come no longer pair with the frames in it
+    InFlightFrames<std::shared_ptr<ProcessBuf>> mInFlight{kMaxInFlight};
+
+    int64_t mCodecRetryUs = 0;
+
+    IProcessDoneListener* mIProcessDoneListener;
+
+    sp<FrameSource> mSource;
+
+    int setupCodec();
+
+    // applies the pending rate control, called by the submit thread only
+    void applyRateControl();
+
+    // folds rc into mCodecParam, the config a restarted encoder starts from
+    void mergeRateControl(const VENC_RC_ATTR_t& rc);
+
+    std::mutex mRcLock;
+
+    VENC_RC_ATTR_t mPendingRc;
+
+    std::atomic<bool> mRcPending{false};
+
+    KeyFrameRequester mKeyFrames;
+
+    // written by setRoiRegions(), swapped with mRoi by the submit thread
+    std::mutex mRoiLock;
+
+    std::vector<RoiRegionCfg> mPendingRoi;
+
+    std::atomic<bool> mRoiPending{false};
+
+    // regions attached to every frame, submit thread only
+    std::vector<RoiRegionCfg> mRoi;
+
+    std::shared_ptr<OsdOverlay> mOsd;
+
+    // palette of mOsd the encoder has
+    uint32_t mOsdPaletteGeneration = 0;
+
+    // motion of an encoded frame, from the harvest thread to the submit
+    // thread where the GOP controller runs
+    struct FrameMotion {
+        GopController::MotionStats stats;
+        bool keyFrame;
+    };
+
+    static const size_t kMaxPendingMotion = 16;
+
+    // called by the harvest thread, under mRcLock
+    void onFrameMotion(const GopController::MotionStats& stats, bool keyFrame);
+
+    // feeds the motion of the frames encoded since the last submission to
+    // the GOP controller and queues what it decides, submit thread only
+    void updateGop();
+
+    bool mAdaptiveGop = false;
+
+    bool mMotionLog = false;
+
+    GopController mGop;
+
+    // movingSad of mGop's config for the harvest thread, under mRcLock
+    uint32_t mMovingSad = 0;
+
+    // IDR the controller asked for, kept out of mKeyFrames so its request
+    // counts are the clients' only. Submit thread only.
+    bool mSceneCutIdr = false;
+
+    std::vector<FrameMotion> mPendingMotion;
+
+    // GOP set through setRateControl() for the controller to follow
+    int mPendingBaseGop = -1;
+
+    virtual bool threadLoop();
+
+    virtual status_t readyToRun();
+
+    JavaVM* globalJvm = nullptr;
+
+    JNIEnv* mJniEnv;
+
+    jobject mJavaEncoder;
+
+    VENC_ATTR_t mCodecParam;
+
+    MppEncoder mppEncoder;
+
+    int mWidth;
+
+    int mHeight;
+
+    int mFps;
+
+    // from setEncodeFps(), 0 keeps mFps
+    int mGrantedFps = 0;
+
+    std::shared_ptr<PacketBufferPool> mPacketPool;
+
+    // granted by EncoderResourceManager
+    int mChannelId;
+
+    struct PacketSink {
+        std::shared_ptr<IPacketSink> sink;
+
+        int maxTemporalId;
+    };
+
+    std::vector<PacketSink> mPacketSinks;
+
+    int mTemporalLayers = 1;
+
+    int mLowDelaySlices = 1;
+
+    int mTraceConsumer = -1;
+
+    // latency to the first slice of a frame in low delay mode, the last one
+    // goes to mTraceConsumer
+    int mFirstSliceTraceConsumer = -1;
+
+};
+
+
+
+#endif //CAPTUREENCODER_MPPENCODERUNIT_H
@@ -0,0 +1,203 @@
+#define LOG_TAG "NativeOsdOverlay"
+
+#include "OsdOverlay.h"
+
+#include <errno.h>
+#include <log/log.h>
+#include <string.h>
+
+OsdOverlay::OsdOverlay() {
+    memset(&mPalette, 0, sizeof(mPalette));
+    memset(mData, 0, sizeof(mData));
+    memset(mPendingGlyphs.glyphIndex, 0, sizeof(mPendingGlyphs.glyphIndex));
+    memset(mGlyphs.glyphIndex, 0, sizeof(mGlyphs.glyphIndex));
+    ALOGI("%s   OsdOverlay: %p", __func__, this);
+}
+
+OsdOverlay::~OsdOverlay() {
+    ALOGI("%s   OsdOverlay: %p", __func__, this);
+    for (Region& region : mRegions) {
+        for (Line& line : region.lines) {
+            if (line.buf) {
+                mpp_buffer_put(line.buf);
+                line.buf = nullptr;
+            }
+        }
+    }
+    if (mGroup) {
+        mpp_buffer_group_put(mGroup);
+        mGroup = nullptr;
+    }
+}
+
+int OsdOverlay::setGlyphs(int cellWidth, int cellHeight,
+                          const std::vector<uint8_t>& bitmaps,
+                          const std::string& charset) {
+    if (cellWidth <= 0 || cellHeight <= 0 || cellWidth % 16 ||
+        cellHeight % 16 || charset.empty() ||
+        bitmaps.size() != (size_t)cellWidth * cellHeight * charset.size()) {
+        ALOGE("%s   %zu bytes are no %zu glyphs of %dx%d", __func__,
+              bitmaps.size(), charset.size(), cellWidth, cellHeight);
+        return -EINVAL;
+    }
+    std::lock_guard<std::mutex> lk(mLock);
+    mPendingGlyphs.cellWidth = cellWidth;
+    mPendingGlyphs.cellHeight = cellHeight;
+    mPendingGlyphs.bitmaps = bitmaps;
+    mPendingGlyphs.count = charset.size();
+    memset(mPendingGlyphs.glyphIndex, 0, sizeof(mPendingGlyphs.glyphIndex));
+    for (size_t i = 0; i < charset.size(); i++) {
+        mPendingGlyphs.glyphIndex[(uint8_t)charset[i]] = i;
+    }
+    mPendingGlyphs.generation++;
+    mPending.store(true, std::memory_order_release);
+    ALOGI("%s   %d glyphs of %dx%d", __func__, mPendingGlyphs.count, cellWidth,
+          cellHeight);
+    return 0;
+}
+
+int OsdOverlay::setText(int region, int x, int y, const std::string& text) {
+    if (region < 0 || region >= kMaxRegions || x < 0 || y < 0) {
+        return -EINVAL;
+    }
+    std::lock_guard<std::mutex> lk(mLock);
+    mPendingTexts[region] = {x & ~15, y & ~15, text};
+    mPending.store(true, std::memory_order_release);
+    return 0;
+}
+
+int OsdOverlay::setPalette(const std::vector<uint32_t>& yuva) {
+    if (yuva.empty() || yuva.size() > 256) {
+        return -EINVAL;
+    }
+    std::lock_guard<std::mutex> lk(mLock);
+    for (size_t i = 0; i < yuva.size(); i++) {
+        mPalette.data[i].val = yuva[i];
+    }
+    mPaletteGeneration++;
+    return 0;
+}
+
+uint32_t OsdOverlay::getPaletteGeneration() {
+    std::lock_guard<std::mutex> lk(mLock);
+    return mPaletteGeneration;
+}
+
+void OsdOverlay::getPalette(MppEncOSDPlt* palette) {
+    std::lock_guard<std::mutex> lk(mLock);
+    *palette = mPalette;
+}
+
+void OsdOverlay::setFrameSize(int width, int height) {
+    mFrameWidth = width;
+    mFrameHeight = height;
+}
+
+const MppEncOSDData2* OsdOverlay::prepare() {
+    if (mPending.load(std::memory_order_acquire)) {
+        // a writer holding the lock gets its change in on a later frame
+        std::unique_lock<std::mutex> lk(mLock, std::try_to_lock);
+        if (lk.owns_lock()) {
+            if (mPendingGlyphs.generation != mGlyphs.generation) {
+                mGlyphs = mPendingGlyphs;
+            }
+            for (int i = 0; i < kMaxRegions; i++) {
+                mTexts[i] = mPendingTexts[i];
+            }
+            mPending.store(false, std::memory_order_relaxed);
+        }
+    }
+    if (mGlyphs.count == 0) {
+        return nullptr;
+    }
+
+    MppEncOSDData2* data = &mData[mDataIndex];
+    mDataIndex = (mDataIndex + 1) % kBufferCount;
+    memset(data, 0, sizeof(*data));
+    for (int i = 0; i < kMaxRegions; i++) {
+        const Text& text = mTexts[i];
+        // the glyphs that fit in the frame
+        int cells = text.text.size();
+        if (text.x + cells * mGlyphs.cellWidth > mFrameWidth) {
+            cells = (mFrameWidth - text.x) / mGlyphs.cellWidth;
+        }
+        if (cells <= 0 || text.y + mGlyphs.cellHeight > mFrameHeight) {
+            continue;
+        }
+        Line* line = draw(&mRegions[i], text.text.substr(0, cells));
+        if (line == nullptr) {
+            continue;
+        }
+        MppEncOSDRegion2* osd = &data->region[data->num_region++];
+        osd->enable = 1;
+        osd->inverse = 0;
+        osd->start_mb_x = text.x / 16;
+        osd->start_mb_y = text.y / 16;
+        osd->num_mb_x = cells * mGlyphs.cellWidth / 16;
+        osd->num_mb_y = mGlyphs.cellHeight / 16;
+        osd->buf_offset = 0;
+        osd->buf = line->buf;
+    }
+    return data->num_region ? data : nullptr;
+}
+
+OsdOverlay::Line* OsdOverlay::draw(Region* region, const std::string& text) {
+    if (region->current >= 0 && region->text == text &&
+        region->generation == mGlyphs.generation) {
+        return &region->lines[region->current];
+    }
+    if (mGroup == nullptr &&
+        mpp_buffer_group_get_internal(
+            &mGroup, MPP_BUFFER_TYPE_DRM | MPP_BUFFER_FLAGS_CACHABLE)) {
+        ALOGE("%s   cannot get a buffer group", __func__);
+        mGroup = nullptr;
+        return nullptr;
+    }
+    // the line frames in flight may still read is left alone
+    int next = (region->current + 1) % kBufferCount;
+    Line* line = &region->lines[next];
+    size_t cellSize = (size_t)mGlyphs.cellWidth * mGlyphs.cellHeight;
+    size_t size = cellSize * text.size();
+    if (line->size < size) {
+        if (line->buf) {
+            mpp_buffer_put(line->buf);
+            line->buf = nullptr;
+        }
+        line->size = 0;
+        if (mpp_buffer_get(mGroup, &line->buf, size)) {
+            ALOGE("%s   cannot get %zu bytes", __func__, size);
+            line->buf = nullptr;
+            return nullptr;
+        }
+        line->size = size;
+        line->shown.clear();
+    }
+    // rows run across the whole line, cells sit side by side in them
+    bool sameLayout = line->generation == mGlyphs.generation &&
+                      line->shown.size() == text.size();
+    uint8_t* dst = (uint8_t*)mpp_buffer_get_ptr(line->buf);
+    size_t stride = (size_t)mGlyphs.cellWidth * text.size();
+    int drawn = 0;
+    mpp_buffer_sync_begin(line->buf);
+    for (size_t i = 0; i < text.size(); i++) {
+        if (sameLayout && line->shown[i] == text[i]) {
+            continue;
+        }
+        const uint8_t* glyph =
+            mGlyphs.bitmaps.data() +
+            mGlyphs.glyphIndex[(uint8_t)text[i]] * cellSize;
+        for (int row = 0; row < mGlyphs.cellHeight; row++) {
+            memcpy(dst + row * stride + i * mGlyphs.cellWidth,
+                   glyph + row * mGlyphs.cellWidth, mGlyphs.cellWidth);
+        }
+        drawn++;
+    }
+    mpp_buffer_sync_end(line->buf);
+    ALOGV("%s   %zu cells, %d drawn", __func__, text.size(), drawn);
+    line->shown = text;
+    line->generation = mGlyphs.generation;
+    region->current = next;
+    region->text = text;
+    region->generation = mGlyphs.generation;
+    return line;
+}
@@ -0,0 +1,125 @@
+#ifndef CAPTUREENCODER_OSDOVERLAY_H
+#define CAPTUREENCODER_OSDOVERLAY_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "mpp_buffer.h"
+#include "rk_venc_cmd.h"
+
+// Text burnt into the video by the encoder's OSD block instead of the CPU.
+// Glyphs are uploaded once as palette index bitmaps, one cell each; every
+// text region is a line of cells in an MPP buffer the VEPU blends over the
+// frame. A text change only copies the cells that differ, a ticking clock
+// costs one cell a second and no pixel of the video is touched.
+class OsdOverlay {
+public:
+    // what MppEncOSDData2 holds
+    static const int kMaxRegions = 8;
+
+    OsdOverlay();
+
+    ~OsdOverlay();
+
+    // Glyph cells of cellWidth x cellHeight palette indices, both multiples
+    // of 16, one after the other in bitmaps. charset maps byte i of a text
+    // to glyph i, bytes it lacks are drawn as glyph 0.
+    int setGlyphs(int cellWidth, int cellHeight,
+                  const std::vector<uint8_t>& bitmaps,
+                  const std::string& charset);
+
+    // text of region at x, y in encoder pixels, rounded down to the 16
+    // pixel OSD grid. An empty text hides the region.
+    int setText(int region, int x, int y, const std::string& text);
+
+    // 256 entries at most, alpha << 24 | y << 16 | u << 8 | v as in
+    // MppEncOSDPltVal, later entries keep their value
+    int setPalette(const std::vector<uint32_t>& yuva);
+
+    // the overlay is cut to the encoded frame
+    void setFrameSize(int width, int height);
+
+    // Called by the encoder thread for every frame it submits, the overlay
+    // to attach as KEY_OSD_DATA2 or null for none. Stays valid while the
+    // frame is encoded, until kBufferCount more frames are prepared.
+    const MppEncOSDData2* prepare();
+
+    // bumped with every palette change, 0 while the MPP default is used
+    uint32_t getPaletteGeneration();
+
+    void getPalette(MppEncOSDPlt* palette);
+
+private:
+    // a frame encoding, one queued and the one being prepared
+    static const int kBufferCount = 3;
+
+    struct Glyphs {
+        int cellWidth = 0;
+        int cellHeight = 0;
+        std::vector<uint8_t> bitmaps;
+        int glyphIndex[256];
+        int count = 0;
+        // bumped with every upload, the cells drawn before are stale
+        uint32_t generation = 0;
+    };
+
+    struct Text {
+        int x = 0;
+        int y = 0;
+        std::string text;
+    };
+
+    // one version of a region's line, kBufferCount rotate
+    struct Line {
+        MppBuffer buf = nullptr;
+        size_t size = 0;
+        // what the cells hold and the glyphs they were drawn with
+        std::string shown;
+        uint32_t generation = 0;
+    };
+
+    struct Region {
+        Line lines[kBufferCount];
+        int current = -1;
+        std::string text;
+        uint32_t generation = 0;
+    };
+
+    // draws text into the next line of region, only the changed cells
+    Line* draw(Region* region, const std::string& text);
+
+    std::mutex mLock;
+
+    Glyphs mPendingGlyphs;
+
+    Text mPendingTexts[kMaxRegions];
+
+    std::atomic<bool> mPending{false};
+
+    MppEncOSDPlt mPalette;
+
+    uint32_t mPaletteGeneration = 0;
+
+    // encoder thread only from here
+    Glyphs mGlyphs;
+
+    Text mTexts[kMaxRegions];
+
+    Region mRegions[kMaxRegions];
+
+    MppBufferGroup mGroup = nullptr;
+
+    int mFrameWidth = 0;
+
+    int mFrameHeight = 0;
+
+    MppEncOSDData2 mData[kBufferCount];
+
+    int mDataIndex = 0;
+};
+
+#endif  // CAPTUREENCODER_OSDOVERLAY_H
@@ -0,0 +1,89 @@
+#define LOG_TAG "NativePacketBufferPool"
+
+#include "PacketBufferPool.h"
+
+#include <errno.h>
+#include <log/log.h>
+
+int PacketBufferPool::addBuffer(void* data, size_t capacity) {
+    if (data == nullptr || capacity == 0) {
+        return -EINVAL;
+    }
+    std::lock_guard<std::mutex> lk(mLock);
+    mBuffers.push_back({(uint8_t*)data, capacity, false});
+    return mBuffers.size() - 1;
+}
+
+int PacketBufferPool::acquire(size_t size) {
+    std::lock_guard<std::mutex> lk(mLock);
+    int best = -1;
+    bool fits = false;
+    for (int i = 0; i < (int)mBuffers.size(); i++) {
+        const Buffer& buf = mBuffers[i];
+        if (buf.capacity < size) {
+            continue;
+        }
+        fits = true;
+        if (!buf.out &&
+            (best < 0 || buf.capacity < mBuffers[best].capacity)) {
+            best = i;
+        }
+    }
+    if (best < 0) {
+        if (!fits) {
+            ALOGE("%s   no buffer holds %zu bytes", __func__, size);
+            return -ENOSPC;
+        }
+        mExhausted++;
+        return -EBUSY;
+    }
+    mBuffers[best].out = true;
+    return best;
+}
+
+int PacketBufferPool::release(int index) {
+    std::lock_guard<std::mutex> lk(mLock);
+    if (index < 0 || index >= (int)mBuffers.size() || !mBuffers[index].out) {
+        ALOGE("%s   index: %d is not out", __func__, index);
+        return -EINVAL;
+    }
+    mBuffers[index].out = false;
+    return 0;
+}
+
+uint8_t* PacketBufferPool::getData(int index) {
+    std::lock_guard<std::mutex> lk(mLock);
+    if (index < 0 || index >= (int)mBuffers.size()) {
+        return nullptr;
+    }
+    return mBuffers[index].data;
+}
+
+size_t PacketBufferPool::getCapacity(int index) {
+    std::lock_guard<std::mutex> lk(mLock);
+    if (index < 0 || index >= (int)mBuffers.size()) {
+        return 0;
+    }
+    return mBuffers[index].capacity;
+}
+
+int PacketBufferPool::getBufferCount() {
+    std::lock_guard<std::mutex> lk(mLock);
+    return mBuffers.size();
+}
+
+int PacketBufferPool::getFreeCount() {
+    std::lock_guard<std::mutex> lk(mLock);
+    int count = 0;
+    for (const auto& buf : mBuffers) {
+        if (!buf.out) {
+            count++;
+        }
+    }
+    return count;
+}
+
+int64_t PacketBufferPool::getExhaustedCount() {
+    std::lock_guard<std::mutex> lk(mLock);
+    return mExhausted;
+}
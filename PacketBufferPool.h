@@ -0,0 +1,62 @@
+#ifndef CAPTUREENCODER_PACKETBUFFERPOOL_H
+#define CAPTUREENCODER_PACKETBUFFERPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <mutex>
+#include <vector>
+
+// Tracks which of a fixed set of packet buffers are free. The memory itself
+// belongs to whoever registered it, in practice direct ByteBuffers the Java
+// encoder allocated once, so encoded packets reach Java without a byte[]
+// per frame. Buffers go out with acquire() and come back with release()
+// once Java is done with them. No JNI in here, the pool can be driven by
+// any caller.
+class PacketBufferPool {
+public:
+    // same values as MediaCodec.BUFFER_FLAG_*
+    static const int kFlagKeyFrame = 1;
+    static const int kFlagCodecConfig = 2;
+    static const int kFlagPartialFrame = 8;
+
+    // temporal layer of an MPP packet, in bits MediaCodec leaves clear
+    static const int kFlagTemporalIdShift = 24;
+    static const int kFlagTemporalIdMask = 0x7 << kFlagTemporalIdShift;
+
+    // returns the index the buffer is known by
+    int addBuffer(void* data, size_t capacity);
+
+    // the smallest free buffer holding size bytes, -ENOSPC when none is
+    // large enough, -EBUSY when all that are large enough are out
+    int acquire(size_t size);
+
+    // -EINVAL when index is not out
+    int release(int index);
+
+    uint8_t* getData(int index);
+
+    size_t getCapacity(int index);
+
+    int getBufferCount();
+
+    int getFreeCount();
+
+    // acquire() calls that found no free buffer
+    int64_t getExhaustedCount();
+
+private:
+    struct Buffer {
+        uint8_t* data;
+        size_t capacity;
+        bool out;
+    };
+
+    std::mutex mLock;
+
+    std::vector<Buffer> mBuffers;
+
+    int64_t mExhausted = 0;
+};
+
+#endif  // CAPTUREENCODER_PACKETBUFFERPOOL_H
@@ -0,0 +1,157 @@
+#ifndef CAPTUREENCODER_PROCESSRING_H
+#define CAPTUREENCODER_PROCESSRING_H
+
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <utility>
+
+// Bounded single-producer single-consumer queue. The producer never blocks,
+// a full ring is reported to it. The consumer peeks at the head while it
+// works on it and commits once done, so the slot stays owned until then.
+// The producer may also take back the oldest item the consumer has not
+// started on yet, which is how a slow consumer sheds frames without the
+// consumer having to run. An idle consumer sleeps on a futex that the
+// producer only touches when someone is actually waiting.
+template <typename T, uint32_t N>
+class ProcessRing {
+    static_assert(N && (N & (N - 1)) == 0, "capacity must be a power of two");
+
+public:
+    // producer side, false when the ring is full
+    bool push(const T& item) {
+        uint32_t tail = mTail.load(std::memory_order_relaxed);
+        if (tail - mHead.load(std::memory_order_acquire) == N) {
+            return false;
+        }
+        Slot& slot = mSlots[tail & (N - 1)];
+        slot.item = item;
+        slot.state.store(kQueued, std::memory_order_relaxed);
+        mPending.fetch_add(1, std::memory_order_relaxed);
+        mTail.store(tail + 1, std::memory_order_release);
+        wake();
+        return true;
+    }
+
+    // producer side, moves the oldest item the consumer has not peeked at
+    // into out, false when there is none
+    bool evictOldest(T* out) {
+        uint32_t tail = mTail.load(std::memory_order_relaxed);
+        for (uint32_t i = mHead.load(std::memory_order_acquire); i != tail;
+             i++) {
+            Slot& slot = mSlots[i & (N - 1)];
+            uint8_t expected = kQueued;
+            if (slot.state.compare_exchange_strong(expected, kEvicting,
+                                                   std::memory_order_acquire)) {
+                *out = std::move(slot.item);
+                slot.item = T();
+                mPending.fetch_sub(1, std::memory_order_relaxed);
+                slot.state.store(kEvicted, std::memory_order_release);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // items queued that the consumer has not started on
+    uint32_t pending() const {
+        return mPending.load(std::memory_order_relaxed);
+    }
+
+    // consumer side, the head item or nullptr when empty. The item belongs
+    // to the consumer from here on until commit().
+    T* peek() {
+        while (true) {
+            uint32_t head = mHead.load(std::memory_order_relaxed);
+            if (head == mTail.load(std::memory_order_acquire)) {
+                return nullptr;
+            }
+            Slot& slot = mSlots[head & (N - 1)];
+            uint8_t state = slot.state.load(std::memory_order_acquire);
+            if (state == kTaken) {
+                return &slot.item;
+            }
+            if (state == kQueued &&
+                slot.state.compare_exchange_strong(state, kTaken,
+                                                   std::memory_order_acquire)) {
+                mPending.fetch_sub(1, std::memory_order_relaxed);
+                return &slot.item;
+            }
+            if (state == kEvicting) {
+                // the producer is moving the item out, a few instructions
+                sched_yield();
+                continue;
+            }
+            if (state == kEvicted) {
+                slot.state.store(kFree, std::memory_order_relaxed);
+                mHead.store(head + 1, std::memory_order_release);
+            }
+        }
+    }
+
+    // consumer side, drops the item returned by peek()
+    void commit() {
+        uint32_t head = mHead.load(std::memory_order_relaxed);
+        Slot& slot = mSlots[head & (N - 1)];
+        slot.item = T();
+        slot.state.store(kFree, std::memory_order_relaxed);
+        mHead.store(head + 1, std::memory_order_release);
+    }
+
+    // consumer side, blocks until an item is queued, wake() is called or
+    // timeoutMs passes. Returns true when an item is available.
+    bool wait(int timeoutMs) {
+        if (peek()) {
+            return true;
+        }
+        mWaiters.fetch_add(1, std::memory_order_seq_cst);
+        uint32_t signal = mSignal.load(std::memory_order_seq_cst);
+        if (peek() == nullptr) {
+            struct timespec timeout;
+            timeout.tv_sec = timeoutMs / 1000;
+            timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&mSignal),
+                    FUTEX_WAIT_PRIVATE, signal, &timeout, NULL, 0);
+        }
+        mWaiters.fetch_sub(1, std::memory_order_relaxed);
+        return peek() != nullptr;
+    }
+
+    // interrupt wait(), used on exit
+    void wake() {
+        mSignal.fetch_add(1, std::memory_order_seq_cst);
+        if (mWaiters.load(std::memory_order_seq_cst)) {
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&mSignal),
+                    FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+        }
+    }
+
+private:
+    enum : uint8_t { kFree = 0, kQueued, kTaken, kEvicting, kEvicted };
+
+    struct Slot {
+        T item;
+        std::atomic<uint8_t> state{kFree};
+    };
+
+    // the indices live on their own cache lines, the producer writes mTail
+    // and the consumer mHead
+    alignas(64) std::atomic<uint32_t> mHead{0};
+
+    alignas(64) std::atomic<uint32_t> mTail{0};
+
+    alignas(64) std::atomic<uint32_t> mSignal{0};
+
+    std::atomic<uint32_t> mWaiters{0};
+
+    std::atomic<uint32_t> mPending{0};
+
+    Slot mSlots[N];
+};
+
+#endif  // CAPTUREENCODER_PROCESSRING_H
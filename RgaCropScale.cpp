@@ -3,45 +3,163 @@
 #include "RgaCropScale.h"
 
 #include <RockchipRga.h>
+#include <errno.h>
 #include <hardware/hardware_rockchip.h>
+#include <linux/videodev2.h>
 #include <log/log.h>
+#include <string.h>
 #include <utils/Trace.h>
 
+#include <atomic>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
+#include "im2d_api/im2d.hpp"
 #include "im2d_api/im2d_common.h"
 
 #define TARGET_RK3588
 
 using namespace android;
 
+// enough for a few cameras with 4-8 capture buffers and their window and
+// codec input buffers
+static const size_t kMaxCachedHandles = 64;
+
+struct HandleKey {
+    int fd;
+    uintptr_t addr;
+    int width;
+    int height;
+    int format;
+
+    bool operator<(const HandleKey& other) const {
+        return std::tie(fd, addr, width, height, format) <
+               std::tie(other.fd, other.addr, other.width, other.height,
+                        other.format);
+    }
+};
+
+struct HandleEntry {
+    rga_buffer_handle_t handle;
+    int refs;
+    // dropped from the cache while a blit still used it
+    bool stale;
+    std::list<HandleKey>::iterator lru;
+};
+
+static std::mutex sCacheLock;
+static std::map<HandleKey, std::shared_ptr<HandleEntry>> sHandles;
+static std::list<HandleKey> sLru;
+static std::atomic<uint64_t> sHits(0);
+static std::atomic<uint64_t> sMisses(0);
+
+// called with sCacheLock held
+static void retireHandle(const std::shared_ptr<HandleEntry>& entry) {
+    entry->stale = true;
+    if (entry->refs == 0) {
+        releasebuffer_handle(entry->handle);
+    }
+}
+
+static std::shared_ptr<HandleEntry> acquireHandle(int fd, void* addr,
+                                                  im_handle_param_t* param) {
+    HandleKey key = {fd, fd < 0 ? (uintptr_t)addr : 0, (int)param->width,
+                     (int)param->height, (int)param->format};
+    std::lock_guard<std::mutex> lk(sCacheLock);
+    auto iter = sHandles.find(key);
+    if (iter != sHandles.end()) {
+        sHits++;
+        std::shared_ptr<HandleEntry> entry = iter->second;
+        sLru.splice(sLru.begin(), sLru, entry->lru);
+        entry->refs++;
+        return entry;
+    }
+
+    sMisses++;
+    rga_buffer_handle_t handle = fd < 0 ? importbuffer_virtualaddr(addr, param)
+                                        : importbuffer_fd(fd, param);
+    if (handle == 0) {
+        ALOGE("%s   import fd: %d addr: %p failed", __func__, fd, addr);
+        return nullptr;
+    }
+    if (sHandles.size() >= kMaxCachedHandles) {
+        auto oldest = sHandles.find(sLru.back());
+        retireHandle(oldest->second);
+        sHandles.erase(oldest);
+        sLru.pop_back();
+    }
+    std::shared_ptr<HandleEntry> entry = std::make_shared<HandleEntry>();
+    entry->handle = handle;
+    entry->refs = 1;
+    entry->stale = false;
+    sLru.push_front(key);
+    entry->lru = sLru.begin();
+    sHandles[key] = entry;
+    return entry;
+}
+
+static void releaseHandle(const std::shared_ptr<HandleEntry>& entry) {
+    std::lock_guard<std::mutex> lk(sCacheLock);
+    entry->refs--;
+    if (entry->stale && entry->refs == 0) {
+        releasebuffer_handle(entry->handle);
+    }
+}
+
+void RgaCropScale::invalidateCache() {
+    std::lock_guard<std::mutex> lk(sCacheLock);
+    for (auto& pair : sHandles) {
+        retireHandle(pair.second);
+    }
+    ALOGI("%s   released: %zu hits: %llu misses: %llu", __func__,
+          sHandles.size(), (unsigned long long)sHits.load(),
+          (unsigned long long)sMisses.load());
+    sHandles.clear();
+    sLru.clear();
+}
+
+void RgaCropScale::getCacheStats(uint64_t* hits, uint64_t* misses) {
+    *hits = sHits.load();
+    *misses = sMisses.load();
+}
+
 void RgaCropScale::convertFormat(int srcWidth, int srcHeight, int srcFd,
                                  void* srcAddr, int srcFormat, int dstWidth,
                                  int dstHeight, int dstFd, void* dstAddr,
                                  int dstFormat) {
     ATRACE_CALL();
     ALOGI(
-        "%s   srcWidth: %d srcHeight: %d srcAddr: %p dstWidth: %d dstHeight: "
-        "%d dstAddr: %p",
-        __func__, srcWidth, srcHeight, srcAddr, dstWidth, dstHeight, dstAddr);
+        "%s   srcWidth: %d srcHeight: %d srcFd: %d srcAddr: %p dstWidth: %d "
+        "dstHeight: %d dstAddr: %p",
+        __func__, srcWidth, srcHeight, srcFd, srcAddr, dstWidth, dstHeight,
+        dstAddr);
     RockchipRga& rkRga(RockchipRga::get());
-    rga_buffer_handle_t src_handle;
-    rga_buffer_handle_t dst_handle;
+    std::shared_ptr<HandleEntry> src_handle;
+    std::shared_ptr<HandleEntry> dst_handle;
     im_handle_param_t param;
     param.width = srcWidth;
     param.height = srcHeight;
     param.format = srcFormat;
 
     rga_info_t srcinfo;
+    memset(&srcinfo, 0, sizeof(srcinfo));
 
-    if (srcFd == -1) {
+    // by fd the capture buffer is never touched through its CPU mapping, no
+    // per-frame page walk or cache maintenance on the 4K source
+    if (srcFd < 0) {
         srcinfo.fd = -1;
         srcinfo.virAddr = srcAddr;
 #if defined(TARGET_RK3588)
-        src_handle = importbuffer_virtualaddr(srcAddr, &param);
+        src_handle = acquireHandle(-1, srcAddr, &param);
 #endif
     } else {
         srcinfo.fd = srcFd;
 #if defined(TARGET_RK3588)
-        src_handle = importbuffer_fd(srcFd, &param);
+        src_handle = acquireHandle(srcFd, nullptr, &param);
 #endif
     }
 
@@ -55,6 +173,7 @@ void RgaCropScale::convertFormat(int srcWidth, int srcHeight, int srcFd,
     srcinfo.rect.format = srcFormat;
 
     rga_info_t dstinfo;
+    memset(&dstinfo, 0, sizeof(dstinfo));
 
     dstinfo.mmuFlag = 1;
 
@@ -62,16 +181,16 @@ void RgaCropScale::convertFormat(int srcWidth, int srcHeight, int srcFd,
     param.height = dstHeight;
     param.format = dstFormat;
 
-    if (dstFd == -1) {
+    if (dstFd < 0) {
         dstinfo.fd = -1;
         dstinfo.virAddr = dstAddr;
 #if defined(TARGET_RK3588)
-        dst_handle = importbuffer_virtualaddr(dstAddr, &param);
+        dst_handle = acquireHandle(-1, dstAddr, &param);
 #endif
     } else {
         dstinfo.fd = dstFd;
 #if defined(TARGET_RK3588)
-        dst_handle = importbuffer_fd(dstFd, &param);
+        dst_handle = acquireHandle(dstFd, nullptr, &param);
 #endif
     }
 
@@ -83,13 +202,86 @@ void RgaCropScale::convertFormat(int srcWidth, int srcHeight, int srcFd,
     dstinfo.rect.hstride = dstHeight;
     dstinfo.rect.format = dstFormat;
 
-    srcinfo.handle = src_handle;
-    srcinfo.fd = 0;
-    dstinfo.handle = dst_handle;
-    dstinfo.fd = 0;
+    if (src_handle && dst_handle) {
+        srcinfo.handle = src_handle->handle;
+        srcinfo.fd = 0;
+        dstinfo.handle = dst_handle->handle;
+        dstinfo.fd = 0;
+
+        rkRga.RkRgaBlit(&srcinfo, &dstinfo, NULL);
+    }
+
+    if (src_handle) {
+        releaseHandle(src_handle);
+    }
+    if (dst_handle) {
+        releaseHandle(dst_handle);
+    }
+}
+static int rgaFormatOf(uint32_t v4l2Format) {
+    // YUYV is passed to RGA the same way convertFormat callers do
+    return v4l2Format == V4L2_PIX_FMT_YUYV ? 0x1c << 8 : RK_FORMAT_YCbCr_420_SP;
+}
+
+int RgaCropScale::resizeBatch(const Image& src, const Image* dsts,
+                              const Rect* crops, int count) {
+    ATRACE_CALL();
+    std::vector<std::shared_ptr<HandleEntry>> handles;
+    im_handle_param_t param;
+    param.width = src.width;
+    param.height = src.height;
+    param.format = rgaFormatOf(src.format);
+    std::shared_ptr<HandleEntry> srcHandle =
+        acquireHandle(src.fd, src.addr, &param);
+    if (!srcHandle) {
+        return -EINVAL;
+    }
+    handles.push_back(srcHandle);
+    rga_buffer_t srcBuf = wrapbuffer_handle(srcHandle->handle, src.width,
+                                            src.height, param.format);
 
-    rkRga.RkRgaBlit(&srcinfo, &dstinfo, NULL);
+    int ret = 0;
+    im_job_handle_t job = imbeginJob();
+    for (int i = 0; i < count; i++) {
+        param.width = dsts[i].width;
+        param.height = dsts[i].height;
+        param.format = rgaFormatOf(dsts[i].format);
+        std::shared_ptr<HandleEntry> dstHandle =
+            acquireHandle(dsts[i].fd, dsts[i].addr, &param);
+        if (!dstHandle) {
+            ret = -EINVAL;
+            break;
+        }
+        handles.push_back(dstHandle);
+        rga_buffer_t dstBuf = wrapbuffer_handle(
+            dstHandle->handle, dsts[i].width, dsts[i].height, param.format);
+        IM_STATUS status;
+        if (crops && crops[i].width > 0) {
+            im_rect rect = {crops[i].x, crops[i].y, crops[i].width,
+                            crops[i].height};
+            status = imcropTask(job, srcBuf, dstBuf, rect);
+        } else {
+            status = imresizeTask(job, srcBuf, dstBuf);
+        }
+        if (status != IM_STATUS_SUCCESS) {
+            ALOGE("%s   imresizeTask %dx%d failed: %s", __func__,
+                  dsts[i].width, dsts[i].height, imStrError(status));
+            ret = -EINVAL;
+            break;
+        }
+    }
+    if (ret == 0) {
+        IM_STATUS status = imendJob(job, IM_SYNC);
+        if (status != IM_STATUS_SUCCESS) {
+            ALOGE("%s   imendJob failed: %s", __func__, imStrError(status));
+            ret = -EIO;
+        }
+    } else {
+        imcancelJob(job);
+    }
 
-    releasebuffer_handle(src_handle);
-    releasebuffer_handle(dst_handle);
-}
\ No newline at end of file
+    for (const auto& handle : handles) {
+        releaseHandle(handle);
+    }
+    return ret;
+}
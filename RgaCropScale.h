@@ -1,12 +1,43 @@
 #ifndef CAPTUREENCODER_RGACROPSCALE_H
 #define CAPTUREENCODER_RGACROPSCALE_H
 
+#include <stdint.h>
+
 class RgaCropScale {
 public:
+    // fd is preferred, addr is used when fd < 0. format is a V4L2 fourcc.
+    struct Image {
+        int fd;
+        void* addr;
+        int width;
+        int height;
+        uint32_t format;
+    };
+
+    // region of the source, width 0 means the whole frame
+    struct Rect {
+        int x;
+        int y;
+        int width;
+        int height;
+    };
+
     static void convertFormat(int srcWidth, int srcHeight, int srcFd,
                               void* srcAddr, int srcFormat, int dstWidth,
                               int dstHeight, int dstFd, void* dstAddr,
                               int dstFormat);
+
+    // RGA handles are imported once per buffer and kept until invalidated.
+    // Call this whenever fds or mappings may be reused for other memory:
+    // stream off, buffer reallocation or a window reconfigure.
+    static void invalidateCache();
+
+    static void getCacheStats(uint64_t* hits, uint64_t* misses);
+
+    // scale and convert src into every dst, submitted as one RGA job. crops
+    // may be null, otherwise crops[i] is the part of src scaled into dsts[i]
+    static int resizeBatch(const Image& src, const Image* dsts,
+                           const Rect* crops, int count);
 };
 
 #endif  // CAPTUREENCODER_RGACROPSCALE_H
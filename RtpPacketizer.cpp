@@ -0,0 +1,276 @@
+#define LOG_TAG "NativeRtpPacketizer"
+
+#include "RtpPacketizer.h"
+
+#include <errno.h>
+#include <log/log.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "AnnexB.h"
+#include "PacketBufferPool.h"
+
+namespace {
+
+const int kHevcAggregation = 48;
+const int kHevcFragmentation = 49;
+const int kHevcAud = 35;
+const int kH264Aggregation = 24;  // STAP-A
+const int kH264Fragmentation = 28;  // FU-A
+const int kH264Aud = 9;
+
+}  // namespace
+
+RtpPacketizer::RtpPacketizer(Codec codec, const std::string& host, int port,
+                             int payloadType, uint32_t ssrc, int mtu)
+    : mCodec(codec),
+      mHost(host),
+      mPort(port),
+      mPayloadType(payloadType & 0x7f),
+      mSsrc(ssrc),
+      mMtu(mtu) {
+    memset(mMessages, 0, sizeof(mMessages));
+    ALOGI("%s   %s %s:%d pt: %d ssrc: %08x mtu: %d", __func__,
+          mCodec == CODEC_HEVC ? "hevc" : "h264", mHost.c_str(), mPort,
+          mPayloadType, mSsrc, mMtu);
+}
+
+RtpPacketizer::~RtpPacketizer() {
+    ALOGI("%s   sent: %lld dropped: %lld", __func__, (long long)mSentDatagrams,
+          (long long)mDroppedDatagrams);
+    if (mFd >= 0) {
+        close(mFd);
+        mFd = -1;
+    }
+}
+
+int RtpPacketizer::open() {
+    std::lock_guard<std::mutex> lk(mLock);
+    if (mFd >= 0) {
+        return 0;
+    }
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+    char port[8];
+    snprintf(port, sizeof(port), "%d", mPort);
+    struct addrinfo* info = nullptr;
+    int ret = getaddrinfo(mHost.c_str(), port, &hints, &info);
+    if (ret) {
+        ALOGE("%s   bad destination %s:%d: %s", __func__, mHost.c_str(), mPort,
+              gai_strerror(ret));
+        return -EINVAL;
+    }
+    mFd = socket(info->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (mFd < 0 || connect(mFd, info->ai_addr, info->ai_addrlen)) {
+        ret = -errno;
+        ALOGE("%s   cannot reach %s:%d errno: %s", __func__, mHost.c_str(),
+              mPort, strerror(errno));
+        if (mFd >= 0) {
+            close(mFd);
+            mFd = -1;
+        }
+        freeaddrinfo(info);
+        return ret;
+    }
+    freeaddrinfo(info);
+    // a key frame leaves as one burst of datagrams
+    int sendBuffer = 1024 * 1024;
+    setsockopt(mFd, SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(sendBuffer));
+    return 0;
+}
+
+int64_t RtpPacketizer::getSentDatagrams() {
+    std::lock_guard<std::mutex> lk(mLock);
+    return mSentDatagrams;
+}
+
+int64_t RtpPacketizer::getDroppedDatagrams() {
+    std::lock_guard<std::mutex> lk(mLock);
+    return mDroppedDatagrams;
+}
+
+void RtpPacketizer::onPacket(const uint8_t* data, size_t length,
+                             uint32_t flags, int64_t ptsUs) {
+    std::lock_guard<std::mutex> lk(mLock);
+    if (mFd < 0 || data == nullptr || length == 0) {
+        return;
+    }
+    uint32_t timestamp = (uint32_t)(ptsUs * 9 / 100);  // 90 kHz
+    size_t maxPayload = mMtu - kRtpHeaderSize;
+    forEachNal(data, length, [&](const uint8_t* nal, size_t size) {
+        if (size <= (size_t)nalHeaderSize()) {
+            return;
+        }
+        int type = mCodec == CODEC_HEVC ? (nal[0] >> 1) & 0x3f : nal[0] & 0x1f;
+        if (type == (mCodec == CODEC_HEVC ? kHevcAud : kH264Aud)) {
+            return;
+        }
+        // aggregation header, then a 16 bit size per NAL unit
+        if (mAggregatedCount == kMaxAggregated ||
+            nalHeaderSize() + mAggregatedBytes + 2 + size > maxPayload) {
+            sendAggregated(timestamp);
+        }
+        if (size > maxPayload) {
+            sendFragmented(nal, size, timestamp);
+            return;
+        }
+        mAggregated[mAggregatedCount] = nal;
+        mAggregatedSizes[mAggregatedCount] = size;
+        mAggregatedCount++;
+        mAggregatedBytes += 2 + size;
+    });
+    sendAggregated(timestamp);
+    // the marker closes the access unit, a slice of a low delay encode goes
+    // out right away and leaves it open
+    if (mBatchCount > 0 && !(flags & PacketBufferPool::kFlagPartialFrame)) {
+        mBatch[mBatchCount - 1].header[1] |= 0x80;
+    }
+    flush();
+}
+
+RtpPacketizer::Datagram* RtpPacketizer::beginDatagram(uint32_t timestamp) {
+    if (mBatchCount == kBatchSize) {
+        flush();
+    }
+    Datagram* datagram = &mBatch[mBatchCount++];
+    datagram->headerSize = 0;
+    datagram->iovCount = 0;
+    uint8_t header[kRtpHeaderSize] = {
+        0x80,  // version 2
+        (uint8_t)mPayloadType,
+        (uint8_t)(mSequence >> 8),
+        (uint8_t)mSequence,
+        (uint8_t)(timestamp >> 24),
+        (uint8_t)(timestamp >> 16),
+        (uint8_t)(timestamp >> 8),
+        (uint8_t)timestamp,
+        (uint8_t)(mSsrc >> 24),
+        (uint8_t)(mSsrc >> 16),
+        (uint8_t)(mSsrc >> 8),
+        (uint8_t)mSsrc,
+    };
+    mSequence++;
+    addHeader(datagram, header, sizeof(header));
+    return datagram;
+}
+
+void RtpPacketizer::addHeader(Datagram* datagram, const uint8_t* data,
+                              size_t length) {
+    uint8_t* dst = datagram->header + datagram->headerSize;
+    memcpy(dst, data, length);
+    datagram->headerSize += length;
+    // header bytes written back to back share one iovec
+    if (datagram->iovCount > 0) {
+        struct iovec* last = &datagram->iov[datagram->iovCount - 1];
+        if ((uint8_t*)last->iov_base + last->iov_len == dst) {
+            last->iov_len += length;
+            return;
+        }
+    }
+    datagram->iov[datagram->iovCount].iov_base = dst;
+    datagram->iov[datagram->iovCount].iov_len = length;
+    datagram->iovCount++;
+}
+
+void RtpPacketizer::addPayload(Datagram* datagram, const uint8_t* data,
+                               size_t length) {
+    datagram->iov[datagram->iovCount].iov_base = (void*)data;
+    datagram->iov[datagram->iovCount].iov_len = length;
+    datagram->iovCount++;
+}
+
+void RtpPacketizer::sendSingle(const uint8_t* nal, size_t size,
+                               uint32_t timestamp) {
+    Datagram* datagram = beginDatagram(timestamp);
+    addPayload(datagram, nal, size);
+}
+
+void RtpPacketizer::sendAggregated(uint32_t timestamp) {
+    if (mAggregatedCount == 1) {
+        sendSingle(mAggregated[0], mAggregatedSizes[0], timestamp);
+    } else if (mAggregatedCount > 1) {
+        Datagram* datagram = beginDatagram(timestamp);
+        if (mCodec == CODEC_HEVC) {
+            // F, layer and TID of the first NAL unit, all share them here
+            uint8_t header[2] = {
+                (uint8_t)((mAggregated[0][0] & 0x81) | kHevcAggregation << 1),
+                mAggregated[0][1]};
+            addHeader(datagram, header, sizeof(header));
+        } else {
+            uint8_t nri = 0;
+            for (int i = 0; i < mAggregatedCount; i++) {
+                nri |= mAggregated[i][0] & 0xe0;
+            }
+            uint8_t header = nri | kH264Aggregation;
+            addHeader(datagram, &header, 1);
+        }
+        for (int i = 0; i < mAggregatedCount; i++) {
+            uint8_t size[2] = {(uint8_t)(mAggregatedSizes[i] >> 8),
+                               (uint8_t)mAggregatedSizes[i]};
+            addHeader(datagram, size, sizeof(size));
+            addPayload(datagram, mAggregated[i], mAggregatedSizes[i]);
+        }
+    }
+    mAggregatedCount = 0;
+    mAggregatedBytes = 0;
+}
+
+void RtpPacketizer::sendFragmented(const uint8_t* nal, size_t size,
+                                   uint32_t timestamp) {
+    uint8_t header[3];
+    size_t headerSize;
+    int type;
+    if (mCodec == CODEC_HEVC) {
+        type = (nal[0] >> 1) & 0x3f;
+        header[0] = (nal[0] & 0x81) | kHevcFragmentation << 1;
+        header[1] = nal[1];
+        headerSize = 3;
+    } else {
+        type = nal[0] & 0x1f;
+        header[0] = (nal[0] & 0xe0) | kH264Fragmentation;
+        headerSize = 2;
+    }
+    // the NAL header is carried in the payload and FU headers
+    const uint8_t* payload = nal + nalHeaderSize();
+    size_t remaining = size - nalHeaderSize();
+    size_t maxChunk = mMtu - kRtpHeaderSize - headerSize;
+    bool start = true;
+    while (remaining > 0) {
+        size_t chunk = remaining < maxChunk ? remaining : maxChunk;
+        bool end = chunk == remaining;
+        header[headerSize - 1] = (start ? 0x80 : 0) | (end ? 0x40 : 0) | type;
+        Datagram* datagram = beginDatagram(timestamp);
+        addHeader(datagram, header, headerSize);
+        addPayload(datagram, payload, chunk);
+        payload += chunk;
+        remaining -= chunk;
+        start = false;
+    }
+}
+
+void RtpPacketizer::flush() {
+    for (int i = 0; i < mBatchCount; i++) {
+        mMessages[i].msg_hdr.msg_iov = mBatch[i].iov;
+        mMessages[i].msg_hdr.msg_iovlen = mBatch[i].iovCount;
+    }
+    int sent = 0;
+    while (sent < mBatchCount) {
+        int ret = sendmmsg(mFd, mMessages + sent, mBatchCount - sent, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ALOGE("%s   sendmmsg failed errno: %s", __func__, strerror(errno));
+            mDroppedDatagrams += mBatchCount - sent;
+            break;
+        }
+        sent += ret;
+        mSentDatagrams += ret;
+    }
+    mBatchCount = 0;
+}
@@ -0,0 +1,121 @@
+#ifndef CAPTUREENCODER_RTPPACKETIZER_H
+#define CAPTUREENCODER_RTPPACKETIZER_H
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <mutex>
+#include <string>
+
+#include "IPacketSink.h"
+
+// Sends the encoder output as RTP over UDP, HEVC per RFC 7798 and H.264 per
+// RFC 6184. Small NAL units go out together in one aggregation packet
+// (AP / STAP-A), large ones are split into fragmentation units (FU /
+// FU-A). Datagrams are scatter-gather lists over the encoded packet, only
+// the RTP and payload headers are written here, and a whole access unit is
+// handed to the kernel in sendmmsg() batches.
+class RtpPacketizer : public IPacketSink {
+public:
+    enum Codec {
+        CODEC_HEVC = 0,
+        CODEC_H264,
+    };
+
+    // host is a numeric IPv4 or IPv6 address, mtu bounds the datagrams
+    RtpPacketizer(Codec codec, const std::string& host, int port,
+                  int payloadType, uint32_t ssrc, int mtu = 1400);
+
+    ~RtpPacketizer();
+
+    // connects the socket, -errno on failure
+    int open();
+
+    void onPacket(const uint8_t* data, size_t length, uint32_t flags,
+                  int64_t ptsUs) override;
+
+    int64_t getSentDatagrams();
+
+    // datagrams the socket did not take
+    int64_t getDroppedDatagrams();
+
+private:
+    static const int kBatchSize = 64;
+
+    // NAL units in one aggregation packet
+    static const int kMaxAggregated = 8;
+
+    static const int kMaxIov = 2 + 2 * kMaxAggregated;
+
+    static const int kRtpHeaderSize = 12;
+
+    // RTP header, payload header and the aggregated NAL sizes
+    static const int kMaxHeaderSize = kRtpHeaderSize + 3 + 2 * kMaxAggregated;
+
+    struct Datagram {
+        uint8_t header[kMaxHeaderSize];
+        size_t headerSize;
+        struct iovec iov[kMaxIov];
+        int iovCount;
+    };
+
+    int nalHeaderSize() const { return mCodec == CODEC_HEVC ? 2 : 1; }
+
+    // starts a datagram with its RTP header, flushing the batch when full
+    Datagram* beginDatagram(uint32_t timestamp);
+
+    // bytes written here, copied into the datagram's header space
+    void addHeader(Datagram* datagram, const uint8_t* data, size_t length);
+
+    // bytes of the encoded packet, referenced in place
+    void addPayload(Datagram* datagram, const uint8_t* data, size_t length);
+
+    void sendSingle(const uint8_t* nal, size_t size, uint32_t timestamp);
+
+    void sendFragmented(const uint8_t* nal, size_t size, uint32_t timestamp);
+
+    // the pending small NAL units as one aggregation packet, or alone when
+    // there is only one
+    void sendAggregated(uint32_t timestamp);
+
+    void flush();
+
+    Codec mCodec;
+
+    std::string mHost;
+
+    int mPort;
+
+    int mPayloadType;
+
+    uint32_t mSsrc;
+
+    int mMtu;
+
+    int mFd = -1;
+
+    std::mutex mLock;
+
+    uint16_t mSequence = 0;
+
+    const uint8_t* mAggregated[kMaxAggregated];
+
+    size_t mAggregatedSizes[kMaxAggregated];
+
+    int mAggregatedCount = 0;
+
+    size_t mAggregatedBytes = 0;
+
+    Datagram mBatch[kBatchSize];
+
+    struct mmsghdr mMessages[kBatchSize];
+
+    int mBatchCount = 0;
+
+    int64_t mSentDatagrams = 0;
+
+    int64_t mDroppedDatagrams = 0;
+};
+
+#endif  // CAPTUREENCODER_RTPPACKETIZER_H
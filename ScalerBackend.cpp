@@ -0,0 +1,24 @@
+#define LOG_TAG "NativeScalerBackend"
+
+#include "ScalerBackend.h"
+
+#include <cutils/properties.h>
+#include <string.h>
+
+std::unique_ptr<ScalerBackend> ScalerBackend::create() {
+    char value[PROPERTY_VALUE_MAX];
+    property_get("debug.capture.scaler", value, "rga");
+    if (strcmp(value, "sw") == 0) {
+        return std::unique_ptr<ScalerBackend>(new SoftwareScalerBackend());
+    }
+    return std::unique_ptr<ScalerBackend>(new RgaScalerBackend());
+}
+
+RgaScalerBackend::~RgaScalerBackend() {
+    RgaCropScale::invalidateCache();
+}
+
+int RgaScalerBackend::scale(const Image& src, const Image* dsts,
+                            const Rect* crops, int count) {
+    return RgaCropScale::resizeBatch(src, dsts, crops, count);
+}
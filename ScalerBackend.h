@@ -0,0 +1,53 @@
+#ifndef CAPTUREENCODER_SCALERBACKEND_H
+#define CAPTUREENCODER_SCALERBACKEND_H
+
+#include <memory>
+
+#include "RgaCropScale.h"
+
+// Scales one source image into several outputs in a single submission.
+class ScalerBackend {
+public:
+    typedef RgaCropScale::Image Image;
+
+    typedef RgaCropScale::Rect Rect;
+
+    virtual ~ScalerBackend() {}
+
+    // the backend of the debug.capture.scaler property, sw for the software
+    // one and RGA otherwise
+    static std::unique_ptr<ScalerBackend> create();
+
+    virtual const char* getName() = 0;
+
+    // crops may be null, see RgaCropScale::resizeBatch
+    virtual int scale(const Image& src, const Image* dsts, const Rect* crops,
+                      int count) = 0;
+};
+
+class RgaScalerBackend : public ScalerBackend {
+public:
+    // drops the RGA handles, the fds and mappings of the outputs get reused
+    ~RgaScalerBackend();
+
+    const char* getName() override { return "rga"; }
+
+    int scale(const Image& src, const Image* dsts, const Rect* crops,
+              int count) override;
+};
+
+// Nearest-neighbour CPU scaler from NV12/YUYV to NV12, far too slow for 4K
+// at frame rate but good enough to run the scaler stage off-device. It has
+// no RGA dependency, SoftwareScalerBackend.cpp builds on the host.
+class SoftwareScalerBackend : public ScalerBackend {
+public:
+    const char* getName() override { return "software"; }
+
+    int scale(const Image& src, const Image* dsts, const Rect* crops,
+              int count) override;
+
+private:
+    void scaleOne(const Image& src, const Image& dst, const Rect& crop);
+};
+
+#endif  // CAPTUREENCODER_SCALERBACKEND_H
@@ -0,0 +1,287 @@
+#define LOG_TAG "NativeScalerStage"
+
+#include "ScalerStage.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/dma-heap.h>
+#include <linux/videodev2.h>
+#include <log/log.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <utils/Trace.h>
+
+#include <utility>
+
+#include "FrameTracer.h"
+
+ScalerStage::ScalerStage(IProcessDoneListener* processDoneListener,
+                         std::unique_ptr<ScalerBackend> backend)
+    : mIProcessDoneListener(processDoneListener), mBackend(std::move(backend)) {
+    mHeapFd = ::open("/dev/dma_heap/system", O_RDONLY | O_CLOEXEC);
+    if (mHeapFd < 0) {
+        ALOGI("%s   no dma heap (%s), using malloc", __func__, strerror(errno));
+    }
+    mTraceConsumer = FrameTracer::getInstance().registerConsumer("ScalerStage");
+    ALOGI("%s   ScalerStage: %p backend: %s", __func__, this,
+          mBackend->getName());
+}
+
+ScalerStage::~ScalerStage() {
+    ALOGI("%s   ScalerStage: %p", __func__, this);
+    FrameTracer::getInstance().unregisterConsumer(mTraceConsumer);
+    for (auto& output : mOutputs) {
+        for (auto& buf : output.buffers) {
+            freeBuffer(&buf);
+        }
+    }
+    mOutputs.clear();
+    if (mHeapFd >= 0) {
+        ::close(mHeapFd);
+        mHeapFd = -1;
+    }
+    // mBackend goes next, the RGA one drops its handles of the pool fds
+    // before their numbers get reused
+}
+
+int ScalerStage::allocBuffer(PoolBuffer* buf, size_t size) {
+    buf->fd = -1;
+    buf->start = nullptr;
+    buf->size = size;
+    buf->refs = 0;
+    if (mHeapFd < 0) {
+        buf->start = malloc(size);
+        return buf->start ? 0 : -ENOMEM;
+    }
+    struct dma_heap_allocation_data data;
+    memset(&data, 0, sizeof(data));
+    data.len = size;
+    data.fd_flags = O_RDWR | O_CLOEXEC;
+    if (ioctl(mHeapFd, DMA_HEAP_IOCTL_ALLOC, &data)) {
+        ALOGE("%s   DMA_HEAP_IOCTL_ALLOC failed: %s", __func__, strerror(errno));
+        return -errno;
+    }
+    buf->fd = data.fd;
+    buf->start =
+        mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, buf->fd, 0);
+    if (buf->start == MAP_FAILED) {
+        buf->start = nullptr;
+        ALOGE("%s   mmap failed: %s", __func__, strerror(errno));
+        return -errno;
+    }
+    return 0;
+}
+
+void ScalerStage::freeBuffer(PoolBuffer* buf) {
+    if (buf->fd >= 0) {
+        if (buf->start) {
+            munmap(buf->start, buf->size);
+        }
+        ::close(buf->fd);
+    } else {
+        free(buf->start);
+    }
+    buf->fd = -1;
+    buf->start = nullptr;
+}
+
+int ScalerStage::addOutput(const OutputSpec& spec,
+                           const sp<IProcessUnit>& consumer) {
+    if (spec.format != V4L2_PIX_FMT_NV12) {
+        ALOGE("%s   unsupported format: 0x%x", __func__, spec.format);
+        return -EINVAL;
+    }
+    {
+        std::lock_guard<std::mutex> lk(mPoolLock);
+        for (size_t i = 0; i < mOutputs.size(); i++) {
+            if (mOutputs[i].spec == spec) {
+                mOutputs[i].consumers.push_back(consumer);
+                ALOGI("%s   output: %zu %ux%u shared by %zu consumers",
+                      __func__, i, spec.width, spec.height,
+                      mOutputs[i].consumers.size());
+                return 0;
+            }
+        }
+    }
+    Output output;
+    output.spec = spec;
+    output.consumers.push_back(consumer);
+    output.drops = 0;
+    output.buffers.resize(kBuffersPerOutput);
+    size_t size = spec.width * spec.height * 3 / 2;
+    for (int i = 0; i < kBuffersPerOutput; i++) {
+        int ret = allocBuffer(&output.buffers[i], size);
+        if (ret < 0) {
+            for (int j = 0; j <= i; j++) {
+                freeBuffer(&output.buffers[j]);
+            }
+            return ret;
+        }
+    }
+    ALOGI("%s   output: %zu %ux%u", __func__, mOutputs.size(), spec.width,
+          spec.height);
+    std::lock_guard<std::mutex> lk(mPoolLock);
+    mOutputs.push_back(output);
+    return 0;
+}
+
+bool ScalerStage::wantsFrame(uint32_t sequence) {
+    for (const auto& output : mOutputs) {
+        for (const auto& consumer : output.consumers) {
+            if (consumer->wantsFrame(sequence)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+int64_t ScalerStage::getSavedConversions() {
+    std::lock_guard<std::mutex> lk(mPoolLock);
+    return mSavedConversions;
+}
+
+int64_t ScalerStage::getOutputDrops() {
+    std::lock_guard<std::mutex> lk(mPoolLock);
+    int64_t drops = 0;
+    for (const auto& output : mOutputs) {
+        drops += output.drops;
+    }
+    return drops;
+}
+
+status_t ScalerStage::readyToRun() {
+    ALOGI("%s   ScalerStage: %p", __func__, this);
+    return NO_ERROR;
+}
+
+int ScalerStage::scaleOutputs(const ProcessBuf& src,
+                              const std::vector<int>& outputs,
+                              const std::vector<int>& slots) {
+    std::vector<RgaCropScale::Image> images(outputs.size());
+    std::vector<RgaCropScale::Rect> crops(outputs.size());
+    for (size_t i = 0; i < outputs.size(); i++) {
+        const OutputSpec& spec = mOutputs[outputs[i]].spec;
+        const PoolBuffer& buf = mOutputs[outputs[i]].buffers[slots[i]];
+        images[i] = {buf.fd, buf.start, (int)spec.width, (int)spec.height,
+                     spec.format};
+        crops[i] = {(int)spec.cropX, (int)spec.cropY, (int)spec.cropWidth,
+                    (int)spec.cropHeight};
+    }
+    RgaCropScale::Image source = {src.fd, src.start, (int)src.width,
+                                  (int)src.height, src.format};
+    return mBackend->scale(source, images.data(), crops.data(),
+                           images.size());
+}
+
+bool ScalerStage::threadLoop() {
+    std::shared_ptr<ProcessBuf> processBuf;
+    waitForNextRequest(&processBuf);
+    if (processBuf == nullptr) {
+        return true;
+    }
+    commitRequest();
+
+    // consumers that take this frame, per output; an output nobody wants
+    // this time is not scaled at all
+    std::vector<std::vector<sp<IProcessUnit>>> wanted(mOutputs.size());
+    for (size_t i = 0; i < mOutputs.size(); i++) {
+        for (const auto& consumer : mOutputs[i].consumers) {
+            if (consumer->wantsFrame(processBuf->sequence)) {
+                wanted[i].push_back(consumer);
+            }
+        }
+    }
+
+    std::vector<int> outputs;
+    std::vector<int> slots;
+    {
+        std::lock_guard<std::mutex> lk(mPoolLock);
+        for (int i = 0; i < (int)mOutputs.size(); i++) {
+            Output& output = mOutputs[i];
+            if (wanted[i].empty()) {
+                continue;
+            }
+            int slot = -1;
+            for (int j = 0; j < kBuffersPerOutput; j++) {
+                if (output.buffers[j].refs == 0) {
+                    slot = j;
+                    break;
+                }
+            }
+            if (slot < 0) {
+                // a consumer of this output is behind, all of them skip it
+                output.drops++;
+                continue;
+            }
+            output.buffers[slot].refs = wanted[i].size();
+            mSavedConversions += wanted[i].size() - 1;
+            outputs.push_back(i);
+            slots.push_back(slot);
+        }
+    }
+
+    int ret = 0;
+    if (!outputs.empty()) {
+        ScopedFrameTrace trace(FrameTracer::STAGE_RGA_BLIT,
+                               processBuf->sequence, mTraceConsumer);
+        ret = scaleOutputs(*processBuf, outputs, slots);
+    }
+    // every output is written, the capture buffer can go back to the driver
+    // before any consumer has started on it
+    if (mIProcessDoneListener) {
+        mIProcessDoneListener->notifyProcessDone(processBuf);
+    }
+
+    if (ret < 0) {
+        ALOGE("%s   scale failed: %d", __func__, ret);
+        std::lock_guard<std::mutex> lk(mPoolLock);
+        for (size_t i = 0; i < outputs.size(); i++) {
+            mOutputs[outputs[i]].buffers[slots[i]].refs = 0;
+        }
+        return true;
+    }
+
+    for (size_t i = 0; i < outputs.size(); i++) {
+        const Output& output = mOutputs[outputs[i]];
+        const PoolBuffer& buf = output.buffers[slots[i]];
+        std::shared_ptr<ProcessBuf> scaled = std::make_shared<ProcessBuf>();
+        scaled->index = outputs[i] * kBuffersPerOutput + slots[i];
+        scaled->fd = buf.fd;
+        scaled->start = buf.start;
+        scaled->width = output.spec.width;
+        scaled->height = output.spec.height;
+        scaled->format = output.spec.format;
+        scaled->processNum = wanted[outputs[i]].size();
+        scaled->timestampUs = processBuf->timestampUs;
+        scaled->sequence = processBuf->sequence;
+        scaled->releaser = this;
+        // one lease for all consumers of this output
+        for (const auto& consumer : wanted[outputs[i]]) {
+            std::shared_ptr<ProcessBuf> evicted;
+            if (consumer->processBuffer(scaled, &evicted) < 0) {
+                notifyProcessDone(scaled);
+            }
+            if (evicted) {
+                notifyProcessDone(evicted);
+            }
+        }
+    }
+    return true;
+}
+
+void ScalerStage::notifyProcessDone(std::shared_ptr<ProcessBuf>& processBuf) {
+    int output = processBuf->index / kBuffersPerOutput;
+    int slot = processBuf->index % kBuffersPerOutput;
+    std::lock_guard<std::mutex> lk(mPoolLock);
+    if (output < (int)mOutputs.size()) {
+        PoolBuffer& buf = mOutputs[output].buffers[slot];
+        if (buf.refs > 0) {
+            buf.refs--;
+        }
+        processBuf->processNum = buf.refs;
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef CAPTUREENCODER_SCALERSTAGE_H
+#define CAPTUREENCODER_SCALERSTAGE_H
+
+#include <utils/RefBase.h>
+#include <utils/Thread.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "IProcessDoneListener.h"
+#include "IProcessUnit.h"
+#include "ScalerBackend.h"
+
+// Produces every resolution the consumers need from one capture frame. All
+// outputs are written by one backend submission, then the capture buffer
+// goes straight back to the driver and the consumers get pooled NV12
+// buffers of their own size instead of each scaling the full-size frame.
+// Consumers asking for the same OutputSpec share one output: it is scaled
+// once and every one of them gets the same read-only buffer, which returns
+// to the pool when the last of them is done.
+class ScalerStage : public IProcessUnit, public IProcessDoneListener {
+public:
+    static const int kBuffersPerOutput = 3;
+
+    ScalerStage(IProcessDoneListener* processDoneListener,
+                std::unique_ptr<ScalerBackend> backend);
+
+    ~ScalerStage();
+
+    // must be called before run(), a consumer whose spec matches an existing
+    // output joins it
+    int addOutput(const OutputSpec& spec, const sp<IProcessUnit>& consumer);
+
+    // true when any consumer wants the frame
+    bool wantsFrame(uint32_t sequence) override;
+
+    // a consumer is done with one of our buffers
+    void notifyProcessDone(std::shared_ptr<ProcessBuf>& processBuf) override;
+
+    // frames an output missed because all of its buffers were still held
+    int64_t getOutputDrops();
+
+    // conversions not run because a consumer shared another one's output
+    int64_t getSavedConversions();
+
+private:
+    struct PoolBuffer {
+        int fd;
+        void* start;
+        size_t size;
+        // consumers still holding the buffer, free at 0
+        int refs;
+    };
+
+    struct Output {
+        OutputSpec spec;
+        std::vector<sp<IProcessUnit>> consumers;
+        std::vector<PoolBuffer> buffers;
+        int64_t drops;
+    };
+
+    virtual bool threadLoop();
+
+    virtual status_t readyToRun();
+
+    int allocBuffer(PoolBuffer* buf, size_t size);
+
+    void freeBuffer(PoolBuffer* buf);
+
+    int scaleOutputs(const ProcessBuf& src, const std::vector<int>& outputs,
+                     const std::vector<int>& slots);
+
+    IProcessDoneListener* mIProcessDoneListener;
+
+    std::unique_ptr<ScalerBackend> mBackend;
+
+    std::mutex mPoolLock;
+
+    std::vector<Output> mOutputs;
+
+    int64_t mSavedConversions = 0;
+
+    int mHeapFd = -1;
+
+    int mTraceConsumer;
+};
+
+#endif  // CAPTUREENCODER_SCALERSTAGE_H
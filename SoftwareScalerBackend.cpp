@@ -0,0 +1,80 @@
+#define LOG_TAG "NativeScalerBackend"
+
+#include "ScalerBackend.h"
+
+#include <errno.h>
+#include <linux/videodev2.h>
+#include <log/log.h>
+#include <utils/Trace.h>
+
+#include <vector>
+
+int SoftwareScalerBackend::scale(const Image& src, const Image* dsts,
+                                 const Rect* crops, int count) {
+    ATRACE_CALL();
+    if (src.addr == nullptr ||
+        (src.format != V4L2_PIX_FMT_NV12 && src.format != V4L2_PIX_FMT_YUYV)) {
+        ALOGE("%s   unsupported source format: 0x%x", __func__, src.format);
+        return -EINVAL;
+    }
+    for (int i = 0; i < count; i++) {
+        if (dsts[i].addr == nullptr || dsts[i].format != V4L2_PIX_FMT_NV12) {
+            ALOGE("%s   unsupported output format: 0x%x", __func__,
+                  dsts[i].format);
+            return -EINVAL;
+        }
+        Rect crop = {0, 0, src.width, src.height};
+        if (crops && crops[i].width > 0) {
+            crop = crops[i];
+        }
+        scaleOne(src, dsts[i], crop);
+    }
+    return 0;
+}
+
+void SoftwareScalerBackend::scaleOne(const Image& src, const Image& dst,
+                                     const Rect& crop) {
+    const uint8_t* in = (const uint8_t*)src.addr;
+    uint8_t* outY = (uint8_t*)dst.addr;
+    uint8_t* outUV = outY + dst.width * dst.height;
+    bool yuyv = src.format == V4L2_PIX_FMT_YUYV;
+
+    std::vector<int> mapX(dst.width);
+    for (int x = 0; x < dst.width; x++) {
+        mapX[x] = crop.x + x * crop.width / dst.width;
+    }
+
+    for (int y = 0; y < dst.height; y++) {
+        int sy = crop.y + y * crop.height / dst.height;
+        uint8_t* row = outY + y * dst.width;
+        if (yuyv) {
+            const uint8_t* line = in + sy * src.width * 2;
+            for (int x = 0; x < dst.width; x++) {
+                row[x] = line[mapX[x] * 2];
+            }
+        } else {
+            const uint8_t* line = in + sy * src.width;
+            for (int x = 0; x < dst.width; x++) {
+                row[x] = line[mapX[x]];
+            }
+        }
+    }
+
+    for (int y = 0; y < dst.height / 2; y++) {
+        int sy = crop.y + (y * 2) * crop.height / dst.height;
+        uint8_t* row = outUV + y * dst.width;
+        for (int x = 0; x + 1 < dst.width; x += 2) {
+            int sx = mapX[x] & ~1;
+            if (yuyv) {
+                const uint8_t* pair = in + (sy * src.width + sx) * 2;
+                row[x] = pair[1];
+                row[x + 1] = pair[3];
+            } else {
+                const uint8_t* uv =
+                    in + src.width * src.height + (sy / 2) * src.width + sx;
+                row[x] = uv[0];
+                row[x + 1] = uv[1];
+            }
+        }
+    }
+}
@@ -0,0 +1,253 @@
+#define LOG_TAG "NativeStreamHandler"
+
+#include "StreamHandler.h"
+
+#include <cutils/properties.h>
+#include <errno.h>
+#include <log/log.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <utils/Trace.h>
+
+#include <algorithm>
+
+#include "FrameTracer.h"
+
+StreamHandler::StreamHandler(
+    sp<FrameSource> source, std::list<sp<IProcessUnit>> processList,
+    uint32_t width, uint32_t height, uint32_t format,
+    const BufferConfig& bufferConfig)
+    : mSource(source),
+      mProcessList(processList),
+      mWidth(width),
+      mHeight(height),
+      mFormat(format),
+      mBufferConfig(bufferConfig) {
+    mImportByFd = !property_get_bool("debug.capture.rga_import_virt", false);
+    ALOGI("%s   StreamHandler: %p mImportByFd: %d", __func__, this, mImportByFd);
+}
+
+StreamHandler::~StreamHandler() {
+    ALOGI("%s   StreamHandler: %p", __func__, this);
+    detach();
+}
+
+int StreamHandler::attach() {
+    mStarvationFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (mStarvationFd < 0) {
+        ALOGE("%s   timerfd_create failed: %s", __func__, strerror(errno));
+        return -errno;
+    }
+    CaptureReactor& reactor = CaptureReactor::getInstance();
+    int ret = reactor.addFd(mStarvationFd, this);
+    if (ret < 0) {
+        return ret;
+    }
+    mCaptureFd = mSource->getPollFd();
+    return reactor.addFd(mCaptureFd, this);
+}
+
+void StreamHandler::detach() {
+    CaptureReactor& reactor = CaptureReactor::getInstance();
+    if (mCaptureFd >= 0) {
+        reactor.removeFd(mCaptureFd);
+    }
+    if (mStarvationFd >= 0) {
+        reactor.removeFd(mStarvationFd);
+    }
+    std::lock_guard<std::mutex> lk(mProcessBufLock);
+    mCaptureFd = -1;
+    if (mStarvationFd >= 0) {
+        close(mStarvationFd);
+        mStarvationFd = -1;
+    }
+}
+
+int StreamHandler::getStarvationEvents() {
+    std::lock_guard<std::mutex> lk(mProcessBufLock);
+    return mStarvationEvents;
+}
+
+int64_t StreamHandler::getDroppedFrames() {
+    std::lock_guard<std::mutex> lk(mProcessBufLock);
+    return mDroppedFrames;
+}
+
+// called with mProcessBufLock held
+void StreamHandler::setCaptureEnabled(bool enabled) {
+    if (mCaptureEnabled == enabled || mCaptureFd < 0) {
+        return;
+    }
+    mCaptureEnabled = enabled;
+    CaptureReactor::getInstance().setFdEnabled(mCaptureFd, this, enabled);
+    armStarvationTimer(!enabled);
+}
+
+// while capture is disabled a one-shot timer reports how long the consumers
+// have been holding every buffer
+void StreamHandler::armStarvationTimer(bool arm) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    if (arm) {
+        spec.it_value.tv_sec = mBufferConfig.starvationMs / 1000;
+        spec.it_value.tv_nsec = (mBufferConfig.starvationMs % 1000) * 1000000L;
+    }
+    timerfd_settime(mStarvationFd, 0, &spec, NULL);
+}
+
+void StreamHandler::onEvent(int fd, uint32_t events) {
+    ATRACE_CALL();
+    if (fd == mStarvationFd) {
+        onStarvationTimeout();
+        return;
+    }
+
+    if (!(events & EPOLLIN)) {
+        // V4L2 reports EPOLLERR while no buffer is queued, wait for a return
+        ALOGE("%s   fd: %d events: 0x%x", __func__, fd, events);
+        std::lock_guard<std::mutex> lk(mProcessBufLock);
+        setCaptureEnabled(false);
+        return;
+    }
+
+    FrameSource::Frame frame;
+    {
+        ScopedFrameTrace trace(FrameTracer::STAGE_DQBUF, FrameTracer::kNoSequence);
+        if (mSource->dequeue(&frame) < 0) {
+            return;
+        }
+        trace.setFrame(frame.sequence, frame.timestampUs);
+    }
+    ALOGI("%s   index: %d start: %p bytesUsed: %d sequence: %u "
+          "timestampUs: %lld",
+          __func__, frame.index, frame.start, frame.bytesUsed, frame.sequence,
+          (long long)frame.timestampUs);
+    ScopedFrameTrace trace(FrameTracer::STAGE_DISPATCH, frame.sequence);
+    postProcess(frame);
+}
+
+void StreamHandler::onStarvationTimeout() {
+    uint64_t expirations = 0;
+    read(mStarvationFd, &expirations, sizeof(expirations));
+
+    std::unique_lock<std::mutex> lk(mProcessBufLock);
+    if (mCaptureEnabled) {
+        return;
+    }
+    int count = mSource->getBufferCount();
+    mStarvationEvents++;
+    ALOGW("%s   starvation event: %d all %d buffers in flight for %d ms",
+          __func__, mStarvationEvents, count, mBufferConfig.starvationMs);
+    if (mBufferConfig.adaptive && count < mBufferConfig.maxCount) {
+        int added =
+            mSource->growBuffers(std::min(2, mBufferConfig.maxCount - count));
+        if (added > 0) {
+            ALOGI("%s   buffer pool grown %d -> %d", __func__, count,
+                  count + added);
+            setCaptureEnabled(true);
+            return;
+        }
+        ALOGE("%s   growBuffers failed: %d", __func__, added);
+    }
+    if (mInFlight < count) {
+        // disabled on a device error rather than a full queue, try again
+        setCaptureEnabled(true);
+        return;
+    }
+    // keep reporting while the stall lasts
+    armStarvationTimer(true);
+}
+
+void StreamHandler::postProcess(const FrameSource::Frame& frame) {
+    std::lock_guard<std::mutex> lk(mProcessBufLock);
+    if (mHasSequence) {
+        uint32_t gap = frame.sequence - mLastSequence - 1;
+        // a backwards or huge jump is a driver restart, not a drop
+        if (gap > 0 && gap < 0x80000000u) {
+            mDroppedFrames += gap;
+            ALOGW("%s   driver dropped %u frames before sequence: %u total: %lld",
+                  __func__, gap, frame.sequence, (long long)mDroppedFrames);
+        }
+    }
+    mHasSequence = true;
+    mLastSequence = frame.sequence;
+
+    int index = frame.index;
+    std::shared_ptr<IProcessUnit::ProcessBuf> processBuf =
+        std::make_shared<IProcessUnit::ProcessBuf>();
+    processBuf->index = index;
+    processBuf->fd = mImportByFd ? mSource->exportFd(index) : -1;
+    if (processBuf->fd < 0) {
+        processBuf->fd = -1;
+    }
+    processBuf->start = frame.start;
+    processBuf->width = mWidth;
+    processBuf->height = mHeight;
+    processBuf->format = mFormat;
+    processBuf->timestampUs = frame.timestampUs;
+    processBuf->sequence = frame.sequence;
+    // units running below the capture rate only get the frames their
+    // cadence picks, the others never hold this buffer
+    std::vector<sp<IProcessUnit>> consumers;
+    for (const auto& unit : mProcessList) {
+        if (unit->wantsFrame(frame.sequence)) {
+            consumers.push_back(unit);
+        }
+    }
+    processBuf->processNum = consumers.size();
+    ALOGI("%s   processBuf index: %d processNum: %d", __func__, processBuf->index, processBuf->processNum);
+    if (processBuf->processNum == 0) {
+        mSource->requeue(index);
+        return;
+    }
+    mInFlight++;
+    if (mInFlight >= mSource->getBufferCount()) {
+        // nothing left to dequeue until a consumer returns a buffer
+        setCaptureEnabled(false);
+    }
+    for (auto iter : consumers) {
+        std::shared_ptr<IProcessUnit::ProcessBuf> evicted;
+        if (iter->processBuffer(processBuf, &evicted) < 0) {
+            // the unit's queue is full, it skips this frame
+            releaseCameraBuffer(processBuf);
+        }
+        if (evicted) {
+            // an older frame the unit never started on, it no longer holds
+            // the capture buffer
+            releaseCameraBuffer(evicted);
+        }
+    }
+}
+
+void StreamHandler::returnCameraBuffer(std::shared_ptr<IProcessUnit::ProcessBuf>& processBuf) {
+    std::lock_guard<std::mutex> lk(mProcessBufLock);
+    releaseCameraBuffer(processBuf);
+}
+
+// called with mProcessBufLock held
+void StreamHandler::releaseCameraBuffer(std::shared_ptr<IProcessUnit::ProcessBuf>& processBuf) {
+    processBuf->processNum--;
+    ALOGI("%s   processBuf index: %d processNum: %d", __func__, processBuf->index, processBuf->processNum);
+    if (processBuf->processNum == 0) {
+        mSource->requeue(processBuf->index);
+        mInFlight--;
+        setCaptureEnabled(true);
+        ALOGI("%s   requeue index: %d", __func__, processBuf->index);
+        showDebugFPS();
+    }
+}
+
+void StreamHandler::showDebugFPS() {
+	double fps = 0;
+	mFrameCount++;
+	nsecs_t now = systemTime();
+	nsecs_t diff = now - mLastFpsTime;
+	if ((unsigned long)diff > 2000000000) {
+		fps = (((double)(mFrameCount - mLastFrameCount)) * (double)(1000000000)) / (double)diff;
+		ALOGI("%s   Preview FPS: %.4f   mFrameCount: %d", __func__, fps, mFrameCount);
+		mLastFpsTime = now;
+		mLastFrameCount = mFrameCount;
+	}
+}
@@ -0,0 +1,107 @@
+#ifndef CAPTUREENCODER_STREAMHANDLER_H
+#define CAPTUREENCODER_STREAMHANDLER_H
+
+#include <stdint.h>
+#include <utils/RefBase.h>
+#include <utils/Timers.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+
+#include "CaptureReactor.h"
+#include "FrameSource.h"
+#include "IProcessUnit.h"
+
+using namespace android;
+
+// Runs on the shared CaptureReactor thread: dequeues frames when the
+// device fd is readable and fans them out to the process units.
+class StreamHandler : public CaptureReactor::Handler {
+public:
+    struct BufferConfig {
+        int count;
+
+        bool adaptive;
+
+        int maxCount;
+
+        int starvationMs;
+    };
+
+    explicit StreamHandler(sp<FrameSource> source,
+                           std::list<sp<IProcessUnit>> processList,
+                           uint32_t width, uint32_t height,
+                           uint32_t format,
+                           const BufferConfig& bufferConfig);
+
+    virtual ~StreamHandler();
+
+    int attach();
+
+    void detach();
+
+    void onEvent(int fd, uint32_t events) override;
+
+    void returnCameraBuffer(std::shared_ptr<IProcessUnit::ProcessBuf>& processBuf);
+
+    int getStarvationEvents();
+
+    int64_t getDroppedFrames();
+
+private:
+    void showDebugFPS();
+
+    sp<FrameSource> mSource = nullptr;
+
+    std::list<sp<IProcessUnit>> mProcessList;
+
+    uint32_t mWidth;
+
+    uint32_t mHeight;
+
+    uint32_t mFormat;
+
+    void postProcess(const FrameSource::Frame& frame);
+
+    void releaseCameraBuffer(std::shared_ptr<IProcessUnit::ProcessBuf>& processBuf);
+
+    void onStarvationTimeout();
+
+    void setCaptureEnabled(bool enabled);
+
+    void armStarvationTimer(bool arm);
+
+    std::mutex mProcessBufLock;
+
+    BufferConfig mBufferConfig;
+
+    int mCaptureFd = -1;
+
+    // one-shot timer armed while every buffer is held by the consumers
+    int mStarvationFd = -1;
+
+    bool mCaptureEnabled = true;
+
+    // hand consumers the dmabuf fd, off only to compare against the
+    // virtual address import
+    bool mImportByFd = true;
+
+    int mInFlight = 0;
+
+    int mStarvationEvents = 0;
+
+    bool mHasSequence = false;
+
+    uint32_t mLastSequence = 0;
+
+    int64_t mDroppedFrames = 0;
+
+    int mFrameCount;
+
+    int mLastFrameCount;
+
+    nsecs_t mLastFpsTime;
+};
+
+#endif  // CAPTUREENCODER_STREAMHANDLER_H
@@ -0,0 +1,329 @@
+#define LOG_TAG "NativeSyntheticFrameSource"
+
+#include "SyntheticFrameSource.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-heap.h>
+#include <linux/videodev2.h>
+#include <log/log.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <utils/Timers.h>
+
+// 75% color bars: white, yellow, cyan, green, magenta, red, blue, black
+static const uint8_t sBarY[] = {180, 162, 131, 112, 84, 65, 35, 16};
+static const uint8_t sBarU[] = {128, 44, 156, 72, 184, 100, 212, 128};
+static const uint8_t sBarV[] = {128, 142, 44, 58, 198, 212, 114, 128};
+
+SyntheticFrameSource::SyntheticFrameSource(uint32_t width, uint32_t height,
+                                           uint32_t format, int bufferCount)
+    : mWidth(width), mHeight(height), mFormat(format),
+      mBufferCount(bufferCount) {
+    ALOGI("%s   SyntheticFrameSource: %p width: %d height: %d format: 0x%x "
+          "bufferCount: %d",
+          __func__, this, width, height, format, bufferCount);
+}
+
+SyntheticFrameSource::~SyntheticFrameSource() {
+    ALOGI("%s   SyntheticFrameSource: %p", __func__, this);
+    stop();
+    close();
+}
+
+int SyntheticFrameSource::open() {
+    if (mFormat != V4L2_PIX_FMT_NV12 && mFormat != V4L2_PIX_FMT_YUYV) {
+        ALOGE("%s   unsupported format: 0x%x", __func__, mFormat);
+        return -EINVAL;
+    }
+    mTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (mTimerFd < 0) {
+        ALOGE("%s   timerfd_create failed: %s", __func__, strerror(errno));
+        return -errno;
+    }
+    return 0;
+}
+
+int SyntheticFrameSource::negotiate(int width, int height, int fps) {
+    // like an HDMI input the geometry is fixed by the source, only the rate
+    // follows the request
+    mFps = fps > 0 ? fps : 30;
+    ALOGI("%s   request %dx%d, generate %dx%d@%d", __func__, width, height,
+          mWidth, mHeight, mFps);
+    return 0;
+}
+
+int SyntheticFrameSource::start() {
+    std::lock_guard<std::mutex> lk(mBufferLock);
+    mFrameSize = mFormat == V4L2_PIX_FMT_NV12 ? mWidth * mHeight * 3 / 2
+                                              : mWidth * mHeight * 2;
+
+    mLumaRow.resize(mFormat == V4L2_PIX_FMT_NV12 ? mWidth : mWidth * 2);
+    mChromaRow.resize(mWidth);
+    for (uint32_t x = 0; x < mWidth; x++) {
+        int bar = x * 8 / mWidth;
+        if (mFormat == V4L2_PIX_FMT_NV12) {
+            mLumaRow[x] = sBarY[bar];
+            mChromaRow[x] = (x & 1) ? sBarV[bar] : sBarU[bar];
+        } else {
+            mLumaRow[x * 2] = sBarY[bar];
+            mLumaRow[x * 2 + 1] = (x & 1) ? sBarV[bar] : sBarU[bar];
+        }
+    }
+
+    // dma-heap buffers behave like the V4L2 ones for RGA and MPP, memfd is
+    // only a fallback where the heap is not accessible and is CPU-only
+    mHeapFd = ::open("/dev/dma_heap/system", O_RDONLY | O_CLOEXEC);
+    if (mHeapFd < 0) {
+        ALOGI("%s   no dma heap (%s), using memfd", __func__, strerror(errno));
+    }
+
+    int ret = allocBuffers(mBufferCount);
+    if (ret < 0) {
+        return ret;
+    }
+
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    long periodNs = 1000000000L / mFps;
+    spec.it_interval.tv_sec = periodNs / 1000000000L;
+    spec.it_interval.tv_nsec = periodNs % 1000000000L;
+    spec.it_value = spec.it_interval;
+    if (timerfd_settime(mTimerFd, 0, &spec, NULL)) {
+        ALOGE("%s   timerfd_settime failed: %s", __func__, strerror(errno));
+        return -errno;
+    }
+    return 0;
+}
+
+int SyntheticFrameSource::stop() {
+    if (mTimerFd >= 0) {
+        struct itimerspec spec;
+        memset(&spec, 0, sizeof(spec));
+        timerfd_settime(mTimerFd, 0, &spec, NULL);
+    }
+    std::lock_guard<std::mutex> lk(mBufferLock);
+    releaseBuffers();
+    ALOGI("%s   mSequence: %u mDroppedFrames: %llu", __func__, mSequence,
+          (unsigned long long)mDroppedFrames);
+    return 0;
+}
+
+void SyntheticFrameSource::close() {
+    if (mTimerFd >= 0) {
+        ::close(mTimerFd);
+        mTimerFd = -1;
+    }
+}
+
+int SyntheticFrameSource::allocBuffers(int count) {
+    int first = mBuffers.size();
+    mBuffers.resize(first + count);
+    mQueued.resize(first + count, true);
+    for (int i = first; i < first + count; i++) {
+        v4l2Buffer& buf = mBuffers[i];
+        buf.index = i;
+        buf.offset = 0;
+        buf.length = mFrameSize;
+        buf.start = nullptr;
+        if (mHeapFd >= 0) {
+            struct dma_heap_allocation_data data;
+            memset(&data, 0, sizeof(data));
+            data.len = mFrameSize;
+            data.fd_flags = O_RDWR | O_CLOEXEC;
+            if (ioctl(mHeapFd, DMA_HEAP_IOCTL_ALLOC, &data)) {
+                ALOGE("%s   DMA_HEAP_IOCTL_ALLOC failed: %s", __func__,
+                      strerror(errno));
+                return -errno;
+            }
+            buf.exportFd = data.fd;
+        } else {
+            buf.exportFd = memfd_create("SyntheticFrame", MFD_CLOEXEC);
+            if (buf.exportFd < 0) {
+                ALOGE("%s   memfd_create failed: %s", __func__, strerror(errno));
+                return -errno;
+            }
+            if (ftruncate(buf.exportFd, mFrameSize)) {
+                ALOGE("%s   ftruncate failed: %s", __func__, strerror(errno));
+                return -errno;
+            }
+        }
+        buf.start = mmap(NULL, mFrameSize, PROT_READ | PROT_WRITE, MAP_SHARED,
+                         buf.exportFd, 0);
+        if (buf.start == MAP_FAILED) {
+            buf.start = nullptr;
+            ALOGE("%s   mmap failed: %s", __func__, strerror(errno));
+            return -errno;
+        }
+        syncCpuAccess(buf.exportFd, true);
+        drawBars((uint8_t*)buf.start);
+        syncCpuAccess(buf.exportFd, false);
+        ALOGI("%s   index: %d exportFd: %d start: %p length: %d", __func__, i,
+              buf.exportFd, buf.start, buf.length);
+    }
+    return 0;
+}
+
+void SyntheticFrameSource::releaseBuffers() {
+    for (auto& buf : mBuffers) {
+        if (buf.start) {
+            munmap(buf.start, buf.length);
+        }
+        if (buf.exportFd > 0) {
+            ::close(buf.exportFd);
+        }
+    }
+    mBuffers.clear();
+    mQueued.clear();
+    if (mHeapFd >= 0) {
+        ::close(mHeapFd);
+        mHeapFd = -1;
+    }
+}
+
+void SyntheticFrameSource::syncCpuAccess(int fd, bool begin) {
+    if (mHeapFd < 0) {
+        return;
+    }
+    struct dma_buf_sync sync;
+    sync.flags = DMA_BUF_SYNC_WRITE | (begin ? DMA_BUF_SYNC_START : DMA_BUF_SYNC_END);
+    ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+int SyntheticFrameSource::getPollFd() { return mTimerFd; }
+
+int SyntheticFrameSource::dequeue(Frame* frame) {
+    uint64_t expirations = 0;
+    if (read(mTimerFd, &expirations, sizeof(expirations)) !=
+        sizeof(expirations)) {
+        return -EAGAIN;
+    }
+
+    std::lock_guard<std::mutex> lk(mBufferLock);
+    // a late reader sees several expirations, the frames in between are lost
+    // exactly like a sensor overrunning its queue
+    mSequence += expirations;
+    mDroppedFrames += expirations - 1;
+
+    for (int i = 0; i < (int)mBuffers.size(); i++) {
+        int index = (mNextIndex + i) % mBuffers.size();
+        if (!mQueued[index]) {
+            continue;
+        }
+        mQueued[index] = false;
+        mNextIndex = (index + 1) % mBuffers.size();
+        syncCpuAccess(mBuffers[index].exportFd, true);
+        drawMarker((uint8_t*)mBuffers[index].start, mSequence);
+        syncCpuAccess(mBuffers[index].exportFd, false);
+
+        frame->index = index;
+        frame->start = mBuffers[index].start;
+        frame->bytesUsed = mFrameSize;
+        frame->timestampUs = systemTime(SYSTEM_TIME_MONOTONIC) / 1000;
+        frame->sequence = mSequence;
+        return 0;
+    }
+
+    mDroppedFrames++;
+    return -EAGAIN;
+}
+
+int SyntheticFrameSource::requeue(int index) {
+    std::lock_guard<std::mutex> lk(mBufferLock);
+    if (index < 0 || index >= (int)mQueued.size()) {
+        ALOGE("%s   index: %d out of range", __func__, index);
+        return -EINVAL;
+    }
+    mQueued[index] = true;
+    return 0;
+}
+
+int SyntheticFrameSource::exportFd(int index) {
+    std::lock_guard<std::mutex> lk(mBufferLock);
+    // a memfd is no dmabuf, consumers have to use the mapping
+    if (index < 0 || index >= (int)mBuffers.size() || mHeapFd < 0) {
+        return -EINVAL;
+    }
+    return mBuffers[index].exportFd;
+}
+
+int SyntheticFrameSource::setBufferCount(int count) {
+    std::lock_guard<std::mutex> lk(mBufferLock);
+    if (!mBuffers.empty()) {
+        return -EBUSY;
+    }
+    mBufferCount = count > 0 ? count : 4;
+    return 0;
+}
+
+int SyntheticFrameSource::getBufferCount() {
+    std::lock_guard<std::mutex> lk(mBufferLock);
+    return mBuffers.empty() ? mBufferCount : mBuffers.size();
+}
+
+int SyntheticFrameSource::growBuffers(int count) {
+    std::lock_guard<std::mutex> lk(mBufferLock);
+    if (mBuffers.empty() || count <= 0) {
+        return -EINVAL;
+    }
+    int ret = allocBuffers(count);
+    return ret < 0 ? ret : count;
+}
+
+uint32_t SyntheticFrameSource::getWidth() { return mWidth; }
+
+uint32_t SyntheticFrameSource::getHeight() { return mHeight; }
+
+uint32_t SyntheticFrameSource::getFormat() { return mFormat; }
+
+void SyntheticFrameSource::getFrameRate(uint32_t* num, uint32_t* den) {
+    *num = mFps;
+    *den = 1;
+}
+
+uint64_t SyntheticFrameSource::getDroppedFrames() {
+    std::lock_guard<std::mutex> lk(mBufferLock);
+    return mDroppedFrames;
+}
+
+void SyntheticFrameSource::drawBars(uint8_t* base) {
+    for (uint32_t y = 0; y < mHeight; y++) {
+        memcpy(base + y * mLumaRow.size(), mLumaRow.data(), mLumaRow.size());
+    }
+    if (mFormat == V4L2_PIX_FMT_NV12) {
+        uint8_t* uv = base + mWidth * mHeight;
+        for (uint32_t y = 0; y < mHeight / 2; y++) {
+            memcpy(uv + y * mWidth, mChromaRow.data(), mWidth);
+        }
+    }
+}
+
+void SyntheticFrameSource::drawMarker(uint8_t* base, uint32_t sequence) {
+    // only the marker band is rewritten per frame so the generator keeps up
+    // at 4K60 without touching the whole buffer
+    uint32_t rows = mHeight < kMarkerRows ? mHeight : kMarkerRows;
+    uint32_t span = mWidth > rows ? mWidth - rows : 1;
+    uint32_t x0 = ((sequence * 16) % span) & ~1u;
+    uint32_t x1 = x0 + rows < mWidth ? x0 + rows : mWidth;
+    uint32_t pixelBytes = mFormat == V4L2_PIX_FMT_NV12 ? 1 : 2;
+
+    for (uint32_t y = 0; y < rows; y++) {
+        uint8_t* line = base + y * mLumaRow.size();
+        memcpy(line, mLumaRow.data(), mLumaRow.size());
+        for (uint32_t x = x0; x < x1; x++) {
+            line[x * pixelBytes] = 235;
+        }
+    }
+    if (mFormat == V4L2_PIX_FMT_NV12) {
+        uint8_t* uv = base + mWidth * mHeight;
+        for (uint32_t y = 0; y < rows / 2; y++) {
+            uint8_t* line = uv + y * mWidth;
+            memcpy(line, mChromaRow.data(), mWidth);
+            memset(line + x0, 128, (x1 - x0) & ~1u);
+        }
+    }
+}
@@ -0,0 +1,100 @@
+#ifndef CAPTUREENCODER_SYNTHETICFRAMESOURCE_H
+#define CAPTUREENCODER_SYNTHETICFRAMESOURCE_H
+
+#include <mutex>
+#include <vector>
+
+#include "FrameSource.h"
+
+// In-memory frame source for running the fan-out without a capture device.
+// Frames are NV12 or YUYV color bars with a moving marker, written into
+// dma-heap buffers (memfd when no heap is available) and released at a
+// fixed rate driven by a timerfd.
+class SyntheticFrameSource : public FrameSource {
+public:
+    SyntheticFrameSource(uint32_t width, uint32_t height, uint32_t format,
+                         int bufferCount = 4);
+
+    ~SyntheticFrameSource();
+
+    int open() override;
+
+    int negotiate(int width, int height, int fps) override;
+
+    int start() override;
+
+    int stop() override;
+
+    void close() override;
+
+    int getPollFd() override;
+
+    int dequeue(Frame* frame) override;
+
+    int requeue(int index) override;
+
+    int exportFd(int index) override;
+
+    int setBufferCount(int count) override;
+
+    int getBufferCount() override;
+
+    int growBuffers(int count) override;
+
+    uint32_t getWidth() override;
+
+    uint32_t getHeight() override;
+
+    uint32_t getFormat() override;
+
+    void getFrameRate(uint32_t* num, uint32_t* den) override;
+
+    uint64_t getDroppedFrames();
+
+private:
+    static const int kMarkerRows = 64;
+
+    uint32_t mWidth;
+
+    uint32_t mHeight;
+
+    uint32_t mFormat;
+
+    int mFps = 30;
+
+    int mBufferCount;
+
+    uint32_t mFrameSize = 0;
+
+    int mTimerFd = -1;
+
+    int mHeapFd = -1;
+
+    std::mutex mBufferLock;
+
+    std::vector<v4l2Buffer> mBuffers;
+
+    std::vector<bool> mQueued;
+
+    int mNextIndex = 0;
+
+    uint32_t mSequence = 0;
+
+    uint64_t mDroppedFrames = 0;
+
+    std::vector<uint8_t> mLumaRow;
+
+    std::vector<uint8_t> mChromaRow;
+
+    int allocBuffers(int count);
+
+    void releaseBuffers();
+
+    void syncCpuAccess(int fd, bool begin);
+
+    void drawBars(uint8_t* base);
+
+    void drawMarker(uint8_t* base, uint32_t sequence);
+};
+
+#endif  // CAPTUREENCODER_SYNTHETICFRAMESOURCE_H
@@ -0,0 +1,13 @@
+#ifndef CAPTUREENCODER_V4L2BUFFER_H
+#define CAPTUREENCODER_V4L2BUFFER_H
+
+// a frame buffer of a FrameSource mapped at start, exportFd is its dmabuf
+struct v4l2Buffer {
+    int index = 0;
+    void* start = nullptr;
+    unsigned int offset;
+    unsigned int length;
+    int exportFd = 0;
+};
+
+#endif  // CAPTUREENCODER_V4L2BUFFER_H
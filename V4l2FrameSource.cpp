@@ -0,0 +1,777 @@
+#define LOG_TAG "NativeV4l2FrameSource"
+
+#include "V4l2FrameSource.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <log/log.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <utils/Errors.h>
+#include <utils/Timers.h>
+
+#include <cstdlib>
+
+#define V4L2_TYPE_IS_META(type)             \
+    ((type) == V4L2_BUF_TYPE_META_OUTPUT || \
+     (type) == V4L2_BUF_TYPE_META_CAPTURE)
+
+#define CLEAR(x) memset(&(x), 0, sizeof(x))
+
+static uint32_t sPreferFormat[] = {
+    V4L2_PIX_FMT_NV12,
+    V4L2_PIX_FMT_YUYV,
+};
+
+V4l2FrameSource::V4l2FrameSource(const char* videoDevice, const char* subDevice)
+    : mVideoDevice(videoDevice), mSubDevice(subDevice) {
+    ALOGI("%s   V4l2FrameSource: %p video: %s subdev: %s", __func__, this,
+          videoDevice, subDevice);
+}
+
+V4l2FrameSource::~V4l2FrameSource() {
+    ALOGI("%s   V4l2FrameSource: %p", __func__, this);
+    stop();
+    close();
+}
+
+int V4l2FrameSource::queryCapability() {
+    int ret;
+    if (mFd.load() < 0) {
+        ALOGE("%s   queryCapability failed fd is wrong", __func__);
+        return -errno;
+    }
+    ret = ioctl(mFd.load(), VIDIOC_QUERYCAP, &mCapability);
+    if (ret) {
+        ALOGE("%s   queryCapability QUERYCAP failed: %s", __func__,
+              strerror(errno));
+        return -errno;
+    }
+
+    if (mCapability.capabilities & V4L2_CAP_VIDEO_CAPTURE) {
+        mBufType = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        ALOGI("%s %d   mBufType: %d", __func__, __LINE__, mBufType);
+    } else if (mCapability.capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE) {
+        mBufType = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        ALOGI("%s %d   mBufType: %d", __func__, __LINE__, mBufType);
+    } else if (mCapability.capabilities & V4L2_CAP_VIDEO_OUTPUT) {
+        mBufType = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        ALOGI("%s %d   mBufType: %d", __func__, __LINE__, mBufType);
+    } else if (mCapability.capabilities & V4L2_CAP_VIDEO_OUTPUT_MPLANE) {
+        mBufType = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+        ALOGI("%s %d   mBufType: %d", __func__, __LINE__, mBufType);
+    } else if (mCapability.capabilities & V4L2_CAP_META_CAPTURE) {
+        mBufType = V4L2_BUF_TYPE_META_CAPTURE;
+        ALOGI("%s %d   mBufType: %d", __func__, __LINE__, mBufType);
+    } else if (mCapability.capabilities & V4L2_CAP_META_OUTPUT) {
+        mBufType = V4L2_BUF_TYPE_META_OUTPUT;
+        ALOGI("%s %d   mBufType: %d", __func__, __LINE__, mBufType);
+    } else {
+        ALOGE("%s   unsupported buffer type", __func__);
+        return DEAD_OBJECT;
+    }
+
+    ALOGI("%s   success", __func__);
+    return 0;
+}
+
+int V4l2FrameSource::enumDeviceFmt() {
+    if (mFd.load() < 0) {
+        ALOGE("%s   enumDeviceFmt failed fd is wrong", __func__);
+        return -errno;
+    }
+    memset(&mSelectParams, 0, sizeof(mSelectParams));
+
+    v4l2_fmtdesc fmtDes;
+    memset(&fmtDes, 0, sizeof(fmtDes));
+    fmtDes.index = 0;
+    fmtDes.type = mBufType;
+
+    while (ioctl(mFd.load(), VIDIOC_ENUM_FMT, &fmtDes) != -1) {
+        fmtDes.index++;
+        ALOGI("%s   fd: %d support index: %d format: %d format description: %s",
+              __func__, mFd.load(), fmtDes.index, fmtDes.pixelformat,
+              (char*)(fmtDes.description));
+        if (!mSelectParams.getFormat) {
+            for (uint32_t format : sPreferFormat) {
+                if (format == fmtDes.pixelformat) {
+                    mSelectParams.getFormat = true;
+                    mSelectParams.mV4l2Format = format;
+                    break;
+                }
+            }
+        }
+    }
+
+    ALOGI("%s   select v4l2 format: %c%c%c%c", __func__,
+          mSelectParams.mV4l2Format & 0xFF,
+          (mSelectParams.mV4l2Format >> 8) & 0xFF,
+          (mSelectParams.mV4l2Format >> 16) & 0xFF,
+          (mSelectParams.mV4l2Format >> 24) & 0xFF);
+
+    mSelectParams.mMinDistance = 3840;
+    v4l2_frmsizeenum frameSize{.index = 0,
+                               .pixel_format = mSelectParams.mV4l2Format};
+    for (; ioctl(mFd, VIDIOC_ENUM_FRAMESIZES, &frameSize) == 0;
+         frameSize.index++) {
+        if (frameSize.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+            ALOGI("%s   index:%d   format:%c%c%c%c   w:%d   h:%d", __func__,
+                  frameSize.index, mSelectParams.mV4l2Format & 0xFF,
+                  (mSelectParams.mV4l2Format >> 8) & 0xFF,
+                  (mSelectParams.mV4l2Format >> 16) & 0xFF,
+                  (mSelectParams.mV4l2Format >> 24) & 0xFF,
+                  frameSize.discrete.width, frameSize.discrete.height);
+
+            if (frameSize.discrete.height > frameSize.discrete.width) {
+                continue;
+            }
+            int distance = std::abs((int)(frameSize.discrete.width - mWidth));
+            if (distance < mSelectParams.mMinDistance) {
+                mSelectParams.mV4l2Width = frameSize.discrete.width;
+                mSelectParams.mV4l2Height = frameSize.discrete.height;
+                mSelectParams.mMinDistance = distance;
+            }
+        }
+    }
+
+    ALOGI("%s   select v4l2 format: %c%c%c%c width: %d height: %d", __func__,
+          mSelectParams.mV4l2Format & 0xFF,
+          (mSelectParams.mV4l2Format >> 8) & 0xFF,
+          (mSelectParams.mV4l2Format >> 16) & 0xFF,
+          (mSelectParams.mV4l2Format >> 24) & 0xFF, mSelectParams.mV4l2Width,
+          mSelectParams.mV4l2Height);
+
+    return 0;
+}
+
+int V4l2FrameSource::getDeviceFmt() {
+    int result;
+    if (mFd.load() < 0) {
+        ALOGE("%s   getDeviceFmt failed fd is wrong", __func__);
+        return -errno;
+    }
+
+    memset(&mFormat, 0, sizeof(mFormat));
+    mFormat.type = mBufType;
+    result = ioctl(mFd.load(), VIDIOC_G_FMT, &mFormat);
+    if (result) {
+        ALOGE("%s   fd: %d getDeviceFmt VIDIOC_G_FMT failed errno: %s",
+              __func__, mFd.load(), strerror(errno));
+    } else {
+        ALOGI(
+            "%s   fd: %d getDeviceFmt current format: %c%c%c%c width: %d "
+            "height: %d",
+            __func__, mFd.load(), mFormat.fmt.pix.pixelformat & 0xFF,
+            (mFormat.fmt.pix.pixelformat >> 8) & 0xFF,
+            (mFormat.fmt.pix.pixelformat >> 16) & 0xFF,
+            (mFormat.fmt.pix.pixelformat >> 24) & 0xFF, mFormat.fmt.pix.width,
+            mFormat.fmt.pix.height);
+        mSelectParams.mV4l2Width = mFormat.fmt.pix.width;
+        mSelectParams.mV4l2Height = mFormat.fmt.pix.height;
+    }
+
+    return result;
+}
+
+int V4l2FrameSource::v4l2StreamOff() {
+    if (!mV4l2Streaming) {
+        return 0;
+    }
+    if (mFd.load() < 0) {
+        ALOGE("%s   v4l2StreamOff failed fd is wrong", __func__);
+        return -errno;
+    }
+    v4l2_buf_type capture_type;
+    capture_type = mBufType;
+    if (ioctl(mFd.load(), VIDIOC_STREAMOFF, &capture_type)) {
+        ALOGE("%s   v4l2StreamOff VIDIOC_STREAMOFF failed: %s", __func__,
+              strerror(errno));
+        return -errno;
+    }
+
+    std::lock_guard<std::mutex> lk(mBufferLock);
+    for (auto& buf : mBuffers) {
+        if (buf.start && buf.start != MAP_FAILED) {
+            if (munmap(buf.start, buf.length) == -1) {
+                ALOGE("%s   fd: %d v4l2StreamOff munmap failed errno: %s",
+                      __func__, mFd.load(), strerror(errno));
+            } else {
+                ALOGI("%s   fd: %d v4l2StreamOff munmap start: %p length: %d",
+                      __func__, mFd.load(), buf.start, buf.length);
+            }
+            if (buf.exportFd) {
+                ::close(buf.exportFd);
+            }
+        }
+    }
+    mBuffers.clear();
+    ALOGI("%s   success", __func__);
+    mV4l2Streaming = false;
+    return 0;
+}
+
+int V4l2FrameSource::v4l2SetFmt() {
+    if (mFd.load() < 0) {
+        ALOGE("%s   v4l2SetFmt failed fd is wrong", __func__);
+        return -errno;
+    }
+    v4l2_format fmt;
+    fmt.type = mBufType;
+    fmt.fmt.pix.width = mSelectParams.mV4l2Width;
+    fmt.fmt.pix.height = mSelectParams.mV4l2Height;
+    fmt.fmt.pix.pixelformat = mSelectParams.mV4l2Format;
+    if (V4L2_TYPE_IS_META(mBufType)) {
+        ALOGE("%s   setting field for meta format is not allowed.", __func__);
+    } else if (V4L2_TYPE_IS_MULTIPLANAR(mBufType)) {
+        fmt.fmt.pix_mp.field = 0;
+    } else {
+        fmt.fmt.pix.field = 0;
+    }
+    if (V4L2_TYPE_IS_META(mBufType)) {
+        ALOGE("%s   setting bytesperline for meta format is not allowed.",
+              __func__);
+    } else if (V4L2_TYPE_IS_MULTIPLANAR(mBufType)) {
+        fmt.fmt.pix_mp.plane_fmt[0].bytesperline = mSelectParams.mV4l2Width;
+    } else {
+        fmt.fmt.pix.bytesperline = mSelectParams.mV4l2Width;
+    }
+    int ret = ioctl(mFd.load(), VIDIOC_S_FMT, &fmt);
+    if (ret) {
+        ALOGE("%s   v4l2SetFmt VIDIOC_S_FMT failed: %s", __func__,
+              strerror(errno));
+        return -errno;
+    }
+    ALOGI("%s   success", __func__);
+    return ret;
+}
+
+int V4l2FrameSource::v4l2ReqBuf() {
+    if (mFd.load() < 0) {
+        ALOGE("%s   v4l2ReqBuf failed fd is wrong", __func__);
+        return -errno;
+    }
+
+    struct v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.count = mBufferCount;
+    req.memory = V4L2_MEMORY_MMAP;
+
+    req.type = mBufType;
+
+    if (ioctl(mFd.load(), VIDIOC_REQBUFS, &req)) {
+        ALOGE("%s   fd: %d v4l2ReqBuf VIDIOC_REQBUFS failed, errno: %s",
+              __func__, mFd.load(), strerror(errno));
+        return -errno;
+    }
+
+    if (req.count < (unsigned int)mBufferCount) {
+        ALOGE("%s   fd: %d v4l2ReqBuf low buffer memory on device, count: %d",
+              __func__, mFd.load(), req.count);
+        return -ENOMEM;
+    }
+
+    std::lock_guard<std::mutex> lk(mBufferLock);
+    mBuffers.resize(req.count);
+    for (unsigned int i = 0; i < req.count; i++) {
+        int ret = v4l2MapBuffer(i);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    ALOGI("%s   v4l2_req_buf ok count: %d", __func__, req.count);
+
+    return 0;
+}
+
+int V4l2FrameSource::v4l2MapBuffer(unsigned int i) {
+    v4l2_buffer v4l2_buf;
+    CLEAR(v4l2_buf);
+    v4l2_buf.flags = 0x0;
+    v4l2_buf.memory = V4L2_MEMORY_MMAP;
+    v4l2_buf.index = i;
+    v4l2_buf.type = mBufType;
+    struct v4l2_plane planes[1];
+    if (V4L2_TYPE_IS_MULTIPLANAR(mBufType)) {
+        CLEAR(planes[0]);
+        v4l2_buf.m.planes = planes;
+        v4l2_buf.length = 1;
+    }
+    ALOGI("%s   VIDIOC_QUERYBUF mFd: %d memType: %d mBufType: %d index: %d",
+          __func__, mFd.load(), v4l2_buf.memory, v4l2_buf.type,
+          v4l2_buf.index);
+    if (ioctl(mFd.load(), VIDIOC_QUERYBUF, &v4l2_buf)) {
+        ALOGE("%s   fd: %d v4l2ReqBuf VIDIOC_QUERYBUF failed, errno: %s",
+              __func__, mFd.load(), strerror(errno));
+        return -errno;
+    }
+    int length = 0;
+    int offset = 0;
+
+    if (V4L2_TYPE_IS_META(mBufType)) {
+        length = mFormat.fmt.meta.buffersize;
+    } else {
+        bool mp = V4L2_TYPE_IS_MULTIPLANAR(mBufType);
+        length = mp ? v4l2_buf.m.planes[0].length : v4l2_buf.length;
+        offset = mp ? v4l2_buf.m.planes[0].m.mem_offset : v4l2_buf.m.offset;
+    }
+    v4l2Buffer& buf = mBuffers[i];
+    buf.index = i;
+    buf.length = length;
+    buf.offset = offset;
+    ALOGI("%s   mmap length: %d offset: %d", __func__, length, offset);
+    // 映射内存
+    buf.start = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     mFd.load(), offset);
+    if (MAP_FAILED == buf.start) {
+        ALOGE("%s   fd: %d v4l2ReqBuf mmap failed, errno: %s", __func__,
+              mFd.load(), strerror(errno));
+        return -errno;
+    } else {
+        ALOGI("%s   fd: %d v4l2ReqBuf mmap start: %p length: %d", __func__,
+              mFd.load(), buf.start, buf.length);
+    }
+    struct v4l2_exportbuffer ebuf;
+    CLEAR(ebuf);
+    ebuf.type = mBufType;
+    ebuf.index = i;
+    int ret = ioctl(mFd.load(), VIDIOC_EXPBUF, &ebuf);
+    if (ret < 0) {
+        ALOGE("%s   VIDIOC_EXPBUF failed ret: %s", __func__, strerror(errno));
+        return -errno;
+    }
+    buf.exportFd = ebuf.fd;
+    ALOGI("%s   VIDIOC_EXPBUF index: %d exportFd: %d", __func__, i, buf.exportFd);
+    return 0;
+}
+
+int V4l2FrameSource::v4l2SetFps() {
+    if (mFd.load() < 0) {
+        ALOGE("%s   v4l2SetFps failed fd is wrong", __func__);
+        return -errno;
+    }
+    struct v4l2_streamparm parm;
+    memset(&parm, 0, sizeof(parm));
+    parm.type = mBufType;
+
+    int ret = ioctl(mFd.load(), VIDIOC_G_PARM, &parm);
+    if (ret != 0) {
+        ALOGE("%s   device does not support VIDIOC_G_PARM", __func__);
+        return -errno;
+    }
+    // Now check if the device is able to accept a capture frame rate set.
+    if (!(parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME)) {
+        ALOGE("%s: device does not support V4L2_CAP_TIMEPERFRAME", __func__);
+        return -EINVAL;
+    }
+
+    parm.parm.capture.timeperframe.denominator = mFps;
+    parm.parm.capture.timeperframe.numerator = 1;
+    int result = ioctl(mFd.load(), VIDIOC_S_PARM, &parm);
+    if (result) {
+        ALOGE("%s   fd:%d v4l2SetFps VIDIOC_S_PARM failed errno: %s", __func__,
+              mFd.load(), strerror(errno));
+        return -errno;
+    }
+
+    return result;
+}
+
+int V4l2FrameSource::v4l2StreamOn() {
+    if (mFd.load() < 0) {
+        ALOGE("%s   v4l2StreamOn failed fd is wrong", __func__);
+        return -errno;
+    }
+
+    unsigned int i = 0;
+    for (i = 0; i < mBuffers.size(); ++i) {
+        // 将缓冲帧放入队列
+        int ret = requeue(i);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    // 开始捕捉图像数据
+    enum v4l2_buf_type type;
+    type = mBufType;
+
+    if (ioctl(mFd.load(), VIDIOC_STREAMON, &type)) {
+        ALOGE("%s   fd:%d VIDIOC_STREAMON failed errno: %s", __func__,
+              mFd.load(), strerror(errno));
+        return -errno;
+    }
+    mV4l2Streaming = true;
+    return 0;
+}
+
+int V4l2FrameSource::querySensorTimings() {
+    int ret = NO_ERROR;
+
+    int fd = ::open(mSubDevice, O_RDWR);
+    if (fd < 0) {
+        ALOGE("%s   open device failed: %s", __func__, strerror(errno));
+        return -errno;
+    }
+    struct v4l2_dv_timings timings;
+    ret = ioctl(fd, VIDIOC_SUBDEV_QUERY_DV_TIMINGS, &timings);
+    ALOGI("%s   ret:%d   I:%d   wxh:%dx%d", __func__, ret,
+          timings.bt.interlaced, timings.bt.width, timings.bt.height);
+    if (ret < 0) {
+        ALOGE("%s   VIDIOC_SUBDEV_QUERY_DV_TIMINGS failed: %s", __func__,
+              strerror(errno));
+        ::close(fd);
+        return UNKNOWN_ERROR;
+    }
+    ::close(fd);
+    mSelectParams.mV4l2Width = timings.bt.width;
+    mSelectParams.mV4l2Height = timings.bt.height;
+    ALOGI("%s done", __func__);
+    return ret;
+}
+
+int V4l2FrameSource::getSensorFormat() {
+    int ret = NO_ERROR;
+
+    int fd = ::open(mSubDevice, O_RDWR);
+    if (fd < 0) {
+        ALOGE("%s   open device failed: %s", __func__, strerror(errno));
+        return -errno;
+    }
+    CLEAR(mSubFormat);
+    ret = ioctl(fd, VIDIOC_SUBDEV_G_FMT, &mSubFormat);
+    if (ret < 0) {
+        ALOGE("%s   VIDIOC_SUBDEV_G_FMT failed: %s", __func__, strerror(errno));
+        ::close(fd);
+        return UNKNOWN_ERROR;
+    }
+
+    ALOGI(
+        "%s   VIDIOC_SUBDEV_G_FMT: pad: %d, which: %d, width: %d, "
+        "height: %d, format: 0x%x, field: %d, color space: %d",
+        __func__, mSubFormat.pad, mSubFormat.which, mSubFormat.format.width,
+        mSubFormat.format.height, mSubFormat.format.code,
+        mSubFormat.format.field, mSubFormat.format.colorspace);
+    ::close(fd);
+    ALOGI("%s done", __func__);
+    return ret;
+}
+
+int V4l2FrameSource::setSensorFormat() {
+    int ret = NO_ERROR;
+
+    int fd = ::open(mSubDevice, O_RDWR);
+    if (fd < 0) {
+        ALOGE("%s   open device failed: %s", __func__, strerror(errno));
+        return -errno;
+    }
+
+    CLEAR(mSubFormat);
+    mSubFormat.pad = 0;
+    mSubFormat.which = V4L2_SUBDEV_FORMAT_ACTIVE;
+    mSubFormat.format.code = 0x2006;
+    mSubFormat.format.width = 3840;
+    mSubFormat.format.height = 2160;
+    mSubFormat.format.field = 0;
+    mSubFormat.format.quantization = 0;
+
+    ALOGI(
+        "%s   VIDIOC_SUBDEV_S_FMT: pad: %d, which: %d, width: %d, "
+        "height: %d, format: 0x%x, field: %d, color space: %d",
+        __func__, mSubFormat.pad, mSubFormat.which, mSubFormat.format.width,
+        mSubFormat.format.height, mSubFormat.format.code,
+        mSubFormat.format.field, mSubFormat.format.colorspace);
+
+    ret = ioctl(fd, VIDIOC_SUBDEV_S_FMT, &mSubFormat);
+    if (ret < 0) {
+        ALOGE("%s   VIDIOC_SUBDEV_S_FMT failed: %s", __func__, strerror(errno));
+        ::close(fd);
+        return UNKNOWN_ERROR;
+    }
+
+    ::close(fd);
+    ALOGI("%s done", __func__);
+    return NO_ERROR;
+}
+
+int V4l2FrameSource::setSensorInterval() {
+    int ret = NO_ERROR;
+
+    int fd = ::open(mSubDevice, O_RDWR);
+    if (fd < 0) {
+        ALOGE("%s   open device failed: %s", __func__, strerror(errno));
+        return -errno;
+    }
+
+    struct v4l2_subdev_frame_interval finterval {
+        .pad = 0, .interval.numerator = 10000,
+        .interval.denominator = (__u32)10000 * mFps,
+    };
+
+    ALOGI(
+        "%s   VIDIOC_SUBDEV_S_FRAME_INTERVAL: pad: %d, numerator %d, "
+        "denominator %d",
+        __func__, finterval.pad, finterval.interval.numerator,
+        finterval.interval.denominator);
+    ret = ioctl(fd, VIDIOC_SUBDEV_S_FRAME_INTERVAL, &finterval);
+    if (ret < 0) {
+        ALOGE("%s   VIDIOC_SUBDEV_S_FRAME_INTERVAL failed: %s", __func__,
+              strerror(errno));
+        ::close(fd);
+        return NO_ERROR;
+    }
+    ::close(fd);
+    ALOGI("%s done", __func__);
+    return NO_ERROR;
+}
+
+int V4l2FrameSource::open() {
+    mFd = ::open(mVideoDevice, O_RDWR);
+    if (mFd.load() < 0) {
+        ALOGE("%s   open device %s failed: %s", __func__, mVideoDevice,
+              strerror(errno));
+        return -errno;
+    }
+    ALOGI("%s   device: %s fd: %d", __func__, mVideoDevice, mFd.load());
+    return 0;
+}
+
+int V4l2FrameSource::negotiate(int width, int height, int fps) {
+    mWidth = width;
+    mHeight = height;
+    mFps = fps;
+
+    int ret = querySensorTimings();
+    if (ret < 0) {
+        ALOGE("%s   querySensorTimings failed: %s", __func__, strerror(errno));
+        return ret;
+    }
+
+    ret = getSensorFormat();
+    if (ret < 0) {
+        ALOGE("%s   getSensorFormat failed: %s", __func__, strerror(errno));
+        return ret;
+    }
+
+    ret = setSensorFormat();
+    if (ret < 0) {
+        ALOGE("%s   setSensorFormat failed: %s", __func__, strerror(errno));
+        return ret;
+    }
+
+    ret = setSensorInterval();
+    if (ret < 0) {
+        ALOGE("%s   setSensorInterval failed: %s", __func__, strerror(errno));
+        return ret;
+    }
+
+    ret = queryCapability();
+    if (ret < 0) {
+        ALOGE("%s   queryCapability failed: %s", __func__, strerror(errno));
+        return ret;
+    }
+
+    ret = enumDeviceFmt();
+    if (ret < 0) {
+        ALOGE("%s   getDeviceFmt failed: %s", __func__, strerror(errno));
+        return ret;
+    }
+    /*
+    ret = v4l2StreamOff();
+    if (ret < 0) {
+        ALOGE("%s   v4l2StreamOff failed: %s", __func__, strerror(errno));
+        return ret;
+    }
+    */
+    if (mSelectParams.mV4l2Width == 0 || mSelectParams.mV4l2Height == 0) {
+        mSelectParams.mV4l2Width = 3840;
+        mSelectParams.mV4l2Height = 2160;
+    }
+    ret = v4l2SetFmt();
+    if (ret < 0) {
+        ALOGE("%s   v4l2SetFmt failed: %s", __func__, strerror(errno));
+        return ret;
+    }
+    /*
+    ret = v4l2SetFps();
+    if (ret < 0) {
+        ALOGE("%s   v4l2SetFps failed: %s", __func__, strerror(errno));
+        return ret;
+    }
+    */
+
+    ret = getDeviceFmt();
+    if (ret < 0) {
+        ALOGE("%s   getDeviceFmt failed: %s", __func__, strerror(errno));
+        return ret;
+    }
+    return 0;
+}
+
+int V4l2FrameSource::start() {
+    int ret = v4l2ReqBuf();
+    if (ret < 0) {
+        ALOGE("%s   v4l2ReqBuf failed: %s", __func__, strerror(errno));
+        return ret;
+    }
+
+    ret = v4l2StreamOn();
+    if (ret < 0) {
+        ALOGE("%s   v4l2StreamOn failed: %s", __func__, strerror(errno));
+        return ret;
+    }
+    return 0;
+}
+
+int V4l2FrameSource::stop() { return v4l2StreamOff(); }
+
+void V4l2FrameSource::close() {
+    if (mFd.load() >= 0) {
+        ALOGI("%s   mFd: %d", __func__, mFd.load());
+        ::close(mFd.load());
+        mFd.store(-1);
+    }
+}
+
+int V4l2FrameSource::getPollFd() { return mFd.load(); }
+
+int V4l2FrameSource::dequeue(Frame* frame) {
+    v4l2_buffer buffer{};
+    buffer.type = mBufType;
+    buffer.memory = V4L2_MEMORY_MMAP;
+
+    // planes live on the stack, dequeue and requeue run on different threads
+    struct v4l2_plane planes[1] = {};
+    if (V4L2_TYPE_IS_MULTIPLANAR(mBufType)) {
+        buffer.m.planes = planes;
+        buffer.length = 1;
+    }
+
+    if (ioctl(mFd.load(), VIDIOC_DQBUF, &buffer) < 0) {
+        ALOGE("%s   VIDIOC_DQBUF fails: %s", __func__, strerror(errno));
+        return -errno;
+    }
+
+    frame->index = buffer.index;
+    {
+        std::lock_guard<std::mutex> lk(mBufferLock);
+        frame->start = mBuffers[buffer.index].start;
+    }
+    if (V4L2_TYPE_IS_MULTIPLANAR(mBufType)) {
+        frame->bytesUsed = buffer.m.planes[0].length;
+    } else {
+        frame->bytesUsed = buffer.bytesused;
+    }
+    frame->sequence = buffer.sequence;
+    frame->timestampUs =
+        (int64_t)buffer.timestamp.tv_sec * 1000000LL + buffer.timestamp.tv_usec;
+    if ((buffer.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) !=
+            V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC ||
+        frame->timestampUs == 0) {
+        // the driver does not stamp buffers, fall back to the dequeue time
+        frame->timestampUs = systemTime(SYSTEM_TIME_MONOTONIC) / 1000;
+    }
+    return 0;
+}
+
+int V4l2FrameSource::requeue(int index) {
+    v4l2_buffer buffer{};
+    buffer.index = index;
+    buffer.type = mBufType;
+    buffer.memory = V4L2_MEMORY_MMAP;
+
+    // planes live on the stack, dequeue and requeue run on different threads
+    struct v4l2_plane planes[1] = {};
+    if (V4L2_TYPE_IS_MULTIPLANAR(mBufType)) {
+        buffer.m.planes = planes;
+        buffer.length = 1;
+    }
+    if (ioctl(mFd.load(), VIDIOC_QBUF, &buffer) < 0) {
+        ALOGE("%s   VIDIOC_QBUF index: %d fails: %s", __func__,
+              buffer.index, strerror(errno));
+        return -errno;
+    }
+    return 0;
+}
+
+int V4l2FrameSource::exportFd(int index) {
+    std::lock_guard<std::mutex> lk(mBufferLock);
+    if (index < 0 || index >= (int)mBuffers.size()) {
+        return -EINVAL;
+    }
+    return mBuffers[index].exportFd;
+}
+
+int V4l2FrameSource::setBufferCount(int count) {
+    if (mV4l2Streaming) {
+        ALOGE("%s   cannot change buffer count while streaming", __func__);
+        return -EBUSY;
+    }
+    mBufferCount = count > 0 ? count : V4L2_BUFFER_COUNT;
+    return 0;
+}
+
+int V4l2FrameSource::getBufferCount() {
+    std::lock_guard<std::mutex> lk(mBufferLock);
+    return mBuffers.empty() ? mBufferCount : mBuffers.size();
+}
+
+int V4l2FrameSource::growBuffers(int count) {
+    if (!mV4l2Streaming) {
+        return -EINVAL;
+    }
+    struct v4l2_create_buffers create;
+    CLEAR(create);
+    create.count = count;
+    create.memory = V4L2_MEMORY_MMAP;
+    create.format.type = mBufType;
+    if (ioctl(mFd.load(), VIDIOC_G_FMT, &create.format)) {
+        ALOGE("%s   VIDIOC_G_FMT failed: %s", __func__, strerror(errno));
+        return -errno;
+    }
+    if (ioctl(mFd.load(), VIDIOC_CREATE_BUFS, &create)) {
+        ALOGE("%s   VIDIOC_CREATE_BUFS failed: %s", __func__, strerror(errno));
+        return -errno;
+    }
+    ALOGI("%s   VIDIOC_CREATE_BUFS index: %d count: %d", __func__, create.index,
+          create.count);
+
+    {
+        std::lock_guard<std::mutex> lk(mBufferLock);
+        mBuffers.resize(create.index + create.count);
+        for (unsigned int i = create.index; i < create.index + create.count; i++) {
+            int ret = v4l2MapBuffer(i);
+            if (ret < 0) {
+                return ret;
+            }
+        }
+    }
+    for (unsigned int i = create.index; i < create.index + create.count; i++) {
+        requeue(i);
+    }
+    return create.count;
+}
+
+uint32_t V4l2FrameSource::getWidth() { return mSelectParams.mV4l2Width; }
+
+uint32_t V4l2FrameSource::getHeight() { return mSelectParams.mV4l2Height; }
+
+uint32_t V4l2FrameSource::getFormat() { return mSelectParams.mV4l2Format; }
+
+// the sensor interval is set in whole frames per second, but the bridge may
+// report the exact rate, e.g. 1001/60000
+void V4l2FrameSource::getFrameRate(uint32_t* num, uint32_t* den) {
+    *num = mFps;
+    *den = 1;
+    struct v4l2_streamparm parm;
+    memset(&parm, 0, sizeof(parm));
+    parm.type = mBufType;
+    if (ioctl(mFd.load(), VIDIOC_G_PARM, &parm) == 0 &&
+        parm.parm.capture.timeperframe.numerator &&
+        parm.parm.capture.timeperframe.denominator) {
+        *num = parm.parm.capture.timeperframe.denominator;
+        *den = parm.parm.capture.timeperframe.numerator;
+    }
+}
@@ -0,0 +1,124 @@
+#ifndef CAPTUREENCODER_V4L2FRAMESOURCE_H
+#define CAPTUREENCODER_V4L2FRAMESOURCE_H
+
+#include <linux/v4l2-subdev.h>
+#include <linux/videodev2.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "FrameSource.h"
+
+#define V4L2_BUFFER_COUNT 4
+
+class V4l2FrameSource : public FrameSource {
+public:
+    V4l2FrameSource(const char* videoDevice = "/dev/video22",
+                    const char* subDevice = "/dev/v4l-subdev5");
+
+    ~V4l2FrameSource();
+
+    int open() override;
+
+    int negotiate(int width, int height, int fps) override;
+
+    int start() override;
+
+    int stop() override;
+
+    void close() override;
+
+    int getPollFd() override;
+
+    int dequeue(Frame* frame) override;
+
+    int requeue(int index) override;
+
+    int exportFd(int index) override;
+
+    int setBufferCount(int count) override;
+
+    int getBufferCount() override;
+
+    int growBuffers(int count) override;
+
+    uint32_t getWidth() override;
+
+    uint32_t getHeight() override;
+
+    uint32_t getFormat() override;
+
+    void getFrameRate(uint32_t* num, uint32_t* den) override;
+
+private:
+    struct v4l2Param {
+        bool getFormat;
+
+        uint32_t mMinDistance;
+
+        uint32_t mV4l2Format;
+
+        uint32_t mV4l2Width;
+
+        uint32_t mV4l2Height;
+    };
+
+    const char* mVideoDevice;
+
+    const char* mSubDevice;
+
+    int mWidth;
+
+    int mHeight;
+
+    int mFps;
+
+    std::atomic<int> mFd = -1;
+
+    volatile bool mV4l2Streaming = false;
+
+    struct v4l2_capability mCapability;
+
+    int mBufferCount = V4L2_BUFFER_COUNT;
+
+    std::mutex mBufferLock;
+
+    std::vector<v4l2Buffer> mBuffers;
+
+    enum v4l2_buf_type mBufType;
+
+    v4l2Param mSelectParams;
+
+    struct v4l2_subdev_format mSubFormat;
+
+    struct v4l2_format mFormat;
+
+    int enumDeviceFmt();
+
+    int getDeviceFmt();
+
+    int queryCapability();
+
+    int v4l2StreamOff();
+
+    int v4l2SetFmt();
+
+    int v4l2SetFps();
+
+    int v4l2ReqBuf();
+
+    int v4l2MapBuffer(unsigned int index);
+
+    int v4l2StreamOn();
+
+    int querySensorTimings();
+
+    int getSensorFormat();
+
+    int setSensorFormat();
+
+    int setSensorInterval();
+};
+
+#endif  // CAPTUREENCODER_V4L2FRAMESOURCE_H
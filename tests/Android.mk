@@ -0,0 +1,45 @@
+LOCAL_PATH := $(call my-dir)
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := CaptureEncoderHostTest
+
+LOCAL_SRC_FILES := \
+    EncoderResourceManagerTest.cpp \
+    FdImportTest.cpp \
+    FrameCadenceTest.cpp \
+    FragmentedMp4RecorderTest.cpp \
+    FrameTracerTest.cpp \
+    GopControllerTest.cpp \
+    InFlightFramesTest.cpp \
+    KeyFrameRequesterTest.cpp \
+    PacketBufferPoolTest.cpp \
+    ProcessRingTest.cpp \
+    RtpPacketizerTest.cpp \
+    ScalerStageTest.cpp \
+    StreamHandlerTest.cpp \
+    SyntheticFrameSourceTest.cpp \
+    ../CaptureReactor.cpp \
+    ../EncoderResourceManager.cpp \
+    ../FragmentedMp4Recorder.cpp \
+    ../FrameTracer.cpp \
+    ../GopController.cpp \
+    ../KeyFrameRequester.cpp \
+    ../PacketBufferPool.cpp \
+    ../RtpPacketizer.cpp \
+    ../ScalerStage.cpp \
+    ../SoftwareScalerBackend.cpp \
+    ../StreamHandler.cpp \
+    ../SyntheticFrameSource.cpp
+
+LOCAL_C_INCLUDES += \
+    $(LOCAL_PATH)/..
+
+LOCAL_CFLAGS += -Wno-unused-parameter
+
+LOCAL_SHARED_LIBRARIES := \
+    liblog \
+    libutils \
+    libcutils
+
+include $(BUILD_HOST_NATIVE_TEST)
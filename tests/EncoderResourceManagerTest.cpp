@@ -0,0 +1,146 @@
+// Admission, downgrade and measured load of the encoder budget, with the
+// rate windows driven by a fake clock.
+
+#include <gtest/gtest.h>
+
+#include <memory>
+
+#include "EncoderResourceManager.h"
+
+namespace {
+
+class FakeClock : public EncoderResourceManager::Clock {
+public:
+    int64_t nowUs() override { return mNowUs; }
+
+    void advanceMs(int64_t ms) { mNowUs += ms * 1000; }
+
+private:
+    int64_t mNowUs = 1000000;
+};
+
+const int64_t k4k60 = 3840LL * 2160 * 60;
+
+EncoderResourceManager::Request fixed(int width, int height, int fps) {
+    return {width, height, fps, fps, width, height};
+}
+
+class EncoderResourceManagerTest : public ::testing::Test {
+protected:
+    EncoderResourceManagerTest()
+        : mClock(std::make_shared<FakeClock>()), mManager(k4k60, mClock) {}
+
+    std::shared_ptr<FakeClock> mClock;
+
+    EncoderResourceManager mManager;
+
+    EncoderResourceManager::Grant mGrant;
+};
+
+}  // namespace
+
+TEST_F(EncoderResourceManagerTest, AdmitsWhatFitsAndRejectsTheRest) {
+    ASSERT_EQ(0, mManager.acquire(fixed(3840, 2160, 30), &mGrant));
+    EXPECT_EQ(3840, mGrant.width);
+    EXPECT_EQ(30, mGrant.fps);
+    int first = mGrant.channelId;
+
+    ASSERT_EQ(0, mManager.acquire(fixed(1920, 1080, 60), &mGrant));
+    int second = mGrant.channelId;
+    EXPECT_NE(first, second);
+    EXPECT_EQ(3840LL * 2160 * 30 + 1920LL * 1080 * 60, mManager.getReservedLoad());
+
+    // a quarter of the budget is left, a second 4K30 does not fit
+    EXPECT_EQ(-EBUSY, mManager.acquire(fixed(3840, 2160, 30), &mGrant));
+    EXPECT_EQ(0, mManager.release(first));
+    EXPECT_EQ(0, mManager.acquire(fixed(3840, 2160, 30), &mGrant));
+    EXPECT_EQ(first, mGrant.channelId);
+}
+
+TEST_F(EncoderResourceManagerTest, DowngradesFpsBeforeResolution) {
+    ASSERT_EQ(0, mManager.acquire(fixed(3840, 2160, 30), &mGrant));
+    ASSERT_EQ(0, mManager.acquire({3840, 2160, 60, 15, 1920, 1080}, &mGrant));
+    EXPECT_EQ(3840, mGrant.width);
+    EXPECT_EQ(2160, mGrant.height);
+    EXPECT_EQ(30, mGrant.fps);
+    EXPECT_EQ(k4k60, mManager.getReservedLoad());
+}
+
+TEST_F(EncoderResourceManagerTest, DowngradesResolutionWhenFpsIsFixed) {
+    ASSERT_EQ(0, mManager.acquire(fixed(3840, 2160, 45), &mGrant));
+    // a quarter left: 1080p60 fits, 4K at 60 does not at any fps >= 60
+    ASSERT_EQ(0, mManager.acquire({3840, 2160, 60, 60, 1920, 1080}, &mGrant));
+    EXPECT_EQ(1920, mGrant.width);
+    EXPECT_EQ(1080, mGrant.height);
+    EXPECT_EQ(60, mGrant.fps);
+
+    // nothing left, and 720p is below what the session allows
+    EXPECT_EQ(-EBUSY, mManager.acquire({1920, 1080, 30, 30, 1920, 1080}, &mGrant));
+}
+
+TEST_F(EncoderResourceManagerTest, HalvedSizesStayAligned) {
+    mManager.setBudget(1000LL * 600 * 30);
+    ASSERT_EQ(0, mManager.acquire({2000, 1200, 30, 30, 0, 0}, &mGrant));
+    EXPECT_EQ(992, mGrant.width);
+    EXPECT_EQ(592, mGrant.height);
+    EXPECT_EQ(30, mGrant.fps);
+}
+
+TEST_F(EncoderResourceManagerTest, RunsOutOfChannels) {
+    mManager.setBudget(k4k60 * 100);
+    for (int i = 0; i < EncoderResourceManager::kMaxChannels; i++) {
+        ASSERT_EQ(0, mManager.acquire(fixed(640, 480, 30), &mGrant));
+        EXPECT_EQ(i, mGrant.channelId);
+    }
+    EXPECT_EQ(-EBUSY, mManager.acquire(fixed(640, 480, 30), &mGrant));
+}
+
+TEST_F(EncoderResourceManagerTest, RejectsBadRequests) {
+    EXPECT_EQ(-EINVAL, mManager.acquire(fixed(0, 1080, 30), &mGrant));
+    EXPECT_EQ(-EINVAL, mManager.acquire(fixed(1920, 1080, 0), &mGrant));
+    EXPECT_EQ(-EINVAL, mManager.acquire(fixed(1920, 1080, 30), nullptr));
+    EXPECT_EQ(-EINVAL, mManager.release(0));
+    EXPECT_EQ(-EINVAL, mManager.release(EncoderResourceManager::kMaxChannels));
+}
+
+TEST_F(EncoderResourceManagerTest, BudgetChangesOnlyLaterAdmissions) {
+    ASSERT_EQ(0, mManager.acquire(fixed(3840, 2160, 60), &mGrant));
+    mManager.setBudget(k4k60 / 2);
+    EXPECT_EQ(k4k60 / 2, mManager.getBudget());
+    // the running session keeps its grant
+    EXPECT_EQ(k4k60, mManager.getReservedLoad());
+    EXPECT_EQ(-EBUSY, mManager.acquire(fixed(640, 480, 30), &mGrant));
+}
+
+TEST_F(EncoderResourceManagerTest, MeasuresTheLoadOverOneSecondWindows) {
+    ASSERT_EQ(0, mManager.acquire(fixed(1920, 1080, 30), &mGrant));
+    int channel = mGrant.channelId;
+    EXPECT_EQ(0, mManager.getMeasuredLoad());
+
+    // the encoder keeps up for a second
+    for (int i = 0; i < 30; i++) {
+        mManager.onFrameEncoded(channel);
+        mClock->advanceMs(1000 / 30 + 1);
+    }
+    EXPECT_EQ(1920LL * 1080 * 30 * 1000 / 1020, mManager.getMeasuredLoad());
+    // 1080p30 is an eighth of 4K60
+    EXPECT_EQ(12, mManager.getUtilization());
+
+    // then runs at half rate
+    for (int i = 0; i < 15; i++) {
+        mManager.onFrameEncoded(channel);
+        mClock->advanceMs(1000 / 15 + 1);
+    }
+    EXPECT_EQ(1920LL * 1080 * 15 * 1000 / 1005, mManager.getMeasuredLoad());
+
+    // and stalls, the load decays without another frame
+    mClock->advanceMs(1000);
+    EXPECT_EQ(0, mManager.getMeasuredLoad());
+    EXPECT_EQ(0, mManager.getUtilization());
+
+    // frames of a released channel are not counted
+    EXPECT_EQ(0, mManager.release(channel));
+    mManager.onFrameEncoded(channel);
+    mClock->advanceMs(1000);
+    EXPECT_EQ(0, mManager.getMeasuredLoad());
+}
@@ -0,0 +1,477 @@
+// Feeds synthetic HEVC and H.264 streams into the recorder and parses the
+// files back: box layout, sample entry, fragment timing and the samples.
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "FragmentedMp4Recorder.h"
+#include "PacketBufferPool.h"
+
+namespace {
+
+const int64_t kFrameUs = 40000;  // 25 fps, 3600 ticks
+const int64_t kStartUs = 5000000;
+
+uint32_t get16(const uint8_t* p) { return p[0] << 8 | p[1]; }
+
+uint32_t get32(const uint8_t* p) {
+    return (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+uint64_t get64(const uint8_t* p) { return (uint64_t)get32(p) << 32 | get32(p + 4); }
+
+struct Box {
+    std::string type;
+    const uint8_t* data;  // payload, after size and type
+    size_t size;
+    size_t offset;  // of the box header in the file
+};
+
+std::vector<Box> parseBoxes(const uint8_t* data, size_t size, size_t base = 0) {
+    std::vector<Box> boxes;
+    size_t pos = 0;
+    while (pos + 8 <= size) {
+        uint32_t boxSize = get32(data + pos);
+        if (boxSize < 8 || pos + boxSize > size) {
+            ADD_FAILURE() << "bad box size " << boxSize << " at " << base + pos;
+            break;
+        }
+        boxes.push_back({std::string((const char*)data + pos + 4, 4),
+                         data + pos + 8, boxSize - 8, base + pos});
+        pos += boxSize;
+    }
+    EXPECT_EQ(size, pos);
+    return boxes;
+}
+
+std::vector<Box> children(const Box& box, size_t skip = 0) {
+    return parseBoxes(box.data + skip, box.size - skip, box.offset + 8 + skip);
+}
+
+std::string typesOf(const std::vector<Box>& boxes) {
+    std::string types;
+    for (const Box& box : boxes) {
+        types += (types.empty() ? "" : " ") + box.type;
+    }
+    return types;
+}
+
+const Box* find(const std::vector<Box>& boxes, const char* type) {
+    for (const Box& box : boxes) {
+        if (box.type == type) {
+            return &box;
+        }
+    }
+    return nullptr;
+}
+
+// walks a path of container boxes, e.g. "trak/mdia/minf/stbl"
+const Box* findPath(const Box& root, const std::string& path,
+                    std::vector<std::vector<Box>>* keep) {
+    const Box* box = &root;
+    size_t start = 0;
+    while (box && start < path.size()) {
+        size_t end = path.find('/', start);
+        std::string type = path.substr(start, end - start);
+        keep->push_back(children(*box));
+        box = find(keep->back(), type.c_str());
+        start = end == std::string::npos ? path.size() : end + 1;
+    }
+    return box;
+}
+
+std::vector<uint8_t> readFile(const std::string& path) {
+    std::vector<uint8_t> data;
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return data;
+    }
+    uint8_t chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        data.insert(data.end(), chunk, chunk + n);
+    }
+    fclose(file);
+    return data;
+}
+
+void appendNal(std::vector<uint8_t>* out, const std::vector<uint8_t>& nal) {
+    static const uint8_t kStartCode[4] = {0, 0, 0, 1};
+    out->insert(out->end(), kStartCode, kStartCode + 4);
+    out->insert(out->end(), nal.begin(), nal.end());
+}
+
+// header bytes followed by a body free of start code emulation
+std::vector<uint8_t> makeNal(std::initializer_list<uint8_t> header, int frame,
+                             size_t bodySize) {
+    std::vector<uint8_t> nal(header);
+    for (size_t i = 0; i < bodySize; i++) {
+        nal.push_back(0x80 | ((frame + i) & 0x7f));
+    }
+    return nal;
+}
+
+// VPS, SPS and PPS of an HEVC Main stream at level 5.1
+const std::vector<uint8_t> kHevcVps = {0x40, 0x01, 0x0c, 0x01, 0xff, 0xff, 0x01, 0x60};
+const std::vector<uint8_t> kHevcSps = {0x42, 0x01, 0x01, 0x01, 0x60, 0x00, 0x00,
+                                       0x00, 0x90, 0x00, 0x00, 0x00, 0x00, 0x00,
+                                       0x99, 0xa0, 0x01, 0xe0, 0x20, 0x02, 0x1c};
+const std::vector<uint8_t> kHevcPps = {0x44, 0x01, 0xc1, 0x72, 0xb4, 0x62, 0x40};
+
+// SPS and PPS of an H.264 High stream at level 4.1
+const std::vector<uint8_t> kH264Sps = {0x67, 0x64, 0x00, 0x29, 0xac, 0x2b, 0x40, 0x3c};
+const std::vector<uint8_t> kH264Pps = {0x68, 0xee, 0x3c, 0xb0};
+
+std::vector<uint8_t> hevcFrame(int frame, bool keyFrame) {
+    std::vector<uint8_t> packet;
+    appendNal(&packet, {0x46, 0x01, 0x50});  // AUD
+    if (keyFrame) {
+        appendNal(&packet, kHevcVps);
+        appendNal(&packet, kHevcSps);
+        appendNal(&packet, kHevcPps);
+        appendNal(&packet, makeNal({0x26, 0x01}, frame, 2000));  // IDR_W_RADL
+    } else {
+        appendNal(&packet, makeNal({0x02, 0x01}, frame, 300));  // TRAIL_R
+    }
+    return packet;
+}
+
+std::vector<uint8_t> h264Frame(int frame, bool keyFrame) {
+    std::vector<uint8_t> packet;
+    if (keyFrame) {
+        appendNal(&packet, kH264Sps);
+        appendNal(&packet, kH264Pps);
+        appendNal(&packet, makeNal({0x65}, frame, 1500));
+    } else {
+        appendNal(&packet, makeNal({0x41}, frame, 200));
+    }
+    return packet;
+}
+
+// the length prefixed NAL unit types of one sample
+std::vector<int> sampleNalTypes(const uint8_t* sample, size_t size, bool hevc) {
+    std::vector<int> types;
+    size_t pos = 0;
+    while (pos + 4 <= size) {
+        uint32_t length = get32(sample + pos);
+        if (length == 0 || pos + 4 + length > size) {
+            ADD_FAILURE() << "bad NAL length " << length;
+            break;
+        }
+        uint8_t header = sample[pos + 4];
+        types.push_back(hevc ? (header >> 1) & 0x3f : header & 0x1f);
+        pos += 4 + length;
+    }
+    EXPECT_EQ(size, pos);
+    return types;
+}
+
+struct Fragment {
+    uint32_t sequence;
+    uint64_t baseTicks;
+    std::vector<uint32_t> durations;
+    std::vector<uint32_t> sizes;
+    std::vector<uint32_t> flags;
+    std::vector<std::vector<int>> nalTypes;
+};
+
+// checks a moof + mdat pair and returns what it holds
+Fragment parseFragment(const Box& moof, const Box& mdat, bool hevc) {
+    Fragment fragment;
+    std::vector<Box> boxes = children(moof);
+    EXPECT_EQ("mfhd traf", typesOf(boxes));
+    if (boxes.size() != 2) {
+        return fragment;
+    }
+    fragment.sequence = get32(boxes[0].data + 4);
+
+    std::vector<Box> traf = children(boxes[1]);
+    EXPECT_EQ("tfhd tfdt trun", typesOf(traf));
+    if (traf.size() != 3) {
+        return fragment;
+    }
+    // default-base-is-moof, track 1
+    EXPECT_EQ(0x020000u, get32(traf[0].data));
+    EXPECT_EQ(1u, get32(traf[0].data + 4));
+    EXPECT_EQ(1, traf[1].data[0]);
+    fragment.baseTicks = get64(traf[1].data + 4);
+
+    const uint8_t* trun = traf[2].data;
+    EXPECT_EQ(0x000701u, get32(trun));
+    uint32_t count = get32(trun + 4);
+    uint32_t dataOffset = get32(trun + 8);
+    // the samples start right after the mdat header
+    EXPECT_EQ(mdat.offset + 8, moof.offset + dataOffset);
+    EXPECT_EQ(12 + count * 12, traf[2].size);
+
+    size_t samplePos = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t* entry = trun + 12 + i * 12;
+        fragment.durations.push_back(get32(entry));
+        fragment.sizes.push_back(get32(entry + 4));
+        fragment.flags.push_back(get32(entry + 8));
+        if (samplePos + fragment.sizes.back() > mdat.size) {
+            ADD_FAILURE() << "sample " << i << " past the mdat";
+            break;
+        }
+        fragment.nalTypes.push_back(
+            sampleNalTypes(mdat.data + samplePos, fragment.sizes.back(), hevc));
+        samplePos += fragment.sizes.back();
+    }
+    EXPECT_EQ(mdat.size, samplePos);
+    return fragment;
+}
+
+class FragmentedMp4RecorderTest : public ::testing::Test {
+protected:
+    FragmentedMp4RecorderTest()
+        : mPrefix("/tmp/fmp4_test_" + std::to_string(getpid())) {}
+
+    ~FragmentedMp4RecorderTest() {
+        for (int i = 0; i < 8; i++) {
+            unlink(segmentPath(i).c_str());
+        }
+    }
+
+    std::string segmentPath(int index) {
+        return mPrefix + "_" + std::to_string(index) + ".mp4";
+    }
+
+    std::string mPrefix;
+};
+
+}  // namespace
+
+TEST_F(FragmentedMp4RecorderTest, HevcParsesBackFragmentPerGop) {
+    FragmentedMp4Recorder recorder(FragmentedMp4Recorder::CODEC_HEVC, 3840,
+                                   2160, mPrefix, 0, 0);
+    const int kGop = 25;
+    const int kFrames = 3 * kGop;
+    for (int i = 0; i < kFrames; i++) {
+        bool keyFrame = i % kGop == 0;
+        std::vector<uint8_t> packet = hevcFrame(i, keyFrame);
+        recorder.onPacket(packet.data(), packet.size(),
+                          keyFrame ? PacketBufferPool::kFlagKeyFrame : 0,
+                          kStartUs + i * kFrameUs);
+    }
+    ASSERT_EQ(0, recorder.close());
+    EXPECT_EQ(1, recorder.getSegmentCount());
+    EXPECT_EQ(0, recorder.getDroppedPackets());
+
+    std::vector<uint8_t> file = readFile(segmentPath(0));
+    ASSERT_FALSE(file.empty());
+    std::vector<Box> top = parseBoxes(file.data(), file.size());
+    ASSERT_EQ("ftyp moov moof mdat moof mdat moof mdat", typesOf(top));
+    EXPECT_EQ(0, memcmp(top[0].data, "iso5", 4));
+
+    std::vector<std::vector<Box>> keep;
+    const Box* mdhd = findPath(top[1], "trak/mdia/mdhd", &keep);
+    ASSERT_NE(nullptr, mdhd);
+    EXPECT_EQ(90000u, get32(mdhd->data + 12));
+    const Box* trex = findPath(top[1], "mvex/trex", &keep);
+    ASSERT_NE(nullptr, trex);
+    EXPECT_EQ(1u, get32(trex->data + 4));
+
+    const Box* stsd = findPath(top[1], "trak/mdia/minf/stbl/stsd", &keep);
+    ASSERT_NE(nullptr, stsd);
+    EXPECT_EQ(1u, get32(stsd->data + 4));
+    std::vector<Box> entries = children(*stsd, 8);
+    ASSERT_EQ("hvc1", typesOf(entries));
+    const Box& hvc1 = entries[0];
+    EXPECT_EQ(3840u, get16(hvc1.data + 24));
+    EXPECT_EQ(2160u, get16(hvc1.data + 26));
+
+    std::vector<Box> config = children(hvc1, 78);
+    ASSERT_EQ("hvcC", typesOf(config));
+    const uint8_t* hvcC = config[0].data;
+    EXPECT_EQ(1, hvcC[0]);
+    // profile_tier_level copied from the SPS: Main, level 5.1
+    EXPECT_EQ(0, memcmp(hvcC + 1, &kHevcSps[3], 12));
+    EXPECT_EQ(0x99, hvcC[12]);
+    EXPECT_EQ(1, hvcC[16] & 3);  // 4:2:0
+    EXPECT_EQ(3, hvcC[21] & 3);  // 4 byte NAL lengths
+    ASSERT_EQ(3, hvcC[22]);
+    const uint8_t* array = hvcC + 23;
+    const std::vector<uint8_t>* sets[3] = {&kHevcVps, &kHevcSps, &kHevcPps};
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(32 + i, array[0] & 0x3f);
+        EXPECT_EQ(1u, get16(array + 1));
+        uint32_t length = get16(array + 3);
+        ASSERT_EQ(sets[i]->size(), length);
+        EXPECT_EQ(0, memcmp(array + 5, sets[i]->data(), length));
+        array += 5 + length;
+    }
+    EXPECT_EQ(config[0].data + config[0].size, array);
+
+    for (int f = 0; f < 3; f++) {
+        Fragment fragment = parseFragment(top[2 + f * 2], top[3 + f * 2], true);
+        EXPECT_EQ((uint32_t)f + 1, fragment.sequence);
+        EXPECT_EQ((uint64_t)f * kGop * 3600, fragment.baseTicks);
+        ASSERT_EQ((size_t)kGop, fragment.durations.size());
+        for (int i = 0; i < kGop; i++) {
+            EXPECT_EQ(3600u, fragment.durations[i]);
+            EXPECT_EQ(i == 0 ? 0x02000000u : 0x01010000u, fragment.flags[i]);
+            // parameter sets and delimiters stay out of the samples
+            std::vector<int> expected = {i == 0 ? 19 : 1};
+            EXPECT_EQ(expected, fragment.nalTypes[i]);
+        }
+        EXPECT_EQ(4u + 2 + 2000, fragment.sizes[0]);
+        EXPECT_EQ(4u + 2 + 300, fragment.sizes[1]);
+    }
+}
+
+TEST_F(FragmentedMp4RecorderTest, H264SampleEntryCarriesAvcC) {
+    FragmentedMp4Recorder recorder(FragmentedMp4Recorder::CODEC_H264, 1920,
+                                   1080, mPrefix, 0, 0);
+    // no flags, key frames are found by their NAL type
+    for (int i = 0; i < 10; i++) {
+        std::vector<uint8_t> packet = h264Frame(i, i % 5 == 0);
+        recorder.onPacket(packet.data(), packet.size(), 0, kStartUs + i * kFrameUs);
+    }
+    ASSERT_EQ(0, recorder.close());
+
+    std::vector<uint8_t> file = readFile(segmentPath(0));
+    std::vector<Box> top = parseBoxes(file.data(), file.size());
+    ASSERT_EQ("ftyp moov moof mdat moof mdat", typesOf(top));
+
+    std::vector<std::vector<Box>> keep;
+    const Box* stsd = findPath(top[1], "trak/mdia/minf/stbl/stsd", &keep);
+    ASSERT_NE(nullptr, stsd);
+    std::vector<Box> entries = children(*stsd, 8);
+    ASSERT_EQ("avc1", typesOf(entries));
+    EXPECT_EQ(1920u, get16(entries[0].data + 24));
+    EXPECT_EQ(1080u, get16(entries[0].data + 26));
+    std::vector<Box> config = children(entries[0], 78);
+    ASSERT_EQ("avcC", typesOf(config));
+    const uint8_t* avcC = config[0].data;
+    EXPECT_EQ(1, avcC[0]);
+    EXPECT_EQ(0x64, avcC[1]);  // High
+    EXPECT_EQ(0x29, avcC[3]);  // level 4.1
+    EXPECT_EQ(0xff, avcC[4]);
+    EXPECT_EQ(0xe1, avcC[5]);
+    ASSERT_EQ(kH264Sps.size(), get16(avcC + 6));
+    EXPECT_EQ(0, memcmp(avcC + 8, kH264Sps.data(), kH264Sps.size()));
+    const uint8_t* pps = avcC + 8 + kH264Sps.size();
+    EXPECT_EQ(1, pps[0]);
+    ASSERT_EQ(kH264Pps.size(), get16(pps + 1));
+    EXPECT_EQ(0, memcmp(pps + 3, kH264Pps.data(), kH264Pps.size()));
+
+    Fragment fragment = parseFragment(top[2], top[3], false);
+    ASSERT_EQ(5u, fragment.sizes.size());
+    EXPECT_EQ(std::vector<int>{5}, fragment.nalTypes[0]);
+    EXPECT_EQ(std::vector<int>{1}, fragment.nalTypes[1]);
+    EXPECT_EQ(0x02000000u, fragment.flags[0]);
+}
+
+TEST_F(FragmentedMp4RecorderTest, NothingIsWrittenBeforeTheFirstKeyFrame) {
+    FragmentedMp4Recorder recorder(FragmentedMp4Recorder::CODEC_HEVC, 1280,
+                                   720, mPrefix, 0, 0);
+    for (int i = 0; i < 3; i++) {
+        std::vector<uint8_t> packet = hevcFrame(i, false);
+        recorder.onPacket(packet.data(), packet.size(), 0, kStartUs + i * kFrameUs);
+    }
+    EXPECT_EQ(0, recorder.getSegmentCount());
+    EXPECT_EQ(3, recorder.getDroppedPackets());
+    EXPECT_NE(0, access(segmentPath(0).c_str(), F_OK));
+
+    for (int i = 3; i < 6; i++) {
+        std::vector<uint8_t> packet = hevcFrame(i, i == 3);
+        recorder.onPacket(packet.data(), packet.size(), 0, kStartUs + i * kFrameUs);
+    }
+    ASSERT_EQ(0, recorder.close());
+    EXPECT_EQ(3, recorder.getDroppedPackets());
+
+    std::vector<uint8_t> file = readFile(segmentPath(0));
+    std::vector<Box> top = parseBoxes(file.data(), file.size());
+    ASSERT_EQ("ftyp moov moof mdat", typesOf(top));
+    Fragment fragment = parseFragment(top[2], top[3], true);
+    EXPECT_EQ(0u, fragment.baseTicks);
+    EXPECT_EQ(3u, fragment.sizes.size());
+
+    // later packets go nowhere
+    std::vector<uint8_t> packet = hevcFrame(6, true);
+    recorder.onPacket(packet.data(), packet.size(), 0, kStartUs + 6 * kFrameUs);
+    EXPECT_EQ(file.size(), readFile(segmentPath(0)).size());
+}
+
+TEST_F(FragmentedMp4RecorderTest, SegmentsRotateOnKeyFramesPastTheirDuration) {
+    FragmentedMp4Recorder recorder(FragmentedMp4Recorder::CODEC_HEVC, 1920,
+                                   1080, mPrefix, 1000000, 0);
+    // key frames every half second, segments of a second
+    const int kGop = 12;
+    const int kFrames = 6 * kGop + 1;
+    for (int i = 0; i < kFrames; i++) {
+        bool keyFrame = i % kGop == 0;
+        std::vector<uint8_t> packet = hevcFrame(i, keyFrame);
+        recorder.onPacket(packet.data(), packet.size(),
+                          keyFrame ? PacketBufferPool::kFlagKeyFrame : 0,
+                          kStartUs + i * kFrameUs);
+    }
+    ASSERT_EQ(0, recorder.close());
+    ASSERT_EQ(3, recorder.getSegmentCount());
+
+    int samples = 0;
+    for (int s = 0; s < 3; s++) {
+        std::vector<uint8_t> file = readFile(segmentPath(s));
+        std::vector<Box> top = parseBoxes(file.data(), file.size());
+        // key frames 480 ms apart: the one at 960 ms still joins the
+        // segment, the one at 1440 ms starts the next
+        std::string expected = s < 2 ? "ftyp moov moof mdat moof mdat moof mdat"
+                                     : "ftyp moov moof mdat";
+        ASSERT_EQ(expected, typesOf(top)) << "segment " << s;
+        uint64_t ticks = 0;
+        for (size_t f = 2; f + 1 < top.size(); f += 2) {
+            Fragment fragment = parseFragment(top[f], top[f + 1], true);
+            // every segment has its own timeline and sequence numbers
+            EXPECT_EQ((f - 2) / 2 + 1, fragment.sequence);
+            EXPECT_EQ(ticks, fragment.baseTicks);
+            EXPECT_EQ(0x02000000u, fragment.flags[0]);
+            for (uint32_t duration : fragment.durations) {
+                ticks += duration;
+            }
+            samples += fragment.sizes.size();
+        }
+    }
+    EXPECT_EQ(kFrames, samples);
+}
+
+TEST_F(FragmentedMp4RecorderTest, SlicesOfALowDelayFrameMakeOneSample) {
+    FragmentedMp4Recorder recorder(FragmentedMp4Recorder::CODEC_HEVC, 1920,
+                                   1080, mPrefix, 0, 0);
+    for (int i = 0; i < 4; i++) {
+        bool keyFrame = i == 0;
+        // three slices, all but the last flagged partial
+        for (int slice = 0; slice < 3; slice++) {
+            std::vector<uint8_t> packet;
+            if (keyFrame && slice == 0) {
+                appendNal(&packet, kHevcVps);
+                appendNal(&packet, kHevcSps);
+                appendNal(&packet, kHevcPps);
+            }
+            appendNal(&packet, makeNal({(uint8_t)(keyFrame ? 0x26 : 0x02), 0x01},
+                                       i * 3 + slice, 100));
+            uint32_t flags = slice < 2 ? PacketBufferPool::kFlagPartialFrame : 0;
+            if (keyFrame && slice == 0) {
+                flags |= PacketBufferPool::kFlagKeyFrame;
+            }
+            recorder.onPacket(packet.data(), packet.size(), flags,
+                              kStartUs + i * kFrameUs);
+        }
+    }
+    ASSERT_EQ(0, recorder.close());
+
+    std::vector<uint8_t> file = readFile(segmentPath(0));
+    std::vector<Box> top = parseBoxes(file.data(), file.size());
+    ASSERT_EQ("ftyp moov moof mdat", typesOf(top));
+    Fragment fragment = parseFragment(top[2], top[3], true);
+    ASSERT_EQ(4u, fragment.sizes.size());
+    EXPECT_EQ((std::vector<int>{19, 19, 19}), fragment.nalTypes[0]);
+    EXPECT_EQ((std::vector<int>{1, 1, 1}), fragment.nalTypes[3]);
+    EXPECT_EQ(3u * (4 + 2 + 100), fragment.sizes[1]);
+    EXPECT_EQ(0x02000000u, fragment.flags[0]);
+    EXPECT_EQ(0x01010000u, fragment.flags[1]);
+}
@@ -0,0 +1,135 @@
+// Frame selection and the output timestamp grid of FrameCadence, driven by
+// simulated capture clocks with jitter, a rate change and a lost frame.
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "FrameCadence.h"
+
+namespace {
+
+struct Taken {
+    uint32_t sequence;
+    int64_t captureUs;
+    int64_t ptsUs;
+};
+
+// capture clock of inNum/inDen fps with up to jitterUs either way, every
+// frame the cadence wants is stamped unless it is in evicted
+std::vector<Taken> run(FrameCadence* cadence, uint32_t inNum, uint32_t inDen,
+                       uint32_t first, uint32_t frames, int64_t jitterUs,
+                       const std::vector<uint32_t>& evicted = {}) {
+    std::vector<Taken> taken;
+    uint32_t seed = 1;
+    for (uint32_t sequence = first; sequence < first + frames; sequence++) {
+        if (!cadence->wants(sequence)) {
+            continue;
+        }
+        seed = seed * 1103515245 + 12345;
+        int64_t jitter = jitterUs ? (int64_t)(seed >> 16) % (2 * jitterUs + 1) - jitterUs : 0;
+        int64_t captureUs = 1000000 + sequence * 1000000LL * inDen / inNum + jitter;
+        bool lost = false;
+        for (uint32_t e : evicted) {
+            lost |= e == sequence;
+        }
+        if (lost) {
+            continue;
+        }
+        taken.push_back({sequence, captureUs, cadence->evenPtsUs(captureUs)});
+    }
+    return taken;
+}
+
+// timestamps strictly increase, each a whole number of periods after the
+// previous one and within half a period of capture
+void expectOnGrid(const std::vector<Taken>& taken, int64_t periodUs,
+                  int64_t* maxStepPeriods = nullptr) {
+    int64_t maxSteps = 0;
+    for (size_t i = 1; i < taken.size(); i++) {
+        int64_t step = taken[i].ptsUs - taken[i - 1].ptsUs;
+        ASSERT_GT(step, 0) << "frame " << taken[i].sequence;
+        int64_t periods = (step + periodUs / 2) / periodUs;
+        EXPECT_LE(llabs(step - periods * periodUs), 1) << "frame " << taken[i].sequence;
+        maxSteps = std::max(maxSteps, periods);
+    }
+    for (const Taken& t : taken) {
+        EXPECT_LE(llabs(t.ptsUs - t.captureUs), periodUs / 2 + 1)
+            << "frame " << t.sequence;
+    }
+    if (maxStepPeriods) {
+        *maxStepPeriods = maxSteps;
+    }
+}
+
+}  // namespace
+
+TEST(FrameCadenceTest, SixtyToTwentyFive) {
+    FrameCadence cadence;
+    cadence.setRates(60, 1, 25, 1);
+    std::vector<Taken> taken = run(&cadence, 60, 1, 0, 600, 200);
+    // 25 of every 60, 2 or 3 capture periods apart
+    ASSERT_EQ(250u, taken.size());
+    for (size_t i = 1; i < taken.size(); i++) {
+        uint32_t gap = taken[i].sequence - taken[i - 1].sequence;
+        EXPECT_TRUE(gap == 2 || gap == 3);
+    }
+    int64_t maxSteps;
+    expectOnGrid(taken, 40000, &maxSteps);
+    // an even 40 ms throughout
+    EXPECT_EQ(1, maxSteps);
+    EXPECT_EQ(taken[0].ptsUs + 249 * 40000, taken.back().ptsUs);
+}
+
+TEST(FrameCadenceTest, NtscToThirty) {
+    FrameCadence cadence;
+    cadence.setRates(60000, 1001, 30, 1);
+    // a minute of 59.94 takes 29.97 of every second
+    std::vector<Taken> taken = run(&cadence, 60000, 1001, 0, 3596, 200);
+    ASSERT_EQ(1799u, taken.size());
+    int64_t maxSteps;
+    expectOnGrid(taken, 33333, &maxSteps);
+    // the grid is a little fast, once in a while it skips a point
+    EXPECT_LE(maxSteps, 2);
+}
+
+TEST(FrameCadenceTest, RateChangeMidStream) {
+    FrameCadence cadence;
+    cadence.setRates(60, 1, 30, 1);
+    std::vector<Taken> before = run(&cadence, 60, 1, 0, 120, 200);
+    expectOnGrid(before, 33333);
+
+    cadence.setOutputRate(20, 1);
+    std::vector<Taken> after = run(&cadence, 60, 1, 120, 120, 200);
+    ASSERT_EQ(40u, after.size());
+    expectOnGrid(after, 50000);
+    // a new grid from the first frame at the new rate, still after the old
+    EXPECT_EQ(after[0].captureUs, after[0].ptsUs);
+    EXPECT_GT(after[0].ptsUs, before.back().ptsUs);
+}
+
+TEST(FrameCadenceTest, EvictedFrameLeavesItsGapRightAway) {
+    FrameCadence cadence;
+    cadence.setRates(60, 1, 30, 1);
+    // frame 41 is taken but dropped before the encoder gets it
+    std::vector<Taken> taken = run(&cadence, 60, 1, 0, 120, 200, {41});
+    ASSERT_EQ(59u, taken.size());
+    expectOnGrid(taken, 33333);
+    for (size_t i = 1; i < taken.size(); i++) {
+        int64_t step = taken[i].ptsUs - taken[i - 1].ptsUs;
+        if (taken[i].sequence == 43) {
+            EXPECT_NEAR(66667, step, 1);
+        } else {
+            EXPECT_NEAR(33333, step, 1);
+        }
+    }
+}
+
+TEST(FrameCadenceTest, EveryFrameKeepsCaptureTime) {
+    FrameCadence cadence;
+    cadence.setRates(30, 1, 60, 1);
+    EXPECT_TRUE(cadence.takesEveryFrame());
+    EXPECT_TRUE(cadence.wants(7));
+    EXPECT_EQ(123456, cadence.evenPtsUs(123456));
+}
@@ -0,0 +1,209 @@
+// What tracing costs the capture threads, and that the dump keeps every
+// consumer apart and is written off the thread that asked for it.
+
+#include <gtest/gtest.h>
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "FrameTracer.h"
+
+namespace {
+
+std::string dumpToString(const char* path) {
+    std::string text;
+    FILE* file = fopen(path, "r");
+    if (file == nullptr) {
+        return text;
+    }
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+        text.append(chunk, n);
+    }
+    fclose(file);
+    return text;
+}
+
+int countOf(const std::string& text, const std::string& needle) {
+    int count = 0;
+    for (size_t pos = text.find(needle); pos != std::string::npos;
+         pos = text.find(needle, pos + needle.size())) {
+        count++;
+    }
+    return count;
+}
+
+// the latency summary the dump keeps for label, e.g. "count=3 p50=..."
+std::string summaryOf(const std::string& text, const std::string& label) {
+    std::string key = "\"" + label + "\":\"";
+    size_t pos = text.find(key);
+    if (pos == std::string::npos) {
+        return "";
+    }
+    pos += key.size();
+    return text.substr(pos, text.find('"', pos) - pos);
+}
+
+// the summaries of every consumer registered under name, in registration order
+std::vector<std::string> summariesOf(const std::string& text, const std::string& name) {
+    std::vector<std::string> summaries;
+    std::string key = "\"" + name + " #";
+    for (size_t pos = text.find(key); pos != std::string::npos;
+         pos = text.find(key, pos + key.size())) {
+        size_t end = text.find("\":\"", pos);
+        if (end != std::string::npos && text.compare(end + 3, 6, "count=") == 0) {
+            summaries.push_back(summaryOf(text, text.substr(pos + 1, end - pos - 1)));
+        }
+    }
+    return summaries;
+}
+
+std::string tempPath(const char* name) {
+    return std::string("/tmp/") + name + "." + std::to_string(getpid()) + ".json";
+}
+
+TEST(FrameTracerTest, RecordCostsWellUnderAMicrosecond) {
+    FrameTracer& tracer = FrameTracer::getInstance();
+    tracer.setEnabled(true);
+    const int kEvents = 1000000;
+    // first call takes the ring, keep it out of the measurement
+    tracer.record(FrameTracer::STAGE_DISPATCH, 0, -1, 0, 0);
+
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < kEvents; i++) {
+        tracer.record(FrameTracer::STAGE_DISPATCH, i, -1, start, start + 1000);
+    }
+    nsecs_t recordNs = (systemTime(SYSTEM_TIME_MONOTONIC) - start) / kEvents;
+
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int i = 0; i < kEvents; i++) {
+        ScopedFrameTrace trace(FrameTracer::STAGE_DISPATCH, i);
+    }
+    nsecs_t scopedNs = (systemTime(SYSTEM_TIME_MONOTONIC) - start) / kEvents;
+
+    printf("record: %lld ns/event, scoped trace with both clock reads: %lld ns/event\n",
+           (long long)recordNs, (long long)scopedNs);
+    EXPECT_LT(recordNs, 1000);
+    EXPECT_LT(scopedNs, 1000);
+}
+
+TEST(FrameTracerTest, DisabledTracerRecordsNothing) {
+    FrameTracer& tracer = FrameTracer::getInstance();
+    int consumer = tracer.registerConsumer("TracerDisabled");
+    ASSERT_GE(consumer, 0);
+    tracer.setEnabled(false);
+    for (int i = 0; i < 100; i++) {
+        ScopedFrameTrace trace(FrameTracer::STAGE_RGA_BLIT, i, consumer);
+        tracer.recordLatency(consumer, systemTime(SYSTEM_TIME_MONOTONIC) / 1000);
+    }
+    tracer.setEnabled(true);
+
+    std::string path = tempPath("tracer_disabled");
+    ASSERT_GT(tracer.dumpChromeTrace(path.c_str()), 0);
+    std::string text = dumpToString(path.c_str());
+    unlink(path.c_str());
+    EXPECT_EQ(0, countOf(text, "\"consumer\":\"TracerDisabled #"));
+    std::vector<std::string> summaries = summariesOf(text, "TracerDisabled");
+    ASSERT_EQ(1u, summaries.size());
+    EXPECT_EQ(0u, summaries[0].find("count=0 "));
+    tracer.unregisterConsumer(consumer);
+}
+
+TEST(FrameTracerTest, ConsumersOfTheSameNameKeepTheirOwnHistogram) {
+    FrameTracer& tracer = FrameTracer::getInstance();
+    int first = tracer.registerConsumer("TracerTwin");
+    int second = tracer.registerConsumer("TracerTwin");
+    ASSERT_GE(first, 0);
+    ASSERT_GE(second, 0);
+    ASSERT_NE(first, second);
+
+    int64_t nowUs = systemTime(SYSTEM_TIME_MONOTONIC) / 1000;
+    for (int i = 0; i < 30; i++) {
+        tracer.recordLatency(first, nowUs - 1000);
+    }
+    for (int i = 0; i < 70; i++) {
+        tracer.recordLatency(second, nowUs - 100000);
+    }
+
+    std::string path = tempPath("tracer_twins");
+    ASSERT_GT(tracer.dumpChromeTrace(path.c_str()), 0);
+    std::string text = dumpToString(path.c_str());
+    unlink(path.c_str());
+
+    std::vector<std::string> summaries = summariesOf(text, "TracerTwin");
+    ASSERT_EQ(2u, summaries.size());
+    const std::string& firstSummary = summaries[0];
+    const std::string& secondSummary = summaries[1];
+    EXPECT_EQ(0u, firstSummary.find("count=30 "));
+    EXPECT_EQ(0u, secondSummary.find("count=70 "));
+
+    unsigned long long count, p50, p99, p999;
+    ASSERT_EQ(4, sscanf(firstSummary.c_str(), "count=%llu p50=%lluus p99=%lluus p999=%lluus",
+                        &count, &p50, &p99, &p999));
+    EXPECT_GE(p50, 1000u);
+    EXPECT_LT(p50, 1200u);
+    ASSERT_EQ(4, sscanf(secondSummary.c_str(), "count=%llu p50=%lluus p99=%lluus p999=%lluus",
+                        &count, &p50, &p99, &p999));
+    EXPECT_GE(p50, 100000u);
+    EXPECT_LT(p50, 120000u);
+
+    tracer.unregisterConsumer(first);
+    tracer.unregisterConsumer(second);
+}
+
+TEST(FrameTracerTest, DumpHoldsTheEventsOfEveryThread) {
+    FrameTracer& tracer = FrameTracer::getInstance();
+    tracer.setEnabled(true);
+    int consumer = tracer.registerConsumer("TracerThreads");
+    ASSERT_GE(consumer, 0);
+
+    const int kThreads = 3;
+    const int kPerThread = 500;
+    std::thread threads[kThreads];
+    for (int t = 0; t < kThreads; t++) {
+        threads[t] = std::thread([&tracer, consumer] {
+            for (int i = 0; i < kPerThread; i++) {
+                ScopedFrameTrace trace(FrameTracer::STAGE_MPP_PUT, i, consumer);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::string path = tempPath("tracer_threads");
+    ASSERT_GT(tracer.dumpChromeTrace(path.c_str()), kThreads * kPerThread);
+    std::string text = dumpToString(path.c_str());
+    unlink(path.c_str());
+
+    EXPECT_EQ(0u, text.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["));
+    EXPECT_EQ(text.size() - 3, text.rfind("}}\n"));
+    EXPECT_EQ(countOf(text, "{"), countOf(text, "}"));
+    EXPECT_EQ(countOf(text, "["), countOf(text, "]"));
+    EXPECT_EQ(kThreads * kPerThread,
+              countOf(text, "\"consumer\":\"TracerThreads #"));
+    tracer.unregisterConsumer(consumer);
+}
+
+TEST(FrameTracerTest, SignalWritesTheDump) {
+    FrameTracer& tracer = FrameTracer::getInstance();
+    std::string path = tempPath("tracer_signal");
+    unlink(path.c_str());
+    ASSERT_EQ(0, tracer.installSignalHandler(path.c_str()));
+
+    ASSERT_EQ(0, raise(SIGUSR2));
+    std::string text;
+    for (int i = 0; i < 200 && text.rfind("}}\n") == std::string::npos; i++) {
+        usleep(10000);
+        text = dumpToString(path.c_str());
+    }
+    unlink(path.c_str());
+    EXPECT_EQ(0u, text.find("{\"displayTimeUnit\":\"ms\",\"traceEvents\":["));
+}
+
+}  // namespace
@@ -0,0 +1,197 @@
+// Replays per-frame motion statistics shaped like an HDMI presentation feed
+// through GopController: static slides, slide changes, a video clip and a
+// burst of changes closer together than the IDR distance allows.
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "GopController.h"
+
+namespace {
+
+// a run of frames with the same kind of picture, the statistics wobble
+// around the given values like a real capture does
+struct Segment {
+    int frames;
+    uint32_t meanSad;
+    uint32_t movingPermille;
+    uint32_t sadJitter;
+    uint32_t permilleJitter;
+};
+
+struct Replay {
+    std::vector<int> keyFrames;
+    // frame, GOP and virtual I interval of every change
+    std::vector<std::vector<int>> gopChanges;
+    int frames = 0;
+};
+
+Replay replay(GopController* controller, const std::vector<Segment>& segments) {
+    Replay result;
+    uint32_t seed = 12345;
+    for (const Segment& segment : segments) {
+        for (int i = 0; i < segment.frames; i++) {
+            seed = seed * 1103515245 + 12345;
+            uint32_t noise = seed >> 16;
+            GopController::MotionStats stats = {
+                segment.meanSad + (segment.sadJitter ? noise % segment.sadJitter : 0),
+                segment.movingPermille +
+                    (segment.permilleJitter ? noise % segment.permilleJitter : 0)};
+            GopController::Decision decision = controller->onFrame(stats);
+            if (decision.keyFrame) {
+                result.keyFrames.push_back(result.frames);
+            }
+            if (decision.gopChanged) {
+                result.gopChanges.push_back(
+                    {result.frames, decision.gopLen, decision.viLen});
+            }
+            result.frames++;
+        }
+    }
+    return result;
+}
+
+const Segment kSlide = {0, 30, 0, 20, 4};
+
+Segment slide(int frames) {
+    Segment segment = kSlide;
+    segment.frames = frames;
+    return segment;
+}
+
+// the whole picture changes for one frame
+Segment slideChange(uint32_t meanSad) { return {1, meanSad, 900, 200, 50}; }
+
+}  // namespace
+
+TEST(GopControllerTest, SummarizeReadsTheSadBitsOfThePictureOnly) {
+    // 3x2 picture in rows of 4 blocks, the padding column is garbage
+    const uint32_t kMv = 0x12345u << 15;
+    uint32_t blocks[8] = {
+        kMv | 100, 0 | 600, kMv | 0x7fff, 0xffffffff,
+        kMv | 200, 513,     512,          0xffffffff,
+    };
+    GopController::MotionStats stats =
+        GopController::summarize(blocks, 4, 3, 2, 512);
+    EXPECT_EQ((100u + 600 + 0x7fff + 200 + 513 + 512) / 6, stats.meanSad);
+    // 600, 0x7fff and 513 moved
+    EXPECT_EQ(500u, stats.movingPermille);
+
+    stats = GopController::summarize(nullptr, 4, 3, 2, 512);
+    EXPECT_EQ(0u, stats.meanSad);
+    stats = GopController::summarize(blocks, 2, 3, 2, 512);
+    EXPECT_EQ(0u, stats.meanSad);
+}
+
+TEST(GopControllerTest, PresentationReplay) {
+    GopController::Config config;
+    GopController controller(config);
+    Replay result = replay(&controller, {
+        slide(120),           // 0: first slide
+        slideChange(4000),    // 120
+        slide(199),           // 121: second slide
+        slideChange(3500),    // 320
+        {300, 900, 350, 600, 300},  // 321: video clip in the slide
+        slide(100),           // 621: back to the slide
+    });
+    ASSERT_EQ(721, result.frames);
+
+    // the slide changes are cuts, nothing in the clip is
+    EXPECT_EQ((std::vector<int>{120, 320}), result.keyFrames);
+
+    std::vector<std::vector<int>> expected = {
+        // a still slide goes to the long GOP after staticFrames
+        {config.staticFrames - 1, config.staticGop, config.baseGop},
+        // the slide change leaves it with the cut
+        {120, config.baseGop, 0},
+        {120 + config.staticFrames, config.staticGop, config.baseGop},
+        {320, config.baseGop, 0},
+        // the clip never goes static, its slide does once it is still
+        {621 + config.staticFrames - 1, config.staticGop, config.baseGop},
+    };
+    EXPECT_EQ(expected, result.gopChanges);
+    EXPECT_TRUE(controller.isStatic());
+}
+
+TEST(GopControllerTest, CutsCloserThanTheIdrDistanceAreHeldBack) {
+    GopController::Config config;
+    GopController controller(config);
+    Replay result = replay(&controller, {
+        slide(100),
+        slideChange(4000),   // 100
+        slide(5),
+        slideChange(30000),  // 106, too soon after 100
+        slide(20),
+        slideChange(30000),  // 127
+        slide(10),
+    });
+    EXPECT_EQ((std::vector<int>{100, 127}), result.keyFrames);
+    for (size_t i = 1; i < result.keyFrames.size(); i++) {
+        EXPECT_GE(result.keyFrames[i] - result.keyFrames[i - 1],
+                  config.minIdrDistance);
+    }
+}
+
+TEST(GopControllerTest, OtherKeyFramesCountForTheIdrDistance) {
+    GopController controller;
+    replay(&controller, {slide(100)});
+    // a viewer asked for an IDR, a slide change right after gets none
+    controller.onKeyFrame();
+    Replay result = replay(&controller, {slide(5), slideChange(4000), slide(30),
+                                         slideChange(4000)});
+    EXPECT_EQ((std::vector<int>{36}), result.keyFrames);
+}
+
+TEST(GopControllerTest, BusyPicturesRaiseTheLevelACutMustClear) {
+    GopController controller;
+    // a high motion scene keeps the level up, a frame three times the old
+    // level of a quiet scene is no cut here
+    Replay result = replay(&controller, {{120, 3000, 700, 400, 100},
+                                         slideChange(6000),
+                                         {30, 3000, 700, 400, 100},
+                                         slideChange(12000)});  // 151
+    EXPECT_EQ((std::vector<int>{151}), result.keyFrames);
+    EXPECT_TRUE(result.gopChanges.empty());
+}
+
+TEST(GopControllerTest, SmallCutsNeedTheMinimumSad) {
+    GopController::Config config;
+    config.cutMinSad = 1024;
+    GopController controller(config);
+    // ten times a very low level is still below the minimum
+    Replay result = replay(&controller, {{100, 10, 0, 0, 0},
+                                         slideChange(800),
+                                         {100, 10, 0, 0, 0}});
+    EXPECT_TRUE(result.keyFrames.empty());
+}
+
+TEST(GopControllerTest, StaticPictureIsLeftOnMotionWithoutACut) {
+    GopController::Config config;
+    GopController controller(config);
+    Replay result = replay(&controller, {
+        slide(80),
+        // the presenter moves the pointer: a few blocks, no cut
+        {5, 40, 10, 10, 5},
+        // then scrolls
+        {10, 300, 60, 100, 20},
+    });
+    EXPECT_TRUE(result.keyFrames.empty());
+    std::vector<std::vector<int>> expected = {
+        {config.staticFrames - 1, config.staticGop, config.baseGop},
+        {85, config.baseGop, 0},
+    };
+    EXPECT_EQ(expected, result.gopChanges);
+}
+
+TEST(GopControllerTest, BaseGopChangesShowInTheNextChange) {
+    GopController::Config config;
+    GopController controller(config);
+    replay(&controller, {slide(70)});
+    ASSERT_TRUE(controller.isStatic());
+    controller.setBaseGop(120);
+    EXPECT_EQ(120, controller.getConfig().baseGop);
+    Replay result = replay(&controller, {slideChange(4000)});
+    std::vector<std::vector<int>> expected = {{0, 120, 0}};
+    EXPECT_EQ(expected, result.gopChanges);
+}
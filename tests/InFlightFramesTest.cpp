@@ -0,0 +1,289 @@
+// The submit/harvest hand-over of MppEncoderUnit, and its throughput against
+// the old synchronous loop on a fake encoder timed like a 4K60 HEVC encode.
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "InFlightFrames.h"
+
+namespace {
+
+int64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+// Encodes the frames put into it one after the other on its own thread, like
+// the VEPU working off MPP's input list, and hands the packets out in the
+// same order. Checks that nobody releases a frame it still reads.
+class FakeEncoder {
+public:
+    FakeEncoder(int frames, int64_t putUs, int64_t encodeUs)
+        : mReleased(frames), mPutUs(putUs), mEncodeUs(encodeUs),
+          mHardware([this] { encodeLoop(); }) {
+        for (auto& released : mReleased) {
+            released = false;
+        }
+    }
+
+    ~FakeEncoder() {
+        {
+            std::lock_guard<std::mutex> lk(mLock);
+            mExit = true;
+            mCond.notify_all();
+        }
+        mHardware.join();
+    }
+
+    // the submission itself, buffer import and the put call
+    void put(int frame) {
+        usleep(mPutUs);
+        std::lock_guard<std::mutex> lk(mLock);
+        mInput.push_back(frame);
+        mCond.notify_all();
+    }
+
+    // blocks until the next packet is out
+    int getPacket() {
+        std::unique_lock<std::mutex> lk(mLock);
+        mCond.wait(lk, [this] { return !mOutput.empty(); });
+        int frame = mOutput.front();
+        mOutput.pop_front();
+        return frame;
+    }
+
+    void release(int frame) {
+        if (mReleased[frame].exchange(true)) {
+            mDoubleReleases++;
+        }
+    }
+
+    int getReadAfterRelease() { return mReadAfterRelease.load(); }
+
+    int getDoubleReleases() { return mDoubleReleases.load(); }
+
+private:
+    void encodeLoop() {
+        std::unique_lock<std::mutex> lk(mLock);
+        while (true) {
+            mCond.wait(lk, [this] { return !mInput.empty() || mExit; });
+            if (mInput.empty()) {
+                return;
+            }
+            int frame = mInput.front();
+            mInput.pop_front();
+            lk.unlock();
+            int64_t endUs = nowUs() + mEncodeUs;
+            while (nowUs() < endUs) {
+                if (mReleased[frame]) {
+                    mReadAfterRelease++;
+                }
+                usleep(1000);
+            }
+            lk.lock();
+            mOutput.push_back(frame);
+            mCond.notify_all();
+        }
+    }
+
+    std::vector<std::atomic<bool>> mReleased;
+
+    std::atomic<int> mReadAfterRelease{0};
+
+    std::atomic<int> mDoubleReleases{0};
+
+    const int64_t mPutUs;
+
+    const int64_t mEncodeUs;
+
+    std::mutex mLock;
+
+    std::condition_variable mCond;
+
+    std::deque<int> mInput;
+
+    std::deque<int> mOutput;
+
+    bool mExit = false;
+
+    std::thread mHardware;
+};
+
+// per frame at 4K: the put, the hardware encode and the JNI delivery of the
+// packet to Java
+const int64_t kPutUs = 1000;
+const int64_t kEncodeUs = 14000;
+const int64_t kDeliverUs = 4000;
+const int kFrames = 90;
+
+double fps(int frames, int64_t us) { return frames * 1000000.0 / us; }
+
+// what MppEncoderUnit::threadLoop did before: put a frame, wait for its
+// packet, deliver it, then the next frame
+double runSynchronous(FakeEncoder* encoder) {
+    int64_t startUs = nowUs();
+    for (int i = 0; i < kFrames; i++) {
+        encoder->put(i);
+        int frame = encoder->getPacket();
+        encoder->release(frame);
+        usleep(kDeliverUs);
+    }
+    return fps(kFrames, nowUs() - startUs);
+}
+
+// the unit thread and SendResultThread as they are now
+double runPipelined(FakeEncoder* encoder, size_t maxInFlight,
+                    std::vector<int>* harvested, size_t* peakInFlight) {
+    InFlightFrames<int> inFlight(maxInFlight);
+    std::atomic<bool> submitDone{false};
+    int64_t startUs = nowUs();
+
+    std::thread harvest([&] {
+        while (true) {
+            int frame;
+            if (!inFlight.waitForOldest(33, [&] { return submitDone.load(); },
+                                        &frame)) {
+                if (submitDone) {
+                    return;
+                }
+                continue;
+            }
+            int packet = encoder->getPacket();
+            EXPECT_EQ(frame, packet);
+            inFlight.popOldest();
+            encoder->release(frame);
+            harvested->push_back(frame);
+            usleep(kDeliverUs);
+        }
+    });
+
+    *peakInFlight = 0;
+    for (int i = 0; i < kFrames; i++) {
+        bool failed = false;
+        while (!inFlight.waitForRoom(33, &failed)) {
+        }
+        EXPECT_FALSE(failed);
+        encoder->put(i);
+        inFlight.push(i);
+        *peakInFlight = std::max(*peakInFlight, inFlight.size());
+    }
+    submitDone = true;
+    inFlight.wake();
+    harvest.join();
+    return fps(kFrames, nowUs() - startUs);
+}
+
+}  // namespace
+
+TEST(InFlightFramesTest, SubmitWaitsForRoom) {
+    InFlightFrames<int> inFlight(2);
+    bool failed = true;
+    ASSERT_TRUE(inFlight.waitForRoom(0, &failed));
+    EXPECT_FALSE(failed);
+    inFlight.push(1);
+    inFlight.push(2);
+    EXPECT_FALSE(inFlight.waitForRoom(10, &failed));
+
+    std::thread harvest([&] {
+        usleep(20000);
+        inFlight.popOldest();
+    });
+    int64_t startUs = nowUs();
+    EXPECT_TRUE(inFlight.waitForRoom(1000, &failed));
+    EXPECT_LT(nowUs() - startUs, 500000);
+    harvest.join();
+
+    int oldest = 0;
+    ASSERT_TRUE(inFlight.waitForOldest(0, [] { return false; }, &oldest));
+    EXPECT_EQ(2, oldest);
+}
+
+TEST(InFlightFramesTest, FailedHarvestLetsTheSubmitThrough) {
+    InFlightFrames<int> inFlight(1);
+    inFlight.push(1);
+    std::thread harvest([&] {
+        usleep(20000);
+        inFlight.setFailed(true);
+    });
+    bool failed = false;
+    EXPECT_TRUE(inFlight.waitForRoom(1000, &failed));
+    EXPECT_TRUE(failed);
+    harvest.join();
+
+    // the encoder is replaced, what it held goes back
+    std::deque<int> frames = inFlight.takeAll();
+    EXPECT_EQ((std::deque<int>{1}), frames);
+    EXPECT_EQ(0u, inFlight.size());
+    inFlight.setFailed(false);
+    EXPECT_TRUE(inFlight.waitForRoom(0, &failed));
+    EXPECT_FALSE(failed);
+}
+
+TEST(InFlightFramesTest, HarvestWakesOnStop) {
+    InFlightFrames<int> inFlight(2);
+    std::atomic<bool> stop{false};
+    int frame = -1;
+    std::thread stopper([&] {
+        usleep(20000);
+        stop = true;
+        inFlight.wake();
+    });
+    int64_t startUs = nowUs();
+    EXPECT_FALSE(inFlight.waitForOldest(5000, [&] { return stop.load(); },
+                                        &frame));
+    EXPECT_LT(nowUs() - startUs, 1000000);
+    EXPECT_EQ(-1, frame);
+    stopper.join();
+
+    // a stopping harvest still drains what is in flight
+    inFlight.push(7);
+    EXPECT_TRUE(inFlight.waitForOldest(0, [] { return true; }, &frame));
+    EXPECT_EQ(7, frame);
+}
+
+TEST(InFlightFramesTest, PipelineOutrunsTheSynchronousLoopAt4k) {
+    double synchronous;
+    {
+        FakeEncoder encoder(kFrames, kPutUs, kEncodeUs);
+        synchronous = runSynchronous(&encoder);
+    }
+
+    std::vector<int> harvested;
+    size_t peakInFlight;
+    double pipelined;
+    int readAfterRelease;
+    int doubleReleases;
+    {
+        FakeEncoder encoder(kFrames, kPutUs, kEncodeUs);
+        pipelined = runPipelined(&encoder, 2, &harvested, &peakInFlight);
+        readAfterRelease = encoder.getReadAfterRelease();
+        doubleReleases = encoder.getDoubleReleases();
+    }
+
+    printf("4K encode %lld us, put %lld us, delivery %lld us: synchronous "
+           "%.1f fps, pipelined %.1f fps\n",
+           (long long)kEncodeUs, (long long)kPutUs, (long long)kDeliverUs,
+           synchronous, pipelined);
+    // put, encode and delivery add up past a 60 fps frame time in turn,
+    // overlapped the encode alone sets the rate
+    EXPECT_LT(synchronous, 57.0);
+    EXPECT_GT(pipelined, 62.0);
+
+    ASSERT_EQ((size_t)kFrames, harvested.size());
+    for (int i = 0; i < kFrames; i++) {
+        EXPECT_EQ(i, harvested[i]);
+    }
+    EXPECT_LE(peakInFlight, 2u);
+    EXPECT_EQ(0, readAfterRelease);
+    EXPECT_EQ(0, doubleReleases);
+}
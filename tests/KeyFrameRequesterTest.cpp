@@ -0,0 +1,122 @@
+// Key frame request coalescing on a frame clock: bursts within the window
+// share one IDR, requests after it get their own.
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+#include "KeyFrameRequester.h"
+
+namespace {
+
+const int64_t kFrameUs = 16667;
+
+// frames submitted from startUs on up to endUs, returns the times of the
+// IDRs among them
+std::vector<int64_t> submit(KeyFrameRequester* requester, int64_t startUs,
+                            int64_t endUs) {
+    std::vector<int64_t> idrs;
+    for (int64_t nowUs = startUs; nowUs < endUs; nowUs += kFrameUs) {
+        if (requester->takeDue(nowUs)) {
+            idrs.push_back(nowUs);
+        }
+    }
+    return idrs;
+}
+
+}  // namespace
+
+TEST(KeyFrameRequesterTest, NothingAskedNothingDue) {
+    KeyFrameRequester requester;
+    EXPECT_TRUE(submit(&requester, 0, 1000000).empty());
+    EXPECT_EQ(0, requester.getRequests());
+    EXPECT_EQ(0, requester.getKeyFrames());
+}
+
+TEST(KeyFrameRequesterTest, TwentyViewersCostTwoIdrs) {
+    KeyFrameRequester requester(500000);
+    // the first is served on the next frame
+    EXPECT_EQ(1, requester.request());
+    std::vector<int64_t> idrs = submit(&requester, 0, kFrameUs);
+    EXPECT_EQ((std::vector<int64_t>{0}), idrs);
+
+    // nineteen more join within the window, frame by frame
+    int64_t nowUs = kFrameUs;
+    for (int i = 0; i < 19; i++) {
+        EXPECT_EQ(i + 1, requester.request());
+        EXPECT_FALSE(requester.takeDue(nowUs));
+        nowUs += kFrameUs;
+    }
+    // they share one IDR at the end of the window
+    idrs = submit(&requester, nowUs, 2000000);
+    EXPECT_EQ(1u, idrs.size());
+    EXPECT_GE(idrs[0], 500000);
+    EXPECT_LT(idrs[0], 500000 + kFrameUs);
+    EXPECT_EQ(20, requester.getRequests());
+    EXPECT_EQ(2, requester.getKeyFrames());
+}
+
+TEST(KeyFrameRequesterTest, RequestAfterTheWindowIsServedAtOnce) {
+    KeyFrameRequester requester(500000);
+    requester.request();
+    ASSERT_TRUE(requester.takeDue(0));
+    // the window is over by the time the next one comes in
+    EXPECT_TRUE(submit(&requester, kFrameUs, 500000 + kFrameUs).empty());
+    EXPECT_EQ(1, requester.request());
+    EXPECT_TRUE(requester.takeDue(500000 + kFrameUs));
+    EXPECT_EQ(2, requester.getKeyFrames());
+}
+
+TEST(KeyFrameRequesterTest, NoWindowServesEveryFrame) {
+    KeyFrameRequester requester(500000);
+    requester.setWindowUs(0);
+    for (int i = 0; i < 5; i++) {
+        requester.request();
+        EXPECT_TRUE(requester.takeDue(i * kFrameUs));
+    }
+    EXPECT_EQ(5, requester.getKeyFrames());
+
+    // negative is no window too
+    requester.setWindowUs(-1);
+    requester.request();
+    EXPECT_TRUE(requester.takeDue(5 * kFrameUs));
+}
+
+TEST(KeyFrameRequesterTest, RequestCountsWhatTheNextIdrServes) {
+    KeyFrameRequester requester(500000);
+    requester.request();
+    ASSERT_TRUE(requester.takeDue(0));
+    EXPECT_EQ(1, requester.request());
+    EXPECT_EQ(2, requester.request());
+    EXPECT_EQ(3, requester.request());
+    ASSERT_TRUE(requester.takeDue(500000));
+    // served, the count starts over
+    EXPECT_EQ(1, requester.request());
+    EXPECT_EQ(5, requester.getRequests());
+}
+
+TEST(KeyFrameRequesterTest, RequestsFromManyThreadsAreAllCounted) {
+    KeyFrameRequester requester(500000);
+    std::vector<std::thread> viewers;
+    for (int i = 0; i < 8; i++) {
+        viewers.emplace_back([&] {
+            for (int j = 0; j < 1000; j++) {
+                requester.request();
+            }
+        });
+    }
+    int idrs = 0;
+    int64_t nowUs = 0;
+    for (int i = 0; i < 200; i++, nowUs += kFrameUs) {
+        idrs += requester.takeDue(nowUs);
+    }
+    for (auto& viewer : viewers) {
+        viewer.join();
+    }
+    idrs += submit(&requester, nowUs, nowUs + 600000).size();
+    EXPECT_EQ(8000, requester.getRequests());
+    EXPECT_EQ(idrs, requester.getKeyFrames());
+    // one per window at most
+    EXPECT_LE(idrs, (nowUs + 600000) / 500000 + 1);
+}
@@ -0,0 +1,254 @@
+// ProcessRing ordering, eviction and wake-up, and what a hand-over costs
+// next to the mutex and condition variable queue the units used before.
+
+#include <gtest/gtest.h>
+#include <utils/Timers.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ProcessRing.h"
+
+namespace {
+
+typedef ProcessRing<int, 8> Ring;
+
+// the queue the units had before the ring, kept here as the baseline
+class LockedQueue {
+public:
+    void push(int item) {
+        std::lock_guard<std::mutex> lk(mLock);
+        mItems.push_back(item);
+        mCond.notify_one();
+    }
+
+    bool wait(int timeoutMs, int* out) {
+        std::unique_lock<std::mutex> lk(mLock);
+        if (!mCond.wait_for(lk, std::chrono::milliseconds(timeoutMs),
+                            [this] { return !mItems.empty(); })) {
+            return false;
+        }
+        *out = mItems.front();
+        mItems.pop_front();
+        return true;
+    }
+
+private:
+    std::mutex mLock;
+
+    std::condition_variable mCond;
+
+    std::list<int> mItems;
+};
+
+nsecs_t now() { return systemTime(SYSTEM_TIME_MONOTONIC); }
+
+nsecs_t median(std::vector<nsecs_t>* samples) {
+    std::nth_element(samples->begin(), samples->begin() + samples->size() / 2,
+                     samples->end());
+    return (*samples)[samples->size() / 2];
+}
+
+// Consumer sleeps, producer pushes the time and waits until it is taken,
+// the sample is how long the sleeping consumer took to see it.
+template <typename Push, typename Take>
+std::vector<nsecs_t> measureWakeLatency(int rounds, Push push, Take take) {
+    std::vector<nsecs_t> samples;
+    std::atomic<int> taken{0};
+    std::thread consumer([&] {
+        for (int i = 0; i < rounds; i++) {
+            nsecs_t pushed = take();
+            samples.push_back(now() - pushed);
+            taken.store(i + 1, std::memory_order_release);
+        }
+    });
+    for (int i = 0; i < rounds; i++) {
+        // give the consumer time to go to sleep
+        usleep(200);
+        push(now());
+        while (taken.load(std::memory_order_acquire) <= i) {
+            sched_yield();
+        }
+    }
+    consumer.join();
+    return samples;
+}
+
+}  // namespace
+
+TEST(ProcessRingTest, KeepsOrderAndRefusesWhenFull) {
+    Ring ring;
+    EXPECT_EQ(nullptr, ring.peek());
+    for (int i = 0; i < 8; i++) {
+        EXPECT_TRUE(ring.push(i));
+    }
+    EXPECT_FALSE(ring.push(8));
+    EXPECT_EQ(8u, ring.pending());
+
+    for (int i = 0; i < 8; i++) {
+        int* item = ring.peek();
+        ASSERT_NE(nullptr, item);
+        EXPECT_EQ(i, *item);
+        // the head stays the consumer's until commit
+        EXPECT_EQ(item, ring.peek());
+        ring.commit();
+        EXPECT_TRUE(ring.push(100 + i));
+    }
+    EXPECT_EQ(100, *ring.peek());
+}
+
+TEST(ProcessRingTest, EvictionSkipsTheItemTheConsumerHolds) {
+    Ring ring;
+    ring.push(1);
+    ring.push(2);
+    ring.push(3);
+    ASSERT_EQ(1, *ring.peek());
+    EXPECT_EQ(2u, ring.pending());
+
+    int evicted = 0;
+    EXPECT_TRUE(ring.evictOldest(&evicted));
+    EXPECT_EQ(2, evicted);
+    EXPECT_EQ(1u, ring.pending());
+
+    ring.commit();
+    // the evicted slot is stepped over
+    ASSERT_NE(nullptr, ring.peek());
+    EXPECT_EQ(3, *ring.peek());
+    EXPECT_FALSE(ring.evictOldest(&evicted));
+    ring.commit();
+    EXPECT_EQ(nullptr, ring.peek());
+    EXPECT_EQ(0u, ring.pending());
+}
+
+TEST(ProcessRingTest, WaitTimesOutAndWakes) {
+    Ring ring;
+    nsecs_t start = now();
+    EXPECT_FALSE(ring.wait(20));
+    EXPECT_GE(now() - start, ms2ns(20));
+
+    std::thread waker([&ring] {
+        usleep(10 * 1000);
+        ring.wake();
+    });
+    start = now();
+    EXPECT_FALSE(ring.wait(5000));
+    EXPECT_LT(now() - start, ms2ns(1000));
+    waker.join();
+
+    std::thread producer([&ring] {
+        usleep(10 * 1000);
+        ring.push(7);
+    });
+    EXPECT_TRUE(ring.wait(5000));
+    EXPECT_EQ(7, *ring.peek());
+    producer.join();
+}
+
+TEST(ProcessRingTest, NothingIsLostWhileEvictingUnderLoad) {
+    const int kItems = 200000;
+    Ring ring;
+    std::vector<int> consumed;
+    std::vector<int> evicted;
+    std::atomic<bool> done{false};
+
+    std::thread consumer([&] {
+        while (true) {
+            if (!ring.wait(10)) {
+                if (done.load() && ring.peek() == nullptr) {
+                    break;
+                }
+                continue;
+            }
+            consumed.push_back(*ring.peek());
+            ring.commit();
+        }
+    });
+    for (int i = 0; i < kItems; i++) {
+        int out;
+        // shed like DROP_OLDEST with maxPending 2
+        if (ring.pending() >= 2 && ring.evictOldest(&out)) {
+            evicted.push_back(out);
+        }
+        while (!ring.push(i)) {
+            sched_yield();
+        }
+    }
+    done.store(true);
+    consumer.join();
+
+    EXPECT_EQ((size_t)kItems, consumed.size() + evicted.size());
+    EXPECT_TRUE(std::is_sorted(consumed.begin(), consumed.end()));
+    EXPECT_TRUE(std::is_sorted(evicted.begin(), evicted.end()));
+    std::vector<int> all(consumed);
+    all.insert(all.end(), evicted.begin(), evicted.end());
+    std::sort(all.begin(), all.end());
+    for (int i = 0; i < kItems; i++) {
+        ASSERT_EQ(i, all[i]);
+    }
+}
+
+TEST(ProcessRingTest, HandOverCostNextToTheLockedQueue) {
+    const int kRounds = 1000000;
+    ProcessRing<int, 32> ring;
+    nsecs_t start = now();
+    for (int i = 0; i < kRounds; i++) {
+        ring.push(i);
+        ring.peek();
+        ring.commit();
+    }
+    nsecs_t ringNs = (now() - start) / kRounds;
+
+    LockedQueue queue;
+    int item;
+    start = now();
+    for (int i = 0; i < kRounds; i++) {
+        queue.push(i);
+        queue.wait(0, &item);
+    }
+    nsecs_t queueNs = (now() - start) / kRounds;
+
+    const int kWakeRounds = 500;
+    ProcessRing<nsecs_t, 32> timeRing;
+    std::vector<nsecs_t> ringWake = measureWakeLatency(
+        kWakeRounds, [&](nsecs_t t) { timeRing.push(t); },
+        [&] {
+            while (!timeRing.wait(1000)) {
+            }
+            nsecs_t t = *timeRing.peek();
+            timeRing.commit();
+            return t;
+        });
+
+    std::mutex lock;
+    std::condition_variable cond;
+    std::list<nsecs_t> items;
+    std::vector<nsecs_t> queueWake = measureWakeLatency(
+        kWakeRounds,
+        [&](nsecs_t t) {
+            std::lock_guard<std::mutex> lk(lock);
+            items.push_back(t);
+            cond.notify_one();
+        },
+        [&] {
+            std::unique_lock<std::mutex> lk(lock);
+            cond.wait(lk, [&] { return !items.empty(); });
+            nsecs_t t = items.front();
+            items.pop_front();
+            return t;
+        });
+
+    nsecs_t ringWakeNs = median(&ringWake);
+    nsecs_t queueWakeNs = median(&queueWake);
+    printf("hand-over without a sleeper: ring %lld ns, locked queue %lld ns\n"
+           "wake of a sleeping consumer, median: ring %lld us, locked queue "
+           "%lld us\n",
+           (long long)ringNs, (long long)queueNs, (long long)ringWakeNs / 1000,
+           (long long)queueWakeNs / 1000);
+    EXPECT_LT(ringNs, 1000);
+    EXPECT_LT(ringWakeNs, ms2ns(5));
+}
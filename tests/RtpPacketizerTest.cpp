@@ -0,0 +1,320 @@
+// Sends access units through the packetizer to a UDP socket on loopback,
+// depacketizes what arrives and compares the NAL units with what went in.
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "PacketBufferPool.h"
+#include "RtpPacketizer.h"
+
+namespace {
+
+const int kPayloadType = 96;
+const uint32_t kSsrc = 0x1234abcd;
+const int kMtu = 1400;
+
+typedef std::vector<uint8_t> Nal;
+
+struct Datagram {
+    bool marker;
+    int payloadType;
+    uint16_t sequence;
+    uint32_t timestamp;
+    uint32_t ssrc;
+    std::vector<uint8_t> payload;
+};
+
+// what a receiver makes of the datagrams of one access unit
+struct AccessUnit {
+    std::vector<Nal> nals;
+    std::vector<Datagram> datagrams;
+};
+
+Nal makeNal(std::initializer_list<uint8_t> header, int seed, size_t size) {
+    Nal nal(header);
+    while (nal.size() < size) {
+        nal.push_back(0x80 | ((seed + nal.size()) & 0x7f));
+    }
+    return nal;
+}
+
+std::vector<uint8_t> toAnnexB(const std::vector<Nal>& nals) {
+    std::vector<uint8_t> packet;
+    for (const Nal& nal : nals) {
+        static const uint8_t kStartCode[4] = {0, 0, 0, 1};
+        packet.insert(packet.end(), kStartCode, kStartCode + 4);
+        packet.insert(packet.end(), nal.begin(), nal.end());
+    }
+    return packet;
+}
+
+class RtpPacketizerTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        mFd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        ASSERT_GE(mFd, 0);
+        int receiveBuffer = 4 * 1024 * 1024;
+        setsockopt(mFd, SOL_SOCKET, SO_RCVBUF, &receiveBuffer,
+                   sizeof(receiveBuffer));
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ASSERT_EQ(0, bind(mFd, (struct sockaddr*)&addr, sizeof(addr)));
+        socklen_t length = sizeof(addr);
+        ASSERT_EQ(0, getsockname(mFd, (struct sockaddr*)&addr, &length));
+        mPort = ntohs(addr.sin_port);
+    }
+
+    void TearDown() override { close(mFd); }
+
+    std::vector<Datagram> receiveAll() {
+        std::vector<Datagram> datagrams;
+        uint8_t buffer[65536];
+        while (true) {
+            ssize_t size = recv(mFd, buffer, sizeof(buffer), MSG_DONTWAIT);
+            if (size < 0) {
+                break;
+            }
+            EXPECT_LE(size, kMtu);
+            if (size < 12) {
+                ADD_FAILURE() << "short datagram " << size;
+                continue;
+            }
+            EXPECT_EQ(0x80, buffer[0]);  // version 2, no padding or CSRC
+            Datagram datagram;
+            datagram.marker = buffer[1] & 0x80;
+            datagram.payloadType = buffer[1] & 0x7f;
+            datagram.sequence = buffer[2] << 8 | buffer[3];
+            datagram.timestamp = (uint32_t)buffer[4] << 24 | buffer[5] << 16 |
+                                 buffer[6] << 8 | buffer[7];
+            datagram.ssrc = (uint32_t)buffer[8] << 24 | buffer[9] << 16 |
+                            buffer[10] << 8 | buffer[11];
+            datagram.payload.assign(buffer + 12, buffer + size);
+            datagrams.push_back(datagram);
+        }
+        return datagrams;
+    }
+
+    // RFC 7798 and RFC 6184 depacketization of one access unit
+    AccessUnit depacketize(const std::vector<Datagram>& datagrams, bool hevc) {
+        AccessUnit unit;
+        unit.datagrams = datagrams;
+        size_t headerSize = hevc ? 2 : 1;
+        Nal fragmented;
+        for (const Datagram& datagram : datagrams) {
+            const std::vector<uint8_t>& p = datagram.payload;
+            if (p.size() <= headerSize) {
+                ADD_FAILURE() << "empty payload";
+                continue;
+            }
+            int type = hevc ? (p[0] >> 1) & 0x3f : p[0] & 0x1f;
+            if (type == (hevc ? 48 : 24)) {
+                size_t pos = headerSize;
+                while (pos + 2 <= p.size()) {
+                    size_t size = p[pos] << 8 | p[pos + 1];
+                    if (size == 0 || pos + 2 + size > p.size()) {
+                        ADD_FAILURE() << "bad aggregation unit size " << size;
+                        break;
+                    }
+                    unit.nals.emplace_back(p.begin() + pos + 2,
+                                           p.begin() + pos + 2 + size);
+                    pos += 2 + size;
+                }
+                EXPECT_EQ(p.size(), pos);
+            } else if (type == (hevc ? 49 : 28)) {
+                uint8_t fu = p[headerSize];
+                bool start = fu & 0x80;
+                bool end = fu & 0x40;
+                int nalType = fu & (hevc ? 0x3f : 0x1f);
+                EXPECT_EQ(start, fragmented.empty());
+                if (start) {
+                    if (hevc) {
+                        fragmented.push_back((p[0] & 0x81) | nalType << 1);
+                        fragmented.push_back(p[1]);
+                    } else {
+                        fragmented.push_back((p[0] & 0xe0) | nalType);
+                    }
+                }
+                fragmented.insert(fragmented.end(), p.begin() + headerSize + 1,
+                                  p.end());
+                if (end) {
+                    unit.nals.push_back(fragmented);
+                    fragmented.clear();
+                }
+            } else {
+                unit.nals.push_back(p);
+            }
+        }
+        EXPECT_TRUE(fragmented.empty()) << "unfinished fragmentation unit";
+        return unit;
+    }
+
+    AccessUnit send(RtpPacketizer* packetizer, const std::vector<Nal>& nals,
+                    bool hevc, int64_t ptsUs, uint32_t flags = 0) {
+        std::vector<uint8_t> packet = toAnnexB(nals);
+        packetizer->onPacket(packet.data(), packet.size(), flags, ptsUs);
+        std::vector<Datagram> datagrams = receiveAll();
+        for (size_t i = 0; i < datagrams.size(); i++) {
+            const Datagram& datagram = datagrams[i];
+            EXPECT_EQ(kPayloadType, datagram.payloadType);
+            EXPECT_EQ(kSsrc, datagram.ssrc);
+            EXPECT_EQ((uint32_t)(ptsUs * 9 / 100), datagram.timestamp);
+            EXPECT_EQ(mNextSequence++, datagram.sequence);
+            bool last = i + 1 == datagrams.size();
+            EXPECT_EQ(last && !(flags & PacketBufferPool::kFlagPartialFrame),
+                      datagram.marker)
+                << "datagram " << i;
+        }
+        return depacketize(datagrams, hevc);
+    }
+
+    int mFd = -1;
+
+    int mPort = 0;
+
+    uint16_t mNextSequence = 0;
+};
+
+// the NAL units the receiver should see: everything but delimiters
+std::vector<Nal> withoutAud(const std::vector<Nal>& nals, bool hevc) {
+    std::vector<Nal> out;
+    for (const Nal& nal : nals) {
+        int type = hevc ? (nal[0] >> 1) & 0x3f : nal[0] & 0x1f;
+        if (type != (hevc ? 35 : 9)) {
+            out.push_back(nal);
+        }
+    }
+    return out;
+}
+
+}  // namespace
+
+TEST_F(RtpPacketizerTest, HevcKeyFrameRoundTrips) {
+    RtpPacketizer packetizer(RtpPacketizer::CODEC_HEVC, "127.0.0.1", mPort,
+                             kPayloadType, kSsrc, kMtu);
+    ASSERT_EQ(0, packetizer.open());
+
+    std::vector<Nal> nals = {
+        {0x46, 0x01, 0x50},                   // AUD, not sent
+        makeNal({0x40, 0x01}, 1, 24),         // VPS
+        makeNal({0x42, 0x01}, 2, 40),         // SPS
+        makeNal({0x44, 0x01}, 3, 8),          // PPS
+        makeNal({0x26, 0x01}, 4, 10000),      // IDR_W_RADL
+    };
+    AccessUnit unit = send(&packetizer, nals, true, 1000000);
+    EXPECT_EQ(withoutAud(nals, true), unit.nals);
+
+    // the parameter sets share one aggregation packet, the slice is split
+    ASSERT_GE(unit.datagrams.size(), 9u);
+    EXPECT_EQ(48, (unit.datagrams[0].payload[0] >> 1) & 0x3f);
+    for (size_t i = 1; i < unit.datagrams.size(); i++) {
+        EXPECT_EQ(49, (unit.datagrams[i].payload[0] >> 1) & 0x3f);
+    }
+    EXPECT_EQ(packetizer.getSentDatagrams(), (int64_t)unit.datagrams.size());
+    EXPECT_EQ(0, packetizer.getDroppedDatagrams());
+}
+
+TEST_F(RtpPacketizerTest, H264RoundTripsWithStapAAndFuA) {
+    RtpPacketizer packetizer(RtpPacketizer::CODEC_H264, "127.0.0.1", mPort,
+                             kPayloadType, kSsrc, kMtu);
+    ASSERT_EQ(0, packetizer.open());
+
+    std::vector<Nal> key = {
+        {0x09, 0xf0},                  // AUD, not sent
+        makeNal({0x67}, 1, 20),        // SPS
+        makeNal({0x68}, 2, 6),         // PPS
+        makeNal({0x65}, 3, 5000),      // IDR
+    };
+    AccessUnit unit = send(&packetizer, key, false, 2000000);
+    EXPECT_EQ(withoutAud(key, false), unit.nals);
+    EXPECT_EQ(24, unit.datagrams[0].payload[0] & 0x1f);
+    // NRI of the STAP-A is the highest of its NAL units
+    EXPECT_EQ(0x60, unit.datagrams[0].payload[0] & 0x60);
+    EXPECT_EQ(28, unit.datagrams[1].payload[0] & 0x1f);
+
+    std::vector<Nal> delta = {makeNal({0x41}, 4, 900)};
+    unit = send(&packetizer, delta, false, 2040000);
+    EXPECT_EQ(delta, unit.nals);
+    ASSERT_EQ(1u, unit.datagrams.size());
+    // a single NAL unit goes out as it is
+    EXPECT_EQ(delta[0], unit.datagrams[0].payload);
+}
+
+TEST_F(RtpPacketizerTest, ManySmallSlicesSpreadOverAggregationPackets) {
+    RtpPacketizer packetizer(RtpPacketizer::CODEC_HEVC, "127.0.0.1", mPort,
+                             kPayloadType, kSsrc, kMtu);
+    ASSERT_EQ(0, packetizer.open());
+
+    std::vector<Nal> slices;
+    for (int i = 0; i < 20; i++) {
+        slices.push_back(makeNal({0x02, 0x01}, i, 60));
+    }
+    // slices that fill a datagram up to the last byte, and one past it
+    slices.push_back(makeNal({0x02, 0x01}, 20, kMtu - 12));
+    slices.push_back(makeNal({0x02, 0x01}, 21, kMtu - 11));
+    AccessUnit unit = send(&packetizer, slices, true, 3000000);
+    EXPECT_EQ(slices, unit.nals);
+    // eight per aggregation packet: 8 + 8 + 4, then the big ones
+    ASSERT_EQ(6u, unit.datagrams.size());
+    EXPECT_EQ(48, (unit.datagrams[2].payload[0] >> 1) & 0x3f);
+    EXPECT_EQ(slices[20], unit.datagrams[3].payload);
+    EXPECT_EQ(49, (unit.datagrams[4].payload[0] >> 1) & 0x3f);
+    EXPECT_EQ(49, (unit.datagrams[5].payload[0] >> 1) & 0x3f);
+}
+
+TEST_F(RtpPacketizerTest, LargeFramesGoOutInSeveralBatches) {
+    RtpPacketizer packetizer(RtpPacketizer::CODEC_HEVC, "127.0.0.1", mPort,
+                             kPayloadType, kSsrc, kMtu);
+    ASSERT_EQ(0, packetizer.open());
+
+    // more datagrams than one sendmmsg batch holds
+    std::vector<Nal> nals = {makeNal({0x26, 0x01}, 7, 150000)};
+    AccessUnit unit = send(&packetizer, nals, true, 4000000);
+    EXPECT_EQ(nals, unit.nals);
+    EXPECT_GT(unit.datagrams.size(), 64u);
+    EXPECT_EQ((int64_t)unit.datagrams.size(), packetizer.getSentDatagrams());
+}
+
+TEST_F(RtpPacketizerTest, PartialFramesLeaveTheAccessUnitOpen) {
+    RtpPacketizer packetizer(RtpPacketizer::CODEC_HEVC, "127.0.0.1", mPort,
+                             kPayloadType, kSsrc, kMtu);
+    ASSERT_EQ(0, packetizer.open());
+
+    std::vector<Nal> first = {makeNal({0x02, 0x01}, 1, 3000)};
+    std::vector<Nal> second = {makeNal({0x02, 0x01}, 2, 500)};
+    AccessUnit unit = send(&packetizer, first, true, 5000000,
+                           PacketBufferPool::kFlagPartialFrame);
+    EXPECT_EQ(first, unit.nals);
+    // the last slice closes it, same timestamp, sequence carries on
+    unit = send(&packetizer, second, true, 5000000);
+    EXPECT_EQ(second, unit.nals);
+}
+
+TEST_F(RtpPacketizerTest, SequenceNumbersCarryOverAccessUnits) {
+    RtpPacketizer packetizer(RtpPacketizer::CODEC_H264, "127.0.0.1", mPort,
+                             kPayloadType, kSsrc, kMtu);
+    ASSERT_EQ(0, packetizer.open());
+    for (int i = 0; i < 50; i++) {
+        std::vector<Nal> nals = {makeNal({0x41}, i, 100 + i * 97)};
+        AccessUnit unit = send(&packetizer, nals, false, 6000000 + i * 33333);
+        EXPECT_EQ(nals, unit.nals);
+    }
+    EXPECT_EQ(0, packetizer.getDroppedDatagrams());
+}
+
+TEST_F(RtpPacketizerTest, RejectsBadDestinations) {
+    RtpPacketizer packetizer(RtpPacketizer::CODEC_HEVC, "not-an-address", mPort,
+                             kPayloadType, kSsrc, kMtu);
+    EXPECT_EQ(-EINVAL, packetizer.open());
+    // not open, packets go nowhere
+    std::vector<uint8_t> packet = toAnnexB({makeNal({0x02, 0x01}, 0, 100)});
+    packetizer.onPacket(packet.data(), packet.size(), 0, 0);
+    EXPECT_EQ(0, packetizer.getSentDatagrams());
+}
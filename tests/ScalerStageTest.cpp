@@ -0,0 +1,406 @@
+// The scaler stage on the software backend and the malloc pool: every output
+// of a frame comes from that frame, the capture buffer goes back before the
+// consumers see their copies, and a consumer holding every buffer of its
+// output costs that output frames instead of stalling the stage. Consumers
+// of the same OutputSpec share one conversion and one pool buffer.
+
+#include <gtest/gtest.h>
+#include <linux/videodev2.h>
+#include <string.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ScalerStage.h"
+
+namespace {
+
+const uint32_t kWidth = 640;
+const uint32_t kHeight = 360;
+
+// luma of the left and right half of a frame, chroma from the sequence
+uint8_t leftLuma(uint32_t sequence) { return 16 + sequence * 4; }
+
+uint8_t rightLuma(uint32_t sequence) { return 17 + sequence * 4; }
+
+uint8_t chroma(uint32_t sequence) { return 100 + sequence; }
+
+// order in which capture buffers went back and scaled ones came in
+class EventLog {
+public:
+    void add(const std::string& event) {
+        std::lock_guard<std::mutex> lk(mLock);
+        mEvents.push_back(event);
+    }
+
+    // position of event, -1 when it never happened
+    int find(const std::string& event) {
+        std::lock_guard<std::mutex> lk(mLock);
+        for (size_t i = 0; i < mEvents.size(); i++) {
+            if (mEvents[i] == event) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+private:
+    std::mutex mLock;
+
+    std::vector<std::string> mEvents;
+};
+
+// stands in for the V4L2 side: gets the capture buffers back
+class CaptureListener : public IProcessDoneListener {
+public:
+    explicit CaptureListener(EventLog* log) : mLog(log) {}
+
+    void notifyProcessDone(std::shared_ptr<IProcessUnit::ProcessBuf>& processBuf) override {
+        mLog->add("returned " + std::to_string(processBuf->sequence));
+        std::lock_guard<std::mutex> lk(mLock);
+        mReturned++;
+        mCond.notify_all();
+    }
+
+    bool waitForReturned(int count) {
+        std::unique_lock<std::mutex> lk(mLock);
+        return mCond.wait_for(lk, std::chrono::seconds(2),
+                              [&] { return mReturned >= count; });
+    }
+
+private:
+    EventLog* mLog;
+
+    std::mutex mLock;
+
+    std::condition_variable mCond;
+
+    int mReturned = 0;
+};
+
+// A consumer of scaled frames that never runs: it keeps what it is handed
+// until the test releases it.
+class HoldingConsumer : public IProcessUnit {
+public:
+    HoldingConsumer(const std::string& name, EventLog* log)
+        : mName(name), mLog(log) {}
+
+    status_t readyToRun() override { return NO_ERROR; }
+
+    bool threadLoop() override { return false; }
+
+    int32_t processBuffer(std::shared_ptr<ProcessBuf>& processBuf,
+                          std::shared_ptr<ProcessBuf>* evicted) override {
+        mLog->add(mName + " got " + std::to_string(processBuf->sequence));
+        std::lock_guard<std::mutex> lk(mLock);
+        mHeld.push_back(processBuf);
+        mCond.notify_all();
+        return 0;
+    }
+
+    // the next frame handed to the consumer, null after a timeout
+    std::shared_ptr<ProcessBuf> next() {
+        std::unique_lock<std::mutex> lk(mLock);
+        if (!mCond.wait_for(lk, std::chrono::seconds(2),
+                            [this] { return !mHeld.empty(); })) {
+            return nullptr;
+        }
+        std::shared_ptr<ProcessBuf> processBuf = mHeld.front();
+        mHeld.pop_front();
+        return processBuf;
+    }
+
+    size_t waiting() {
+        std::lock_guard<std::mutex> lk(mLock);
+        return mHeld.size();
+    }
+
+private:
+    std::string mName;
+
+    EventLog* mLog;
+
+    std::mutex mLock;
+
+    std::condition_variable mCond;
+
+    std::deque<std::shared_ptr<ProcessBuf>> mHeld;
+};
+
+// the software backend, counting the outputs it writes
+class CountingBackend : public SoftwareScalerBackend {
+public:
+    explicit CountingBackend(int* conversions) : mConversions(conversions) {}
+
+    int scale(const Image& src, const Image* dsts, const Rect* crops,
+              int count) override {
+        *mConversions += count;
+        return SoftwareScalerBackend::scale(src, dsts, crops, count);
+    }
+
+private:
+    int* mConversions;
+};
+
+IProcessUnit::OutputSpec nv12(uint32_t width, uint32_t height) {
+    IProcessUnit::OutputSpec spec;
+    spec.width = width;
+    spec.height = height;
+    spec.format = V4L2_PIX_FMT_NV12;
+    return spec;
+}
+
+class ScalerStageTest : public ::testing::Test {
+protected:
+    ScalerStageTest() : mListener(&mLog) {
+        mStage = new ScalerStage(&mListener, std::unique_ptr<ScalerBackend>(
+                                                 new CountingBackend(&mConversions)));
+    }
+
+    ~ScalerStageTest() {
+        mStage->requestExit();
+        mStage->join();
+    }
+
+    sp<HoldingConsumer> addConsumer(const std::string& name,
+                                    const IProcessUnit::OutputSpec& spec) {
+        sp<HoldingConsumer> consumer = new HoldingConsumer(name, &mLog);
+        EXPECT_EQ(0, mStage->addOutput(spec, consumer));
+        return consumer;
+    }
+
+    // hands the stage a capture frame and waits until it is done with it
+    void feed(uint32_t sequence) {
+        std::vector<uint8_t>& frame = mFrames[sequence % 2];
+        frame.resize(kWidth * kHeight * 3 / 2);
+        for (uint32_t y = 0; y < kHeight; y++) {
+            memset(&frame[y * kWidth], leftLuma(sequence), kWidth / 2);
+            memset(&frame[y * kWidth + kWidth / 2], rightLuma(sequence), kWidth / 2);
+        }
+        memset(&frame[kWidth * kHeight], chroma(sequence), kWidth * kHeight / 2);
+
+        std::shared_ptr<IProcessUnit::ProcessBuf> processBuf =
+            std::make_shared<IProcessUnit::ProcessBuf>();
+        processBuf->index = sequence % 2;
+        processBuf->fd = -1;
+        processBuf->start = frame.data();
+        processBuf->width = kWidth;
+        processBuf->height = kHeight;
+        processBuf->format = V4L2_PIX_FMT_NV12;
+        processBuf->timestampUs = sequence * 16667;
+        processBuf->sequence = sequence;
+        processBuf->releaser = nullptr;
+        std::shared_ptr<IProcessUnit::ProcessBuf> evicted;
+        ASSERT_EQ(0, mStage->processBuffer(processBuf, &evicted));
+        ASSERT_TRUE(mListener.waitForReturned(++mFed));
+    }
+
+    void release(std::shared_ptr<IProcessUnit::ProcessBuf> processBuf) {
+        mStage->notifyProcessDone(processBuf);
+    }
+
+    EventLog mLog;
+
+    CaptureListener mListener;
+
+    int mConversions = 0;
+
+    sp<ScalerStage> mStage;
+
+    std::vector<uint8_t> mFrames[2];
+
+    int mFed = 0;
+};
+
+// every pixel of the NV12 image is the luma or chroma of one frame
+void expectScaledFrom(const IProcessUnit::ProcessBuf& scaled, uint32_t sequence,
+                      uint8_t luma) {
+    const uint8_t* data = (const uint8_t*)scaled.start;
+    size_t lumaSize = scaled.width * scaled.height;
+    int wrong = 0;
+    for (size_t i = 0; i < lumaSize; i++) {
+        wrong += data[i] != luma;
+    }
+    for (size_t i = lumaSize; i < lumaSize * 3 / 2; i++) {
+        wrong += data[i] != chroma(sequence);
+    }
+    EXPECT_EQ(0, wrong) << scaled.width << "x" << scaled.height
+                        << " sequence: " << sequence;
+}
+
+}  // namespace
+
+TEST_F(ScalerStageTest, EveryOutputComesFromOneSourceFrame) {
+    IProcessUnit::OutputSpec right = nv12(160, 90);
+    right.cropX = kWidth / 2;
+    right.cropWidth = kWidth / 2;
+    right.cropHeight = kHeight;
+    sp<HoldingConsumer> preview = addConsumer("preview", nv12(320, 180));
+    sp<HoldingConsumer> crop = addConsumer("crop", right);
+    ASSERT_EQ(0, mStage->run("ScalerStage"));
+
+    for (uint32_t sequence = 0; sequence < 6; sequence++) {
+        feed(sequence);
+        std::shared_ptr<IProcessUnit::ProcessBuf> full = preview->next();
+        std::shared_ptr<IProcessUnit::ProcessBuf> half = crop->next();
+        ASSERT_TRUE(full && half);
+        EXPECT_EQ(sequence, full->sequence);
+        EXPECT_EQ(sequence, half->sequence);
+        EXPECT_EQ(sequence * 16667, full->timestampUs);
+        EXPECT_EQ(320u, full->width);
+        EXPECT_EQ(90u, half->height);
+
+        const uint8_t* luma = (const uint8_t*)full->start;
+        EXPECT_EQ(leftLuma(sequence), luma[0]);
+        EXPECT_EQ(rightLuma(sequence), luma[319]);
+        EXPECT_EQ(leftLuma(sequence), luma[179 * 320 + 159]);
+        EXPECT_EQ(rightLuma(sequence), luma[179 * 320 + 160]);
+        // the crop only sees the right half
+        expectScaledFrom(*half, sequence, rightLuma(sequence));
+        release(full);
+        release(half);
+    }
+    EXPECT_EQ(12, mConversions);
+    EXPECT_EQ(0, mStage->getOutputDrops());
+}
+
+TEST_F(ScalerStageTest, CaptureBufferGoesBackBeforeTheConsumersGetTheirs) {
+    sp<HoldingConsumer> preview = addConsumer("preview", nv12(320, 180));
+    sp<HoldingConsumer> encoder = addConsumer("encoder", nv12(480, 270));
+    ASSERT_EQ(0, mStage->run("ScalerStage"));
+
+    for (uint32_t sequence = 0; sequence < 3; sequence++) {
+        feed(sequence);
+        std::shared_ptr<IProcessUnit::ProcessBuf> small = preview->next();
+        std::shared_ptr<IProcessUnit::ProcessBuf> large = encoder->next();
+        ASSERT_TRUE(small && large);
+        // nothing is released yet, the capture buffer is back regardless
+        std::string seq = std::to_string(sequence);
+        int returned = mLog.find("returned " + seq);
+        ASSERT_GE(returned, 0);
+        EXPECT_LT(returned, mLog.find("preview got " + seq));
+        EXPECT_LT(returned, mLog.find("encoder got " + seq));
+        // and scaled copies stay valid while it is being refilled
+        release(small);
+        release(large);
+    }
+}
+
+TEST_F(ScalerStageTest, FullyHeldOutputCountsADropInsteadOfBlocking) {
+    sp<HoldingConsumer> preview = addConsumer("preview", nv12(320, 180));
+    sp<HoldingConsumer> slow = addConsumer("slow", nv12(160, 90));
+    ASSERT_EQ(0, mStage->run("ScalerStage"));
+
+    // the slow consumer keeps every buffer of its output
+    std::vector<std::shared_ptr<IProcessUnit::ProcessBuf>> held;
+    for (uint32_t sequence = 0; sequence < ScalerStage::kBuffersPerOutput;
+         sequence++) {
+        feed(sequence);
+        release(preview->next());
+        held.push_back(slow->next());
+        ASSERT_TRUE(held.back());
+    }
+    EXPECT_EQ(0, mStage->getOutputDrops());
+
+    // the stage goes on for the preview, the slow output skips frames
+    for (uint32_t sequence = ScalerStage::kBuffersPerOutput;
+         sequence < ScalerStage::kBuffersPerOutput + 2; sequence++) {
+        feed(sequence);
+        std::shared_ptr<IProcessUnit::ProcessBuf> full = preview->next();
+        ASSERT_TRUE(full);
+        EXPECT_EQ(sequence, full->sequence);
+        EXPECT_EQ(leftLuma(sequence), ((const uint8_t*)full->start)[0]);
+        release(full);
+    }
+    EXPECT_EQ(2, mStage->getOutputDrops());
+    EXPECT_EQ(0u, slow->waiting());
+    // what it holds is untouched by the frames it missed
+    for (uint32_t i = 0; i < held.size(); i++) {
+        EXPECT_EQ(leftLuma(i), ((const uint8_t*)held[i]->start)[0]);
+    }
+
+    // one buffer back, the next frame reaches it again
+    release(held[0]);
+    feed(ScalerStage::kBuffersPerOutput + 2);
+    release(preview->next());
+    std::shared_ptr<IProcessUnit::ProcessBuf> again = slow->next();
+    ASSERT_TRUE(again);
+    EXPECT_EQ((uint32_t)ScalerStage::kBuffersPerOutput + 2, again->sequence);
+    EXPECT_EQ(2, mStage->getOutputDrops());
+}
+
+TEST_F(ScalerStageTest, EqualSpecsShareOneConversion) {
+    IProcessUnit::OutputSpec right = nv12(320, 180);
+    right.cropX = kWidth / 2;
+    right.cropWidth = kWidth / 2;
+    right.cropHeight = kHeight;
+    sp<HoldingConsumer> preview = addConsumer("preview", nv12(320, 180));
+    sp<HoldingConsumer> encoder = addConsumer("encoder", nv12(320, 180));
+    // same size, different crop: an output of its own
+    sp<HoldingConsumer> crop = addConsumer("crop", right);
+    ASSERT_EQ(0, mStage->run("ScalerStage"));
+
+    const int kFrames = 5;
+    for (uint32_t sequence = 0; sequence < kFrames; sequence++) {
+        feed(sequence);
+        std::shared_ptr<IProcessUnit::ProcessBuf> first = preview->next();
+        std::shared_ptr<IProcessUnit::ProcessBuf> second = encoder->next();
+        std::shared_ptr<IProcessUnit::ProcessBuf> half = crop->next();
+        ASSERT_TRUE(first && second && half);
+        // one lease on one buffer for both
+        EXPECT_EQ(first.get(), second.get());
+        EXPECT_EQ(2u, first->processNum);
+        EXPECT_NE(first->start, half->start);
+        EXPECT_EQ(leftLuma(sequence), ((const uint8_t*)first->start)[0]);
+        expectScaledFrom(*half, sequence, rightLuma(sequence));
+        release(first);
+        release(second);
+        release(half);
+    }
+    // the shared output and the crop, once each per frame
+    EXPECT_EQ(2 * kFrames, mConversions);
+    EXPECT_EQ(kFrames, mStage->getSavedConversions());
+}
+
+TEST_F(ScalerStageTest, SharedBufferIsReusedAfterTheLastRelease) {
+    sp<HoldingConsumer> preview = addConsumer("preview", nv12(320, 180));
+    sp<HoldingConsumer> encoder = addConsumer("encoder", nv12(320, 180));
+    ASSERT_EQ(0, mStage->run("ScalerStage"));
+
+    feed(0);
+    std::shared_ptr<IProcessUnit::ProcessBuf> kept = preview->next();
+    ASSERT_TRUE(kept);
+    ASSERT_TRUE(encoder->next());
+    // the preview is done, the encoder still reads it
+    release(kept);
+    EXPECT_EQ(1u, kept->processNum);
+    int keptIndex = kept->index;
+
+    for (uint32_t sequence = 1; sequence < 6; sequence++) {
+        feed(sequence);
+        std::shared_ptr<IProcessUnit::ProcessBuf> scaled = preview->next();
+        ASSERT_TRUE(scaled);
+        ASSERT_EQ(scaled.get(), encoder->next().get());
+        EXPECT_NE(keptIndex, scaled->index);
+        EXPECT_EQ(leftLuma(0), ((const uint8_t*)kept->start)[0]);
+        release(scaled);
+        release(scaled);
+    }
+    EXPECT_EQ(0, mStage->getOutputDrops());
+
+    // the encoder lets go, the slot is the first free one again
+    release(kept);
+    EXPECT_EQ(0u, kept->processNum);
+    feed(6);
+    std::shared_ptr<IProcessUnit::ProcessBuf> reused = preview->next();
+    ASSERT_TRUE(reused);
+    EXPECT_EQ(keptIndex, reused->index);
+    EXPECT_EQ(leftLuma(6), ((const uint8_t*)reused->start)[0]);
+    // seven frames shared by two consumers
+    EXPECT_EQ(7, mStage->getSavedConversions());
+}
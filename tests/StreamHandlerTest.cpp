@@ -0,0 +1,162 @@
+// Slow consumers on a synthetic source: starvation is reported, and an
+// adaptive pool grows up to its limit while a fast consumer never starves.
+
+#include <gtest/gtest.h>
+#include <linux/videodev2.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <deque>
+#include <utility>
+
+#include "StreamHandler.h"
+#include "SyntheticFrameSource.h"
+
+namespace {
+
+// Hands every frame back holdMs after it came in. A serial unit works on
+// one frame at a time like preview, a pipelined one keeps any number in
+// flight like an encoder whose latency is longer than the frame time.
+class HoldingUnit : public IProcessUnit {
+public:
+    HoldingUnit(int holdMs, bool pipelined)
+        : mHoldNs(ms2ns(holdMs)), mPipelined(pipelined) {}
+
+    void setHandler(const sp<StreamHandler>& handler) { mHandler = handler; }
+
+    int getFrames() const { return mFrames.load(); }
+
+    status_t readyToRun() override { return NO_ERROR; }
+
+    bool threadLoop() override {
+        if (mProcessRing.wait(1)) {
+            nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+            nsecs_t start = now;
+            if (!mPipelined && !mHeld.empty() && mHeld.back().first > now) {
+                start = mHeld.back().first;
+            }
+            mHeld.push_back({start + mHoldNs, *mProcessRing.peek()});
+            commitRequest();
+        }
+        nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+        while (!mHeld.empty() && (mHeld.front().first <= now || exitPending())) {
+            mFrames++;
+            mHandler->returnCameraBuffer(mHeld.front().second);
+            mHeld.pop_front();
+        }
+        return true;
+    }
+
+private:
+    nsecs_t mHoldNs;
+
+    bool mPipelined;
+
+    std::deque<std::pair<nsecs_t, std::shared_ptr<ProcessBuf>>> mHeld;
+
+    sp<StreamHandler> mHandler;
+
+    std::atomic<int> mFrames{0};
+};
+
+struct Session {
+    sp<SyntheticFrameSource> source;
+
+    sp<HoldingUnit> unit;
+
+    sp<StreamHandler> handler;
+};
+
+Session startSession(int holdMs, bool pipelined,
+                     const StreamHandler::BufferConfig& config, int fps = 200) {
+    Session session;
+    session.source = new SyntheticFrameSource(320, 180, V4L2_PIX_FMT_NV12,
+                                              config.count);
+    EXPECT_EQ(0, session.source->open());
+    EXPECT_EQ(0, session.source->negotiate(320, 180, fps));
+    EXPECT_EQ(0, session.source->start());
+    session.unit = new HoldingUnit(holdMs, pipelined);
+    std::list<sp<IProcessUnit>> units;
+    units.push_back(session.unit);
+    session.handler = new StreamHandler(session.source, units, 320, 180,
+                                        V4L2_PIX_FMT_NV12, config);
+    session.unit->setHandler(session.handler);
+    session.unit->run("HoldingUnit");
+    EXPECT_EQ(0, session.handler->attach());
+    return session;
+}
+
+void stopSession(Session* session) {
+    session->handler->detach();
+    session->unit->requestExit();
+    session->unit->join();
+    session->unit->setHandler(nullptr);
+    session->source->stop();
+    session->source->close();
+}
+
+}  // namespace
+
+TEST(StreamHandlerTest, FastConsumerNeverStarves) {
+    Session session = startSession(0, false, {4, true, 8, 50});
+    usleep(300 * 1000);
+    stopSession(&session);
+    EXPECT_GT(session.unit->getFrames(), 20);
+    EXPECT_EQ(0, session.handler->getStarvationEvents());
+    EXPECT_EQ(4, session.source->getBufferCount());
+}
+
+TEST(StreamHandlerTest, SlowConsumerStarvesAFixedPool) {
+    // two buffers held 60 ms each by a consumer at 200 fps
+    Session session = startSession(60, false, {2, false, 8, 20});
+    usleep(400 * 1000);
+    stopSession(&session);
+    EXPECT_GT(session.unit->getFrames(), 0);
+    EXPECT_GT(session.handler->getStarvationEvents(), 0);
+    EXPECT_EQ(2, session.source->getBufferCount());
+    // the sensor kept going while every buffer was held
+    EXPECT_GT(session.handler->getDroppedFrames(), 0);
+}
+
+TEST(StreamHandlerTest, AdaptivePoolGrowsUpToItsLimit) {
+    // a consumer that never catches up takes whatever the pool grows to
+    Session session = startSession(200, false, {2, true, 6, 20});
+    usleep(500 * 1000);
+    int grown = session.source->getBufferCount();
+    int events = session.handler->getStarvationEvents();
+    stopSession(&session);
+    EXPECT_EQ(6, grown);
+    // one event per growth step of two, then the stall at the limit
+    EXPECT_GE(events, 3);
+}
+
+TEST(StreamHandlerTest, GrowthEndsTheStarvation) {
+    // 40 ms in flight at 100 fps: with two buffers capture stalls 30 ms,
+    // past the 20 ms threshold, with four it stalls 10 ms and never starves
+    Session session = startSession(40, true, {2, true, 16, 20}, 100);
+    usleep(300 * 1000);
+    int grown = session.source->getBufferCount();
+    int events = session.handler->getStarvationEvents();
+    usleep(300 * 1000);
+    int count = session.source->getBufferCount();
+    int laterEvents = session.handler->getStarvationEvents();
+    stopSession(&session);
+    EXPECT_EQ(4, grown);
+    EXPECT_GT(events, 0);
+    EXPECT_EQ(grown, count);
+    EXPECT_EQ(events, laterEvents);
+    EXPECT_GT(session.unit->getFrames(), 40);
+}
+
+TEST(StreamHandlerTest, DetachDoesNotWaitForAPollTimeout) {
+    // 5 fps leaves the reactor parked in epoll_wait most of the time, the
+    // old capture loop slept in a 1 s select there
+    Session session = startSession(0, false, {4, true, 8, 50}, 5);
+    usleep(500 * 1000);
+    ASSERT_GT(session.unit->getFrames(), 0);
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    session.handler->detach();
+    nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    stopSession(&session);
+    EXPECT_LT(elapsed, ms2ns(50));
+}
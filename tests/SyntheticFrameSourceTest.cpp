@@ -0,0 +1,156 @@
+// Runs the synthetic source the way the capture reactor does, on the host.
+
+#include <gtest/gtest.h>
+#include <linux/videodev2.h>
+#include <poll.h>
+
+#include "SyntheticFrameSource.h"
+
+namespace {
+
+const uint32_t kWidth = 640;
+const uint32_t kHeight = 360;
+const int kFps = 100;
+
+// what the capture reactor waits for before it dequeues
+bool waitReadable(int fd, int timeoutMs) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    return poll(&pfd, 1, timeoutMs) == 1 && (pfd.revents & POLLIN);
+}
+
+int dequeueNext(const sp<SyntheticFrameSource>& source,
+                FrameSource::Frame* frame) {
+    for (int i = 0; i < 10; i++) {
+        if (!waitReadable(source->getPollFd(), 1000)) {
+            return -ETIMEDOUT;
+        }
+        int ret = source->dequeue(frame);
+        if (ret != -EAGAIN) {
+            return ret;
+        }
+    }
+    return -EAGAIN;
+}
+
+sp<SyntheticFrameSource> startSource(uint32_t format, int bufferCount) {
+    sp<SyntheticFrameSource> source =
+        new SyntheticFrameSource(kWidth, kHeight, format, bufferCount);
+    EXPECT_EQ(0, source->open());
+    EXPECT_EQ(0, source->negotiate(1920, 1080, kFps));
+    EXPECT_EQ(0, source->start());
+    return source;
+}
+
+}  // namespace
+
+TEST(SyntheticFrameSourceTest, KeepsItsGeometryAndTakesTheRate) {
+    sp<SyntheticFrameSource> source = startSource(V4L2_PIX_FMT_NV12, 3);
+    EXPECT_EQ(kWidth, source->getWidth());
+    EXPECT_EQ(kHeight, source->getHeight());
+    EXPECT_EQ((uint32_t)V4L2_PIX_FMT_NV12, source->getFormat());
+    uint32_t num = 0;
+    uint32_t den = 0;
+    source->getFrameRate(&num, &den);
+    EXPECT_EQ((uint32_t)kFps, num);
+    EXPECT_EQ(1u, den);
+    EXPECT_EQ(3, source->getBufferCount());
+}
+
+TEST(SyntheticFrameSourceTest, RejectsOtherFormats) {
+    sp<SyntheticFrameSource> source =
+        new SyntheticFrameSource(kWidth, kHeight, V4L2_PIX_FMT_MJPEG);
+    EXPECT_EQ(-EINVAL, source->open());
+}
+
+TEST(SyntheticFrameSourceTest, DrawsBarsAndAMovingMarker) {
+    sp<SyntheticFrameSource> source = startSource(V4L2_PIX_FMT_NV12, 3);
+    FrameSource::Frame frame;
+    ASSERT_EQ(0, dequeueNext(source, &frame));
+    ASSERT_NE(nullptr, frame.start);
+    EXPECT_EQ(kWidth * kHeight * 3 / 2, frame.bytesUsed);
+    EXPECT_GT(frame.timestampUs, 0);
+
+    const uint8_t* y = (const uint8_t*)frame.start;
+    const uint8_t* uv = y + kWidth * kHeight;
+    // below the marker band: white on the left, black on the right
+    EXPECT_EQ(180, y[200 * kWidth]);
+    EXPECT_EQ(16, y[200 * kWidth + kWidth - 1]);
+    // yellow bar, U then V
+    uint32_t yellow = kWidth / 8 + 2;
+    EXPECT_EQ(44, uv[100 * kWidth + yellow]);
+    EXPECT_EQ(142, uv[100 * kWidth + yellow + 1]);
+
+    // the marker starts 16 pixels further per frame
+    uint32_t span = kWidth - 64;
+    uint32_t x0 = ((frame.sequence * 16) % span) & ~1u;
+    EXPECT_EQ(235, y[x0]);
+    EXPECT_EQ(235, y[63 * kWidth + x0 + 63]);
+    EXPECT_EQ(128, uv[x0]);
+    source->requeue(frame.index);
+}
+
+TEST(SyntheticFrameSourceTest, DrawsYuyv) {
+    sp<SyntheticFrameSource> source = startSource(V4L2_PIX_FMT_YUYV, 2);
+    FrameSource::Frame frame;
+    ASSERT_EQ(0, dequeueNext(source, &frame));
+    EXPECT_EQ(kWidth * kHeight * 2, frame.bytesUsed);
+    const uint8_t* line = (const uint8_t*)frame.start + 200 * kWidth * 2;
+    // Y U Y V of the white bar, then of the blue one
+    EXPECT_EQ(180, line[0]);
+    EXPECT_EQ(128, line[1]);
+    uint32_t blue = (kWidth * 6 / 8 + 2) * 2;
+    EXPECT_EQ(35, line[blue]);
+    EXPECT_EQ(212, line[blue + 1]);
+    EXPECT_EQ(114, line[blue + 3]);
+}
+
+TEST(SyntheticFrameSourceTest, SequenceCountsEveryFrame) {
+    sp<SyntheticFrameSource> source = startSource(V4L2_PIX_FMT_NV12, 3);
+    FrameSource::Frame previous;
+    ASSERT_EQ(0, dequeueNext(source, &previous));
+    source->requeue(previous.index);
+    for (int i = 0; i < 5; i++) {
+        FrameSource::Frame frame;
+        ASSERT_EQ(0, dequeueNext(source, &frame));
+        EXPECT_GT(frame.sequence, previous.sequence);
+        EXPECT_GE(frame.timestampUs, previous.timestampUs);
+        source->requeue(frame.index);
+        previous = frame;
+    }
+}
+
+TEST(SyntheticFrameSourceTest, DropsWhileTheConsumersHoldEveryBuffer) {
+    sp<SyntheticFrameSource> source = startSource(V4L2_PIX_FMT_NV12, 2);
+    FrameSource::Frame held[2];
+    ASSERT_EQ(0, dequeueNext(source, &held[0]));
+    ASSERT_EQ(0, dequeueNext(source, &held[1]));
+    EXPECT_NE(held[0].index, held[1].index);
+
+    uint64_t dropped = source->getDroppedFrames();
+    ASSERT_TRUE(waitReadable(source->getPollFd(), 1000));
+    FrameSource::Frame frame;
+    EXPECT_EQ(-EAGAIN, source->dequeue(&frame));
+    EXPECT_GT(source->getDroppedFrames(), dropped);
+
+    // a late consumer sees the sequence jump over the frames it missed
+    ASSERT_EQ(0, source->requeue(held[0].index));
+    ASSERT_EQ(0, dequeueNext(source, &frame));
+    EXPECT_EQ(held[0].index, frame.index);
+    EXPECT_GT(frame.sequence, held[1].sequence + 1);
+    EXPECT_EQ(-EINVAL, source->requeue(2));
+}
+
+TEST(SyntheticFrameSourceTest, GrowsARunningPool) {
+    sp<SyntheticFrameSource> source = startSource(V4L2_PIX_FMT_NV12, 2);
+    EXPECT_EQ(-EBUSY, source->setBufferCount(6));
+    EXPECT_EQ(2, source->growBuffers(2));
+    EXPECT_EQ(4, source->getBufferCount());
+
+    FrameSource::Frame frames[4];
+    for (int i = 0; i < 4; i++) {
+        ASSERT_EQ(0, dequeueNext(source, &frames[i]));
+        EXPECT_EQ(i, frames[i].index);
+    }
+    EXPECT_EQ(0, source->stop());
+    EXPECT_EQ(-EINVAL, source->growBuffers(2));
+}
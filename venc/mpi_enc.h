@@ -1,162 +1,277 @@
-//
-// Created by Charlie on 2024/7/31.
-//
-
-#ifndef CAPTUREENCODER_MPI_ENC_H
-#define CAPTUREENCODER_MPI_ENC_H
-
-#include <string.h>
-#include "mpp_common.h"
-#include "mpp_debug.h"
-#include "mpp_env.h"
-#include "mpp_mem.h"
-#include "mpp_rc_api.h"
-#include "rk_mpi.h"
-#include "rk_type.h"
-#include "utils.h"
-#include "mpp_enc_roi_utils.h"
-#include "mpi_enc_utils.h"
-#include <jni.h>
-#include "JNIEnvUtil.h"
-
-#define V4L2_BUFFER_COUNT 4
-
-typedef struct VENC_MPI_ATTR {
-    MppCtx ctx;
-    MppApi *mpi;
-    RK_S32 chn;
-
-    MppEncCfg cfg;
-    MppEncOSDPltCfg osd_plt_cfg;
-    MppEncOSDPlt osd_plt;
-    MppEncOSDData osd_data;
-    RoiRegionCfg roi_region;
-    MppEncROICfg roi_cfg;
-
-    MppBufferGroup buf_grp;
-    MppBuffer frm_buf;
-    MppBuffer pkt_buf;
-    MppBuffer md_info;
-    MppEncSeiMode sei_mode;
-    MppEncHeaderMode header_mode;
-
-    // resources
-    size_t header_size;
-    size_t frame_size;
-    size_t mdinfo_size;
-    /* NOTE: packet buffer may overflow */
-    size_t packet_size;
-
-    RK_U32 width;
-    RK_U32 height;
-    RK_U32 hor_stride;
-    RK_U32 ver_stride;
-    MppFrameFormat fmt;
-    MppCodingType type;
-    MppEncRoiCtx roi_ctx;
-
-    RK_U32 osd_enable;
-    RK_U32 osd_mode;
-    RK_U32 split_mode;
-    RK_U32 split_arg;
-    RK_U32 split_out;
-
-    RK_U32 user_data_enable;
-    RK_U32 roi_enable;
-
-    // rate control runtime parameter
-    RK_S32 fps_in_flex;
-    RK_S32 fps_in_den;
-    RK_S32 fps_in_num;
-    RK_S32 fps_out_flex;
-    RK_S32 fps_out_den;
-    RK_S32 fps_out_num;
-    RK_S32 bps;
-    RK_S32 bps_max;
-    RK_S32 bps_min;
-    RK_S32 rc_mode;
-    RK_S32 gop_mode;
-    RK_S32 gop_len;
-    RK_S32 vi_len;
-    RK_S32 scene_mode;
-    /* -qc */
-    RK_S32 qp_init;
-    RK_S32 qp_min;
-    RK_S32 qp_max;
-    RK_S32 qp_min_i;
-    RK_S32 qp_max_i;
-
-    /* -fqc */
-    RK_S32 fqp_min_i;
-    RK_S32 fqp_min_p;
-    RK_S32 fqp_max_i;
-    RK_S32 fqp_max_p;
-
-    RK_S32 frm_cnt_in;
-    RK_U32 frm_eos;
-    RK_U32 pkt_eos;
-
-    RK_U32 frame_count;
-} VENC_MPI_ATTR_t;
-
-typedef struct VENC_ATTR {
-    MppCodingType type;
-    MppFrameFormat format;
-    RK_U32 width;
-    RK_U32 height;
-
-    /* -rc */
-    RK_S32 rc_mode;
-
-    /* -bps */
-    RK_S32 bps_target;
-    RK_S32 bps_max;
-    RK_S32 bps_min;
-
-    /* -fps */
-    RK_S32 fps_in_flex;
-    RK_S32 fps_in_num;
-    RK_S32 fps_in_den;
-    RK_S32 fps_out_flex;
-    RK_S32 fps_out_num;
-    RK_S32 fps_out_den;
-
-    /* -qc */
-    RK_S32 qp_init;
-    RK_S32 qp_min;
-    RK_S32 qp_max;
-    RK_S32 qp_min_i;
-    RK_S32 qp_max_i;
-
-    /* -g gop mode */
-    RK_S32 gop_mode;
-    RK_S32 gop_len;
-    RK_S32 vi_len;
-
-} VENC_ATTR_t;
-
-class MppEncoder {
-public:
-    MppEncoder();
-
-    ~MppEncoder();
-
-    MPP_RET venc_init(RK_S32 chn, VENC_ATTR_t *venc_attr, v4l2Buffer* buffer, int buf_len);
-
-    MPP_RET venc_put_src_imge(int v4l2Index);
-
-    MPP_RET venc_get_frame(RK_U8 *frame_buf, size_t *frame_len);
-
-    MPP_RET venc_deinit();
-
-private:
-    MPP_RET venc_mpi_init(VENC_MPI_ATTR *venc_mpi_attr, VENC_ATTR *venc_attr);
-
-    MPP_RET venc_mpp_cfg_setup(VENC_MPI_ATTR *venc_mpi_attr);
-
-    VENC_MPI_ATTR venc_mpi_attr;
-
-    MppBuffer mppBuffer[V4L2_BUFFER_COUNT];
-};
-
-#endif  // CAPTUREENCODER_MPI_ENC_H
+//
+// Created by Charlie on 2024/7/31.
+//
+
+#ifndef CAPTUREENCODER_MPI_ENC_H
+#define CAPTUREENCODER_MPI_ENC_H
+
+#include <string.h>
+#include "mpp_common.h"
+#include "mpp_debug.h"
+#include "mpp_env.h"
+#include "mpp_mem.h"
+#include "mpp_rc_api.h"
+#include "rk_mpi.h"
+#include "rk_type.h"
+#include "utils.h"
+#include "mpp_enc_roi_utils.h"
+#include "mpi_enc_utils.h"
+#include <jni.h>
+#include <memory>
+#include <vector>
+#include "JNIEnvUtil.h"
+
+// motion detection outputs, one per frame in flight and a spare
+#define VENC_MD_INFO_COUNT 4
+
+// ROI maps in use by MPP at a time, a frame encoding, one queued and the
+// one being prepared
+#define VENC_ROI_CTX_COUNT 3
+// what every VEPU generation takes per frame
+#define VENC_ROI_MAX_REGIONS 8
+
+typedef struct VENC_MPI_ATTR {
+    MppCtx ctx;
+    MppApi *mpi;
+    RK_S32 chn;
+
+    MppEncCfg cfg;
+    MppEncOSDPltCfg osd_plt_cfg;
+    MppEncOSDPlt osd_plt;
+    MppEncOSDData osd_data;
+    RoiRegionCfg roi_region;
+    MppEncROICfg roi_cfg;
+
+    MppBufferGroup buf_grp;
+    // frames are encoded from the capture buffers and packets come from
+    // MPP's own pool, only the motion info buffers are allocated here
+    MppBuffer md_info[VENC_MD_INFO_COUNT];
+    RK_U32 md_put;
+    RK_U32 md_get;
+    MppEncSeiMode sei_mode;
+    MppEncHeaderMode header_mode;
+
+    // resources
+    size_t header_size;
+    size_t frame_size;
+    size_t mdinfo_size;
+    /* NOTE: packet buffer may overflow */
+    size_t packet_size;
+
+    RK_U32 width;
+    RK_U32 height;
+    RK_U32 hor_stride;
+    RK_U32 ver_stride;
+    MppFrameFormat fmt;
+    MppCodingType type;
+    // allocated on the first frame with regions, freed by venc_deinit()
+    // when the encoder unit stops
+    MppEncRoiCtx roi_ctx[VENC_ROI_CTX_COUNT];
+    RK_U32 roi_put;
+
+    RK_U32 osd_enable;
+    RK_U32 osd_mode;
+    RK_U32 split_mode;
+    RK_U32 split_arg;
+    RK_U32 split_out;
+
+    RK_U32 user_data_enable;
+    RK_U32 roi_enable;
+
+    // rate control runtime parameter
+    RK_S32 fps_in_flex;
+    RK_S32 fps_in_den;
+    RK_S32 fps_in_num;
+    RK_S32 fps_out_flex;
+    RK_S32 fps_out_den;
+    RK_S32 fps_out_num;
+    RK_S32 bps;
+    RK_S32 bps_max;
+    RK_S32 bps_min;
+    RK_S32 rc_mode;
+    RK_S32 gop_mode;
+    RK_S32 gop_len;
+    RK_S32 vi_len;
+    RK_S32 scene_mode;
+    /* -qc */
+    RK_S32 qp_init;
+    RK_S32 qp_min;
+    RK_S32 qp_max;
+    RK_S32 qp_min_i;
+    RK_S32 qp_max_i;
+
+    /* -fqc */
+    RK_S32 fqp_min_i;
+    RK_S32 fqp_min_p;
+    RK_S32 fqp_max_i;
+    RK_S32 fqp_max_p;
+
+    RK_S32 frm_cnt_in;
+    RK_U32 frm_eos;
+    RK_U32 pkt_eos;
+
+    RK_U32 frame_count;
+} VENC_MPI_ATTR_t;
+
+typedef struct VENC_ATTR {
+    MppCodingType type;
+    MppFrameFormat format;
+    RK_U32 width;
+    RK_U32 height;
+
+    /* -rc */
+    RK_S32 rc_mode;
+
+    /* -bps */
+    RK_S32 bps_target;
+    RK_S32 bps_max;
+    RK_S32 bps_min;
+
+    /* -fps */
+    RK_S32 fps_in_flex;
+    RK_S32 fps_in_num;
+    RK_S32 fps_in_den;
+    RK_S32 fps_out_flex;
+    RK_S32 fps_out_num;
+    RK_S32 fps_out_den;
+
+    /* -qc */
+    RK_S32 qp_init;
+    RK_S32 qp_min;
+    RK_S32 qp_max;
+    RK_S32 qp_min_i;
+    RK_S32 qp_max_i;
+
+    /* -g gop mode */
+    // 1 to 3 are hierarchical P with 2 to 4 temporal layers, 4 a smart P
+    // GOP of vi_len
+    RK_S32 gop_mode;
+    RK_S32 gop_len;
+    RK_S32 vi_len;
+
+    /* -sm slice split, MppEncSliceSplit values */
+    // with MPP_ENC_SPLIT_OUT_LOWDELAY every slice is its own packet as soon
+    // as it is encoded, see EncodedPacket::flags
+    RK_U32 split_mode;
+    RK_U32 split_arg;
+    RK_U32 split_out;
+
+} VENC_ATTR_t;
+
+// Rate control of a running encoder, a negative field keeps the current
+// setting
+typedef struct VENC_RC_ATTR {
+    RK_S32 rc_mode;
+    RK_S32 bps_target;
+    RK_S32 bps_max;
+    RK_S32 bps_min;
+    RK_S32 fps_num;
+    RK_S32 fps_den;
+    RK_S32 qp_init;
+    RK_S32 qp_min;
+    RK_S32 qp_max;
+    RK_S32 qp_min_i;
+    RK_S32 qp_max_i;
+    RK_S32 gop_len;
+    // virtual I interval of a smart P GOP, 0 goes back to a plain P chain
+    RK_S32 vi_len;
+} VENC_RC_ATTR_t;
+
+// every field kept
+static inline void venc_rc_attr_init(VENC_RC_ATTR *rc_attr) {
+    memset(rc_attr, 0xff, sizeof(*rc_attr));
+}
+
+// the fields update sets override the ones in rc_attr
+static inline void venc_rc_attr_merge(VENC_RC_ATTR *rc_attr,
+                                      const VENC_RC_ATTR *update) {
+    RK_S32 *dst = (RK_S32 *)rc_attr;
+    const RK_S32 *src = (const RK_S32 *)update;
+    for (size_t i = 0; i < sizeof(*rc_attr) / sizeof(RK_S32); i++) {
+        if (src[i] >= 0) dst[i] = src[i];
+    }
+}
+
+// An encoded packet lent out of MPP without a copy. The MppPacket behind it
+// stays alive until the last reference to the view is dropped, which has to
+// happen before venc_deinit().
+typedef struct EncodedPacket {
+    const RK_U8 *data;
+    size_t length;
+    // bit 0 is an intra frame, as MediaCodec.BUFFER_FLAG_KEY_FRAME, bit 3
+    // a slice the rest of the frame follows, as BUFFER_FLAG_PARTIAL_FRAME
+    RK_U32 flags;
+    RK_S64 pts_us;
+    // motion detection output of the frame as MppEncMDBlkInfo words, rows
+    // md_stride apart, md_cols x md_rows of them cover the picture. NULL
+    // without one, valid until VENC_MD_INFO_COUNT more frames are put.
+    const RK_U32 *md_blocks;
+    size_t md_stride;
+    size_t md_cols;
+    size_t md_rows;
+    // temporal layer of the frame, 0 is the base layer. Frames of a layer
+    // only reference lower or equal ones, so dropping every layer above some
+    // id leaves a decodable stream at a fraction of the rate.
+    RK_S32 temporal_id;
+} EncodedPacket;
+
+class MppEncoder {
+public:
+    MppEncoder();
+
+    ~MppEncoder();
+
+    MPP_RET venc_init(RK_S32 chn, VENC_ATTR_t *venc_attr, int buf_count, int buf_len);
+
+    // the capture buffer is imported on first use, so buffers added to a
+    // running capture session are picked up without re-initializing
+    // regions are the ROI of this frame only, up to VENC_ROI_MAX_REGIONS,
+    // osd the overlay blended over it, both read by MPP until the packet
+    // is out
+    MPP_RET venc_put_src_imge(int v4l2Index, int exportFd, RK_S64 pts_us,
+                              const RoiRegionCfg *regions = NULL,
+                              int region_count = 0,
+                              const MppEncOSDData2 *osd = NULL);
+
+    // no size limit and no copy, packets of any size get through
+    MPP_RET venc_get_packet(std::shared_ptr<EncodedPacket> *packet);
+
+    // copies the packet into frame_buf, MPP_NOK when it does not fit
+    MPP_RET venc_get_frame(RK_U8 *frame_buf, size_t *frame_len, RK_S64 *pts_us,
+                           RK_U32 *flags = NULL);
+
+    // reconfigures rate control between two frames, the next frame put is
+    // encoded with it
+    MPP_RET venc_set_rc(const VENC_RC_ATTR *rc_attr);
+
+    // the next frame put is encoded as IDR
+    MPP_RET venc_request_idr();
+
+    // user defined OSD palette from the next frame on
+    MPP_RET venc_set_osd_palette(const MppEncOSDPlt *palette);
+
+    // releases the context and every buffer init and put created or
+    // imported, a no-op when there is none
+    MPP_RET venc_deinit();
+
+private:
+    MPP_RET venc_mpi_init(VENC_MPI_ATTR *venc_mpi_attr, VENC_ATTR *venc_attr);
+
+    MPP_RET venc_mpp_cfg_setup(VENC_MPI_ATTR *venc_mpi_attr);
+
+    // the rc:* part of the config, shared by init and venc_set_rc()
+    void venc_rc_cfg_setup(VENC_MPI_ATTR *venc_mpi_attr, MppEncCfg cfg);
+
+    VENC_MPI_ATTR venc_mpi_attr;
+
+    MPP_RET venc_import_buffer(int v4l2Index, int exportFd);
+
+    // the ROI maps are only allocated once a frame has regions
+    MPP_RET venc_roi_init(VENC_MPI_ATTR *venc_mpi_attr);
+
+    int mBufLen = 0;
+
+    std::vector<MppBuffer> mppBuffer;
+};
+
+#endif  // CAPTUREENCODER_MPI_ENC_H